@@ -52,8 +52,9 @@
     #define PHO_DECL extern
 #endif // PHOTON_STATIC
 
-/* Total number of Host-Calls that can be registered at once. This can be reduced if fewer calls are used.
- * The maximum number of calls is: 0xFFF = 4095. Note that one group always consists of 256 functions. */
+/* Total number of Host-Calls that can be registered at once, packed ids must be less than this value.
+ * The maximum number of calls is: 0xFFF = 4095. Note that one group always consists of 256 functions and that Host-Call tables
+ * only allocate memory for the groups that contain a callback, so raising this value does not increase the size of a VM. */
 #ifndef PHOTON_MAX_HOST_CALLS
     #define PHOTON_MAX_HOST_CALLS 32
 #endif // PHOTON_MAX_HOST_CALLS
@@ -62,21 +63,151 @@
     #define PHOTON_DEBUG_CALLBACK_ENABLED 0 // Enable or disable the user debug callback on the virtual machine.
 #endif // PHOTON_DEBUG_CALLBACK_ENABLED
 
+#ifndef PHOTON_FUSION_ENABLED
+    #define PHOTON_FUSION_ENABLED 1 // Enable or disable fusion of common instruction sequences into a single operation when decoding byte-code.
+#endif // PHOTON_FUSION_ENABLED
+
+#ifndef PHOTON_TRACE_ENABLED
+    #define PHOTON_TRACE_ENABLED 0 // Enable or disable recording of executed instructions into a trace buffer. See setTraceBuffer.
+#endif // PHOTON_TRACE_ENABLED
+
+/* Number of records that a trace buffer can hold before the oldest record gets overwritten. Must be a power of two. */
+#ifndef PHOTON_TRACE_BUFFER_SIZE
+    #define PHOTON_TRACE_BUFFER_SIZE 64
+#endif // PHOTON_TRACE_BUFFER_SIZE
+
+#ifndef PHOTON_PROFILE_ENABLED
+    #define PHOTON_PROFILE_ENABLED 0 // Enable or disable counting of executed instructions and cycles per instruction, op code and Host-Call. See setProfile.
+#endif // PHOTON_PROFILE_ENABLED
+
+/* Profiles read the time stamp counter on x86. All other systems measure nanoseconds with a monotonic clock instead. */
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define PHOTON_PROFILE_USES_TSC 1
+#else
+    #define PHOTON_PROFILE_USES_TSC 0
+#endif
+
+#if PHOTON_PROFILE_ENABLED && PHOTON_PROFILE_USES_TSC && defined(_MSC_VER)
+    #include <intrin.h>
+#elif PHOTON_PROFILE_ENABLED && PHOTON_PROFILE_USES_TSC
+    #include <x86intrin.h>
+#elif PHOTON_PROFILE_ENABLED
+    #include <chrono>
+#endif
+
 #ifndef PHOTON_IS_HOST_CALL_STRICT
     #define PHOTON_IS_HOST_CALL_STRICT 0 // Enable or disable strictness of Host-Calls. If enabled and no Host-Call can be found for a hcall instruction the VM will halt, otherwise it will continue.
 #endif // PHOTON_IS_HOST_CALL_STRICT
 
+/* Dispatch technique of the VM's instruction loop. PHOTON_DISPATCH_SWITCH executes every instruction through a single switch
+ * statement. PHOTON_DISPATCH_THREADED jumps from one instruction handler directly to the next one using computed goto which
+ * is only supported by GCC and Clang. Other compilers will always use the switch dispatch. */
+#define PHOTON_DISPATCH_SWITCH 0
+#define PHOTON_DISPATCH_THREADED 1
+#ifndef PHOTON_DISPATCH
+    #define PHOTON_DISPATCH PHOTON_DISPATCH_THREADED
+#endif // PHOTON_DISPATCH
+
+#if (PHOTON_DISPATCH == PHOTON_DISPATCH_THREADED) && (defined(__GNUC__) || defined(__clang__))
+    #define PHOTON_DISPATCH_IS_THREADED 1
+#else
+    #define PHOTON_DISPATCH_IS_THREADED 0
+#endif
+
+/* Enable or disable the JIT compiler that translates byte-code into native code. See createJitVirtualMachine.
+ * Native code can only be generated for x86-64 on systems that support mmap, all other systems will always use the interpreter. */
+#ifndef PHOTON_JIT_ENABLED
+    #define PHOTON_JIT_ENABLED 0
+#endif // PHOTON_JIT_ENABLED
+
+#if PHOTON_JIT_ENABLED && (defined(__x86_64__) || defined(__amd64__)) && (defined(__unix__) || defined(__APPLE__))
+    #define PHOTON_JIT_IS_SUPPORTED 1
+#else
+    #define PHOTON_JIT_IS_SUPPORTED 0
+#endif
+
+/* Byte-code files are mapped into memory on systems that support mmap, see loadByteCodeFile. All other systems read the file. */
+#if defined(__unix__) || defined(__APPLE__)
+    #define PHOTON_MMAP_IS_SUPPORTED 1
+#else
+    #define PHOTON_MMAP_IS_SUPPORTED 0
+#endif
+
+/* Enable or disable the VMPool that runs jobs on several threads, see createVMPool. This requires C++11 threads. */
+#ifndef PHOTON_POOL_ENABLED
+    #define PHOTON_POOL_ENABLED 0
+#endif // PHOTON_POOL_ENABLED
+
+#if PHOTON_POOL_ENABLED
+    #include <atomic>
+    #include <condition_variable>
+    #include <mutex>
+    #include <new>
+    #include <thread>
+#endif // PHOTON_POOL_ENABLED
+
+/* Number of lanes that the batch executor runs with a single instruction, see runBatch. This depends on the instruction set
+ * that the compiler targets: 16 lanes with AVX-512, 8 lanes with AVX2 and 4 lanes of portable code otherwise. */
+#if defined(__AVX512F__)
+    #define PHOTON_BATCH_LANES 16
+#elif defined(__AVX2__)
+    #define PHOTON_BATCH_LANES 8
+#else
+    #define PHOTON_BATCH_LANES 4
+#endif
+
+/* Number of characters that the lexer of the compiler scans at once when it skips whitespace and comments: 32 characters
+ * if the compiler targets AVX2, 16 characters with SSE2 and a single character otherwise. Blocks of 16 and 32 characters
+ * require GCC or Clang and the matching instruction set. */
+#ifndef PHOTON_LEXER_BLOCK_SIZE
+    #if defined(__AVX2__) && (defined(__GNUC__) || defined(__clang__))
+        #define PHOTON_LEXER_BLOCK_SIZE 32
+    #elif defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+        #define PHOTON_LEXER_BLOCK_SIZE 16
+    #else
+        #define PHOTON_LEXER_BLOCK_SIZE 1
+    #endif
+#endif // PHOTON_LEXER_BLOCK_SIZE
+
+#if (PHOTON_LEXER_BLOCK_SIZE != 1) && (PHOTON_LEXER_BLOCK_SIZE != 16) && (PHOTON_LEXER_BLOCK_SIZE != 32)
+    #error "PHOTON_LEXER_BLOCK_SIZE must be 1, 16 or 32."
+#elif (PHOTON_LEXER_BLOCK_SIZE > 1) && !(defined(__GNUC__) || defined(__clang__))
+    #error "PHOTON_LEXER_BLOCK_SIZE of 16 or 32 requires GCC or Clang."
+#elif (PHOTON_LEXER_BLOCK_SIZE == 32) && !defined(__AVX2__)
+    #error "PHOTON_LEXER_BLOCK_SIZE of 32 requires AVX2."
+#elif (PHOTON_LEXER_BLOCK_SIZE == 16) && !defined(__SSE2__)
+    #error "PHOTON_LEXER_BLOCK_SIZE of 16 requires SSE2."
+#endif
+
 #ifndef PHOTON_COMPILER_ERROR_STRICT
     #define PHOTON_COMPILER_ERROR_STRICT 0 // If set to 1 then the lexer will stop after it encounters an error, otherwise it will continue.
 #endif // PHOTON_COMPILER_ERROR_STRICT
 
+/* System headers that only the implementation uses. Translation units that only include the interface never see them, so
+ * the names that they declare can not collide with names of the application. */
+#ifdef PHOTON_IMPLEMENTATION
+    #if PHOTON_JIT_IS_SUPPORTED || PHOTON_MMAP_IS_SUPPORTED
+        #include <sys/mman.h>
+    #endif
+    #if PHOTON_MMAP_IS_SUPPORTED
+        #include <fcntl.h>
+        #include <sys/stat.h>
+        #include <unistd.h>
+    #endif // PHOTON_MMAP_IS_SUPPORTED
+    #if (PHOTON_BATCH_LANES > 4) || (PHOTON_LEXER_BLOCK_SIZE == 32)
+        #include <immintrin.h>
+    #elif PHOTON_LEXER_BLOCK_SIZE == 16
+        #include <emmintrin.h>
+    #endif
+#endif // PHOTON_IMPLEMENTATION
+
 
 /*----------------------------------------------------------------------------------------------------------------
  * Version Information
  *--------------------------------------------------------------------------------------------------------------*/  
 
 /** Version number of the PhotonVM in X.YYY.ZZ (Major, Minor, Sub-Minor) format. Change only this value if the version changes. */
-const int32_t PHOTON_VM_VERSION				= 200000;
+const int32_t PHOTON_VM_VERSION				= 300000;
 /** Major version extracted from PHOTON_VM_VERSION. */
 const int32_t PHOTON_VM_VERSION_MAJOR		= (PHOTON_VM_VERSION / 100000);
 /** Minor version extracted from PHOTON_VM_VERSION. */
@@ -100,6 +231,8 @@ typedef int32_t RegisterType;
 typedef RegisterType* RegisterRef;
 /** Define an exit code that can be emitted by the VM or user code. */
 typedef uint8_t VMExitCode;
+/** Define the status that is returned by a Host-Call with context, see HostCallStatusCodes. */
+typedef uint32_t HostCallStatus;
 
 struct MappedInstruction;
 /** Define a common function signature that can be used to add a custom debugging callback. 
@@ -116,6 +249,12 @@ typedef DebugCallback(fDebugCallback);
  * Register a host call function with a virtual machine using the registerHostCall function. */
 #define HostCallback(name) void name(Photon::RegisterType* registers)
 typedef HostCallback(fHostCallback);
+/** Signature of an application host call that receives context pointers and can stop the VM. The vmContext is the pointer that was
+ * set on the executing VM with setHostCallContext and the callContext is the pointer that was registered with the callback.
+ * Register a host call function with this signature using the registerContextHostCall function.
+ * The returned status is HostCallContinue to execute the next instruction, HostCallPending to suspend the VM or the result of hostCallHalt or hostCallFault. */
+#define ContextHostCallback(name) Photon::HostCallStatus name(Photon::RegisterType* registers, void* vmContext, void* callContext)
+typedef ContextHostCallback(fContextHostCallback);
 
 
 /** Enumerations of all verbosity levels of the VM. */
@@ -158,6 +297,27 @@ enum VMExitCodes
     ExitCodeUserCode = 1
 };
 
+/** Status codes that can be returned by a Host-Call with context. The lower 8 bits contain the exit code of the VM. */
+enum HostCallStatusCodes
+{
+    /** Continue the execution with the next instruction. */
+    HostCallContinue = 0,
+    /** Halt the VM with the exit code in the lower 8 bits. The VM stops behind the Host-Call, see hostCallHalt. */
+    HostCallHalt = 0x100,
+    /** Halt the VM with the exit code in the lower 8 bits and report the failed Host-Call as an error, see hostCallFault. */
+    HostCallFault = 0x200,
+    /** Signals that no callback is stored for the called id. This is only returned by callHostCall and not by callbacks. */
+    HostCallNotFound = 0x400,
+    /** Suspend the VM behind the Host-Call until the host completes the call, see completeHostCall. The VM is not halted and its
+     * isSuspended flag is set, the run functions return ExitCodeSuccess. */
+    HostCallPending = 0x800
+};
+
+/** Create the status that halts the VM from a Host-Call with context. */
+inline HostCallStatus hostCallHalt(VMExitCode exitCode) { return HostCallHalt | exitCode; }
+/** Create the status that halts the VM from a Host-Call with context and reports an error. */
+inline HostCallStatus hostCallFault(VMExitCode exitCode) { return HostCallFault | exitCode; }
+
 /** Enumeration of all VM instructions. */
 enum OpCode
 {
@@ -189,6 +349,12 @@ enum OpCode
     OpCodeJump = 0x0C,
     /** Execute a function in the host application space. */
 	OpCodeCallHost = 0x0D,
+    /** Jumps by the signed 8-bit offset in value relative to the branch instruction if the register in destReg is not zero.
+     * With BranchAlways as destReg the jump is always made. An offset of 0 does not jump. */
+    OpCodeBranch = 0x0E,
+    /** Prefix of a wide instruction that is followed by a 32-bit immediate. The operation is stored in the low four bits
+     * of the prefix and is either a set or an arithmetic or compare operation that uses the immediate as second argument. */
+    OpCodeWide = 0x0F,
 };
 
 /** Enumeration of all registers. */
@@ -214,6 +380,12 @@ enum Register
     RegisterCount ///< Total number of registers of the Virtual Machine.
 };
 
+/** Register index of a branch instruction that jumps without checking any register. */
+const uint8_t BranchAlways = 0x0F;
+
+/** Number of words of a wide instruction: the OpCodeWide prefix followed by the low and the high 16 bits of the immediate. */
+const uint32_t WideInstructionSize = 3;
+
 
 /*----------------------------------------------------------------------------------------------------------------
  * 
@@ -228,19 +400,30 @@ struct MappedInstruction
 		uint32_t destReg;
 
 		// set, jmp, hcl, halt
-		int32_t value; // 8 bits used.
+		int32_t value; // 8 bits used, all 32 bits for the immediate of wide instructions.
 			
 		// everything else
 		int32_t argRegA; // 4 bits used
-		int32_t argRegB; // 4 bits used
+		int32_t argRegB; // 4 bits used, unused by wide instructions
 	} params;
+	/** Operation of a wide instruction, see OpCodeWide. OpCodeWide if the immediate of the instruction is missing. */
+	OpCode wideOpCode;
 };
 
 
+/** Check if the specified op code can be used as the operation of a wide instruction.
+ * \param	opCode	Op code to check.
+ * \return	Returns <b>true</b> for set and all arithmetic and compare operations except inv, otherwise <b>false</b>. */
+inline bool isWideOperation(uint32_t opCode)
+{
+    return (opCode == OpCodeSet) || (opCode >= OpCodeAdd && opCode <= OpCodeLet && opCode != OpCodeInv);
+}
+
+
 inline RawInstruction packInstruction(MappedInstruction* inst)
 {
-	// argA is stored in the high four bits and argB in the low four bits.
-	uint32_t value = inst->params.value | (inst->params.argRegB | (inst->params.argRegA << 4));
+	// argA is stored in the high four bits and argB in the low four bits. The prefix of a wide instruction stores its operation instead of argB.
+	uint32_t value = (inst->opCode == OpCodeWide) ? (inst->wideOpCode | (inst->params.argRegA << 4)) : (inst->params.value | (inst->params.argRegB | (inst->params.argRegA << 4)));
     
     RawInstruction result = 0;
     result |= (inst->opCode << 12) & 0xF000;
@@ -263,6 +446,63 @@ inline void unpackInstruction(RawInstruction raw, MappedInstruction* inst)
 	inst->params.value   = value;
 	inst->params.argRegA = argRegA;
 	inst->params.argRegB = argRegB;
+	inst->wideOpCode = OpCodeHalt;
+
+	if(opCode == OpCodeWide)
+	{
+		// The immediate is stored in the words that follow the prefix.
+		inst->params.value = 0;
+		inst->params.argRegB = 0;
+		inst->wideOpCode = static_cast<OpCode>(argRegB);
+	}
+}
+
+/** Pack an instruction into the specified words. Wide instructions are followed by the low and the high 16 bits of their immediate.
+ * \param	inst	Instruction to pack.
+ * \param	words	Receives the packed words. Must be able to hold WideInstructionSize words for wide instructions.
+ * \return	Returns the number of words that were written. */
+inline uint32_t packInstruction(MappedInstruction* inst, RawInstruction* words)
+{
+	words[0] = packInstruction(inst);
+	if(inst->opCode != OpCodeWide)
+		return 1;
+
+	const uint32_t immediate = static_cast<uint32_t>(inst->params.value);
+	words[1] = static_cast<RawInstruction>(immediate & 0xFFFF);
+	words[2] = static_cast<RawInstruction>(immediate >> 16);
+	return WideInstructionSize;
+}
+
+/** Unpack the instruction that starts at the specified word, including the immediate of a wide instruction.
+ * \param	words		Words of the instruction.
+ * \param	wordCount	Number of words that can be read, at least one. A wide prefix without its immediate gets OpCodeWide as wideOpCode.
+ * \param	inst		Receives the unpacked instruction.
+ * \return	Returns the number of words of the instruction. */
+inline uint32_t unpackInstruction(const RawInstruction* words, uint32_t wordCount, MappedInstruction* inst)
+{
+	unpackInstruction(words[0], inst);
+	if(inst->opCode != OpCodeWide)
+		return 1;
+
+	if(wordCount < WideInstructionSize)
+	{
+		inst->wideOpCode = OpCodeWide;
+		return 1;
+	}
+
+	const uint32_t low  = static_cast<uint16_t>(words[1]);
+	const uint32_t high = static_cast<uint16_t>(words[2]);
+	inst->params.value = static_cast<int32_t>(low | (high << 16));
+	return WideInstructionSize;
+}
+
+/** Get the number of words of the instruction that starts at the specified word.
+ * \param	words		Words of the instruction.
+ * \param	wordCount	Number of words that can be read, at least one.
+ * \return	Returns WideInstructionSize for wide instructions, otherwise <b>1</b>. */
+inline uint32_t getInstructionSize(const RawInstruction* words, uint32_t wordCount)
+{
+	return (((words[0] >> 12) & 0x0F) == OpCodeWide && wordCount >= WideInstructionSize) ? WideInstructionSize : 1;
 }
 
 
@@ -276,7 +516,8 @@ struct ByteCode
 {
     /** Pointer to the byte-code array to execute. */
     RawInstruction* instructions;
-    /** Total number of byte-code instructions that are stored in the byte code array. */
+    /** Total number of 16-bit words that are stored in the byte code array. Most instructions take a single word,
+     * wide instructions take WideInstructionSize words. Positions and jump offsets are counted in words. */
     uint32_t instructionCount;
 };
 
@@ -285,7 +526,7 @@ struct ByteCode
  * Note that this function only checks if any byte-code is set, not if the set byte-code instructions are valid. 
  * \param	byteCode	Byte-code to check for.
  * \return	Returns <b>true</b> if the byte-code is valid and contains any instructions or otherwise <b>false</b>. */
-inline bool isByteCodeValid(ByteCode* byteCode)
+inline bool isByteCodeValid(const ByteCode* byteCode)
 {
     return (byteCode && byteCode->instructions && byteCode->instructionCount);
 }
@@ -296,34 +537,612 @@ inline bool isByteCodeValid(ByteCode* byteCode)
 PHO_DECL void releaseByteCode(ByteCode* byteCode);
 
 
+/*----------------------------------------------------------------------------------------------------------------
+ * Byte-Code Files
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Magic number of a byte-code file, the characters "PHBC" in little-endian byte order. Files that were written on a system
+ * with a different byte order have a different magic number and are rejected. */
+const uint32_t ByteCodeFileMagic = 0x43424850;
+/** Alignment of the instructions of a byte-code file in bytes. */
+const uint32_t ByteCodeFileAlignment = 64;
+
+/** Header at the start of a byte-code file. The instructions follow at instructionOffset, all values are stored in the byte
+ * order of the system that wrote the file. */
+struct ByteCodeFileHeader
+{
+    /** Must be ByteCodeFileMagic. */
+    uint32_t magic;
+    /** PHOTON_VM_VERSION of the library that wrote the file. Only files of the same version are loaded. */
+    int32_t version;
+    /** Number of 16-bit words of the byte-code. */
+    uint32_t instructionCount;
+    /** Alignment of the instructions in bytes, a power of two. */
+    uint32_t alignment;
+    /** Offset of the instructions from the start of the file in bytes, a multiple of the alignment. */
+    uint32_t instructionOffset;
+    /** FNV-1a hash of all instruction bytes. */
+    uint32_t checksum;
+};
+static_assert(sizeof(ByteCodeFileHeader) == 24, "The header of a byte-code file must not have any padding.");
+
+/** Result of loading a byte-code file. */
+enum ByteCodeFileResult
+{
+    /** The file got loaded. */
+    ByteCodeFileSuccess = 0,
+    /** The file could not be opened or read. */
+    ByteCodeFileOpenFailed,
+    /** The file has no valid header, e.g. it is not a byte-code file or it was written with a different byte order. */
+    ByteCodeFileInvalidHeader,
+    /** The file was written by a different version of the library. */
+    ByteCodeFileVersionMismatch,
+    /** The file is shorter than the instructions that are stored in the header. */
+    ByteCodeFileTruncated,
+    /** The instructions do not match the checksum of the header. */
+    ByteCodeFileChecksumMismatch,
+    /** No memory could be allocated for the file on systems without mmap. */
+    ByteCodeFileOutOfMemory
+};
+
+/** Byte-code that got loaded from a file. The instructions point directly into the memory mapped file and must not be
+ * modified. Release it with releaseByteCodeFile and not with releaseByteCode. */
+struct ByteCodeFile
+{
+    /** Byte-code of the file that can be passed to the VM. */
+    ByteCode byteCode;
+    /** Start of the mapped file or of the memory that the file was read into. */
+    void* data;
+    /** Size of the data in bytes. */
+    size_t size;
+    /** Flag to indicate that the data is a mapping, otherwise it was allocated with pho_malloc. */
+    bool isMapped;
+};
+
+/** Write the byte-code into a file that can be loaded with loadByteCodeFile.
+ * \param	byteCode	Byte-code to write.
+ * \param	fileName	Name of the file to create or overwrite.
+ * \return	Returns <b>false</b> if the byte-code is not valid or the file could not be written. */
+PHO_DECL bool writeByteCodeFile(const ByteCode* byteCode, const char* fileName);
+/** Load a byte-code file without copying its instructions. The file is mapped into memory on systems that support mmap,
+ * otherwise it is read into memory. The header and the checksum are checked before the byte-code is returned.
+ * The file must stay loaded while any VM that was created with its byte-code is used.
+ * \param	fileName	Name of the file to load.
+ * \param	file		Receives the loaded byte-code. It is cleared if the file could not be loaded.
+ * \return	Returns ByteCodeFileSuccess or the reason why the file could not be loaded. */
+PHO_DECL ByteCodeFileResult loadByteCodeFile(const char* fileName, ByteCodeFile* file);
+/** Unmap or free the data of a byte-code file. The byte-code of the file is invalid afterwards. */
+PHO_DECL void releaseByteCodeFile(ByteCodeFile* file);
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ *
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Size of a cache line in bytes. The pre-decoded instruction stream is aligned to this boundary. */
+#ifndef PHOTON_CACHE_LINE_SIZE
+    #define PHOTON_CACHE_LINE_SIZE 64
+#endif // PHOTON_CACHE_LINE_SIZE
+
+/** Enumeration of all operations of the pre-decoded instruction stream.
+ * The first operations map directly to an OpCode while the remaining ones are only generated by the decoder. */
+enum DecodedOp
+{
+    DecodedOpHalt,
+    DecodedOpSet,
+    DecodedOpCopy,
+    DecodedOpAdd,
+    DecodedOpSub,
+    DecodedOpMul,
+    DecodedOpDiv,
+    DecodedOpInv,
+    DecodedOpEql,
+    DecodedOpNeq,
+    DecodedOpGrt,
+    DecodedOpLet,
+    /** Jump relative to the current position by the value of destReg. */
+    DecodedOpJumpRelative,
+    /** Jump to the absolute position that is stored in destReg. */
+    DecodedOpJumpAbsolute,
+    /** Host call with an id that is already resolved and known to be in range. */
+    DecodedOpCallHost,
+    /** Relative jump with a target that got resolved by the verifier. Jumps to the position in value if destReg is not zero. */
+    DecodedOpJumpResolved,
+    /** Absolute jump with a target that got resolved by the verifier. Always jumps to the position in value. */
+    DecodedOpJumpDirect,
+
+    /* Wide instructions that use the 32-bit immediate in value. They skip the immediate words that follow them. */
+
+    /** Wide set that writes value to destReg. */
+    DecodedOpSetWide,
+    /** Add value to argRegA, e.g. "add i i 1". */
+    DecodedOpAddImmediate,
+    DecodedOpSubImmediate,
+    DecodedOpMulImmediate,
+    /** Divide argRegA by value, which is never zero. */
+    DecodedOpDivImmediate,
+    DecodedOpEqlImmediate,
+    DecodedOpNeqImmediate,
+    DecodedOpGrtImmediate,
+    DecodedOpLetImmediate,
+
+    /* Fused operations that execute a sequence of instructions with a single dispatch. They always execute the decoded
+     * instructions that follow them, which are left unchanged so they can still be entered by a jump. */
+
+    /** eql, mul and relative jmp. This is the branch idiom: "eql local a b", "mul local local blockSize", "jmp local 0". */
+    DecodedOpEqlMulJump,
+    /** neq, mul and relative jmp. */
+    DecodedOpNeqMulJump,
+    /** gre, mul and relative jmp. */
+    DecodedOpGrtMulJump,
+    /** les, mul and relative jmp. */
+    DecodedOpLetMulJump,
+    /** set and a jmp with a resolved target, e.g. "set local 5", "jmp local 0". */
+    DecodedOpSetJump,
+    /** set, inv and a jmp with a resolved target. This is the backward jump idiom: "set local 10", "inv local", "jmp local 0". */
+    DecodedOpSetInvJump,
+    /** set and add, e.g. "set local 1", "add i i local". */
+    DecodedOpSetAdd,
+    /** set and sub. */
+    DecodedOpSetSub,
+    /** Instruction that can not be executed without runtime checks, e.g. because it accesses an invalid register.
+     * It will be executed by the checked instruction handlers on the raw instruction instead. */
+    DecodedOpChecked,
+
+    DecodedOpCount ///< Total number of decoded operations.
+};
+
+/** A single instruction of the pre-decoded instruction stream. All operands are unpacked and validated so that
+ * the VM can execute the instruction without any further decoding. */
+struct DecodedInstruction
+{
+    /** Operation to execute. See DecodedOp. */
+    uint8_t op;
+    /** Index of the destination register. Group id for host calls. */
+    uint8_t destReg;
+    /** Index of the first argument register. */
+    uint8_t argRegA;
+    /** Index of the second argument register. */
+    uint8_t argRegB;
+    /** Constant value of set and halt instructions, the immediate of wide instructions or the packed id of a host call. */
+    int32_t value;
+};
+
+/** Byte-code that got decoded into a cache aligned array of DecodedInstructions.
+ * Every decoded instruction has the same index as the raw instruction that it was generated from. Every word gets
+ * decoded as if an instruction started at it, so the immediate words of a wide instruction can still be entered by a jump. */
+struct DecodedByteCode
+{
+    /** Pointer to the decoded instructions. This contains one additional halt instruction at the end of the array. */
+    DecodedInstruction* instructions;
+    /** Total number of decoded instructions, not including the trailing halt instruction. */
+    uint32_t instructionCount;
+    /** Pointer to the unaligned memory block that holds the instructions. */
+    void* memory;
+    /** Flag to indicate if the byte-code passed verification. See verifyByteCode. */
+    bool isVerified;
+    /** FNV-1a hash of the raw byte-code. This identifies the byte-code of a snapshot, see saveSnapshot. */
+    uint32_t checksum;
+};
+
+/** Result of the byte-code verification. */
+struct VerificationResult
+{
+    /** Flag to indicate if the byte-code passed verification. */
+    bool isValid;
+    /** Exit code that the first invalid instruction would halt the VM with. ExitCodeSuccess if the byte-code is valid. */
+    VMExitCode errorCode;
+    /** Position of the first invalid instruction. */
+    uint32_t errorPosition;
+    /** Number of reachable jumps of which all targets are known and in bounds. */
+    uint32_t resolvedJumpCount;
+    /** Number of reachable jumps with a target that depends on a register value that can not be resolved statically. */
+    uint32_t unresolvedJumpCount;
+};
+
+/** Verify the specified byte-code. This proves that all register indices and Host-Call ids are in range, that all
+ * op codes are known and that every jump target that can be resolved statically is in bounds. Jump targets are resolved
+ * by tracking the set of values that a register can hold at every jump instruction. Jumps into the immediate words of a wide
+ * instruction are counted as unresolved jumps.
+ * Note that the verification assumes that the byte-code is always entered at the first instruction.
+ * \param	byteCode	Byte-code to verify.
+ * \param	result		Optional result that receives details about the verification.
+ * \return	Returns <b>true</b> if the byte-code passed verification, otherwise <b>false</b>. */
+PHO_DECL bool verifyByteCode(const ByteCode* byteCode, VerificationResult* result = nullptr);
+
+/** Decode the specified byte-code into a pre-decoded instruction stream. The byte-code gets verified while decoding and
+ * all jumps with a target that could be resolved are decoded into direct jumps that do not need to be checked at runtime.
+ * \param	byteCode	Byte-code to decode.
+ * \param	decoded		Decoded byte-code that receives the result. Release it with releaseDecodedByteCode.
+ * \return	Returns <b>true</b> if the byte-code got decoded or <b>false</b> if it is invalid or the memory could not be allocated. */
+PHO_DECL bool decodeByteCode(const ByteCode* byteCode, DecodedByteCode* decoded);
+/** Release the memory of a pre-decoded instruction stream that was created by decodeByteCode. */
+PHO_DECL void releaseDecodedByteCode(DecodedByteCode* decoded);
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Control-Flow Analysis
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Mask of a register set that contains every register. Register sets store one bit per register. */
+const uint16_t AllRegisters = (1U << RegisterCount) - 1;
+static_assert(RegisterCount <= 16, "A register set must have one bit for every register.");
+/** Marks an invalid index of a block, loop or definition, e.g. the immediate dominator of the entry block. */
+const uint32_t InvalidIndex = 0xFFFFFFFFU;
+
+/** Parts of the control-flow analysis that get computed by createControlFlowGraph. The blocks and edges are always computed. */
+enum ControlFlowAnalysis
+{
+    /** Immediate dominators and the dominator tree of all blocks. */
+    ControlFlowDominators = 0x1,
+    /** Natural loops of the graph, this includes ControlFlowDominators. */
+    ControlFlowLoops = 0x2 | ControlFlowDominators,
+    /** Registers that are live at the start and the end of every block. */
+    ControlFlowLiveness = 0x4,
+    /** Definitions that reach the start of every block. This needs one bit per definition and block. */
+    ControlFlowReachingDefinitions = 0x8,
+    /** Every part of the analysis. */
+    ControlFlowAll = 0xF
+};
+
+/** Result of createControlFlowGraph. */
+enum ControlFlowResult
+{
+    /** The graph got created. */
+    ControlFlowSuccess = 0,
+    /** No byte-code is set, see isByteCodeValid. */
+    ControlFlowInvalidByteCode,
+    /** A reachable jump has a target that can not be resolved statically or jumps into the immediate of a wide instruction,
+     * so any instruction could follow it. */
+    ControlFlowUnresolvedJump,
+    /** The memory of the graph could not be allocated. */
+    ControlFlowOutOfMemory
+};
+
+/** Flags of a basic block. */
+enum ControlFlowBlockFlag
+{
+    /** The VM can halt at the end of the block, e.g. on a halt instruction, a fault or a jump out of bounds. */
+    ControlFlowBlockExit = 0x1,
+    /** The block is the header of a loop. */
+    ControlFlowBlockLoopHeader = 0x2
+};
+
+/** Sequence of instructions that is only entered at its first instruction and only left after its last instruction. */
+struct ControlFlowBlock
+{
+    /** Position of the first instruction. */
+    uint32_t firstPosition;
+    /** Position behind the last instruction, including the immediate of a wide instruction. */
+    uint32_t endPosition;
+    /** Range of the successors of the block in ControlFlowGraph::successors. */
+    uint32_t firstSuccessor;
+    uint32_t successorCount;
+    /** Range of the predecessors of the block in ControlFlowGraph::predecessors. */
+    uint32_t firstPredecessor;
+    uint32_t predecessorCount;
+    /** Index of the block in reverse postorder, which visits every block before its successors except for the targets of back edges. */
+    uint32_t order;
+    /** Block that is the last one before this block on every path from the entry. InvalidIndex for the entry block. */
+    uint32_t immediateDominator;
+    /** Range of the block in a preorder walk of the dominator tree. A block dominates all blocks of which the index in the
+     * walk is in [dominatorIndex, dominatorEnd). */
+    uint32_t dominatorIndex;
+    uint32_t dominatorEnd;
+    /** Innermost loop that contains the block or InvalidIndex. */
+    uint32_t loop;
+    /** Range of the definitions of the block in ControlFlowGraph::definitions. */
+    uint32_t firstDefinition;
+    uint32_t definitionCount;
+    /** Registers that can be read before they are written when entering or leaving the block. */
+    uint16_t liveIn;
+    uint16_t liveOut;
+    /** Combination of ControlFlowBlockFlag values. */
+    uint16_t flags;
+};
+
+/** Natural loop of a control-flow graph. Loops that share a header are merged into one loop. */
+struct ControlFlowLoop
+{
+    /** Block that dominates every block of the loop and is the target of all of its back edges. */
+    uint32_t header;
+    /** Innermost loop that contains this loop or InvalidIndex. */
+    uint32_t parent;
+    /** Number of loops that contain this loop, plus one. */
+    uint32_t depth;
+    /** Number of blocks of the loop, including the blocks of nested loops. */
+    uint32_t blockCount;
+    /** Number of edges from a block of the loop back to the header. */
+    uint32_t backEdgeCount;
+};
+
+/** Instruction that writes a register. */
+struct ControlFlowDefinition
+{
+    /** Position of the instruction or InvalidIndex for the value that the register holds when entering the byte-code. */
+    uint32_t position;
+    /** Register that gets written. */
+    uint32_t reg;
+    /** Flag to indicate that the register may also keep its value, which is the case for Host-Calls. The definition still replaces
+     * all earlier ones, the definitions that reach the instruction itself hold the values that it may keep. */
+    bool isConditional;
+};
+
+/** Control-flow graph of a byte-code and the results of the dataflow analysis. Only instructions that can be reached from the
+ * first instruction are part of the graph. Blocks are sorted by position and the entry block is always the first block. */
+struct ControlFlowGraph
+{
+    /** Byte-code of the graph. It must not change or be released while the graph is used. */
+    const ByteCode* byteCode;
+    /** All basic blocks. */
+    ControlFlowBlock* blocks;
+    uint32_t blockCount;
+    /** Block indices of the successors and predecessors of all blocks. */
+    uint32_t* successors;
+    uint32_t* predecessors;
+    uint32_t edgeCount;
+    /** Block that contains each word of the byte-code or InvalidIndex if the word can not be reached. */
+    uint32_t* instructionBlocks;
+    /** All natural loops, nested loops are stored before the loops that contain them. */
+    ControlFlowLoop* loops;
+    uint32_t loopCount;
+    /** All definitions sorted by position. The first RegisterCount definitions are the register values when entering the byte-code. */
+    ControlFlowDefinition* definitions;
+    uint32_t definitionCount;
+    /** Number of 32-bit words of a set of definitions that stores one bit per definition. */
+    uint32_t definitionWordCount;
+    /** Definitions that reach the start of every block, definitionWordCount words per block. */
+    uint32_t* reachingDefinitions;
+    /** Combination of ControlFlowAnalysis values that got computed. */
+    uint32_t analyses;
+    /** Flag to indicate that a cycle can be entered at more than one block. Such cycles are not found as loops. */
+    bool isIrreducible;
+};
+
+/** Build the basic blocks and the control-flow graph of a byte-code and run the requested dataflow analyses on it.
+ * The targets of jumps are resolved by the same constant propagation as in verifyByteCode, so jumps with several possible
+ * targets get several successors. The byte-code is entered at the first instruction and the host application can read every
+ * register after the VM halted.
+ * \param	byteCode	Byte-code to analyse.
+ * \param	graph		Receives the graph. Release it with releaseControlFlowGraph, even if the creation failed.
+ * \param	analyses	Combination of ControlFlowAnalysis values that should be computed.
+ * \return	Returns ControlFlowSuccess or the reason why the graph could not be created. */
+PHO_DECL ControlFlowResult createControlFlowGraph(const ByteCode* byteCode, ControlFlowGraph* graph, uint32_t analyses = ControlFlowAll);
+/** Release the memory of a control-flow graph. */
+PHO_DECL void releaseControlFlowGraph(ControlFlowGraph* graph);
+/** Check if every path from the entry to the block passes the dominator. Every block dominates itself. Needs ControlFlowDominators. */
+PHO_DECL bool dominatesBlock(const ControlFlowGraph* graph, uint32_t dominator, uint32_t block);
+/** Check if the block is part of the loop or of one of its nested loops. Needs ControlFlowLoops. */
+PHO_DECL bool isBlockInLoop(const ControlFlowGraph* graph, uint32_t block, uint32_t loop);
+/** Get the registers that are live in front of the instruction at the specified position. Needs ControlFlowLiveness.
+ * \return	Returns the register set or 0 if the instruction can not be reached. */
+PHO_DECL uint16_t getLiveRegisters(const ControlFlowGraph* graph, uint32_t position);
+/** Get the definitions that reach the instruction at the specified position. Needs ControlFlowReachingDefinitions.
+ * \param	definitions		Receives definitionWordCount words with one bit per definition. Cleared if the instruction can not be reached. */
+PHO_DECL void getReachingDefinitions(const ControlFlowGraph* graph, uint32_t position, uint32_t* definitions);
+
+
 /*----------------------------------------------------------------------------------------------------------------
  * 
  *--------------------------------------------------------------------------------------------------------------*/  
 
-/** Helper structure that contains all registered script host call functions.
- * The host callbacks are stored as simple function pointers and are indexed by
- * a packed value*/
-struct HostCallContainer
+/** Number of Host-Call groups. */
+const uint32_t HostCallGroupCount = 16;
+/** Number of functions in every Host-Call group. */
+const uint32_t HostCallGroupSize = 256;
+
+/** A Host-Call that gets added to a Host-Call table, see createHostCallTable. Only one of both callbacks should be set. */
+struct HostCallDefinition
+{
+    /** Host application callback function or <b>nullptr</b> if contextCallback is used. */
+    fHostCallback* callback;
+    /** Id of the group of the callback. Range is [0, 15]. */
+    uint8_t groupId;
+    /** Id of the function slot of the callback inside of the group. Range is [0, 255]. */
+    uint8_t functionId;
+    /** Host application callback function with context or <b>nullptr</b> if callback is used. */
+    fContextHostCallback* contextCallback;
+    /** Context that is passed to the contextCallback as callContext. */
+    void* context;
+};
+
+/** A single slot of a Host-Call table. At most one of both callbacks is set. */
+struct HostCallEntry
 {
-    fHostCallback* callbacks[PHOTON_MAX_HOST_CALLS]; // 0xFFFU Max count of functions: 0xF groups, 0xFF functions.
+    /** Callback without context. This is checked first, so the common calls only need a single load. */
+    fHostCallback* callback;
+    /** Callback with context. */
+    fContextHostCallback* contextCallback;
+    /** Context that is passed to the contextCallback. */
+    void* context;
+};
 
-    uint16_t usedCallCount;
-    uint16_t firstFreeEntryIndex;
+/** Immutable table of Host-Calls that can be shared by any number of virtual machines, see setHostCallTable.
+ * Only groups that contain a callback get their own array of entries. All other groups point to a shared group without
+ * any callbacks, so every id can be read with groups[groupId][functionId] without checking the group. */
+struct HostCallTable
+{
+    /** Entries of every group, indexed by the function id. */
+    const HostCallEntry* groups[HostCallGroupCount];
+    /** Number of callbacks in the table. */
+    uint32_t callCount;
 };
 
-/** Register a host callback with the specified virtual machine.
+/** Get the entry with the specified packed id from a Host-Call table.
+ * \param	table	Table to read or <b>nullptr</b> for an empty table.
+ * \param	id		Packed id of the Host-Call: (groupId << 8) | functionId.
+ * \return	Returns the entry of the id, both callbacks are <b>nullptr</b> if no callback is stored with the id. */
+inline const HostCallEntry* getHostCallEntry(const HostCallTable* table, uint32_t id)
+{
+    static const HostCallEntry emptyEntry = {};
+    return table ? &table->groups[(id >> 8) & 0x0F][id & 0xFF] : &emptyEntry;
+}
+
+/** Call a Host-Call entry with the specified registers. This is used by the VM and by translated byte-code.
+ * \param	entry		Entry to call, see getHostCallEntry.
+ * \param	registers	Registers that are passed to the callback.
+ * \param	vmContext	Context of the calling VM, see setHostCallContext.
+ * \return	Returns the status of a callback with context, HostCallContinue for callbacks without context or HostCallNotFound if the entry is empty. */
+inline HostCallStatus callHostCall(const HostCallEntry* entry, RegisterType* registers, void* vmContext)
+{
+    if(entry->callback)
+    {
+        entry->callback(registers);
+        return HostCallContinue;
+    }
+    if(entry->contextCallback)
+        return entry->contextCallback(registers, vmContext, entry->context);
+    return HostCallNotFound;
+}
+
+/** Create a Host-Call table that contains the specified callbacks. Definitions without a callback are skipped and
+ * later definitions overwrite earlier ones with the same id. Release the table after all VMs that use it got released.
+ * \param	definitions		Callbacks to store in the table.
+ * \param	definitionCount	Number of definitions.
+ * \return	Returns the table or <b>nullptr</b> if a packed id is out of range or the memory could not be allocated. */
+PHO_DECL HostCallTable* createHostCallTable(const HostCallDefinition* definitions, uint32_t definitionCount);
+/** Release a Host-Call table that was created by createHostCallTable. */
+PHO_DECL void releaseHostCallTable(HostCallTable* table);
+/** Set the Host-Call table of the specified virtual machine. The table is not copied and must stay valid while the VM is used.
+ * This replaces all callbacks that were registered on the VM with registerHostCall.
+ * \param   vm      Virtual machine that uses the table.
+ * \param   table   Table to use or <b>nullptr</b> to remove all Host-Calls. */
+PHO_DECL void setHostCallTable(struct VirtualMachine* vm, const HostCallTable* table);
+/** Register a host callback with the specified virtual machine. The callback is stored in a private copy of the VM's Host-Call table
+ * that is created on the first call and released with the VM, a shared table that was set with setHostCallTable is not modified.
+ * Use a shared table instead if many VMs use the same callbacks.
  * \param   vm          Virtual machine to which the callback should be registered.
  * \param   callback    Host application callback function to register. 
  * \param   groupId     Id of the group that the callback will be assigned to. Range is [0, 15].
  * \param   functionId  Id of the function slot that the callback will be assigned to inside of the group. Range is [0, 255]. 
- * \return  Returns 0 on success. -1 if the packed id is out of range and 1 if an already registered callback will be overwritten. */
+ * \return  Returns 0 on success. -1 if the packed id is out of range or the memory could not be allocated and 1 if an already registered callback will be overwritten. */
 PHO_DECL int32_t registerHostCall(struct VirtualMachine* vm, fHostCallback* callback, uint8_t groupId, uint8_t functionId);
+/** Register a host callback with context like registerHostCall. The callback receives the context of the VM, see setHostCallContext,
+ * and the specified context and its status can halt the VM.
+ * \param   vm          Virtual machine to which the callback should be registered.
+ * \param   callback    Host application callback function to register. 
+ * \param   context     Context that is passed to every call of the callback as callContext.
+ * \param   groupId     Id of the group that the callback will be assigned to. Range is [0, 15].
+ * \param   functionId  Id of the function slot that the callback will be assigned to inside of the group. Range is [0, 255]. 
+ * \return  Returns 0 on success. -1 if the packed id is out of range or the memory could not be allocated and 1 if an already registered callback will be overwritten. */
+PHO_DECL int32_t registerContextHostCall(struct VirtualMachine* vm, fContextHostCallback* callback, void* context, uint8_t groupId, uint8_t functionId);
+/** Set the context that is passed to all Host-Calls with context that are executed by the specified VM. The default is <b>nullptr</b>. */
+PHO_DECL void setHostCallContext(struct VirtualMachine* vm, void* context);
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ *
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** A single executed instruction that got recorded into a trace buffer. */
+struct TraceRecord
+{
+    /** Position of the instruction in the byte-code. */
+    uint32_t position;
+    /** Value of the destination register after the instruction got executed. */
+    RegisterType result;
+    /** The executed instruction. Instructions that got executed by the checked handlers are stored as DecodedOpChecked
+     * with the first word of the raw instruction in the lower 16 bits of value, so the immediate of a wide instruction is
+     * not recorded. If such an instruction halted the VM then bit 24 of value is set and the exit code is stored in bits 16 to 23. */
+    DecodedInstruction instruction;
+};
+
+/** Ring buffer that contains the last PHOTON_TRACE_BUFFER_SIZE instructions that were executed by a VM.
+ * Records are written without any formatting, use dumpTraceBuffer or formatTraceRecord to decode them. */
+struct TraceBuffer
+{
+    /** Recorded instructions. The record at (recordCount % PHOTON_TRACE_BUFFER_SIZE) will be written next. */
+    TraceRecord records[PHOTON_TRACE_BUFFER_SIZE];
+    /** Total number of instructions that got recorded. */
+    uint32_t recordCount;
+};
+
+/** Get the number of records that are stored in the specified trace buffer. */
+inline uint32_t getTraceRecordCount(const TraceBuffer* buffer)
+{
+    return (buffer->recordCount < PHOTON_TRACE_BUFFER_SIZE) ? buffer->recordCount : PHOTON_TRACE_BUFFER_SIZE;
+}
+
+/** Get a record from the specified trace buffer.
+ * \param	index	Index of the record to get, where 0 is the oldest record. Must be less than getTraceRecordCount. */
+inline const TraceRecord* getTraceRecord(const TraceBuffer* buffer, uint32_t index)
+{
+    uint32_t first = buffer->recordCount - getTraceRecordCount(buffer);
+    return &buffer->records[(first + index) & (PHOTON_TRACE_BUFFER_SIZE - 1)];
+}
+
+/** Decode a trace record into a human readable line of text, e.g. "12: add reg4 reg4 reg12 => reg4=3".
+ * \param	record	Record to decode.
+ * \param	text	Output buffer that receives the null-terminated text.
+ * \param	size	Size of the output buffer in characters.
+ * \return	Returns the number of characters that were written or would have been written, see snprintf. */
+PHO_DECL int32_t formatTraceRecord(const TraceRecord* record, char* text, size_t size);
+/** Decode all records of the trace buffer from the oldest to the newest and write them to the specified file. */
+PHO_DECL void dumpTraceBuffer(const TraceBuffer* buffer, FILE* file = stdout);
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ *
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Number of executions and cycles of an instruction, an op code or a Host-Call in a profile. */
+struct ProfileEntry
+{
+    /** Number of times it got executed. */
+    uint64_t count;
+    /** Total number of cycles that it took. */
+    uint64_t cycles;
+};
+
+/** Execution profile that gets filled by the VM while it runs, see setProfile. Every executed instruction is charged with the
+ * cycles since the previous instruction finished, so the cycles of a Host-Call are also included in its hcl instruction.
+ * Cycles are read from the time stamp counter on x86 and are nanoseconds of a monotonic clock on all other systems.
+ * runJit executes the VM with run while a profile is set and runBatch does not use the profile. */
+struct Profile
+{
+    /** Entry of every instruction, indexed by its position in the byte-code. This contains one additional entry for the
+     * trailing halt instruction that is executed if the VM runs past the end of the byte-code. */
+    ProfileEntry* positions;
+    /** Op code of the instruction at every position. Wide instructions are stored as the operation that they execute. */
+    uint8_t* opCodes;
+    /** Number of entries in positions and opCodes. */
+    uint32_t positionCount;
+    /** Entry of every Host-Call, indexed by its packed id: (groupId << 8) | functionId. */
+    ProfileEntry hostCalls[PHOTON_MAX_HOST_CALLS];
+    /** Cycle counter when the previous instruction finished. This is only used while the VM is running. */
+    uint64_t timestamp;
+};
+
+/** Create an empty profile for the specified byte-code. Call releaseProfile to free it.
+ * \return	Returns <b>false</b> if the byte-code is invalid or the memory could not be allocated. */
+PHO_DECL bool createProfile(const ByteCode* byteCode, Profile* profile);
+/** Release all memory that is owned by the profile. */
+PHO_DECL void releaseProfile(Profile* profile);
+/** Set all counts and cycles of the profile to zero. */
+PHO_DECL void resetProfile(Profile* profile);
+/** Get the sum of all instructions with the specified op code in the profile. */
+PHO_DECL ProfileEntry getOpCodeProfile(const Profile* profile, uint32_t opCode);
+/** Write a report of the profile to the specified file. Op codes, instructions and Host-Calls are sorted by their cycles.
+ * \param	maxPositions	Maximum number of instructions that are listed in the report. */
+PHO_DECL void dumpProfile(const Profile* profile, FILE* file = stdout, uint32_t maxPositions = 16);
 
 
 /*----------------------------------------------------------------------------------------------------------------
  * 
  *--------------------------------------------------------------------------------------------------------------*/
 
+/** Native code that got generated from the byte-code of a virtual machine. See createJitVirtualMachine. */
+struct JitCode
+{
+    /** Executable memory that contains the generated code. */
+    void* code;
+    /** Size of the executable memory in bytes. */
+    size_t size;
+    /** Address of the native code of every instruction, indexed by the instruction position. Contains one additional
+     * entry for the trailing halt instruction. This is used by jumps with a target that is only known at runtime. */
+    const void** jumpTable;
+};
+
 struct VirtualMachine
 {
     /** Flag to indicate if the virtual machine has halted or is running. */
@@ -336,10 +1155,20 @@ struct VirtualMachine
     RegisterType registers[RegisterCount];
     /** Pointer to the byte code that will be executed. */
     ByteCode byteCode;
+    /** Pre-decoded form of the byte code. This is what the VM actually executes. */
+    DecodedByteCode decodedByteCode;
     /** Current position of the VM in the byte code array. */
     uint32_t currentPosition;
-    /** A container for all registered Host-Call functions. */
-    HostCallContainer hostCallContainer;
+    /** Table of all Host-Call functions that can be called by the byte-code. See setHostCallTable and registerHostCall. */
+    const HostCallTable* hostCallTable;
+    /** Flag to indicate if the Host-Call table is a private copy that got created by registerHostCall and is released with the VM. */
+    bool isHostCallTableOwned;
+    /** Context that is passed to Host-Calls with context. See setHostCallContext. */
+    void* hostCallContext;
+    /** Flag to indicate that a Host-Call returned HostCallPending and was not completed yet. See completeHostCall. */
+    bool isSuspended;
+    /** Flag to indicate that the VM was created by forkVirtualMachine and shares the decoded byte-code and native code of another VM. */
+    bool isForked;
     /** Current output verbosity level of the VM. */
     VerbosityLevel verbosityLevel;
 
@@ -347,26 +1176,491 @@ struct VirtualMachine
     /** Debug callback function of the VM. This can be set by the user via the setDebugCallback() method. */
     fDebugCallback* debugCallback;
 #endif
+#if PHOTON_TRACE_ENABLED
+    /** Trace buffer that records all executed instructions. This can be set by the user via the setTraceBuffer() method. */
+    TraceBuffer* traceBuffer;
+#endif
+#if PHOTON_PROFILE_ENABLED
+    /** Profile that counts all executed instructions and Host-Calls. This can be set by the user via the setProfile() method. */
+    Profile* profile;
+#endif
+#if PHOTON_JIT_ENABLED
+    /** Native code of the byte code. This is only generated by createJitVirtualMachine. */
+    JitCode jitCode;
+#endif
 };
 
 /** Create a new virtual machine. The VM is halted by default. To execute it call the run method.
+ * This will decode the byte-code into the VM's pre-decoded instruction stream, call releaseVirtualMachine to free it.
  * \param	byteCode	Byte code to execute on the VM. 
  * \param   verbosity   Output verbosoty of the vm. Default is VerbosityLevelDefault. */
 PHO_DECL VirtualMachine createVirtualMachine(ByteCode byteCode, VerbosityLevel verbosity = VerbosityLevelDefault);
+/** Release all memory that is owned by the virtual machine. This does not release the byte-code it was created with or a table that was set with setHostCallTable.
+ * \param   vm  Virtual machine to release. */
+PHO_DECL void releaseVirtualMachine(VirtualMachine* vm);
 /** Run the virtual machine and execute the byte-code. 
  * \param   vm  Virtual machine to execute.
- * \return	Returns the exit code which was set when the VM halts. */
+ * \return	Returns the exit code which was set when the VM halts. If a Host-Call is pending, the VM is not halted, isSuspended is set
+ *          and ExitCodeSuccess is returned, see completeHostCall. */
 PHO_DECL VMExitCode run(VirtualMachine* vm);
+/** Run the virtual machine from the first instruction with all registers set to zero, but stop once the instruction
+ * budget is used up. Use resume to continue a VM that got stopped instead. The budget is charged for every basic
+ * block when its closing jump is taken, so the VM may execute up to the length of the byte-code more than maxInstructions.
+ * \param   vm              Virtual machine to execute.
+ * \param   maxInstructions Number of instructions that the VM may execute before it is stopped.
+ * \return	Returns the exit code which was set when the VM halts. If the budget got used up first, the VM is not halted and
+ *          ExitCodeSuccess is returned, see isHalted. The registers and the current position are kept and the VM can be continued with resume. */
+PHO_DECL VMExitCode runFor(VirtualMachine* vm, uint32_t maxInstructions);
+/** Continue the execution of a VM that got stopped by runFor or resume or that got suspended by a Host-Call. The registers are not reset.
+ * \param   vm              Virtual machine to continue.
+ * \param   maxInstructions Number of instructions that the VM may execute before it is stopped again, see runFor.
+ * \return	Returns the exit code which was set when the VM halts or ExitCodeSuccess if the VM got stopped again or suspended
+ *          without being halted, see isHalted and isSuspended. If the VM is already halted its exit code is returned and if its
+ *          Host-Call was not completed yet nothing is executed. */
+PHO_DECL VMExitCode resume(VirtualMachine* vm, uint32_t maxInstructions);
+/** Complete the Host-Call that suspended the VM by returning HostCallPending. The results of the call can be written to the
+ * registers of the VM before, the VM then continues behind the Host-Call with resume.
+ * \return	Returns <b>false</b> if the VM was not suspended. */
+PHO_DECL bool completeHostCall(VirtualMachine* vm);
+/** Create a new virtual machine and compile its byte-code into native code. The VM can be used like any other VM but
+ * should be executed with runJit. If PHOTON_JIT_ENABLED is disabled or native code can not be generated on this system then
+ * this is the same as createVirtualMachine.
+ * \param	byteCode	Byte code to execute on the VM.
+ * \param   verbosity   Output verbosoty of the vm. Default is VerbosityLevelDefault. */
+PHO_DECL VirtualMachine createJitVirtualMachine(ByteCode byteCode, VerbosityLevel verbosity = VerbosityLevelDefault);
+/** Run the native code of the virtual machine. This produces the same results and exit codes as run.
+ * The VM is executed by run if no native code is available or if a debug callback, trace buffer or profile is set.
+ * \param   vm  Virtual machine to execute.
+ * \return	Returns the exit code which was set when the VM halts. */
+PHO_DECL VMExitCode runJit(VirtualMachine* vm);
+/** Run the byte-code of the VM for many register files at once. The registers of all lanes are stored as a structure of
+ * arrays, register r of lane l is stored at registers[r * laneCount + l]. Every PHOTON_BATCH_LANES lanes are executed
+ * together with vector instructions. Lanes that take different jumps continue separately and join again when they reach
+ * the same instruction. Unlike run the registers are not reset, every lane produces the same registers and exit code as
+ * run would if it started with the lane's registers. The VM itself is not modified and no debug callback, trace buffer or profile is used.
+ * Lanes can not be suspended, a lane that calls a pending Host-Call ends there with the exit code ExitCodeSuccess.
+ * \param   vm          Virtual machine that provides the byte-code and Host-Calls.
+ * \param   registers   Registers of all lanes, RegisterCount * laneCount values.
+ * \param   laneCount   Number of lanes to execute.
+ * \param   exitCodes   Receives the exit code of every lane, laneCount values.
+ * \param   suspended   Receives for every lane if it ended at a pending Host-Call, laneCount values. Default is <b>nullptr</b>. */
+PHO_DECL void runBatch(const VirtualMachine* vm, RegisterType* registers, uint32_t laneCount, VMExitCode* exitCodes, bool* suspended = nullptr);
 /** Set the debug callback function of the specified VM. */
 PHO_DECL void setDebugCallback(VirtualMachine* vm, fDebugCallback* callback);
+/** Set the trace buffer that records all instructions that are executed by the VM. Pass <b>nullptr</b> to disable tracing.
+ * This has no effect if PHOTON_TRACE_ENABLED is disabled. The buffer is not reset by this call. */
+PHO_DECL void setTraceBuffer(VirtualMachine* vm, TraceBuffer* buffer);
+/** Set the profile that counts all instructions and Host-Calls that are executed by the VM. Pass <b>nullptr</b> to disable profiling.
+ * The profile must be created for the byte-code of the VM. This has no effect if PHOTON_PROFILE_ENABLED is disabled. The profile is not reset by this call. */
+PHO_DECL void setProfile(VirtualMachine* vm, Profile* profile);
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ *
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Magic number of a snapshot, the characters "PHSN" in little-endian byte order. */
+const uint32_t SnapshotMagic = 0x4E534850;
+
+/** Flags of the state of a VM that is stored in a snapshot. */
+enum SnapshotFlags
+{
+    /** The VM was halted. */
+    SnapshotFlagHalted = 0x01,
+    /** The VM waited for a pending Host-Call, see completeHostCall. */
+    SnapshotFlagSuspended = 0x02
+};
+
+/** Execution state of a VM as it is stored by saveSnapshot. All values are stored in the byte order of the system that saved
+ * the snapshot, so it can be restored by any thread or process on the same kind of system. */
+struct Snapshot
+{
+    /** Must be SnapshotMagic. */
+    uint32_t magic;
+    /** PHOTON_VM_VERSION of the library that saved the snapshot. */
+    int32_t version;
+    /** FNV-1a hash of the byte-code of the VM. A snapshot can only be restored on a VM with the same byte-code. */
+    uint32_t byteCodeChecksum;
+    /** Position of the next instruction. */
+    uint32_t currentPosition;
+    /** State of the VM, see SnapshotFlags. */
+    uint8_t flags;
+    /** Exit code of the VM. */
+    VMExitCode exitCode;
+    /** Unused, always zero. */
+    uint16_t reserved;
+    /** Registers of the VM. */
+    RegisterType registers[RegisterCount];
+};
+static_assert(sizeof(Snapshot) == 20 + sizeof(RegisterType) * RegisterCount, "A snapshot must not have any padding.");
+
+/** Result of restoring a snapshot. */
+enum SnapshotResult
+{
+    /** The snapshot got restored. */
+    SnapshotSuccess = 0,
+    /** The buffer is too small or does not contain a snapshot, e.g. it was saved with a different byte order. */
+    SnapshotInvalid,
+    /** The snapshot was saved by a different version of the library. */
+    SnapshotVersionMismatch,
+    /** The snapshot was saved from a VM with different byte-code. */
+    SnapshotByteCodeMismatch
+};
+
+/** Save the execution state of a VM into a buffer: the registers, the current position, the halt and suspend state and the exit code.
+ * Host-Calls, callbacks and the byte-code itself are not stored.
+ * \param	vm			VM to save.
+ * \param	buffer		Buffer that receives the snapshot.
+ * \param	bufferSize	Size of the buffer in bytes, at least sizeof(Snapshot).
+ * \return	Returns the number of bytes written or 0 if the buffer is too small. */
+PHO_DECL uint32_t saveSnapshot(const VirtualMachine* vm, void* buffer, uint32_t bufferSize);
+/** Restore the execution state of a VM from a snapshot that was saved by saveSnapshot. The VM must have the same byte-code as the VM
+ * that was saved, its Host-Calls and callbacks are kept. A VM that was running continues with resume.
+ * \param	vm			VM that receives the state. It is not changed if the snapshot can not be restored.
+ * \param	buffer		Buffer that contains the snapshot.
+ * \param	bufferSize	Size of the buffer in bytes.
+ * \return	Returns SnapshotSuccess or the reason why the snapshot could not be restored. */
+PHO_DECL SnapshotResult restoreSnapshot(VirtualMachine* vm, const void* buffer, uint32_t bufferSize);
+/** Create a copy of a VM that continues from the same state, e.g. after a setup that is shared by several inputs or from a pending
+ * Host-Call that is completed with different results. The fork shares the byte-code, the decoded byte-code, the native code and the
+ * Host-Call table with the original VM, so nothing is decoded or allocated. The original VM must not be released before its forks.
+ * The trace buffer and the profile are not used by the fork. Release the fork with releaseVirtualMachine.
+ * \param	vm	VM to fork.
+ * \return	Returns the new VM. */
+PHO_DECL VirtualMachine forkVirtualMachine(const VirtualMachine* vm);
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ *
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Read-only part of a VM that can be shared by any number of instances: the byte-code, its decoded and native forms and the
+ * Host-Calls. A program is not changed by executing instances, so it can be used by several threads at once. */
+struct Program
+{
+    /** Byte code of the program. It is not copied and must stay valid while the program is used. */
+    ByteCode byteCode;
+    /** Pre-decoded form of the byte code. */
+    DecodedByteCode decodedByteCode;
+    /** Table of the Host-Calls of the program or <b>nullptr</b>. The table is not owned by the program, see setProgramHostCallTable. */
+    const HostCallTable* hostCallTable;
+    /** Output verbosity level of all instances. */
+    VerbosityLevel verbosityLevel;
+#if PHOTON_JIT_ENABLED
+    /** Native code of the byte code. This is only generated by createJitProgram. */
+    JitCode jitCode;
+#endif
+};
+
+/** Execution state of a single run of a program. An instance fills exactly one cache line, so millions of instances can be kept
+ * in contiguous arrays, see createInstances. Instances are plain data and can be copied, moved between threads or stored freely. */
+struct alignas(64) Instance
+{
+    /** Registers of the instance. */
+    RegisterType registers[RegisterCount];
+    /** Position of the next instruction. */
+    uint32_t currentPosition;
+    /** Flag to indicate if the instance has halted. */
+    bool isHalted;
+    /** Flag to indicate that a Host-Call returned HostCallPending and was not completed yet. */
+    bool isSuspended;
+    /** Exit code that was set when the instance halted. */
+    VMExitCode exitCode;
+};
+static_assert(sizeof(Instance) == 64, "An instance must fill a single cache line.");
+
+/** Create a program from byte-code. The byte-code is decoded once and shared by all instances.
+ * \param	byteCode	Byte code of the program.
+ * \param	program		Receives the program. Release it with releaseProgram.
+ * \param   verbosity   Output verbosity of all instances. Default is VerbosityLevelDefault.
+ * \return	Returns <b>false</b> if the byte-code could not be decoded, e.g. because it is invalid. */
+PHO_DECL bool createProgram(ByteCode byteCode, Program* program, VerbosityLevel verbosity = VerbosityLevelDefault);
+/** Create a program like createProgram and compile its byte-code into native code, see createJitVirtualMachine. Instances that
+ * run without an instruction budget execute the native code. */
+PHO_DECL bool createJitProgram(ByteCode byteCode, Program* program, VerbosityLevel verbosity = VerbosityLevelDefault);
+/** Release the decoded byte-code and native code of a program. This does not release the byte-code or the Host-Call table. */
+PHO_DECL void releaseProgram(Program* program);
+/** Set the shared Host-Call table of a program, see createHostCallTable. The table must stay valid while the program is used.
+ * Host-Calls with context receive the executing Instance as vmContext. */
+PHO_DECL void setProgramHostCallTable(Program* program, const HostCallTable* table);
+
+/** Allocate a cache line aligned array of instances. All instances are reset, see resetInstance.
+ * \return	Returns the array or <b>nullptr</b> if the memory could not be allocated. Release it with releaseInstances. */
+PHO_DECL Instance* createInstances(uint32_t instanceCount);
+/** Release an array of instances that was allocated by createInstances. */
+PHO_DECL void releaseInstances(Instance* instances);
+/** Reset an instance so that the program is executed from the start with all registers set to zero. */
+PHO_DECL void resetInstance(Instance* instance);
+/** Execute an instance of a program like resume executes a VM. Debug callbacks, trace buffers and profiles are not used.
+ * \param	program			Program to execute.
+ * \param	instance		Instance that is continued. It must have been reset or executed with the same program before.
+ * \param	maxInstructions	Number of instructions that may be executed before the instance is stopped, see runFor.
+ * \return	Returns the exit code which was set when the instance halts or ExitCodeSuccess if it got stopped or suspended without
+ *          being halted, see isHalted and isSuspended. */
+PHO_DECL VMExitCode runInstance(const Program* program, Instance* instance, uint32_t maxInstructions = UINT32_MAX);
+/** Execute several instances of the same program one after another with runInstance. The program is only prepared once for
+ * all instances, so this is faster than calling runInstance for every instance.
+ * \param	program			Program to execute.
+ * \param	instances		Instances to continue.
+ * \param	instanceCount	Number of instances.
+ * \param	maxInstructions	Instruction budget of every instance. */
+PHO_DECL void runInstances(const Program* program, Instance* instances, uint32_t instanceCount, uint32_t maxInstructions = UINT32_MAX);
+/** Complete the Host-Call that suspended an instance, see completeHostCall.
+ * \return	Returns <b>false</b> if the instance was not suspended. */
+PHO_DECL bool completeHostCall(Instance* instance);
+
+#if PHOTON_POOL_ENABLED
+/*----------------------------------------------------------------------------------------------------------------
+ *
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** A single execution of a program that is run by a VMPool. */
+struct VMJob
+{
+    /** Virtual machine that provides the byte-code and the Host-Calls of the job. The pool only reads the VM, so the same
+     * VM and its Host-Calls can be shared by any number of jobs. It must not be modified while the job is running. */
+    const VirtualMachine* program;
+    /** Registers that the job starts with. Receives the registers of the VM after it halted. */
+    RegisterType registers[RegisterCount];
+    /** Receives the exit code of the VM. */
+    VMExitCode exitCode;
+    /** Receives <b>true</b> if the job ended at a pending Host-Call, the exit code is ExitCodeSuccess then. */
+    bool isSuspended;
+};
+
+struct VMPoolWorker;
+
+/** Pool of worker threads that execute jobs. Every worker owns a range of the jobs and takes them from the front, workers
+ * without jobs steal half of the remaining jobs of another worker. Jobs and results are distributed without any locks. */
+struct VMPool
+{
+    /** Workers of the pool. The first worker is the thread that calls runJobs. */
+    VMPoolWorker* workers;
+    /** Total number of workers, including the calling thread. */
+    uint32_t workerCount;
+    /** Jobs that are currently executed. */
+    VMJob* jobs;
+
+    /** Incremented for every call of runJobs to wake up the worker threads. */
+    uint32_t epoch;
+    /** Number of worker threads that are still executing jobs of the current call. */
+    std::atomic<uint32_t> runningWorkerCount;
+    /** Flag that tells all worker threads to exit. */
+    bool isShuttingDown;
+    /** Only used to put idle worker threads to sleep and wake them up again. */
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+
+    /** Pointer to the memory block that holds the pool and the workers. */
+    void* memory;
+};
+
+/** Create a pool of worker threads.
+ * \param	workerCount	Number of threads that execute jobs, including the thread that calls runJobs. If 0 then one worker per core is used.
+ * \return	Returns the new pool or <b>nullptr</b> if the memory could not be allocated. Release it with releaseVMPool. */
+PHO_DECL VMPool* createVMPool(uint32_t workerCount = 0);
+/** Stop all worker threads and release the pool. */
+PHO_DECL void releaseVMPool(VMPool* pool);
+/** Execute all jobs on the workers of the pool and return after all jobs have finished. Every job produces the same registers
+ * and exit code as run would if it started with the job's registers. No debug callback, trace buffer or profile is used by the jobs.
+ * Jobs can not be suspended, a job that calls a pending Host-Call ends there with isSuspended set. Use a VMScheduler for such programs.
+ * \param	pool		Pool that executes the jobs. Only one thread can run jobs on a pool at a time.
+ * \param	jobs		Jobs to execute.
+ * \param	jobCount	Number of jobs. */
+PHO_DECL void runJobs(VMPool* pool, VMJob* jobs, uint32_t jobCount);
+
+/** States of a VMTask. */
+enum VMTaskState
+{
+    /** The task was not started or it has finished. */
+    VMTaskStateIdle = 0,
+    /** The task waits in the run queue of the scheduler. */
+    VMTaskStateQueued,
+    /** The task is executed by a thread of the scheduler. */
+    VMTaskStateRunning,
+    /** The VM of the task is suspended by a pending Host-Call and waits for resumeTask. No thread is used by the task. */
+    VMTaskStateParked
+};
+
+/** A VM that is executed by a VMScheduler. The task is owned by the caller and must stay valid until it has finished. */
+struct VMTask
+{
+    /** VM that is executed. It must not be used by the caller while the task is queued or running. */
+    VirtualMachine* vm;
+    /** User data of the task, e.g. the request that the VM handles. This is not used by the scheduler. */
+    void* userData;
+    /** Current state of the task. This is only changed by the scheduler. */
+    VMTaskState state;
+    /** Flag to indicate that resumeTask was called while the task was still running. */
+    bool isCompleted;
+    /** Next task in the run queue of the scheduler. */
+    VMTask* next;
+};
+
+/** Signature of the callback that is called when the VM of a task has halted. It is called by the thread that executed the task
+ * without holding any lock, so it may start new tasks. The exit code is stored in the VM of the task. */
+#define VMTaskCallback(name) void name(Photon::VMTask* task)
+typedef VMTaskCallback(fVMTaskCallback);
+
+/** Scheduler that multiplexes any number of VMs on a few threads. Tasks are executed in slices of a fixed instruction budget from a
+ * single run queue, so long running VMs can not starve others. A VM that calls a pending Host-Call is parked without a thread
+ * until the host completes the call with resumeTask, e.g. from the completion handler of an event loop. */
+struct VMScheduler
+{
+    /** Threads of the scheduler. */
+    std::thread* threads;
+    /** Number of threads. If this is 0 then tasks are only executed by pollVMScheduler. */
+    uint32_t threadCount;
+    /** Number of instructions that a task is executed before it is put back into the run queue. */
+    uint32_t sliceInstructions;
+    /** Callback that is called when a task has finished or <b>nullptr</b>. */
+    fVMTaskCallback* finishedCallback;
+
+    /** First and last task of the run queue. */
+    VMTask* queueHead;
+    VMTask* queueTail;
+    /** Number of tasks that were started and have not finished yet. */
+    uint32_t activeTaskCount;
+    /** Number of tasks that are parked. */
+    uint32_t parkedTaskCount;
+    /** Flag that tells all threads to exit. */
+    bool isShuttingDown;
+    /** Protects the run queue and the state of all tasks. */
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+
+    /** Pointer to the memory block that holds the scheduler and the threads. */
+    void* memory;
+};
+
+/** Create a scheduler for tasks.
+ * \param	threadCount			Number of threads that execute tasks. Pass 0 to execute the tasks only from pollVMScheduler.
+ * \param	sliceInstructions	Instruction budget of a single slice, see runFor.
+ * \param	finishedCallback	Callback that is called when a task has finished or <b>nullptr</b>.
+ * \return	Returns the new scheduler or <b>nullptr</b> if the memory could not be allocated. Release it with releaseVMScheduler. */
+PHO_DECL VMScheduler* createVMScheduler(uint32_t threadCount, uint32_t sliceInstructions = 10000, fVMTaskCallback* finishedCallback = nullptr);
+/** Stop all threads and release the scheduler. Tasks that are still queued, running or parked are not finished. */
+PHO_DECL void releaseVMScheduler(VMScheduler* scheduler);
+/** Start the VM of a task. Unlike run the registers are not reset and the VM starts at its current position, so inputs can be
+ * written to the registers before and the position must be reset to run the byte-code again. The VM is executed with resume.
+ * \return	Returns <b>false</b> if the task is already started. */
+PHO_DECL bool startTask(VMScheduler* scheduler, VMTask* task);
+/** Complete the pending Host-Call of a task and put it back into the run queue. This can be called from any thread, also while the
+ * thread that executed the Host-Call did not finish the slice yet. Results of the call must be written to the registers of the VM before.
+ * \return	Returns <b>false</b> if the task is not parked or running. */
+PHO_DECL bool resumeTask(VMScheduler* scheduler, VMTask* task);
+/** Execute slices of queued tasks on the calling thread until the run queue is empty. This is used to drive a scheduler without threads
+ * from an event loop but can also be called to help the threads of a scheduler.
+ * \param	maxSlices	Maximum number of slices to execute, so the event loop gets control back while tasks are still running.
+ * \return	Returns the number of tasks that were started and have not finished yet. */
+PHO_DECL uint32_t pollVMScheduler(VMScheduler* scheduler, uint32_t maxSlices = UINT32_MAX);
+#endif // PHOTON_POOL_ENABLED
 
 #ifndef PHOTON_NO_COMPILER
+/** Optimization levels of the compiler. Optimized byte-code produces the same exit code and the same register values when it
+ * halts, calls the host or takes a jump, where runFor and resume may stop it. Fewer instructions are executed, so debug callbacks,
+ * traces and instruction budgets see a different program. */
+enum OptimizationLevel
+{
+    /** Emit every instruction as it is written in the source. */
+    OptimizationLevelNone = 0,
+    /** Replace instructions that always compute the same value that fits into 8 bits with a set instruction.
+     * The position of every instruction stays the same. */
+    OptimizationLevelFold = 1,
+    /** Fold instructions and remove unreachable code, copies without an effect and stores to registers that are overwritten
+     * before they are read or before the next jump is taken. The offsets of all jumps are fixed up after instructions got removed. */
+    OptimizationLevelFull = 2
+};
+
+struct CompilerLabel;
+struct CompilerLabelReference;
+struct OptimizerJump;
+struct AbstractBlock;
+
+/** Scratch memory of the compiler that can be reused across compiles. Parsed instructions are packed into this buffer
+ * before they are copied into the byte-code, so a compile does not allocate any memory if the buffer is large enough.
+ * The optimizer keeps its buffers in the arena as well. Zero-initialize the arena before its first use and release it with releaseCompilerArena. */
+struct CompilerArena
+{
+    /** Buffer that receives the packed instructions. */
+    RawInstruction* instructions;
+    /** Number of instructions that fit into the buffer. */
+    uint32_t capacity;
+
+    /** All labels that got defined in the source. */
+    CompilerLabel* labels;
+    uint32_t labelCapacity;
+    /** All jumps to labels, in the order of their positions. */
+    CompilerLabelReference* labelReferences;
+    uint32_t labelReferenceCapacity;
+    /** Hash table that maps the names of the labels to their indices. */
+    uint32_t* labelTable;
+    uint32_t labelTableCapacity;
+
+    /** Flags, live registers and new positions of every instruction while the optimizer runs, see OptimizationLevel. */
+    uint8_t* optimizerFlags;
+    uint16_t* liveRegisters;
+    uint32_t* newPositions;
+    uint32_t optimizerCapacity;
+    /** All reachable jumps while the optimizer runs. */
+    OptimizerJump* optimizerJumps;
+    uint32_t optimizerJumpCapacity;
+    /** Memory of the analysis of the register values that the optimizer runs. */
+    uint32_t* blockIndices;
+    uint32_t* blockOwners;
+    uint8_t* instructionSizes;
+    uint32_t analysisCapacity;
+    AbstractBlock* blocks;
+    uint32_t* blockQueue;
+    uint32_t blockCapacity;
+};
+
 /** Compile Photon byte-code from the specified string of source code.
  * \param   source      Null-terminated string that contains the source data.
- * \param   fileName    Path to the file that gets compiled. Only for debug output. Default is <b>nullptr</b>. */
-PHO_DECL ByteCode compile(char* source, const char* fileName = nullptr);
+ * \param   fileName    Path to the file that gets compiled. Only for debug output. Default is <b>nullptr</b>.
+ * \param   level       Optimizations that are applied to the instructions. Default is <b>OptimizationLevelNone</b>. */
+PHO_DECL ByteCode compile(char* source, const char* fileName = nullptr, OptimizationLevel level = OptimizationLevelNone);
+/** Compile Photon byte-code like compile but use the memory of the specified arena while parsing. The arena grows if the
+ * source needs more memory and keeps it for the next compile. The returned byte-code does not reference the arena.
+ * \param   arena       Arena that is used while parsing.
+ * \param   source      Null-terminated string that contains the source data.
+ * \param   fileName    Path to the file that gets compiled. Only for debug output. Default is <b>nullptr</b>.
+ * \param   level       Optimizations that are applied to the instructions. Default is <b>OptimizationLevelNone</b>. */
+PHO_DECL ByteCode compileWithArena(CompilerArena* arena, char* source, const char* fileName = nullptr, OptimizationLevel level = OptimizationLevelNone);
+/** Release the memory of the specified arena. The arena can be used again afterwards. */
+PHO_DECL void releaseCompilerArena(CompilerArena* arena);
+/** Compile Photon byte-code like compileWithArena but keep the result in a cache directory. The key of an entry is a hash of
+ * the source, the optimization level, PHOTON_VM_VERSION and PHOTON_COMPILER_ERROR_STRICT. If a valid entry with the same key
+ * exists the byte-code is loaded from it instead of parsing the source. Sources with errors are never cached. Entries are
+ * written to a temporary file first and renamed, so concurrent processes can share the directory. Corrupted entries are
+ * detected by their checksum and replaced. Every entry also stores the length and a second, independent hash of the source,
+ * an entry with the same key that was written for a different source is a miss and gets replaced. The returned byte-code is
+ * released with releaseByteCode.
+ * \param   cacheDirectory  Existing directory that stores the cache entries.
+ * \param   arena           Arena that is used while parsing or <b>nullptr</b> to use a temporary arena.
+ * \param   source          Null-terminated string that contains the source data.
+ * \param   fileName        Path to the file that gets compiled. Only for debug output. Default is <b>nullptr</b>.
+ * \param   level           Optimizations that are applied to the instructions. Default is <b>OptimizationLevelNone</b>. */
+PHO_DECL ByteCode compileCached(const char* cacheDirectory, CompilerArena* arena, char* source, const char* fileName = nullptr,
+                                OptimizationLevel level = OptimizationLevelNone);
 #endif // PHOTON_NO_COMPILER
 
+/** Translate byte-code into the C++ source code of a standalone function with the signature:
+ *     Photon::VMExitCode functionName(Photon::RegisterType* registers, const Photon::HostCallTable* hostCalls, void* hostCallContext = nullptr,
+ *                                     bool* isSuspended = nullptr)
+ * The function executes the byte-code on the registers and returns the same exit code as run. Jumps with a target that can be
+ * resolved statically are translated into direct gotos, all other jumps go through a switch over the instruction positions.
+ * The function requires the PhotonVM.h interface and a Host-Call table, e.g. the hostCallTable of a VM, which may be <b>nullptr</b>.
+ * The hostCallContext is passed to Host-Calls with context like the context of a VM, see setHostCallContext.
+ * A pending Host-Call returns ExitCodeSuccess and sets isSuspended if it is not <b>nullptr</b>, the function can not be continued.
+ * Unlike the VM it does not print any error messages.
+ * \param   byteCode        Byte-code to translate.
+ * \param   functionName    Name of the generated function.
+ * \param   file            File that receives the source code.
+ * \return	Returns <b>true</b> on success or <b>false</b> if the byte-code is invalid or the memory could not be allocated. */
+PHO_DECL bool translateByteCode(const ByteCode* byteCode, const char* functionName, FILE* file);
+
 
 /*----------------------------------------------------------------------------------------------------------------
  * IMPLEMENTATION
@@ -375,6 +1669,9 @@ PHO_DECL ByteCode compile(char* source, const char* fileName = nullptr);
 #ifdef PHOTON_IMPLEMENTATION
 
 static void instructionHalt(VirtualMachine* vm, VMExitCode exitCode);
+#if PHOTON_JIT_IS_SUPPORTED
+static void releaseJitCode(JitCode* jitCode);
+#endif // PHOTON_JIT_IS_SUPPORTED
 
 PHO_DECL void releaseByteCode(ByteCode* byteCode)
 {
@@ -386,782 +1683,7112 @@ PHO_DECL void releaseByteCode(ByteCode* byteCode)
     }
 }
 
-PHO_DECL int32_t registerHostCall(struct VirtualMachine* vm, fHostCallback* callback, uint8_t groupId, uint8_t functionId)
-{
-    int32_t result = 0;
-    HostCallContainer* container = &vm->hostCallContainer;
 
-    if(callback)
-    {
-        uint32_t id = (groupId << 8) | functionId;
-        if(id < PHOTON_MAX_HOST_CALLS)
-        {
-            if(container->callbacks[id] != nullptr)
-            {
-                result = 1; // Callback overwrite.
-            }
+/*----------------------------------------------------------------------------------------------------------------
+ * Byte-Code Files
+ *--------------------------------------------------------------------------------------------------------------*/
 
-            container->callbacks[id] = callback;
-            container->usedCallCount++;
-            if(id < container->firstFreeEntryIndex)
-            {
-                container->firstFreeEntryIndex = id;
-            }
-        }
-        else
-        {
-            result = -1; // Out of range.
-        }
-    }
+/** Seed of the FNV-1a hash. */
+const uint32_t HashSeed = 2166136261U;
 
-    return result;
+/** Continue the FNV-1a hash of the specified bytes. Start with HashSeed. */
+static uint32_t hashBytes(const void* data, size_t size, uint32_t hash)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for(size_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 16777619U;
+    return hash;
 }
 
-// @Cleanup: Use a single, overridable error reporting function like reportErrorInternal.
-//    - C-574 (28.09.2017)
-/** Outputs messages that are emitted by the VM to the standard output.
- * \param	verbosity	Verbosity level of the emitted message. If this is below the VM's level then the message will be ignored.
- * \param	message		Message to display. */
-template <typename... Args>
-inline void printMessage(VirtualMachine* vm, VerbosityLevel verbosity, const char* message, Args... args)
+/** Get the offset of the instructions behind the header of a byte-code file. */
+inline uint32_t getByteCodeFileInstructionOffset()
 {
-    if(verbosity == VerbosityLevelSilent)
-        return;
+    return (sizeof(ByteCodeFileHeader) + ByteCodeFileAlignment - 1) & ~(ByteCodeFileAlignment - 1);
+}
 
-    if(verbosity & vm->verbosityLevel)
-    {
-        if(verbosity & VerbosityLevelError)
-            fprintf(stderr, message, args...);
-        else
-            fprintf(stdout, message, args...);
-    }
+/** Write a byte-code file and store the specified data at the start of the padding between the header and the instructions.
+ * The data must fit into the padding. Loaders that do not know the data ignore it like the padding of any other file. */
+static bool writeByteCodeFileData(const ByteCode* byteCode, const char* fileName, const void* data, size_t dataSize)
+{
+    if(!isByteCodeValid(byteCode) || dataSize > getByteCodeFileInstructionOffset() - sizeof(ByteCodeFileHeader))
+        return false;
+
+    FILE* file = fopen(fileName, "wb");
+    if(!file)
+        return false;
+
+    const size_t instructionSize = sizeof(RawInstruction) * byteCode->instructionCount;
+    ByteCodeFileHeader header = {};
+    header.magic             = ByteCodeFileMagic;
+    header.version           = PHOTON_VM_VERSION;
+    header.instructionCount  = byteCode->instructionCount;
+    header.alignment         = ByteCodeFileAlignment;
+    header.instructionOffset = getByteCodeFileInstructionOffset();
+    header.checksum          = hashBytes(byteCode->instructions, instructionSize, HashSeed);
+
+    // The padding between the header and the instructions is written as zeros behind the data.
+    uint8_t padding[ByteCodeFileAlignment] = {};
+    if(dataSize)
+        memcpy(padding, data, dataSize);
+    bool isWritten = (fwrite(&header, sizeof(header), 1, file) == 1)
+                  && (fwrite(padding, 1, header.instructionOffset - sizeof(header), file) == header.instructionOffset - sizeof(header))
+                  && (fwrite(byteCode->instructions, 1, instructionSize, file) == instructionSize);
+    isWritten &= (fclose(file) == 0);
+    return isWritten;
 }
 
-/** Get a register from the VM at the specified register index.
- * \param	registerIndex	Index of the register to get.
- * \return	Returns a pointer to register at the register index. The Local register will be returned if the index is invalid.
- * \warning If the specified index is invalid the VM will halt execution. */
-static RegisterRef getRegister(VirtualMachine* vm, int32_t registerIndex)
+PHO_DECL bool writeByteCodeFile(const ByteCode* byteCode, const char* fileName)
 {
-    if(registerIndex < RegisterCount && registerIndex >= 0)
-    {
-        return (&vm->registers[registerIndex]);
-    }
-    else
-    {
-        printMessage(vm, VerbosityLevelError, "VMFAULT: Tried to access invalid register at index %d!\n", registerIndex);
-        instructionHalt(vm, ExitCodeRegisterFault);
-    }
+    return writeByteCodeFileData(byteCode, fileName, nullptr, 0);
+}
 
-    return (&vm->registers[Local]);
+/** Check the header and the instructions of a byte-code file that is stored in memory and point the byte-code at them. */
+static ByteCodeFileResult attachByteCodeFile(ByteCodeFile* file)
+{
+    if(file->size < sizeof(ByteCodeFileHeader))
+        return ByteCodeFileInvalidHeader;
+
+    const ByteCodeFileHeader* header = static_cast<const ByteCodeFileHeader*>(file->data);
+    const bool isAlignmentValid = (header->alignment >= sizeof(RawInstruction)) && !(header->alignment & (header->alignment - 1));
+    if(header->magic != ByteCodeFileMagic || !isAlignmentValid || (header->instructionOffset & (header->alignment - 1))
+       || header->instructionOffset < sizeof(ByteCodeFileHeader) || header->instructionCount == 0)
+        return ByteCodeFileInvalidHeader;
+    if(header->version != PHOTON_VM_VERSION)
+        return ByteCodeFileVersionMismatch;
+
+    const uint64_t instructionSize = static_cast<uint64_t>(sizeof(RawInstruction)) * header->instructionCount;
+    if(header->instructionOffset + instructionSize > file->size)
+        return ByteCodeFileTruncated;
+
+    RawInstruction* instructions = reinterpret_cast<RawInstruction*>(static_cast<uint8_t*>(file->data) + header->instructionOffset);
+    if(hashBytes(instructions, static_cast<size_t>(instructionSize), HashSeed) != header->checksum)
+        return ByteCodeFileChecksumMismatch;
+
+    file->byteCode.instructions = instructions;
+    file->byteCode.instructionCount = header->instructionCount;
+    return ByteCodeFileSuccess;
 }
 
-/** Jumps a specified number of instructions forwards or backwards in the instruction queue relative to the current position or absolute to the start in the byte-code queue.
- * \param	jumpOffset		Offset to the instruction to jump to. In relative mode -1 will jump one instruction back and a value of 0 will be ignored and no jump will be executed. 
- * \param	isRelative		Flag to indicate if the jump is relative to the current position (<b>true</b>) or absolute to the first instruction (<b>false</b>). 
- * \return	Returns <b>true</b> if the jump executed successfully and the next instruction is set or <b>false</b> if the new position is out of bunds. */
-static bool jumpTo(VirtualMachine* vm, int32_t jumpOffset, uint8_t isRelative)
+PHO_DECL ByteCodeFileResult loadByteCodeFile(const char* fileName, ByteCodeFile* file)
 {
-    if(isRelative && jumpOffset == 0) 
-        return true;
+    *file = {};
 
-    /* Calculate the new position in the instruction queue. We subtract one instruction in relative mode so we are not 
-    * skipping the new set instruction as the instruction counter will get incremented on the next instruction fetch. */
-    const uint32_t newPosition = (vm->currentPosition * isRelative) + jumpOffset - isRelative;
-    
-    if(isByteCodeValid(&vm->byteCode) && (newPosition < vm->byteCode.instructionCount))
+#if PHOTON_MMAP_IS_SUPPORTED
+    const int descriptor = open(fileName, O_RDONLY);
+    if(descriptor < 0)
+        return ByteCodeFileOpenFailed;
+
+    struct stat status;
+    const bool isStatValid = (fstat(descriptor, &status) == 0);
+    if(!isStatValid || status.st_size < static_cast<off_t>(sizeof(ByteCodeFileHeader)))
     {
-        vm->currentPosition = newPosition;
-        return true;
+        close(descriptor);
+        return isStatValid ? ByteCodeFileInvalidHeader : ByteCodeFileOpenFailed;
     }
 
-    printMessage(vm, VerbosityLevelError, "VMFAULT: Failed to jump to specified instruction! Instruction address is out of bounds. \n\tInstruction position: %d (%s + %d), begin = 0, end = %d.\n",
-        newPosition, (isRelative ? "current" : "0"), jumpOffset, (isByteCodeValid(&vm->byteCode) ? (vm->byteCode.instructionCount - 1) : 0));
-
-    return false;
-}
-
-/*----------------------------------------------------------------------------------------------------------------
- * Instructions
- *--------------------------------------------------------------------------------------------------------------*/  
-
-#define PHOTON_INSTRUCTION(name) static void name(VirtualMachine* vm, MappedInstruction* instruction)
-#define storeRegister(reg, value) *(reg) = (value)
-#define loadRegister(vm, registerIndex) (*getRegister(vm, registerIndex))
-
+    // The mapping stays valid after the descriptor is closed.
+    file->size = static_cast<size_t>(status.st_size);
+    file->data = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if(file->data == MAP_FAILED)
+    {
+        *file = {};
+        return ByteCodeFileOpenFailed;
+    }
+    file->isMapped = true;
+#else
+    FILE* stream = fopen(fileName, "rb");
+    if(!stream)
+        return ByteCodeFileOpenFailed;
+
+    long size = -1;
+    if(fseek(stream, 0, SEEK_END) == 0)
+        size = ftell(stream);
+    if(size < 0 || fseek(stream, 0, SEEK_SET) != 0)
+    {
+        fclose(stream);
+        return ByteCodeFileOpenFailed;
+    }
+    if(size < static_cast<long>(sizeof(ByteCodeFileHeader)))
+    {
+        fclose(stream);
+        return ByteCodeFileInvalidHeader;
+    }
 
-static void instructionHalt(VirtualMachine* vm, VMExitCode exitCode)
-{
-    if(!vm->isHalted)
+    file->size = static_cast<size_t>(size);
+    file->data = pho_malloc(file->size);
+    if(!file->data)
     {
-        vm->isHalted = true;
-        vm->exitCode = exitCode;
+        fclose(stream);
+        *file = {};
+        return ByteCodeFileOutOfMemory;
+    }
 
-        printMessage(vm, VerbosityLevelDebugInfo, "-- HALTING VIRTUAL MACHINE --\n");
+    const bool isRead = (fread(file->data, 1, file->size, stream) == file->size);
+    fclose(stream);
+    if(!isRead)
+    {
+        releaseByteCodeFile(file);
+        return ByteCodeFileOpenFailed;
     }
+#endif // PHOTON_MMAP_IS_SUPPORTED
+
+    const ByteCodeFileResult result = attachByteCodeFile(file);
+    if(result != ByteCodeFileSuccess)
+        releaseByteCodeFile(file);
+    return result;
 }
 
-PHOTON_INSTRUCTION(instructionSet)
+PHO_DECL void releaseByteCodeFile(ByteCodeFile* file)
 {
-    RegisterRef reg = getRegister(vm, instruction->params.destReg);
-    storeRegister(reg, instruction->params.value);
+    if(!file || !file->data)
+        return;
 
-    printMessage(vm, VerbosityLevelDebugInfo, "set reg%d #%d\n", instruction->params.destReg, instruction->params.value);
+#if PHOTON_MMAP_IS_SUPPORTED
+    if(file->isMapped)
+        munmap(file->data, file->size);
+    else
+        pho_free(file->data);
+#else
+    pho_free(file->data);
+#endif // PHOTON_MMAP_IS_SUPPORTED
+    *file = {};
 }
 
-PHOTON_INSTRUCTION(instructionCopy)
+/** Check if the specified index addresses a register of the VM. */
+inline bool isRegisterIndexValid(uint32_t registerIndex)
 {
-    RegisterRef result = getRegister(vm, instruction->params.destReg);
-	RegisterType regSource = loadRegister(vm, instruction->params.argRegA);
-	storeRegister(result, regSource);
-
-	printMessage(vm, VerbosityLevelDebugInfo, "cpy reg%d reg%d (#%d)\n", instruction->params.destReg, instruction->params.argRegA, *result);
+    return (registerIndex < RegisterCount);
 }
 
-PHOTON_INSTRUCTION(instructionAdd)
+/** Divide two register values like the div instruction. The divisor must not be zero. Dividing by -1 is a negation,
+ * so INT32_MIN / -1 wraps around to INT32_MIN instead of raising the hardware exception of the overflowing division. */
+inline RegisterType divideRegister(RegisterType dividend, RegisterType divisor)
 {
-    RegisterRef result = getRegister(vm, instruction->params.destReg);
-	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
-    RegisterType regB = loadRegister(vm, instruction->params.argRegB);
-    storeRegister(result, regA + regB);
-
-	printMessage(vm, VerbosityLevelDebugInfo, "add reg%d reg%d => reg%d=%d\n", instruction->params.argRegA, instruction->params.argRegB, instruction->params.destReg, *result);
+    if(divisor == -1)
+        return static_cast<RegisterType>(0U - static_cast<uint32_t>(dividend));
+    return dividend / divisor;
 }
 
-PHOTON_INSTRUCTION(instructionSubtract)
+/** Get the decoded operation of a wide instruction with the specified operation. */
+inline uint8_t getWideDecodedOperation(uint32_t wideOpCode)
 {
-    RegisterRef result = getRegister(vm, instruction->params.destReg);
-	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
-	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
-	storeRegister(result, regA - regB);
-
-	printMessage(vm, VerbosityLevelDebugInfo, "sub reg%d reg%d => reg%d=%d\n", instruction->params.argRegA, instruction->params.argRegB, instruction->params.destReg, *result);
+    if(wideOpCode == OpCodeSet)
+        return DecodedOpSetWide;
+    return static_cast<uint8_t>((wideOpCode <= OpCodeDiv) ? (DecodedOpAddImmediate + wideOpCode - OpCodeAdd) : (DecodedOpEqlImmediate + wideOpCode - OpCodeEql));
 }
 
-PHOTON_INSTRUCTION(instructionMultiply)
+/** Get the operation of a wide instruction that got decoded into the specified operation. */
+inline OpCode getWideOperation(uint32_t decodedOp)
 {
-    RegisterRef result = getRegister(vm, instruction->params.destReg);
-	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
-	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
-	storeRegister(result, regA * regB);
-
-	printMessage(vm, VerbosityLevelDebugInfo, "mul reg%d reg%d => reg%d=%d\n", instruction->params.argRegA, instruction->params.argRegB, instruction->params.destReg, *result);
+    if(decodedOp == DecodedOpSetWide)
+        return OpCodeSet;
+    return static_cast<OpCode>((decodedOp <= DecodedOpDivImmediate) ? (OpCodeAdd + decodedOp - DecodedOpAddImmediate) : (OpCodeEql + decodedOp - DecodedOpEqlImmediate));
 }
 
-PHOTON_INSTRUCTION(instructionDivide)
+/** Get the number of words of the instruction that got decoded into the specified operation. */
+inline uint32_t getDecodedInstructionSize(uint32_t decodedOp)
 {
-    RegisterRef result = getRegister(vm, instruction->params.destReg);
-	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
-	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
-    if(regB != 0)
-	{
-		storeRegister(result, regA / regB);
-	}
-	else
-	{
-		fprintf(stderr, "VMFAULT: Invalid division by zero! Arguments: reg%d reg%d(%d) reg%d(%d)\n", instruction->params.destReg, instruction->params.argRegA, regA, instruction->params.argRegB, regB);
-		instructionHalt(vm, ExitCodeDivideByZero);
-	}
-
-	printMessage(vm, VerbosityLevelDebugInfo, "div reg%d reg%d => reg%d=%d\n", instruction->params.argRegA, instruction->params.argRegB, instruction->params.destReg, *result);
+    return (decodedOp >= DecodedOpSetWide && decodedOp <= DecodedOpLetImmediate) ? WideInstructionSize : 1;
 }
 
-PHOTON_INSTRUCTION(instructionInvert)
+/** Decode the instruction that starts at the specified word into its pre-decoded form. */
+static DecodedInstruction decodeInstruction(const RawInstruction* words, uint32_t wordCount)
 {
-    RegisterRef result = getRegister(vm, instruction->params.destReg);
-	storeRegister(result, -(*result));
+    MappedInstruction instruction;
+    unpackInstruction(words, wordCount, &instruction);
 
-	printMessage(vm, VerbosityLevelDebugInfo, "inv reg%d => reg%d=%d\n", instruction->params.destReg, instruction->params.destReg, *result);
-}
+    DecodedInstruction result = {};
+    result.op      = DecodedOpChecked;
+    result.destReg = static_cast<uint8_t>(instruction.params.destReg);
+    result.argRegA = static_cast<uint8_t>(instruction.params.argRegA);
+    result.argRegB = static_cast<uint8_t>(instruction.params.argRegB);
+    result.value   = instruction.params.value;
 
-PHOTON_INSTRUCTION(instructionEquals)
-{
-    RegisterRef result = getRegister(vm, instruction->params.destReg);
-	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
-	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
-	storeRegister(result, regA == regB);
+    switch(instruction.opCode)
+    {
+    case OpCodeHalt:
+    {
+        result.op      = DecodedOpHalt;
+        result.destReg = Local;
+    } break;
+    case OpCodeSet:
+    case OpCodeInv:
+    {
+        if(isRegisterIndexValid(result.destReg))
+            result.op = static_cast<uint8_t>(instruction.opCode);
+    } break;
+    case OpCodeCopy:
+    {
+        if(isRegisterIndexValid(result.destReg) && isRegisterIndexValid(result.argRegA))
+            result.op = DecodedOpCopy;
+    } break;
+    case OpCodeAdd:
+    case OpCodeSub:
+    case OpCodeMul:
+    case OpCodeDiv:
+    case OpCodeEql:
+    case OpCodeNeq:
+    case OpCodeGrt:
+    case OpCodeLet:
+    {
+        if(isRegisterIndexValid(result.destReg) && isRegisterIndexValid(result.argRegA) && isRegisterIndexValid(result.argRegB))
+            result.op = static_cast<uint8_t>(instruction.opCode);
+    } break;
+    case OpCodeJump:
+    {
+        if(isRegisterIndexValid(result.destReg))
+            result.op = (instruction.params.value != 0) ? DecodedOpJumpAbsolute : DecodedOpJumpRelative;
+    } break;
+    case OpCodeCallHost:
+    {
+        uint32_t id = (instruction.params.destReg << 8) | instruction.params.value;
+        if(id < PHOTON_MAX_HOST_CALLS)
+        {
+            result.op      = DecodedOpCallHost;
+            result.destReg = Local;
+            result.value   = static_cast<int32_t>(id);
+        }
+    } break;
+    case OpCodeBranch:
+    {
+        // The target depends on the position of the branch, see resolveBranch.
+    } break;
+    case OpCodeWide:
+    {
+        // Incomplete wide instructions, unknown operations and divisions by zero are left to the checked handlers.
+        const uint32_t wideOpCode = instruction.wideOpCode;
+        const bool isSet = (wideOpCode == OpCodeSet);
+        if(isWideOperation(wideOpCode) && isRegisterIndexValid(result.destReg) && (isSet || isRegisterIndexValid(result.argRegA)) &&
+           !(wideOpCode == OpCodeDiv && instruction.params.value == 0))
+            result.op = getWideDecodedOperation(wideOpCode);
+    } break;
+    default:
+    {
+        // Unknown instructions are executed by the checked handlers which will halt the VM.
+    } break;
+    }
 
-	printMessage(vm, VerbosityLevelDebugInfo, "eql reg%d reg%d => reg%d=%d\n", instruction->params.argRegA, instruction->params.argRegB, instruction->params.destReg, *result);
+    return result;
 }
 
-PHOTON_INSTRUCTION(instructionNotEquals)
+/** Get the target of a branch instruction that is stored at the specified position. */
+inline uint32_t getBranchTarget(const MappedInstruction* instruction, uint32_t position)
 {
-    RegisterRef result = getRegister(vm, instruction->params.destReg);
-	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
-	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
-	storeRegister(result, regA != regB);
-
-	printMessage(vm, VerbosityLevelDebugInfo, "neq reg%d reg%d => reg%d=%d\n", instruction->params.argRegA, instruction->params.argRegB, instruction->params.destReg, *result);
+    return position + static_cast<int8_t>(instruction->params.value);
 }
 
-PHOTON_INSTRUCTION(instructionGreater)
+/** Turn a decoded branch into a jump with a known target, other instructions are not changed. Branches that jump out of
+ * bounds or use an invalid register stay with the checked handlers. The original op code is kept in argRegA so traces can show the branch instead of a jump.
+ * \param	position			Position of the branch in the byte-code.
+ * \param	instructionCount	Number of instructions of the byte-code. */
+static void resolveBranch(DecodedInstruction* result, RawInstruction rawInstruction, uint32_t position, uint32_t instructionCount)
 {
-    RegisterRef result = getRegister(vm, instruction->params.destReg);
-	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
-	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
-    storeRegister(result, regA > regB);
+    MappedInstruction instruction;
+    unpackInstruction(rawInstruction, &instruction);
+    const uint32_t target = getBranchTarget(&instruction, position);
+    const bool isAlways = (instruction.params.destReg == BranchAlways);
+    if(instruction.opCode != OpCodeBranch || instruction.params.value == 0 || target >= instructionCount || !(isAlways || isRegisterIndexValid(instruction.params.destReg)))
+        return;
 
-	printMessage(vm, VerbosityLevelDebugInfo, "gre reg%d(%d) reg%d(%d) => reg%d=%d\n", instruction->params.argRegA, regA, instruction->params.argRegB, regB, instruction->params.destReg, *result);
+    // Direct jumps do not read any register, but traces still expect a valid one.
+    result->op      = isAlways ? DecodedOpJumpDirect : DecodedOpJumpResolved;
+    result->destReg = isAlways ? static_cast<uint8_t>(Local) : static_cast<uint8_t>(instruction.params.destReg);
+    result->argRegA = OpCodeBranch;
+    result->value   = static_cast<int32_t>(target);
 }
 
-PHOTON_INSTRUCTION(instructionLess)
-{
-    RegisterRef result = getRegister(vm, instruction->params.destReg);
-	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
-	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
-    storeRegister(result, regA < regB);
-    
-	printMessage(vm, VerbosityLevelDebugInfo, "les reg%d(%d) reg%d(%d) => reg%d=%d\n", instruction->params.argRegA, regA, instruction->params.argRegB, regB, instruction->params.destReg, *result);
-}
+/*----------------------------------------------------------------------------------------------------------------
+ * Byte-Code Verification
+ *--------------------------------------------------------------------------------------------------------------*/
 
-PHOTON_INSTRUCTION(instructionJump)
+/** Maximum number of distinct values that are tracked for a register during the verification. */
+const uint8_t AbstractValueCapacity = 4;
+/** Value count of an abstract value that can hold any value. */
+const uint8_t AbstractValueUnknown = AbstractValueCapacity + 1;
+/** Marks an invalid instruction position, e.g. a jump that could not be resolved. */
+const uint32_t InvalidPosition = 0xFFFFFFFFU;
+
+/** Set of values that a register can hold at a specific instruction. A count of zero means that the register was never written,
+ * which is only the case for instructions that are not reachable. */
+struct AbstractValue
 {
-    RegisterRef regSource = getRegister(vm, instruction->params.destReg);
-	int32_t instructionJumpOffset = *regSource;
-	uint8_t isAbsolute = instruction->params.value != 0;
+    /** Number of used values or AbstractValueUnknown if the register can hold any value. */
+    uint8_t count;
+    /** All values that the register can hold. */
+    int32_t values[AbstractValueCapacity];
+};
 
-	if(!jumpTo(vm, instructionJumpOffset, !isAbsolute))
-		instructionHalt(vm, ExitCodeJumpOutOfBounds);
+/** Abstract values of all registers at a specific instruction. */
+struct AbstractState
+{
+    AbstractValue registers[RegisterCount];
+};
 
-	printMessage(vm, VerbosityLevelDebugInfo, "jmp => %s + reg%d(%d)\n", (isAbsolute ? "0" : "current"), instruction->params.destReg, *regSource);
-}
+/** Abstract state at the start of a block of instructions that can be entered by a jump. */
+struct AbstractBlock
+{
+    /** Register values at the first instruction of the block. */
+    AbstractState state;
+    /** Position of the first instruction of the block. */
+    uint32_t position;
+    /** Flag to indicate if the block is waiting to be analysed. */
+    bool isQueued;
+};
 
+/** Internal data that is used to track the register values of a byte-code. */
+struct ByteCodeAnalysis
+{
+    /** Byte-code that gets analysed. */
+    const ByteCode* byteCode;
+    /** Index into blocks for every instruction that starts a block, otherwise InvalidPosition. */
+    uint32_t* blockIndices;
+    /** Position of the block that last analysed an instruction, otherwise InvalidPosition. */
+    uint32_t* blockOwners;
+    /** Number of words of the instruction that starts at every position when the byte-code is read from the start,
+     * zero for the immediate words of wide instructions. */
+    uint8_t* instructionSizes;
+    /** Number of instructions that fit into blockIndices, blockOwners and instructionSizes. */
+    uint32_t instructionCapacity;
+    /** All known blocks. */
+    AbstractBlock* blocks;
+    uint32_t blockCount;
+    uint32_t blockCapacity;
+    /** Stack of block indices that need to be analysed. */
+    uint32_t* queue;
+    uint32_t queueCount;
+    /** Flag to indicate that the analysis ran out of memory. */
+    bool isOutOfMemory;
+    /** Flag to indicate that a reachable jump can not be resolved, so every instruction could be a jump target. */
+    bool hasUnresolvedJump;
+};
 
-PHOTON_INSTRUCTION(instructionHostCall)
+/** Add a value to the specified abstract value. The value becomes unknown if it can not hold any more values. */
+static void addAbstractValue(AbstractValue* value, int32_t constant)
 {
-    fHostCallback* callback = nullptr;
-    uint32_t groupId = instruction->params.destReg;
-    uint32_t functionId = instruction->params.value;
+    if(value->count == AbstractValueUnknown)
+        return;
 
-    uint32_t id = (groupId << 8) | functionId;
-    if(id < PHOTON_MAX_HOST_CALLS)
+    for(uint8_t i = 0; i < value->count; ++i)
     {
-        callback = vm->hostCallContainer.callbacks[id];
-        if(callback)
-        {
-            callback(vm->registers);
-            printMessage(vm, VerbosityLevelDebugInfo, "hcl %d %d\n", groupId, functionId);
-        }
-        else
-        {
-            printMessage(vm, VerbosityLevelError, "No callable function found with gid=%d and fid=%d, callback is null.\n", groupId, functionId);
-        }
+        if(value->values[i] == constant)
+            return;
     }
+
+    if(value->count == AbstractValueCapacity)
+        value->count = AbstractValueUnknown;
     else
+        value->values[value->count++] = constant;
+}
+
+/** Merge all values of the source into the target.
+ * \return	Returns <b>true</b> if the target changed. */
+static bool joinAbstractValue(AbstractValue* target, const AbstractValue* source)
+{
+    const uint8_t count = target->count;
+    if(source->count == AbstractValueUnknown)
     {
-		printMessage(vm, VerbosityLevelError, "Host callback IDs are out of range. Got: gid=%d and fid=%d\n", groupId, functionId);
+        target->count = AbstractValueUnknown;
     }
-
-#if PHOTON_IS_HOST_CALL_STRICT
-    if(!callback)
+    else
     {
-        // We are strict and do not allow the execution to continue as the call could be important.
-        instructionHalt(vm, VMExitCodes::ExitCodeInvalidHostCall);
+        for(uint8_t i = 0; i < source->count; ++i)
+            addAbstractValue(target, source->values[i]);
     }
-#endif // PHOTON_IS_HOST_CALL_STRICT
+
+    return (target->count != count);
 }
 
-#undef PHOTON_INSTRUCTION
-#undef storeRegister
-#undef loadRegister
+/** Evaluate an arithmetic or compare instruction on constant values.
+ * \return	Returns <b>false</b> if the instruction would halt the VM, e.g. on a division by zero. */
+static bool evaluateOperation(uint32_t opCode, int32_t a, int32_t b, int32_t* result)
+{
+    // Use unsigned arithmetic to get the same wrap around behaviour as the VM without overflowing.
+    const uint32_t ua = static_cast<uint32_t>(a);
+    const uint32_t ub = static_cast<uint32_t>(b);
 
+    switch(opCode)
+    {
+    case OpCodeAdd: *result = static_cast<int32_t>(ua + ub); break;
+    case OpCodeSub: *result = static_cast<int32_t>(ua - ub); break;
+    case OpCodeMul: *result = static_cast<int32_t>(ua * ub); break;
+    case OpCodeDiv:
+    {
+        if(b == 0)
+            return false;
+        *result = divideRegister(a, b);
+    } break;
+    case OpCodeEql: *result = (a == b); break;
+    case OpCodeNeq: *result = (a != b); break;
+    case OpCodeGrt: *result = (a > b); break;
+    case OpCodeLet: *result = (a < b); break;
+    default:
+        return false;
+    }
 
-/*----------------------------------------------------------------------------------------------------------------
- * 
- *--------------------------------------------------------------------------------------------------------------*/  
+    return true;
+}
 
-PHO_DECL VirtualMachine createVirtualMachine(ByteCode byteCode, VerbosityLevel verbosity)
+/** Check if all operands of the instruction are valid.
+ * \return	Returns ExitCodeSuccess if the instruction is valid or the exit code that the VM would halt with. */
+static VMExitCode validateInstruction(const MappedInstruction* instruction)
 {
-    VirtualMachine vm = {};
-    vm.isHalted = true;
-    vm.byteCode = byteCode;
-    vm.verbosityLevel = verbosity;
-
-    return vm;
+    switch(instruction->opCode)
+    {
+    case OpCodeHalt:
+        return ExitCodeSuccess;
+    case OpCodeSet:
+    case OpCodeInv:
+    case OpCodeJump:
+        return isRegisterIndexValid(instruction->params.destReg) ? ExitCodeSuccess : ExitCodeRegisterFault;
+    case OpCodeCopy:
+        return (isRegisterIndexValid(instruction->params.destReg) && isRegisterIndexValid(instruction->params.argRegA)) ? ExitCodeSuccess : ExitCodeRegisterFault;
+    case OpCodeAdd:
+    case OpCodeSub:
+    case OpCodeMul:
+    case OpCodeDiv:
+    case OpCodeEql:
+    case OpCodeNeq:
+    case OpCodeGrt:
+    case OpCodeLet:
+        return (isRegisterIndexValid(instruction->params.destReg) && isRegisterIndexValid(instruction->params.argRegA) &&
+                isRegisterIndexValid(instruction->params.argRegB)) ? ExitCodeSuccess : ExitCodeRegisterFault;
+    case OpCodeCallHost:
+        return (((instruction->params.destReg << 8) | instruction->params.value) < PHOTON_MAX_HOST_CALLS) ? ExitCodeSuccess : ExitCodeInvalidHostCall;
+    case OpCodeBranch:
+        return (instruction->params.destReg == BranchAlways || isRegisterIndexValid(instruction->params.destReg)) ? ExitCodeSuccess : ExitCodeRegisterFault;
+    case OpCodeWide:
+    {
+        if(!isWideOperation(instruction->wideOpCode))
+            break;
+        return (isRegisterIndexValid(instruction->params.destReg) &&
+                (instruction->wideOpCode == OpCodeSet || isRegisterIndexValid(instruction->params.argRegA))) ? ExitCodeSuccess : ExitCodeRegisterFault;
+    }
+    default:
+        break;
+    }
+
+    // Unknown op codes and wide instructions with an unknown operation are executed as halt.
+    return ExitCodeHaltRequested;
 }
 
-PHO_DECL VMExitCode run(VirtualMachine* vm)
+/** Apply the effect of a non-jump instruction to the abstract register values.
+ * \return	Returns <b>false</b> if the VM can not continue with the next instruction. */
+static bool transferInstruction(const MappedInstruction* instruction, AbstractState* state)
 {
-    if(!vm) return ExitCodeHaltRequested;
+    if(validateInstruction(instruction) != ExitCodeSuccess)
+    {
+        // Register faults always halt, invalid host calls only in strict mode.
+        return (instruction->opCode == OpCodeCallHost) && !PHOTON_IS_HOST_CALL_STRICT;
+    }
 
-    vm->isHalted = false;
-    vm->exitCode = ExitCodeSuccess;
-    memset(&vm->registers, 0, sizeof(vm->registers));
+    // A branch without an offset does not jump and has no effect, BranchAlways is not a register.
+    if(instruction->opCode == OpCodeBranch)
+        return true;
 
-    RawInstruction rawInstruction;
-    MappedInstruction instruction;
+    // Wide instructions use their immediate in place of argRegB.
+    const bool isWide = (instruction->opCode == OpCodeWide);
+    const uint32_t opCode = isWide ? instruction->wideOpCode : instruction->opCode;
+    AbstractValue immediate = {};
+    immediate.count = 1;
+    immediate.values[0] = instruction->params.value;
 
-    while(!vm->isHalted)
+    AbstractValue* result = &state->registers[instruction->params.destReg];
+    switch(opCode)
     {
-        rawInstruction = 0;
-        if(isByteCodeValid(&vm->byteCode) &&
-           vm->currentPosition < vm->byteCode.instructionCount)
+    case OpCodeSet:
+    {
+        result->count = 1;
+        result->values[0] = instruction->params.value;
+    } break;
+    case OpCodeCopy:
+    {
+        *result = state->registers[instruction->params.argRegA];
+    } break;
+    case OpCodeInv:
+    {
+        if(result->count != AbstractValueUnknown)
+        {
+            for(uint8_t i = 0; i < result->count; ++i)
+                result->values[i] = static_cast<int32_t>(0U - static_cast<uint32_t>(result->values[i]));
+        }
+    } break;
+    case OpCodeAdd:
+    case OpCodeSub:
+    case OpCodeMul:
+    case OpCodeDiv:
+    case OpCodeEql:
+    case OpCodeNeq:
+    case OpCodeGrt:
+    case OpCodeLet:
+    {
+        const AbstractValue a = state->registers[instruction->params.argRegA];
+        const AbstractValue b = isWide ? immediate : state->registers[instruction->params.argRegB];
+        if(a.count == AbstractValueUnknown || b.count == AbstractValueUnknown)
         {
-            rawInstruction = vm->byteCode.instructions[vm->currentPosition];
-            vm->currentPosition++;
+            // Compare instructions always result in either 0 or 1.
+            const bool isCompare = (opCode >= OpCodeEql && opCode <= OpCodeLet);
+            result->count = isCompare ? 2 : AbstractValueUnknown;
+            result->values[0] = 0;
+            result->values[1] = 1;
+            break;
         }
 
-        unpackInstruction(rawInstruction, &instruction);
-        if(instruction.opCode == OpCodeHalt)
+        AbstractValue value = {};
+        for(uint8_t i = 0; i < a.count; ++i)
         {
-            instructionHalt(vm, instruction.params.value);
+            for(uint8_t j = 0; j < b.count; ++j)
+            {
+                int32_t constant;
+                if(evaluateOperation(opCode, a.values[i], b.values[j], &constant))
+                    addAbstractValue(&value, constant);
+            }
         }
-        else
+
+        // Every combination faults if no value is left.
+        if(value.count == 0)
+            return false;
+        *result = value;
+    } break;
+    case OpCodeCallHost:
+    {
+        // Host calls can modify any register.
+        for(uint32_t i = 0; i < RegisterCount; ++i)
+            state->registers[i].count = AbstractValueUnknown;
+    } break;
+    case OpCodeHalt:
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+/** Allocate a new array and copy the old content into it. The old array will be released. */
+static void* growArray(void* data, size_t count, size_t newCount, size_t elementSize)
+{
+    void* result = pho_malloc(newCount * elementSize);
+    if(result && data)
+        memcpy(result, data, count * elementSize);
+    if(data)
+        pho_free(data);
+    return result;
+}
+
+/** Merge the specified register values into the block that starts at the specified position.
+ * A new block will be created if no block starts at this position yet. */
+static void mergeIntoBlock(ByteCodeAnalysis* analysis, uint32_t position, const AbstractState* state)
+{
+    // A jump into the immediate of a wide instruction decodes its words differently, which is not tracked.
+    if(analysis->instructionSizes[position] == 0)
+    {
+        analysis->hasUnresolvedJump = true;
+        return;
+    }
+
+    uint32_t blockIndex = analysis->blockIndices[position];
+    bool isChanged = false;
+
+    if(blockIndex == InvalidPosition)
+    {
+        if(analysis->blockCount == analysis->blockCapacity)
         {
-            switch(instruction.opCode)
+            uint32_t capacity = analysis->blockCapacity ? analysis->blockCapacity * 2 : 16;
+            analysis->blocks = static_cast<AbstractBlock*>(growArray(analysis->blocks, analysis->blockCount, capacity, sizeof(AbstractBlock)));
+            analysis->queue = static_cast<uint32_t*>(growArray(analysis->queue, analysis->queueCount, capacity, sizeof(uint32_t)));
+            analysis->blockCapacity = capacity;
+            if(!analysis->blocks || !analysis->queue)
             {
-                case OpCodeSet:
-                {
-                    instructionSet(vm, &instruction);
-                } break;
-                case OpCodeCopy:
-                {
-                    instructionCopy(vm, &instruction);
-                } break;
-                case OpCodeAdd:
-                {
-                    instructionAdd(vm, &instruction);
-                } break;
-                case OpCodeSub:
-                {
-                    instructionSubtract(vm, &instruction);
-                } break;
-                case OpCodeMul:
-                {
-                    instructionMultiply(vm, &instruction);
-                } break;
-                case OpCodeDiv:
-                {
-                    instructionDivide(vm, &instruction);
-                } break;
-                case OpCodeInv:
-                {
-                    instructionInvert(vm, &instruction);
-                } break;
-                case OpCodeEql:
-                {
-                    instructionEquals(vm, &instruction);
-                } break;
-                case OpCodeNeq:
-                {
-                    instructionNotEquals(vm, &instruction);
-                } break;
-                case OpCodeGrt:
-                {
-                    instructionGreater(vm, &instruction);
-                } break;
-                case OpCodeLet:
-                {
-                    instructionLess(vm, &instruction);
-                } break;
-                case OpCodeJump:
-                {
-                    instructionJump(vm, &instruction);   
-                } break;
-                case OpCodeCallHost:
+                analysis->isOutOfMemory = true;
+                return;
+            }
+        }
+
+        blockIndex = analysis->blockCount++;
+        analysis->blockIndices[position] = blockIndex;
+
+        AbstractBlock* block = &analysis->blocks[blockIndex];
+        block->state = *state;
+        block->position = position;
+        block->isQueued = false;
+        isChanged = true;
+
+        // The instruction got analysed as part of another block which now has to stop in front of it.
+        uint32_t owner = analysis->blockOwners[position];
+        if(owner != InvalidPosition && owner != position)
+        {
+            AbstractBlock* ownerBlock = &analysis->blocks[analysis->blockIndices[owner]];
+            if(!ownerBlock->isQueued)
+            {
+                ownerBlock->isQueued = true;
+                analysis->queue[analysis->queueCount++] = analysis->blockIndices[owner];
+            }
+        }
+    }
+    else
+    {
+        AbstractBlock* block = &analysis->blocks[blockIndex];
+        for(uint32_t i = 0; i < RegisterCount; ++i)
+            isChanged |= joinAbstractValue(&block->state.registers[i], &state->registers[i]);
+    }
+
+    AbstractBlock* block = &analysis->blocks[blockIndex];
+    if(isChanged && !block->isQueued)
+    {
+        block->isQueued = true;
+        analysis->queue[analysis->queueCount++] = blockIndex;
+    }
+}
+
+/** Analyse all instructions of the block that starts at the specified position until the next block or the end of the control flow.
+ * \param	jumpTargets		If not null, the resolved targets of all jumps are stored here and no further blocks will be created.
+ * \param	result			If not null, jumps will be checked and counted. */
+static void analyseBlock(ByteCodeAnalysis* analysis, uint32_t position, uint32_t* jumpTargets, VerificationResult* result)
+{
+    const ByteCode* byteCode = analysis->byteCode;
+    const bool isFinalPass = (result != nullptr);
+    AbstractState state = analysis->blocks[analysis->blockIndices[position]].state;
+
+    uint32_t size = 1;
+    for(uint32_t i = position; i < byteCode->instructionCount; i += size)
+    {
+        if(i != position && analysis->blockIndices[i] != InvalidPosition)
+        {
+            if(!isFinalPass)
+                mergeIntoBlock(analysis, i, &state);
+            return;
+        }
+        analysis->blockOwners[i] = position;
+
+        MappedInstruction instruction;
+        size = unpackInstruction(&byteCode->instructions[i], byteCode->instructionCount - i, &instruction);
+        if(instruction.opCode == OpCodeBranch && instruction.params.value != 0 && validateInstruction(&instruction) == ExitCodeSuccess)
+        {
+            // Branches always have a known target, only the condition decides whether it is taken.
+            bool isTaken = true;
+            bool isFallthrough = false;
+            if(instruction.params.destReg != BranchAlways)
+            {
+                const AbstractValue* condition = &state.registers[instruction.params.destReg];
+                isTaken = isFallthrough = (condition->count == AbstractValueUnknown);
+                for(uint8_t v = 0; !isFallthrough && v < condition->count; ++v)
+                    isFallthrough = (condition->values[v] == 0);
+                for(uint8_t v = 0; !isTaken && v < condition->count; ++v)
+                    isTaken = (condition->values[v] != 0);
+            }
+
+            const uint32_t target = getBranchTarget(&instruction, i);
+            if(isTaken && target >= byteCode->instructionCount)
+            {
+                if(isFinalPass && (result->isValid || i < result->errorPosition))
                 {
-                    instructionHostCall(vm, &instruction);
-                } break;
-                case OpCodeHalt:
-                default:
+                    result->isValid = false;
+                    result->errorCode = ExitCodeJumpOutOfBounds;
+                    result->errorPosition = i;
+                }
+            }
+            else if(isFinalPass)
+            {
+                result->resolvedJumpCount++;
+            }
+            else if(isTaken)
+            {
+                mergeIntoBlock(analysis, target, &state);
+            }
+
+            if(!isFallthrough)
+                return;
+            continue;
+        }
+
+        if(instruction.opCode != OpCodeJump || validateInstruction(&instruction) != ExitCodeSuccess)
+        {
+            if(!transferInstruction(&instruction, &state))
+                return;
+            continue;
+        }
+
+        const AbstractValue* offset = &state.registers[instruction.params.destReg];
+        const bool isRelative = (instruction.params.value == 0);
+        if(offset->count == AbstractValueUnknown)
+        {
+            analysis->hasUnresolvedJump = true;
+            if(isFinalPass)
+                result->unresolvedJumpCount++;
+            return;
+        }
+
+        bool isFallthrough = false;
+        bool isInBounds = true;
+        uint32_t target = InvalidPosition;
+        for(uint8_t v = 0; v < offset->count; ++v)
+        {
+            if(isRelative && offset->values[v] == 0)
+            {
+                isFallthrough = true;
+                continue;
+            }
+
+            // Same as in jumpTo, relative jumps are relative to the jump instruction.
+            target = isRelative ? (i + offset->values[v]) : static_cast<uint32_t>(offset->values[v]);
+            if(target >= byteCode->instructionCount)
+            {
+                isInBounds = false;
+                if(isFinalPass && (result->isValid || i < result->errorPosition))
                 {
-                    instructionHalt(vm, instruction.params.value);
-                } break;
+                    result->isValid = false;
+                    result->errorCode = ExitCodeJumpOutOfBounds;
+                    result->errorPosition = i;
+                }
+            }
+            else if(!isFinalPass)
+            {
+                mergeIntoBlock(analysis, target, &state);
             }
         }
 
-
-#if PHOTON_DEBUG_CALLBACK_ENABLED
-        if(vm->debugCallback) vm->debugCallback(&instruction, vm->registers);
-#endif // PHOTON_DEBUG_CALLBACK_ENABLED
+        if(isFinalPass && isInBounds)
+        {
+            result->resolvedJumpCount++;
+
+            // Only jumps with a single target can be executed directly.
+            const uint8_t targetCount = offset->count - (isFallthrough ? 1 : 0);
+            if(jumpTargets && targetCount <= 1)
+                jumpTargets[i] = (targetCount == 1) ? target : (i + 1);
+        }
+
+        if(!isFallthrough)
+            return;
+    }
+}
+
+/** Run the analysis like runAnalysis but keep the memory of the previous analysis of the same object. The arrays only grow if
+ * the byte-code has more instructions or blocks than any byte-code before.
+ * \return	Returns <b>false</b> if the analysis ran out of memory or a reachable jump could not be resolved. */
+static bool rerunAnalysis(ByteCodeAnalysis* analysis, const ByteCode* byteCode)
+{
+    const uint32_t instructionCount = byteCode->instructionCount;
+    analysis->byteCode = byteCode;
+    analysis->blockCount = 0;
+    analysis->queueCount = 0;
+    analysis->hasUnresolvedJump = false;
+    if(analysis->instructionCapacity < instructionCount)
+    {
+        pho_free(analysis->blockIndices);
+        pho_free(analysis->blockOwners);
+        pho_free(analysis->instructionSizes);
+        analysis->blockIndices = static_cast<uint32_t*>(pho_malloc(sizeof(uint32_t) * instructionCount));
+        analysis->blockOwners = static_cast<uint32_t*>(pho_malloc(sizeof(uint32_t) * instructionCount));
+        analysis->instructionSizes = static_cast<uint8_t*>(pho_malloc(instructionCount));
+        const bool isAllocated = analysis->blockIndices && analysis->blockOwners && analysis->instructionSizes;
+        analysis->instructionCapacity = isAllocated ? instructionCount : 0;
+    }
+    // The blocks of a previous analysis that ran out of memory are allocated again.
+    if(!analysis->blocks || !analysis->queue)
+    {
+        pho_free(analysis->blocks);
+        pho_free(analysis->queue);
+        analysis->blocks = nullptr;
+        analysis->queue = nullptr;
+        analysis->blockCapacity = 0;
+    }
+    analysis->isOutOfMemory = !analysis->blockIndices || !analysis->blockOwners || !analysis->instructionSizes;
+
+    if(!analysis->isOutOfMemory)
+    {
+        memset(analysis->blockIndices, 0xFF, sizeof(uint32_t) * instructionCount);
+        memset(analysis->blockOwners, 0xFF, sizeof(uint32_t) * instructionCount);
+        memset(analysis->instructionSizes, 0, instructionCount);
+        for(uint32_t i = 0; i < instructionCount; i += analysis->instructionSizes[i])
+            analysis->instructionSizes[i] = static_cast<uint8_t>(getInstructionSize(&byteCode->instructions[i], instructionCount - i));
+
+        // Nothing is known about the registers when entering the byte-code.
+        AbstractState entry;
+        for(uint32_t i = 0; i < RegisterCount; ++i)
+            entry.registers[i].count = AbstractValueUnknown;
+        mergeIntoBlock(analysis, 0, &entry);
+
+        while(analysis->queueCount && !analysis->isOutOfMemory && !analysis->hasUnresolvedJump)
+        {
+            uint32_t blockIndex = analysis->queue[--analysis->queueCount];
+            analysis->blocks[blockIndex].isQueued = false;
+            analyseBlock(analysis, analysis->blocks[blockIndex].position, nullptr, nullptr);
+        }
+    }
+
+    return !analysis->isOutOfMemory && !analysis->hasUnresolvedJump;
+}
+
+/** Find the register values at the start of every block that can be reached from the first instruction.
+ * The analysis must be released with releaseAnalysis, even if it failed.
+ * \return	Returns <b>false</b> if the analysis ran out of memory or a reachable jump could not be resolved. */
+static bool runAnalysis(ByteCodeAnalysis* analysis, const ByteCode* byteCode)
+{
+    *analysis = {};
+    return rerunAnalysis(analysis, byteCode);
+}
+
+/** Release the memory of an analysis. */
+static void releaseAnalysis(ByteCodeAnalysis* analysis)
+{
+    if(analysis->blockIndices) pho_free(analysis->blockIndices);
+    if(analysis->blockOwners)  pho_free(analysis->blockOwners);
+    if(analysis->instructionSizes) pho_free(analysis->instructionSizes);
+    if(analysis->blocks)       pho_free(analysis->blocks);
+    if(analysis->queue)        pho_free(analysis->queue);
+    *analysis = {};
+}
+
+/** Verify the byte-code and resolve the targets of all jumps.
+ * \param	jumpTargets		Optional array with one entry per instruction that receives the resolved jump targets. InvalidPosition if a jump could not be resolved.
+ * \return	Returns <b>true</b> if the byte-code passed verification. */
+static bool analyseByteCode(const ByteCode* byteCode, uint32_t* jumpTargets, VerificationResult* result)
+{
+    VerificationResult verification = {};
+    verification.isValid = isByteCodeValid(byteCode);
+    if(!verification.isValid)
+    {
+        if(result)
+            *result = verification;
+        return false;
+    }
+
+    const uint32_t instructionCount = byteCode->instructionCount;
+    if(jumpTargets)
+    {
+        for(uint32_t i = 0; i < instructionCount; ++i)
+            jumpTargets[i] = InvalidPosition;
+    }
+
+    // Check the operands of all instructions, including the ones that are not reachable.
+    uint32_t size;
+    for(uint32_t i = 0; i < instructionCount; i += size)
+    {
+        MappedInstruction instruction;
+        size = unpackInstruction(&byteCode->instructions[i], instructionCount - i, &instruction);
+        VMExitCode errorCode = validateInstruction(&instruction);
+        if(errorCode != ExitCodeSuccess)
+        {
+            verification.isValid = false;
+            verification.errorCode = errorCode;
+            verification.errorPosition = i;
+            break;
+        }
+    }
+
+    ByteCodeAnalysis analysis;
+    if(!runAnalysis(&analysis, byteCode))
+    {
+        // A jump that can not be resolved may enter any instruction with any register values, so no jump target can be known.
+        // The same applies if the analysis failed. Count all jumps as unresolved in this case.
+        for(uint32_t i = 0; i < instructionCount; i += size)
+        {
+            MappedInstruction instruction;
+            size = unpackInstruction(&byteCode->instructions[i], instructionCount - i, &instruction);
+            if(instruction.opCode == OpCodeJump)
+                verification.unresolvedJumpCount++;
+        }
+    }
+    else
+    {
+        for(uint32_t i = 0; i < analysis.blockCount; ++i)
+            analyseBlock(&analysis, analysis.blocks[i].position, jumpTargets, &verification);
+    }
+    releaseAnalysis(&analysis);
+
+    if(result)
+        *result = verification;
+    return verification.isValid;
+}
+
+PHO_DECL bool verifyByteCode(const ByteCode* byteCode, VerificationResult* result)
+{
+    return analyseByteCode(byteCode, nullptr, result);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Control-Flow Analysis
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Get the registers that an instruction reads and writes. Instructions that can halt the VM or call the host read all registers. */
+static void getRegisterAccess(const MappedInstruction* instruction, uint16_t* reads, uint16_t* writes)
+{
+    *reads = AllRegisters;
+    *writes = 0;
+    if(validateInstruction(instruction) != ExitCodeSuccess)
+        return;
+
+    const uint16_t dest = static_cast<uint16_t>((1U << instruction->params.destReg) & AllRegisters);
+    const uint16_t argA = static_cast<uint16_t>(1U << instruction->params.argRegA);
+    const uint16_t argB = static_cast<uint16_t>(1U << instruction->params.argRegB);
+    switch(instruction->opCode)
+    {
+    case OpCodeSet:  *reads = 0;           *writes = dest; break;
+    case OpCodeCopy: *reads = argA;        *writes = dest; break;
+    case OpCodeInv:  *reads = dest;        *writes = dest; break;
+    case OpCodeJump: *reads = dest;                        break;
+    case OpCodeBranch:
+    {
+        *reads = (instruction->params.destReg == BranchAlways) ? 0 : dest;
+    } break;
+    case OpCodeAdd:
+    case OpCodeSub:
+    case OpCodeMul:
+    case OpCodeEql:
+    case OpCodeNeq:
+    case OpCodeGrt:
+    case OpCodeLet:  *reads = argA | argB; *writes = dest; break;
+    case OpCodeDiv:
+    {
+        // A division by zero halts the VM, so the host can read all registers.
+        *writes = dest;
+    } break;
+    case OpCodeWide:
+    {
+        if(instruction->wideOpCode == OpCodeSet)
+            *reads = 0;
+        else if(instruction->wideOpCode != OpCodeDiv || instruction->params.value != 0)
+            *reads = argA;
+        *writes = dest;
+    } break;
+    default:
+        break;
+    }
+}
+
+/** Get the registers that an instruction defines. Host-Calls may write every register, but they can also keep its value.
+ * \param	isConditional	Receives <b>true</b> if the instruction does not always write the registers. */
+static uint16_t getDefinedRegisters(const MappedInstruction* instruction, bool* isConditional)
+{
+    *isConditional = (instruction->opCode == OpCodeCallHost) && (validateInstruction(instruction) == ExitCodeSuccess);
+    if(*isConditional)
+        return AllRegisters;
+
+    uint16_t reads, writes;
+    getRegisterAccess(instruction, &reads, &writes);
+    return writes;
+}
+
+/** Internal data that is used while a control-flow graph gets built. */
+struct ControlFlowBuilder
+{
+    ControlFlowGraph* graph;
+    /** Register values of all reachable blocks and the size of every instruction. */
+    ByteCodeAnalysis analysis;
+    uint32_t blockCapacity;
+    /** Positions of the successors of all blocks, these become the block indices once all blocks are known. */
+    uint32_t* targets;
+    uint32_t targetCount;
+    uint32_t targetCapacity;
+    bool isOutOfMemory;
+};
+
+/** Add a block that starts at the specified position.
+ * \return	Returns the index of the block or InvalidIndex if no memory is left. */
+static uint32_t addControlFlowBlock(ControlFlowBuilder* builder, uint32_t position)
+{
+    ControlFlowGraph* graph = builder->graph;
+    if(graph->blockCount == builder->blockCapacity)
+    {
+        const uint32_t capacity = builder->blockCapacity ? builder->blockCapacity * 2 : 16;
+        graph->blocks = static_cast<ControlFlowBlock*>(growArray(graph->blocks, graph->blockCount, capacity, sizeof(ControlFlowBlock)));
+        builder->blockCapacity = capacity;
+        if(!graph->blocks)
+        {
+            graph->blockCount = 0;
+            builder->isOutOfMemory = true;
+            return InvalidIndex;
+        }
+    }
+
+    ControlFlowBlock* block = &graph->blocks[graph->blockCount];
+    *block = {};
+    block->firstPosition = position;
+    block->endPosition = position;
+    block->firstSuccessor = builder->targetCount;
+    block->immediateDominator = InvalidIndex;
+    block->loop = InvalidIndex;
+    return graph->blockCount++;
+}
+
+/** Add a successor to the last block. Targets behind the end of the byte-code halt the VM and make the block an exit. */
+static void addControlFlowTarget(ControlFlowBuilder* builder, uint32_t blockIndex, uint32_t position)
+{
+    if(builder->isOutOfMemory)
+        return;
+
+    ControlFlowBlock* block = &builder->graph->blocks[blockIndex];
+    if(position >= builder->analysis.byteCode->instructionCount)
+    {
+        block->flags |= ControlFlowBlockExit;
+        return;
+    }
+
+    for(uint32_t i = 0; i < block->successorCount; ++i)
+    {
+        if(builder->targets[block->firstSuccessor + i] == position)
+            return;
+    }
+
+    if(builder->targetCount == builder->targetCapacity)
+    {
+        const uint32_t capacity = builder->targetCapacity ? builder->targetCapacity * 2 : 32;
+        builder->targets = static_cast<uint32_t*>(growArray(builder->targets, builder->targetCount, capacity, sizeof(uint32_t)));
+        builder->targetCapacity = capacity;
+        if(!builder->targets)
+        {
+            builder->targetCount = 0;
+            builder->isOutOfMemory = true;
+            return;
+        }
+    }
+
+    builder->targets[builder->targetCount++] = position;
+    block->successorCount++;
+}
+
+/** Split the analysed block that starts at the specified position into basic blocks and add their successors. Works like analyseBlock. */
+static void buildControlFlowBlocks(ControlFlowBuilder* builder, uint32_t position)
+{
+    const ByteCodeAnalysis* analysis = &builder->analysis;
+    const uint32_t instructionCount = analysis->byteCode->instructionCount;
+    uint32_t* instructionBlocks = builder->graph->instructionBlocks;
+    AbstractState state = analysis->blocks[analysis->blockIndices[position]].state;
+
+    uint32_t blockIndex = addControlFlowBlock(builder, position);
+    uint32_t size = 1;
+    for(uint32_t i = position; blockIndex != InvalidIndex; i += size)
+    {
+        // The block falls through into the next analysed block or off the end of the byte-code.
+        if(i >= instructionCount || (i != position && analysis->blockIndices[i] != InvalidPosition))
+        {
+            addControlFlowTarget(builder, blockIndex, i);
+            return;
+        }
+
+        MappedInstruction instruction;
+        size = unpackInstruction(&analysis->byteCode->instructions[i], instructionCount - i, &instruction);
+        for(uint32_t w = i; w < i + size; ++w)
+            instructionBlocks[w] = blockIndex;
+        builder->graph->blocks[blockIndex].endPosition = i + size;
+
+        const bool isBranch = (instruction.opCode == OpCodeBranch && instruction.params.value != 0);
+        if((instruction.opCode != OpCodeJump && !isBranch) || validateInstruction(&instruction) != ExitCodeSuccess)
+        {
+            if(!transferInstruction(&instruction, &state))
+            {
+                builder->graph->blocks[blockIndex].flags |= ControlFlowBlockExit;
+                return;
+            }
+            continue;
+        }
+
+        // The analysis succeeded, so the offset of every reachable jump is known. Branches are relative jumps that read either
+        // their offset or 0 from the condition, see foldBlock.
+        AbstractValue offset = {};
+        const bool isRelative = isBranch || (instruction.params.value == 0);
+        if(isBranch)
+        {
+            const int32_t branchOffset = static_cast<int8_t>(instruction.params.value);
+            const AbstractValue* condition = (instruction.params.destReg == BranchAlways) ? nullptr : &state.registers[instruction.params.destReg];
+            if(!condition || condition->count == AbstractValueUnknown)
+            {
+                addAbstractValue(&offset, branchOffset);
+                if(condition)
+                    addAbstractValue(&offset, 0);
+            }
+            else
+            {
+                for(uint8_t v = 0; v < condition->count; ++v)
+                    addAbstractValue(&offset, (condition->values[v] != 0) ? branchOffset : 0);
+            }
+        }
+        else
+        {
+            offset = state.registers[instruction.params.destReg];
+        }
+
+        bool isFallthrough = false;
+        for(uint8_t v = 0; v < offset.count && offset.count != AbstractValueUnknown; ++v)
+        {
+            if(isRelative && offset.values[v] == 0)
+                isFallthrough = true;
+            else
+                addControlFlowTarget(builder, blockIndex, isRelative ? (i + offset.values[v]) : static_cast<uint32_t>(offset.values[v]));
+        }
+
+        if(!isFallthrough)
+            return;
+
+        // The instruction behind the jump starts a new block, unless it already starts an analysed block.
+        addControlFlowTarget(builder, blockIndex, i + size);
+        if(i + size >= instructionCount || analysis->blockIndices[i + size] != InvalidPosition)
+            return;
+        blockIndex = addControlFlowBlock(builder, i + size);
+    }
+}
+
+/** Turn the successor positions into block indices and collect the predecessors of all blocks. */
+static bool linkControlFlowBlocks(ControlFlowBuilder* builder)
+{
+    ControlFlowGraph* graph = builder->graph;
+    graph->successors = builder->targets;
+    graph->edgeCount = builder->targetCount;
+    builder->targets = nullptr;
+    for(uint32_t i = 0; i < graph->edgeCount; ++i)
+        graph->successors[i] = graph->instructionBlocks[graph->successors[i]];
+
+    graph->predecessors = static_cast<uint32_t*>(pho_malloc(sizeof(uint32_t) * (graph->edgeCount + 1)));
+    if(!graph->predecessors)
+        return false;
+
+    for(uint32_t i = 0; i < graph->edgeCount; ++i)
+        graph->blocks[graph->successors[i]].predecessorCount++;
+    uint32_t first = 0;
+    for(uint32_t i = 0; i < graph->blockCount; ++i)
+    {
+        graph->blocks[i].firstPredecessor = first;
+        first += graph->blocks[i].predecessorCount;
+        graph->blocks[i].predecessorCount = 0;
+    }
+    for(uint32_t i = 0; i < graph->blockCount; ++i)
+    {
+        const ControlFlowBlock* block = &graph->blocks[i];
+        for(uint32_t s = 0; s < block->successorCount; ++s)
+        {
+            ControlFlowBlock* successor = &graph->blocks[graph->successors[block->firstSuccessor + s]];
+            graph->predecessors[successor->firstPredecessor + successor->predecessorCount++] = i;
+        }
+    }
+    return true;
+}
+
+/** Number the blocks in reverse postorder. Every block can be reached from the entry, so every block gets a number.
+ * \param	orderedBlocks	Receives the block indices in reverse postorder.
+ * \param	stack			Temporary array with one entry per block. */
+static void orderControlFlowBlocks(ControlFlowGraph* graph, uint32_t* orderedBlocks, uint32_t* stack)
+{
+    // The order field counts the visited successors of the blocks on the stack until the block is finished.
+    for(uint32_t i = 0; i < graph->blockCount; ++i)
+        graph->blocks[i].order = InvalidIndex;
+
+    uint32_t stackCount = 0;
+    uint32_t postorder = graph->blockCount;
+    stack[stackCount++] = 0;
+    graph->blocks[0].order = 0;
+    while(stackCount)
+    {
+        ControlFlowBlock* block = &graph->blocks[stack[stackCount - 1]];
+        if(block->order < block->successorCount)
+        {
+            const uint32_t successor = graph->successors[block->firstSuccessor + block->order++];
+            if(graph->blocks[successor].order == InvalidIndex)
+            {
+                graph->blocks[successor].order = 0;
+                stack[stackCount++] = successor;
+            }
+            continue;
+        }
+
+        // The block is finished, it gets the next number from the end.
+        orderedBlocks[--postorder] = stack[--stackCount];
+    }
+
+    for(uint32_t i = 0; i < graph->blockCount; ++i)
+        graph->blocks[orderedBlocks[i]].order = i;
+}
+
+/** Find the immediate dominators with the iterative algorithm of Cooper, Harvey and Kennedy and number the dominator tree.
+ * \param	subtreeSizes	Temporary array with one entry per block. */
+static void findDominators(ControlFlowGraph* graph, const uint32_t* orderedBlocks, uint32_t* subtreeSizes)
+{
+    ControlFlowBlock* blocks = graph->blocks;
+    blocks[0].immediateDominator = 0;
+
+    // Every block is visited after its dominators, so this usually finishes after two iterations.
+    bool isChanged = true;
+    while(isChanged)
+    {
+        isChanged = false;
+        for(uint32_t k = 1; k < graph->blockCount; ++k)
+        {
+            ControlFlowBlock* block = &blocks[orderedBlocks[k]];
+            uint32_t dominator = InvalidIndex;
+            for(uint32_t p = 0; p < block->predecessorCount; ++p)
+            {
+                uint32_t predecessor = graph->predecessors[block->firstPredecessor + p];
+                if(blocks[predecessor].immediateDominator == InvalidIndex)
+                    continue;
+                if(dominator == InvalidIndex)
+                {
+                    dominator = predecessor;
+                    continue;
+                }
+
+                // Walk up the dominator tree until both paths meet.
+                while(predecessor != dominator)
+                {
+                    while(blocks[predecessor].order > blocks[dominator].order)
+                        predecessor = blocks[predecessor].immediateDominator;
+                    while(blocks[dominator].order > blocks[predecessor].order)
+                        dominator = blocks[dominator].immediateDominator;
+                }
+            }
+
+            if(block->immediateDominator != dominator)
+            {
+                block->immediateDominator = dominator;
+                isChanged = true;
+            }
+        }
+    }
+    blocks[0].immediateDominator = InvalidIndex;
+
+    // Dominators come first in reverse postorder, so the sizes of all subtrees are known when walking it backwards.
+    for(uint32_t i = 0; i < graph->blockCount; ++i)
+        subtreeSizes[i] = 1;
+    for(uint32_t k = graph->blockCount; k-- > 1;)
+        subtreeSizes[blocks[orderedBlocks[k]].immediateDominator] += subtreeSizes[orderedBlocks[k]];
+
+    // Each child takes the next range of its parent, dominatorEnd tracks the next free index until all children got their range.
+    blocks[0].dominatorIndex = 0;
+    blocks[0].dominatorEnd = 1;
+    for(uint32_t k = 1; k < graph->blockCount; ++k)
+    {
+        ControlFlowBlock* block = &blocks[orderedBlocks[k]];
+        ControlFlowBlock* parent = &blocks[block->immediateDominator];
+        block->dominatorIndex = parent->dominatorEnd;
+        block->dominatorEnd = block->dominatorIndex + 1;
+        parent->dominatorEnd += subtreeSizes[orderedBlocks[k]];
+    }
+    for(uint32_t i = 0; i < graph->blockCount; ++i)
+        blocks[i].dominatorEnd = blocks[i].dominatorIndex + subtreeSizes[i];
+}
+
+/** Find the natural loops of all back edges, which are edges to a block that dominates their source. Inner loops have headers
+ * that come later in reverse postorder, so visiting the headers backwards finds them before the loops that contain them.
+ * \param	stack	Temporary array with one entry per edge.
+ * \return	Returns <b>false</b> if no memory is left. */
+static bool findLoops(ControlFlowGraph* graph, const uint32_t* orderedBlocks, uint32_t* stack)
+{
+    ControlFlowBlock* blocks = graph->blocks;
+    uint32_t loopCapacity = 0;
+    for(uint32_t k = graph->blockCount; k-- > 0;)
+    {
+        const uint32_t header = orderedBlocks[k];
+        uint32_t stackCount = 0;
+        uint32_t backEdgeCount = 0;
+        for(uint32_t p = 0; p < blocks[header].predecessorCount; ++p)
+        {
+            const uint32_t predecessor = graph->predecessors[blocks[header].firstPredecessor + p];
+            if(dominatesBlock(graph, header, predecessor))
+            {
+                backEdgeCount++;
+                if(predecessor != header)
+                    stack[stackCount++] = predecessor;
+            }
+            else if(blocks[predecessor].order >= blocks[header].order)
+            {
+                // The cycle of this edge can be entered without passing its target.
+                graph->isIrreducible = true;
+            }
+        }
+        if(!backEdgeCount)
+            continue;
+
+        if(graph->loopCount == loopCapacity)
+        {
+            loopCapacity = loopCapacity ? loopCapacity * 2 : 8;
+            graph->loops = static_cast<ControlFlowLoop*>(growArray(graph->loops, graph->loopCount, loopCapacity, sizeof(ControlFlowLoop)));
+            if(!graph->loops)
+            {
+                graph->loopCount = 0;
+                return false;
+            }
+        }
+
+        const uint32_t loopIndex = graph->loopCount++;
+        ControlFlowLoop* loop = &graph->loops[loopIndex];
+        loop->header = header;
+        loop->parent = InvalidIndex;
+        loop->blockCount = 1;
+        loop->backEdgeCount = backEdgeCount;
+        blocks[header].loop = loopIndex;
+        blocks[header].flags |= ControlFlowBlockLoopHeader;
+
+        // Walk backwards from the back edges to the header. Blocks of inner loops are skipped by continuing at their header.
+        while(stackCount)
+        {
+            const uint32_t blockIndex = stack[--stackCount];
+            uint32_t predecessorsOf = blockIndex;
+            if(blocks[blockIndex].loop == InvalidIndex)
+            {
+                blocks[blockIndex].loop = loopIndex;
+                loop->blockCount++;
+            }
+            else
+            {
+                uint32_t outer = blocks[blockIndex].loop;
+                while(outer != loopIndex && graph->loops[outer].parent != InvalidIndex)
+                    outer = graph->loops[outer].parent;
+                if(outer == loopIndex)
+                    continue;
+                graph->loops[outer].parent = loopIndex;
+                predecessorsOf = graph->loops[outer].header;
+            }
+
+            const ControlFlowBlock* block = &blocks[predecessorsOf];
+            for(uint32_t p = 0; p < block->predecessorCount; ++p)
+                stack[stackCount++] = graph->predecessors[block->firstPredecessor + p];
+        }
+    }
+
+    // Loops that contain other loops are stored after them.
+    for(uint32_t i = 0; i < graph->loopCount; ++i)
+    {
+        if(graph->loops[i].parent != InvalidIndex)
+            graph->loops[graph->loops[i].parent].blockCount += graph->loops[i].blockCount;
+    }
+    for(uint32_t i = graph->loopCount; i-- > 0;)
+    {
+        const uint32_t parent = graph->loops[i].parent;
+        graph->loops[i].depth = (parent == InvalidIndex) ? 1 : graph->loops[parent].depth + 1;
+    }
+    return true;
+}
+
+/** Blocks that wait to be analysed again until the results of the dataflow analysis do not change anymore. */
+struct ControlFlowQueue
+{
+    /** Ring buffer of queued blocks, every block is queued at most once. */
+    uint32_t* blocks;
+    /** Non-zero for every block that is queued. */
+    uint32_t* isQueued;
+    uint32_t first;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+/** Queue all blocks in reverse postorder or in postorder.
+ * \param	memory	Temporary array with two entries per block. */
+static void initControlFlowQueue(ControlFlowQueue* queue, uint32_t* memory, const uint32_t* orderedBlocks, uint32_t blockCount, bool isPostorder)
+{
+    queue->blocks = memory;
+    queue->isQueued = memory + blockCount;
+    queue->first = 0;
+    queue->count = blockCount;
+    queue->capacity = blockCount;
+    for(uint32_t k = 0; k < blockCount; ++k)
+    {
+        queue->blocks[k] = isPostorder ? orderedBlocks[blockCount - 1 - k] : orderedBlocks[k];
+        queue->isQueued[k] = 1;
+    }
+}
+
+/** Queue a block again if it is not queued yet. */
+inline void pushControlFlowQueue(ControlFlowQueue* queue, uint32_t blockIndex)
+{
+    if(queue->isQueued[blockIndex])
+        return;
+    queue->isQueued[blockIndex] = 1;
+    queue->blocks[(queue->first + queue->count++) % queue->capacity] = blockIndex;
+}
+
+/** Remove the next block from the queue. */
+inline uint32_t popControlFlowQueue(ControlFlowQueue* queue)
+{
+    const uint32_t blockIndex = queue->blocks[queue->first];
+    queue->first = (queue->first + 1) % queue->capacity;
+    queue->count--;
+    queue->isQueued[blockIndex] = 0;
+    return blockIndex;
+}
+
+/** Find the registers that are live at the start and the end of every block.
+ * \param	temporary	Temporary array with three entries per block. */
+static void findLiveRegisters(ControlFlowGraph* graph, const uint32_t* orderedBlocks, uint32_t* temporary)
+{
+    const ByteCode* byteCode = graph->byteCode;
+    uint32_t* blockWrites = temporary;
+    for(uint32_t b = 0; b < graph->blockCount; ++b)
+    {
+        ControlFlowBlock* block = &graph->blocks[b];
+        uint16_t reads = 0;
+        uint16_t writes = 0;
+        uint32_t size;
+        for(uint32_t i = block->firstPosition; i < block->endPosition; i += size)
+        {
+            MappedInstruction instruction;
+            size = unpackInstruction(&byteCode->instructions[i], byteCode->instructionCount - i, &instruction);
+            uint16_t instructionReads, instructionWrites;
+            getRegisterAccess(&instruction, &instructionReads, &instructionWrites);
+            reads |= instructionReads & ~writes;
+            writes |= instructionWrites;
+        }
+
+        // The host application can read all registers after the VM halted.
+        block->liveIn = reads;
+        block->liveOut = (block->flags & ControlFlowBlockExit) ? AllRegisters : 0;
+        blockWrites[b] = writes;
+    }
+
+    // The live registers only grow. Starting in postorder handles everything but loops with a single visit of every block.
+    ControlFlowQueue queue;
+    initControlFlowQueue(&queue, temporary + graph->blockCount, orderedBlocks, graph->blockCount, true);
+    while(queue.count)
+    {
+        const uint32_t blockIndex = popControlFlowQueue(&queue);
+        ControlFlowBlock* block = &graph->blocks[blockIndex];
+        uint16_t live = block->liveOut;
+        for(uint32_t s = 0; s < block->successorCount; ++s)
+            live |= graph->blocks[graph->successors[block->firstSuccessor + s]].liveIn;
+        block->liveOut = live;
+
+        const uint16_t liveIn = static_cast<uint16_t>(block->liveIn | (live & ~blockWrites[blockIndex]));
+        if(liveIn != block->liveIn)
+        {
+            block->liveIn = liveIn;
+            for(uint32_t p = 0; p < block->predecessorCount; ++p)
+                pushControlFlowQueue(&queue, graph->predecessors[block->firstPredecessor + p]);
+        }
+    }
+}
+
+/** Collect the definitions of all blocks. The register values when entering the byte-code are the first definitions.
+ * \return	Returns <b>false</b> if no memory is left. */
+static bool collectDefinitions(ControlFlowGraph* graph)
+{
+    const ByteCode* byteCode = graph->byteCode;
+
+    // The first pass counts the definitions, the second pass stores them.
+    for(uint32_t pass = 0; pass < 2; ++pass)
+    {
+        uint32_t count = RegisterCount;
+        for(uint32_t b = 0; b < graph->blockCount; ++b)
+        {
+            ControlFlowBlock* block = &graph->blocks[b];
+            block->firstDefinition = count;
+            uint32_t size;
+            for(uint32_t i = block->firstPosition; i < block->endPosition; i += size)
+            {
+                MappedInstruction instruction;
+                size = unpackInstruction(&byteCode->instructions[i], byteCode->instructionCount - i, &instruction);
+                bool isConditional;
+                const uint16_t defined = getDefinedRegisters(&instruction, &isConditional);
+                for(uint32_t r = 0; r < RegisterCount; ++r)
+                {
+                    if(!(defined & (1U << r)))
+                        continue;
+                    if(graph->definitions)
+                        graph->definitions[count] = { i, r, isConditional };
+                    count++;
+                }
+            }
+            block->definitionCount = count - block->firstDefinition;
+        }
+
+        if(!graph->definitions)
+        {
+            graph->definitions = static_cast<ControlFlowDefinition*>(pho_malloc(sizeof(ControlFlowDefinition) * count));
+            if(!graph->definitions)
+                return false;
+            for(uint32_t r = 0; r < RegisterCount; ++r)
+                graph->definitions[r] = { InvalidPosition, r, false };
+            graph->definitionCount = count;
+            graph->definitionWordCount = (count + 31) / 32;
+        }
+    }
+    return true;
+}
+
+/** Apply the definitions of a block in front of the end definition to a set of definitions. Every definition replaces all
+ * earlier definitions of its register. */
+static void transferDefinitions(const ControlFlowGraph* graph, const ControlFlowBlock* block, uint32_t endDefinition, uint32_t* definitions)
+{
+    uint16_t killed = 0;
+    for(uint32_t d = block->firstDefinition; d < endDefinition; ++d)
+        killed |= static_cast<uint16_t>(1U << graph->definitions[d].reg);
+
+    if(killed)
+    {
+        for(uint32_t d = 0; d < graph->definitionCount; ++d)
+        {
+            if(killed & (1U << graph->definitions[d].reg))
+                definitions[d / 32] &= ~(1U << (d % 32));
+        }
+    }
+
+    // Only the last definition of every register in the block reaches the end.
+    uint16_t overwritten = 0;
+    for(uint32_t d = endDefinition; d-- > block->firstDefinition;)
+    {
+        const uint16_t reg = static_cast<uint16_t>(1U << graph->definitions[d].reg);
+        if(!(overwritten & reg))
+            definitions[d / 32] |= 1U << (d % 32);
+        overwritten |= reg;
+    }
+}
+
+/** Find the definitions that reach the start of every block. The last definition of a register in a block is added to every
+ * block that can be reached without passing another definition of the register. Unlike an iterative dataflow analysis this
+ * visits every block at most once per definition, no matter how the loops are nested.
+ * \return	Returns <b>false</b> if no memory is left. */
+static bool findReachingDefinitions(ControlFlowGraph* graph)
+{
+    const uint32_t blockCount = graph->blockCount;
+    const uint32_t wordCount = graph->definitionWordCount;
+    const size_t setCount = static_cast<size_t>(blockCount) * wordCount;
+    graph->reachingDefinitions = static_cast<uint32_t*>(pho_malloc(sizeof(uint32_t) * setCount));
+
+    // The registers that every block writes, the last walk that visited every block and the stack of the walk.
+    const size_t temporaryCount = 2 * static_cast<size_t>(blockCount) + graph->edgeCount + 1;
+    uint32_t* killedRegisters = static_cast<uint32_t*>(pho_malloc(sizeof(uint32_t) * temporaryCount));
+    if(!graph->reachingDefinitions || !killedRegisters)
+    {
+        if(killedRegisters)
+            pho_free(killedRegisters);
+        return false;
+    }
+    uint32_t* visits = killedRegisters + blockCount;
+    uint32_t* stack = visits + blockCount;
+
+    memset(graph->reachingDefinitions, 0, sizeof(uint32_t) * setCount);
+    for(uint32_t b = 0; b < blockCount; ++b)
+    {
+        const ControlFlowBlock* block = &graph->blocks[b];
+        killedRegisters[b] = 0;
+        visits[b] = InvalidIndex;
+        for(uint32_t d = block->firstDefinition; d < block->firstDefinition + block->definitionCount; ++d)
+            killedRegisters[b] |= 1U << graph->definitions[d].reg;
+    }
+
+    // Only the last definition of every register in a block reaches its end. The last walks start in front of the entry block
+    // with the register values when entering the byte-code.
+    uint32_t walk = 0;
+    for(uint32_t b = 0; b <= blockCount; ++b)
+    {
+        const bool isEntry = (b == blockCount);
+        const ControlFlowBlock* block = isEntry ? nullptr : &graph->blocks[b];
+        const uint32_t firstDefinition = isEntry ? 0 : block->firstDefinition;
+        const uint32_t endDefinition = isEntry ? static_cast<uint32_t>(RegisterCount) : block->firstDefinition + block->definitionCount;
+        uint16_t overwritten = 0;
+        for(uint32_t definition = endDefinition; definition-- > firstDefinition;)
+        {
+            const uint32_t r = graph->definitions[definition].reg;
+            if(overwritten & (1U << r))
+                continue;
+            overwritten |= static_cast<uint16_t>(1U << r);
+
+            uint32_t stackCount = 0;
+            if(isEntry)
+            {
+                stack[stackCount++] = 0;
+            }
+            else
+            {
+                for(uint32_t s = 0; s < block->successorCount; ++s)
+                    stack[stackCount++] = graph->successors[block->firstSuccessor + s];
+            }
+
+            // Blocks that define the register do not continue the walk, so every edge is followed at most once and the stack
+            // holds at most one entry per edge plus the entry block.
+            while(stackCount)
+            {
+                const uint32_t blockIndex = stack[--stackCount];
+                if(visits[blockIndex] == walk)
+                    continue;
+                visits[blockIndex] = walk;
+
+                graph->reachingDefinitions[static_cast<size_t>(blockIndex) * wordCount + definition / 32] |= 1U << (definition % 32);
+                if(killedRegisters[blockIndex] & (1U << r))
+                    continue;
+
+                const ControlFlowBlock* visited = &graph->blocks[blockIndex];
+                for(uint32_t s = 0; s < visited->successorCount; ++s)
+                {
+                    const uint32_t successor = graph->successors[visited->firstSuccessor + s];
+                    if(visits[successor] != walk)
+                        stack[stackCount++] = successor;
+                }
+            }
+            walk++;
+        }
+    }
+
+    pho_free(killedRegisters);
+    return true;
+}
+
+PHO_DECL ControlFlowResult createControlFlowGraph(const ByteCode* byteCode, ControlFlowGraph* graph, uint32_t analyses)
+{
+    *graph = {};
+    if(!isByteCodeValid(byteCode))
+        return ControlFlowInvalidByteCode;
+    graph->byteCode = byteCode;
+
+    ControlFlowBuilder builder = {};
+    builder.graph = graph;
+    if(!runAnalysis(&builder.analysis, byteCode))
+    {
+        const bool isOutOfMemory = builder.analysis.isOutOfMemory;
+        releaseAnalysis(&builder.analysis);
+        return isOutOfMemory ? ControlFlowOutOfMemory : ControlFlowUnresolvedJump;
+    }
+
+    // The analysed blocks are visited by position, so the basic blocks are sorted and the entry becomes the first block.
+    const uint32_t instructionCount = byteCode->instructionCount;
+    graph->instructionBlocks = static_cast<uint32_t*>(pho_malloc(sizeof(uint32_t) * instructionCount));
+    if(graph->instructionBlocks)
+    {
+        memset(graph->instructionBlocks, 0xFF, sizeof(uint32_t) * instructionCount);
+        for(uint32_t i = 0; i < instructionCount && !builder.isOutOfMemory; ++i)
+        {
+            if(builder.analysis.blockIndices[i] != InvalidPosition)
+                buildControlFlowBlocks(&builder, i);
+        }
+    }
+    releaseAnalysis(&builder.analysis);
+
+    const bool isBuilt = graph->instructionBlocks && !builder.isOutOfMemory && linkControlFlowBlocks(&builder);
+    if(builder.targets)
+        pho_free(builder.targets);
+    if(!isBuilt)
+        return ControlFlowOutOfMemory;
+
+    // The order of the blocks and one temporary array that is large enough for every analysis.
+    const uint32_t blockCount = graph->blockCount;
+    const size_t temporaryCount = (3 * static_cast<size_t>(blockCount) > graph->edgeCount) ? 3 * static_cast<size_t>(blockCount) : graph->edgeCount;
+    uint32_t* orderedBlocks = static_cast<uint32_t*>(pho_malloc(sizeof(uint32_t) * (blockCount + temporaryCount)));
+    if(!orderedBlocks)
+        return ControlFlowOutOfMemory;
+    uint32_t* temporary = orderedBlocks + blockCount;
+
+    orderControlFlowBlocks(graph, orderedBlocks, temporary);
+    bool isOutOfMemory = false;
+    if(analyses & ControlFlowDominators)
+        findDominators(graph, orderedBlocks, temporary);
+    if((analyses & ControlFlowLoops) == ControlFlowLoops)
+        isOutOfMemory = !findLoops(graph, orderedBlocks, temporary);
+    if(!isOutOfMemory && (analyses & ControlFlowLiveness))
+        findLiveRegisters(graph, orderedBlocks, temporary);
+    if(!isOutOfMemory && (analyses & ControlFlowReachingDefinitions))
+        isOutOfMemory = !collectDefinitions(graph) || !findReachingDefinitions(graph);
+    pho_free(orderedBlocks);
+
+    if(isOutOfMemory)
+        return ControlFlowOutOfMemory;
+    graph->analyses = analyses & ControlFlowAll;
+    return ControlFlowSuccess;
+}
+
+PHO_DECL void releaseControlFlowGraph(ControlFlowGraph* graph)
+{
+    if(graph->blocks)              pho_free(graph->blocks);
+    if(graph->successors)          pho_free(graph->successors);
+    if(graph->predecessors)        pho_free(graph->predecessors);
+    if(graph->instructionBlocks)   pho_free(graph->instructionBlocks);
+    if(graph->loops)               pho_free(graph->loops);
+    if(graph->definitions)         pho_free(graph->definitions);
+    if(graph->reachingDefinitions) pho_free(graph->reachingDefinitions);
+    *graph = {};
+}
+
+PHO_DECL bool dominatesBlock(const ControlFlowGraph* graph, uint32_t dominator, uint32_t block)
+{
+    const ControlFlowBlock* dominatorBlock = &graph->blocks[dominator];
+    const uint32_t index = graph->blocks[block].dominatorIndex;
+    return (index >= dominatorBlock->dominatorIndex) && (index < dominatorBlock->dominatorEnd);
+}
+
+PHO_DECL bool isBlockInLoop(const ControlFlowGraph* graph, uint32_t block, uint32_t loop)
+{
+    for(uint32_t i = graph->blocks[block].loop; i != InvalidIndex; i = graph->loops[i].parent)
+    {
+        if(i == loop)
+            return true;
+    }
+    return false;
+}
+
+PHO_DECL uint16_t getLiveRegisters(const ControlFlowGraph* graph, uint32_t position)
+{
+    if(position >= graph->byteCode->instructionCount || graph->instructionBlocks[position] == InvalidIndex)
+        return 0;
+
+    // A register is live if the rest of the block reads it before writing it or if it is live at the end and not written.
+    const ControlFlowBlock* block = &graph->blocks[graph->instructionBlocks[position]];
+    const ByteCode* byteCode = graph->byteCode;
+    uint16_t live = 0;
+    uint16_t written = 0;
+    uint32_t size;
+    for(uint32_t i = position; i < block->endPosition; i += size)
+    {
+        MappedInstruction instruction;
+        size = unpackInstruction(&byteCode->instructions[i], byteCode->instructionCount - i, &instruction);
+        uint16_t reads, writes;
+        getRegisterAccess(&instruction, &reads, &writes);
+        live |= reads & ~written;
+        written |= writes;
+    }
+    return static_cast<uint16_t>(live | (block->liveOut & ~written));
+}
+
+PHO_DECL void getReachingDefinitions(const ControlFlowGraph* graph, uint32_t position, uint32_t* definitions)
+{
+    const uint32_t wordCount = graph->definitionWordCount;
+    if(position >= graph->byteCode->instructionCount || graph->instructionBlocks[position] == InvalidIndex)
+    {
+        memset(definitions, 0, sizeof(uint32_t) * wordCount);
+        return;
+    }
+
+    const uint32_t blockIndex = graph->instructionBlocks[position];
+    const ControlFlowBlock* block = &graph->blocks[blockIndex];
+    uint32_t endDefinition = block->firstDefinition;
+    while(endDefinition < block->firstDefinition + block->definitionCount && graph->definitions[endDefinition].position < position)
+        endDefinition++;
+
+    memcpy(definitions, &graph->reachingDefinitions[static_cast<size_t>(blockIndex) * wordCount], sizeof(uint32_t) * wordCount);
+    transferDefinitions(graph, block, endDefinition, definitions);
+}
+
+/** Get the operation of the first instruction of a fused operation. This is used by code generators that translate every
+ * instruction on its own and do not need the fused operations. */
+inline uint8_t getUnfusedOperation(uint8_t op)
+{
+    if(op >= DecodedOpEqlMulJump && op <= DecodedOpLetMulJump)
+        return static_cast<uint8_t>(DecodedOpEql + (op - DecodedOpEqlMulJump));
+    if(op >= DecodedOpSetJump && op <= DecodedOpSetSub)
+        return DecodedOpSet;
+    return op;
+}
+
+#if PHOTON_FUSION_ENABLED && !PHOTON_DEBUG_CALLBACK_ENABLED
+/** Get the fused operation that starts with the decoded instruction at the specified position.
+ * \param	length	Receives the number of words that the fused operation executes, which skips the immediate of a wide instruction.
+ * \return	Returns the fused operation or the operation of the instruction itself if nothing can be fused. */
+static uint8_t getFusedOperation(const DecodedInstruction* instructions, uint32_t position, uint32_t instructionCount, uint32_t* length)
+{
+    const DecodedInstruction* instruction = &instructions[position];
+    const uint32_t remaining = instructionCount - position;
+    *length = getDecodedInstructionSize(instruction->op);
+
+    switch(instruction->op)
+    {
+    case DecodedOpEql:
+    case DecodedOpNeq:
+    case DecodedOpGrt:
+    case DecodedOpLet:
+    {
+        if(remaining >= 3 && instruction[1].op == DecodedOpMul &&
+           (instruction[2].op == DecodedOpJumpRelative || instruction[2].op == DecodedOpJumpResolved))
+        {
+            *length = 3;
+            return static_cast<uint8_t>(DecodedOpEqlMulJump + (instruction->op - DecodedOpEql));
+        }
+    } break;
+    case DecodedOpSet:
+    {
+        if(remaining >= 2 && (instruction[1].op == DecodedOpJumpResolved || instruction[1].op == DecodedOpJumpDirect))
+        {
+            *length = 2;
+            return DecodedOpSetJump;
+        }
+        if(remaining >= 3 && instruction[1].op == DecodedOpInv &&
+           (instruction[2].op == DecodedOpJumpResolved || instruction[2].op == DecodedOpJumpDirect))
+        {
+            *length = 3;
+            return DecodedOpSetInvJump;
+        }
+        if(remaining >= 2 && (instruction[1].op == DecodedOpAdd || instruction[1].op == DecodedOpSub))
+        {
+            *length = 2;
+            return (instruction[1].op == DecodedOpAdd) ? DecodedOpSetAdd : DecodedOpSetSub;
+        }
+    } break;
+    default:
+        break;
+    }
+
+    return instruction->op;
+}
+
+/** Replace common instruction sequences with fused operations. The fused operations only replace the first instruction of
+ * a sequence, all following instructions stay the same so jumps into the middle of a sequence still work. */
+static void fuseInstructions(DecodedInstruction* instructions, uint32_t instructionCount)
+{
+    uint32_t position = 0;
+    while(position < instructionCount)
+    {
+        uint32_t length;
+        instructions[position].op = getFusedOperation(instructions, position, instructionCount, &length);
+        position += length;
+    }
+}
+#endif // PHOTON_FUSION_ENABLED && !PHOTON_DEBUG_CALLBACK_ENABLED
+
+PHO_DECL bool decodeByteCode(const ByteCode* byteCode, DecodedByteCode* decoded)
+{
+    if(!decoded)
+        return false;
+
+    *decoded = {};
+    if(!isByteCodeValid(byteCode))
+        return false;
+
+    // Allocate one additional halt instruction so the VM does not need to check the end of the byte-code on every fetch.
+    const size_t size = sizeof(DecodedInstruction) * (byteCode->instructionCount + 1) + PHOTON_CACHE_LINE_SIZE - 1;
+    void* memory = pho_malloc(size);
+    if(!memory)
+        return false;
+
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(memory) + PHOTON_CACHE_LINE_SIZE - 1) & ~static_cast<uintptr_t>(PHOTON_CACHE_LINE_SIZE - 1);
+    DecodedInstruction* instructions = reinterpret_cast<DecodedInstruction*>(aligned);
+
+    for(uint32_t i = 0; i < byteCode->instructionCount; ++i)
+    {
+        instructions[i] = decodeInstruction(&byteCode->instructions[i], byteCode->instructionCount - i);
+        resolveBranch(&instructions[i], byteCode->instructions[i], i, byteCode->instructionCount);
+    }
+    const RawInstruction halt = 0;
+    instructions[byteCode->instructionCount] = decodeInstruction(&halt, 1);
+
+    // Jumps with a known target do not need to read the offset register or check the bounds at runtime.
+    uint32_t* jumpTargets = static_cast<uint32_t*>(pho_malloc(sizeof(uint32_t) * byteCode->instructionCount));
+    if(jumpTargets)
+    {
+        decoded->isVerified = analyseByteCode(byteCode, jumpTargets, nullptr);
+        for(uint32_t i = 0; i < byteCode->instructionCount; ++i)
+        {
+            if(jumpTargets[i] == InvalidPosition)
+                continue;
+
+            DecodedInstruction* instruction = &instructions[i];
+            instruction->op = (instruction->op == DecodedOpJumpRelative) ? DecodedOpJumpResolved : DecodedOpJumpDirect;
+            instruction->argRegA = OpCodeJump;
+            instruction->value = static_cast<int32_t>(jumpTargets[i]);
+        }
+        pho_free(jumpTargets);
+    }
+
+#if PHOTON_FUSION_ENABLED && !PHOTON_DEBUG_CALLBACK_ENABLED
+    // The debug callback needs to be called after every single instruction, so nothing can be fused if it is enabled.
+    fuseInstructions(instructions, byteCode->instructionCount);
+#endif // PHOTON_FUSION_ENABLED && !PHOTON_DEBUG_CALLBACK_ENABLED
+
+    decoded->instructions     = instructions;
+    decoded->instructionCount = byteCode->instructionCount;
+    decoded->memory           = memory;
+    decoded->checksum         = hashBytes(byteCode->instructions, sizeof(RawInstruction) * byteCode->instructionCount, HashSeed);
+    return true;
+}
+
+PHO_DECL void releaseDecodedByteCode(DecodedByteCode* decoded)
+{
+    if(decoded && decoded->memory)
+    {
+        pho_free(decoded->memory);
+        *decoded = {};
+    }
+}
+
+/** Group without any callbacks that is shared by all groups of a Host-Call table that do not have their own functions. */
+static const HostCallEntry EmptyHostCallGroup[HostCallGroupSize] = {};
+/** Host-Call table without any callbacks. This is used by the native code of VMs without a table. */
+static const HostCallTable EmptyHostCallTable =
+{
+    {
+        EmptyHostCallGroup, EmptyHostCallGroup, EmptyHostCallGroup, EmptyHostCallGroup,
+        EmptyHostCallGroup, EmptyHostCallGroup, EmptyHostCallGroup, EmptyHostCallGroup,
+        EmptyHostCallGroup, EmptyHostCallGroup, EmptyHostCallGroup, EmptyHostCallGroup,
+        EmptyHostCallGroup, EmptyHostCallGroup, EmptyHostCallGroup, EmptyHostCallGroup,
+    },
+    0
+};
+
+/** Check if a Host-Call definition contains a callback. */
+inline bool hasHostCallback(const HostCallDefinition* definition)
+{
+    return definition->callback || definition->contextCallback;
+}
+
+/** Create a Host-Call table that contains the callbacks of an existing table and the specified definitions.
+ * The table and the entries of all groups that contain a callback are stored in a single memory block.
+ * \param	base	Table that provides the initial callbacks or <b>nullptr</b> to start with an empty table.
+ * \return	Returns <b>nullptr</b> if a packed id is out of range or the memory could not be allocated. */
+static HostCallTable* buildHostCallTable(const HostCallTable* base, const HostCallDefinition* definitions, uint32_t definitionCount)
+{
+    bool isGroupUsed[HostCallGroupCount];
+    for(uint32_t i = 0; i < HostCallGroupCount; ++i)
+        isGroupUsed[i] = base && base->groups[i] != EmptyHostCallGroup;
+
+    for(uint32_t i = 0; i < definitionCount; ++i)
+    {
+        if(!hasHostCallback(&definitions[i]))
+            continue;
+        if(((definitions[i].groupId << 8) | definitions[i].functionId) >= PHOTON_MAX_HOST_CALLS)
+            return nullptr;
+        isGroupUsed[definitions[i].groupId] = true;
+    }
+
+    uint32_t usedGroupCount = 0;
+    for(uint32_t i = 0; i < HostCallGroupCount; ++i)
+        usedGroupCount += isGroupUsed[i];
+
+    HostCallTable* table = static_cast<HostCallTable*>(pho_malloc(sizeof(HostCallTable) + sizeof(HostCallEntry) * HostCallGroupSize * usedGroupCount));
+    if(!table)
+        return nullptr;
+
+    HostCallEntry* functions = reinterpret_cast<HostCallEntry*>(table + 1);
+    for(uint32_t i = 0; i < HostCallGroupCount; ++i)
+    {
+        if(!isGroupUsed[i])
+        {
+            table->groups[i] = EmptyHostCallGroup;
+            continue;
+        }
+
+        memcpy(functions, base ? base->groups[i] : EmptyHostCallGroup, sizeof(HostCallEntry) * HostCallGroupSize);
+        table->groups[i] = functions;
+        functions += HostCallGroupSize;
+    }
+
+    table->callCount = base ? base->callCount : 0;
+    for(uint32_t i = 0; i < definitionCount; ++i)
+    {
+        if(!hasHostCallback(&definitions[i]))
+            continue;
+
+        HostCallEntry* entry = const_cast<HostCallEntry*>(&table->groups[definitions[i].groupId][definitions[i].functionId]);
+        if(!entry->callback && !entry->contextCallback)
+            ++table->callCount;
+        entry->callback = definitions[i].callback;
+        entry->contextCallback = definitions[i].callback ? nullptr : definitions[i].contextCallback;
+        entry->context = definitions[i].context;
+    }
+
+    return table;
+}
+
+PHO_DECL HostCallTable* createHostCallTable(const HostCallDefinition* definitions, uint32_t definitionCount)
+{
+    return buildHostCallTable(nullptr, definitions, definitionCount);
+}
+
+PHO_DECL void releaseHostCallTable(HostCallTable* table)
+{
+    if(table)
+        pho_free(table);
+}
+
+PHO_DECL void setHostCallTable(struct VirtualMachine* vm, const HostCallTable* table)
+{
+    if(vm->isHostCallTableOwned)
+        releaseHostCallTable(const_cast<HostCallTable*>(vm->hostCallTable));
+
+    vm->hostCallTable = table;
+    vm->isHostCallTableOwned = false;
+}
+
+/** Store a single Host-Call definition in the private Host-Call table of a VM, see registerHostCall. */
+static int32_t registerHostCallDefinition(struct VirtualMachine* vm, const HostCallDefinition* definition)
+{
+    if(!hasHostCallback(definition))
+        return 0;
+
+    uint32_t id = (definition->groupId << 8) | definition->functionId;
+    if(id >= PHOTON_MAX_HOST_CALLS)
+        return -1; // Out of range.
+
+    const HostCallEntry* entry = getHostCallEntry(vm->hostCallTable, id);
+    int32_t result = (entry->callback || entry->contextCallback) ? 1 : 0; // Callback overwrite.
+
+    // A private table that already contains the group can be changed in place.
+    if(vm->isHostCallTableOwned && vm->hostCallTable->groups[definition->groupId] != EmptyHostCallGroup)
+    {
+        HostCallTable* table = const_cast<HostCallTable*>(vm->hostCallTable);
+        HostCallEntry* ownedEntry = const_cast<HostCallEntry*>(entry);
+        ownedEntry->callback = definition->callback;
+        ownedEntry->contextCallback = definition->callback ? nullptr : definition->contextCallback;
+        ownedEntry->context = definition->context;
+        table->callCount += (result == 0);
+        return result;
+    }
+
+    HostCallTable* table = buildHostCallTable(vm->hostCallTable, definition, 1);
+    if(!table)
+        return -1;
+
+    setHostCallTable(vm, table);
+    vm->isHostCallTableOwned = true;
+    return result;
+}
+
+PHO_DECL int32_t registerHostCall(struct VirtualMachine* vm, fHostCallback* callback, uint8_t groupId, uint8_t functionId)
+{
+    const HostCallDefinition definition = { callback, groupId, functionId, nullptr, nullptr };
+    return registerHostCallDefinition(vm, &definition);
+}
+
+PHO_DECL int32_t registerContextHostCall(struct VirtualMachine* vm, fContextHostCallback* callback, void* context, uint8_t groupId, uint8_t functionId)
+{
+    const HostCallDefinition definition = { nullptr, groupId, functionId, callback, context };
+    return registerHostCallDefinition(vm, &definition);
+}
+
+PHO_DECL void setHostCallContext(struct VirtualMachine* vm, void* context)
+{
+    vm->hostCallContext = context;
+}
+
+// @Cleanup: Use a single, overridable error reporting function like reportErrorInternal.
+//    - C-574 (28.09.2017)
+/** Outputs messages that are emitted by the VM to the standard output.
+ * \param	verbosity	Verbosity level of the emitted message. If this is below the VM's level then the message will be ignored.
+ * \param	message		Message to display. */
+template <typename... Args>
+inline void printMessage(VirtualMachine* vm, VerbosityLevel verbosity, const char* message, Args... args)
+{
+    if(verbosity == VerbosityLevelSilent)
+        return;
+
+    if(verbosity & vm->verbosityLevel)
+    {
+        if(verbosity & VerbosityLevelError)
+            fprintf(stderr, message, args...);
+        else
+            fprintf(stdout, message, args...);
+    }
+}
+
+/** Get a register from the VM at the specified register index.
+ * \param	registerIndex	Index of the register to get.
+ * \return	Returns a pointer to register at the register index. The Local register will be returned if the index is invalid.
+ * \warning If the specified index is invalid the VM will halt execution. */
+static RegisterRef getRegister(VirtualMachine* vm, int32_t registerIndex)
+{
+    if(registerIndex < RegisterCount && registerIndex >= 0)
+    {
+        return (&vm->registers[registerIndex]);
+    }
+    else
+    {
+        printMessage(vm, VerbosityLevelError, "VMFAULT: Tried to access invalid register at index %d!\n", registerIndex);
+        instructionHalt(vm, ExitCodeRegisterFault);
+    }
+
+    return (&vm->registers[Local]);
+}
+
+/** Jumps a specified number of instructions forwards or backwards in the instruction queue relative to the current position or absolute to the start in the byte-code queue.
+ * \param	jumpOffset		Offset to the instruction to jump to. In relative mode -1 will jump one instruction back and a value of 0 will be ignored and no jump will be executed. 
+ * \param	isRelative		Flag to indicate if the jump is relative to the current position (<b>true</b>) or absolute to the first instruction (<b>false</b>). 
+ * \return	Returns <b>true</b> if the jump executed successfully and the next instruction is set or <b>false</b> if the new position is out of bunds. */
+static bool jumpTo(VirtualMachine* vm, int32_t jumpOffset, uint8_t isRelative)
+{
+    if(isRelative && jumpOffset == 0) 
+        return true;
+
+    /* Calculate the new position in the instruction queue. We subtract one instruction in relative mode so we are not 
+    * skipping the new set instruction as the instruction counter will get incremented on the next instruction fetch. */
+    const uint32_t newPosition = (vm->currentPosition * isRelative) + jumpOffset - isRelative;
+    
+    if(isByteCodeValid(&vm->byteCode) && (newPosition < vm->byteCode.instructionCount))
+    {
+        vm->currentPosition = newPosition;
+        return true;
+    }
+
+    printMessage(vm, VerbosityLevelError, "VMFAULT: Failed to jump to specified instruction! Instruction address is out of bounds. \n\tInstruction position: %d (%s + %d), begin = 0, end = %d.\n",
+        newPosition, (isRelative ? "current" : "0"), jumpOffset, (isByteCodeValid(&vm->byteCode) ? (vm->byteCode.instructionCount - 1) : 0));
+
+    return false;
+}
+
+#if PHOTON_PROFILE_ENABLED
+/** Read the cycle counter that is used by profiles. */
+inline uint64_t readCycleCounter()
+{
+#if PHOTON_PROFILE_USES_TSC
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif // PHOTON_PROFILE_USES_TSC
+}
+
+/** Add an executed instruction to the profile. It is charged with the cycles since the previous instruction finished. */
+inline void profileInstruction(Profile* profile, uint32_t position)
+{
+    const uint64_t timestamp = readCycleCounter();
+    ProfileEntry* entry = &profile->positions[(position < profile->positionCount) ? position : (profile->positionCount - 1)];
+    ++entry->count;
+    entry->cycles += timestamp - profile->timestamp;
+    profile->timestamp = timestamp;
+}
+#endif // PHOTON_PROFILE_ENABLED
+
+/** Call the Host-Call entry with the specified packed id. The call is added to the profile of the VM if one is set.
+ * \return	Returns the status of the call, see callHostCall. */
+inline HostCallStatus invokeHostCall(VirtualMachine* vm, const HostCallEntry* entry, uint32_t id)
+{
+#if PHOTON_PROFILE_ENABLED
+    if(vm->profile)
+    {
+        const uint64_t start = readCycleCounter();
+        const HostCallStatus status = callHostCall(entry, vm->registers, vm->hostCallContext);
+        if(status != HostCallNotFound)
+        {
+            ProfileEntry* profileEntry = &vm->profile->hostCalls[id];
+            ++profileEntry->count;
+            profileEntry->cycles += readCycleCounter() - start;
+        }
+        return status;
+    }
+#endif // PHOTON_PROFILE_ENABLED
+    (void)id;
+    return callHostCall(entry, vm->registers, vm->hostCallContext);
+}
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Instructions
+ *--------------------------------------------------------------------------------------------------------------*/  
+
+#define PHOTON_INSTRUCTION(name) static void name(VirtualMachine* vm, MappedInstruction* instruction)
+#define storeRegister(reg, value) *(reg) = (value)
+#define loadRegister(vm, registerIndex) (*getRegister(vm, registerIndex))
+
+
+static void instructionHalt(VirtualMachine* vm, VMExitCode exitCode)
+{
+    if(!vm->isHalted)
+    {
+        vm->isHalted = true;
+        vm->exitCode = exitCode;
+
+        printMessage(vm, VerbosityLevelDebugInfo, "-- HALTING VIRTUAL MACHINE --\n");
+    }
+}
+
+PHOTON_INSTRUCTION(instructionSet)
+{
+    RegisterRef reg = getRegister(vm, instruction->params.destReg);
+    storeRegister(reg, instruction->params.value);
+}
+
+PHOTON_INSTRUCTION(instructionCopy)
+{
+    RegisterRef result = getRegister(vm, instruction->params.destReg);
+	RegisterType regSource = loadRegister(vm, instruction->params.argRegA);
+	storeRegister(result, regSource);
+}
+
+PHOTON_INSTRUCTION(instructionAdd)
+{
+    RegisterRef result = getRegister(vm, instruction->params.destReg);
+	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
+    RegisterType regB = loadRegister(vm, instruction->params.argRegB);
+    storeRegister(result, regA + regB);
+}
+
+PHOTON_INSTRUCTION(instructionSubtract)
+{
+    RegisterRef result = getRegister(vm, instruction->params.destReg);
+	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
+	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
+	storeRegister(result, regA - regB);
+}
+
+PHOTON_INSTRUCTION(instructionMultiply)
+{
+    RegisterRef result = getRegister(vm, instruction->params.destReg);
+	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
+	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
+	storeRegister(result, regA * regB);
+}
+
+PHOTON_INSTRUCTION(instructionDivide)
+{
+    RegisterRef result = getRegister(vm, instruction->params.destReg);
+	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
+	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
+    if(regB != 0)
+	{
+		storeRegister(result, divideRegister(regA, regB));
+	}
+	else
+	{
+		fprintf(stderr, "VMFAULT: Invalid division by zero! Arguments: reg%d reg%d(%d) reg%d(%d)\n", instruction->params.destReg, instruction->params.argRegA, regA, instruction->params.argRegB, regB);
+		instructionHalt(vm, ExitCodeDivideByZero);
+	}
+}
+
+PHOTON_INSTRUCTION(instructionInvert)
+{
+    RegisterRef result = getRegister(vm, instruction->params.destReg);
+	storeRegister(result, -(*result));
+}
+
+PHOTON_INSTRUCTION(instructionEquals)
+{
+    RegisterRef result = getRegister(vm, instruction->params.destReg);
+	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
+	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
+	storeRegister(result, regA == regB);
+}
+
+PHOTON_INSTRUCTION(instructionNotEquals)
+{
+    RegisterRef result = getRegister(vm, instruction->params.destReg);
+	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
+	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
+	storeRegister(result, regA != regB);
+}
+
+PHOTON_INSTRUCTION(instructionGreater)
+{
+    RegisterRef result = getRegister(vm, instruction->params.destReg);
+	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
+	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
+    storeRegister(result, regA > regB);
+}
+
+PHOTON_INSTRUCTION(instructionLess)
+{
+    RegisterRef result = getRegister(vm, instruction->params.destReg);
+	RegisterType regA = loadRegister(vm, instruction->params.argRegA);
+	RegisterType regB = loadRegister(vm, instruction->params.argRegB);
+    storeRegister(result, regA < regB);
+}
+
+PHOTON_INSTRUCTION(instructionJump)
+{
+    RegisterRef regSource = getRegister(vm, instruction->params.destReg);
+	int32_t instructionJumpOffset = *regSource;
+	uint8_t isAbsolute = instruction->params.value != 0;
+
+	if(!jumpTo(vm, instructionJumpOffset, !isAbsolute))
+		instructionHalt(vm, ExitCodeJumpOutOfBounds);
+}
+
+PHOTON_INSTRUCTION(instructionBranch)
+{
+    bool isTaken = true;
+    if(instruction->params.destReg != BranchAlways)
+        isTaken = (loadRegister(vm, instruction->params.destReg) != 0);
+
+    if(!vm->isHalted && isTaken && !jumpTo(vm, static_cast<int8_t>(instruction->params.value), true))
+        instructionHalt(vm, ExitCodeJumpOutOfBounds);
+}
+
+PHOTON_INSTRUCTION(instructionWide)
+{
+    if(!isWideOperation(instruction->wideOpCode))
+    {
+        printMessage(vm, VerbosityLevelError, "VMFAULT: Invalid or incomplete wide instruction with operation %d!\n", instruction->wideOpCode);
+        instructionHalt(vm, ExitCodeHaltRequested);
+        return;
+    }
+
+    RegisterRef result = getRegister(vm, instruction->params.destReg);
+    if(instruction->wideOpCode == OpCodeSet)
+    {
+        storeRegister(result, instruction->params.value);
+        return;
+    }
+
+    // The immediate is the second argument of the operation.
+    RegisterType regA = loadRegister(vm, instruction->params.argRegA);
+    RegisterType value = instruction->params.value;
+    switch(instruction->wideOpCode)
+    {
+    case OpCodeAdd: storeRegister(result, regA + value); break;
+    case OpCodeSub: storeRegister(result, regA - value); break;
+    case OpCodeMul: storeRegister(result, regA * value); break;
+    case OpCodeDiv:
+    {
+        if(value != 0)
+        {
+            storeRegister(result, divideRegister(regA, value));
+        }
+        else
+        {
+            fprintf(stderr, "VMFAULT: Invalid division by zero! Arguments: reg%d reg%d(%d) %d\n", instruction->params.destReg, instruction->params.argRegA, regA, value);
+            instructionHalt(vm, ExitCodeDivideByZero);
+        }
+    } break;
+    case OpCodeEql: storeRegister(result, regA == value); break;
+    case OpCodeNeq: storeRegister(result, regA != value); break;
+    case OpCodeGrt: storeRegister(result, regA > value); break;
+    case OpCodeLet: storeRegister(result, regA < value); break;
+    default: break;
+    }
+}
+
+
+/** Stop the VM with the status that was returned by a Host-Call with context. A pending call suspends the VM, all other statuses halt it. */
+static void stopHostCall(VirtualMachine* vm, HostCallStatus status, uint32_t id)
+{
+    if(status & HostCallPending)
+    {
+        vm->isSuspended = true;
+        return;
+    }
+    if(status & HostCallFault)
+        printMessage(vm, VerbosityLevelError, "VMFAULT: Host-Call with gid=%d and fid=%d failed with exit code %d.\n", id >> 8, id & 0xFF, status & 0xFF);
+    instructionHalt(vm, static_cast<VMExitCode>(status & 0xFF));
+}
+
+PHOTON_INSTRUCTION(instructionHostCall)
+{
+    HostCallStatus status = HostCallNotFound;
+    uint32_t groupId = instruction->params.destReg;
+    uint32_t functionId = instruction->params.value;
+
+    uint32_t id = (groupId << 8) | functionId;
+    if(id < PHOTON_MAX_HOST_CALLS)
+    {
+        status = invokeHostCall(vm, getHostCallEntry(vm->hostCallTable, id), id);
+        if(status != HostCallNotFound)
+        {
+            if(status != HostCallContinue)
+                stopHostCall(vm, status, id);
+        }
+        else
+        {
+            printMessage(vm, VerbosityLevelError, "No callable function found with gid=%d and fid=%d, callback is null.\n", groupId, functionId);
+        }
+    }
+    else
+    {
+		printMessage(vm, VerbosityLevelError, "Host callback IDs are out of range. Got: gid=%d and fid=%d\n", groupId, functionId);
+    }
+
+#if PHOTON_IS_HOST_CALL_STRICT
+    if(status == HostCallNotFound)
+    {
+        // We are strict and do not allow the execution to continue as the call could be important.
+        instructionHalt(vm, VMExitCodes::ExitCodeInvalidHostCall);
+    }
+#endif // PHOTON_IS_HOST_CALL_STRICT
+}
+
+#undef PHOTON_INSTRUCTION
+#undef storeRegister
+#undef loadRegister
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * 
+ *--------------------------------------------------------------------------------------------------------------*/  
+
+/** Execute a single unpacked instruction using the checked instruction handlers. */
+static void executeInstruction(VirtualMachine* vm, MappedInstruction* instruction)
+{
+    switch(instruction->opCode)
+    {
+        case OpCodeSet:
+        {
+            instructionSet(vm, instruction);
+        } break;
+        case OpCodeCopy:
+        {
+            instructionCopy(vm, instruction);
+        } break;
+        case OpCodeAdd:
+        {
+            instructionAdd(vm, instruction);
+        } break;
+        case OpCodeSub:
+        {
+            instructionSubtract(vm, instruction);
+        } break;
+        case OpCodeMul:
+        {
+            instructionMultiply(vm, instruction);
+        } break;
+        case OpCodeDiv:
+        {
+            instructionDivide(vm, instruction);
+        } break;
+        case OpCodeInv:
+        {
+            instructionInvert(vm, instruction);
+        } break;
+        case OpCodeEql:
+        {
+            instructionEquals(vm, instruction);
+        } break;
+        case OpCodeNeq:
+        {
+            instructionNotEquals(vm, instruction);
+        } break;
+        case OpCodeGrt:
+        {
+            instructionGreater(vm, instruction);
+        } break;
+        case OpCodeLet:
+        {
+            instructionLess(vm, instruction);
+        } break;
+        case OpCodeJump:
+        {
+            instructionJump(vm, instruction);
+        } break;
+        case OpCodeCallHost:
+        {
+            instructionHostCall(vm, instruction);
+        } break;
+        case OpCodeBranch:
+        {
+            instructionBranch(vm, instruction);
+        } break;
+        case OpCodeWide:
+        {
+            instructionWide(vm, instruction);
+        } break;
+        case OpCodeHalt:
+        default:
+        {
+            instructionHalt(vm, instruction->params.value);
+        } break;
+    }
+}
+
+#if PHOTON_TRACE_ENABLED
+static_assert((PHOTON_TRACE_BUFFER_SIZE & (PHOTON_TRACE_BUFFER_SIZE - 1)) == 0, "PHOTON_TRACE_BUFFER_SIZE must be a power of two!");
+
+/** Write an executed instruction into the next record of the trace buffer. */
+inline void traceInstruction(TraceBuffer* buffer, uint32_t position, const DecodedInstruction* instruction, RegisterType result)
+{
+    TraceRecord* record = &buffer->records[buffer->recordCount & (PHOTON_TRACE_BUFFER_SIZE - 1)];
+    ++buffer->recordCount;
+
+    record->position    = position;
+    record->result      = result;
+    record->instruction = *instruction;
+}
+
+/** Write the instruction at the specified position into the trace buffer of the VM after it got executed by the checked handlers.
+ * Positions behind the end of the byte-code are traced as halt. */
+static void traceCheckedInstruction(VirtualMachine* vm, uint32_t position)
+{
+    const bool isInBounds = isByteCodeValid(&vm->byteCode) && position < vm->byteCode.instructionCount;
+    const RawInstruction* words = isInBounds ? &vm->byteCode.instructions[position] : nullptr;
+    const RawInstruction rawInstruction = isInBounds ? words[0] : 0;
+
+    DecodedInstruction instruction = decodeInstruction(isInBounds ? words : &rawInstruction, isInBounds ? (vm->byteCode.instructionCount - position) : 1);
+    RegisterType result = vm->registers[isRegisterIndexValid(instruction.destReg) ? instruction.destReg : static_cast<uint8_t>(Local)];
+
+    instruction.op    = DecodedOpChecked;
+    instruction.value = static_cast<uint16_t>(rawInstruction);
+    if(vm->isHalted)
+        instruction.value |= (1 << 24) | (vm->exitCode << 16);
+
+    traceInstruction(vm->traceBuffer, position, &instruction, result);
+}
+#endif // PHOTON_TRACE_ENABLED
+
+/** Execute the raw byte-code of the VM. Every instruction is unpacked and validated before it gets executed.
+ * This is used if no pre-decoded instruction stream is available. Like in executeDecodedByteCode the budget is only checked
+ * when a jump is taken, so both stop the VM at the same positions.
+ * \param	budget	Number of instructions that may be executed before the VM is stopped.
+ * \return	Returns <b>false</b> if the budget got used up or a Host-Call suspended the VM before it halted. */
+static bool executeByteCode(VirtualMachine* vm, int64_t budget = INT64_MAX)
+{
+    MappedInstruction instruction;
+#if PHOTON_PROFILE_ENABLED
+    if(vm->profile) vm->profile->timestamp = readCycleCounter();
+#endif // PHOTON_PROFILE_ENABLED
+
+    while(!vm->isHalted)
+    {
+#if PHOTON_TRACE_ENABLED || PHOTON_PROFILE_ENABLED
+        const uint32_t position = vm->currentPosition;
+#endif // PHOTON_TRACE_ENABLED || PHOTON_PROFILE_ENABLED
+        if(isByteCodeValid(&vm->byteCode) &&
+           vm->currentPosition < vm->byteCode.instructionCount)
+        {
+            const uint32_t remaining = vm->byteCode.instructionCount - vm->currentPosition;
+            vm->currentPosition += unpackInstruction(&vm->byteCode.instructions[vm->currentPosition], remaining, &instruction);
+        }
+        else
+        {
+            unpackInstruction(0, &instruction);
+        }
+
+        const uint32_t nextPosition = vm->currentPosition;
+        executeInstruction(vm, &instruction);
+
+#if PHOTON_TRACE_ENABLED
+        if(vm->traceBuffer) traceCheckedInstruction(vm, position);
+#endif // PHOTON_TRACE_ENABLED
+#if PHOTON_PROFILE_ENABLED
+        if(vm->profile) profileInstruction(vm->profile, position);
+#endif // PHOTON_PROFILE_ENABLED
+
+#if PHOTON_DEBUG_CALLBACK_ENABLED
+        if(vm->debugCallback) vm->debugCallback(&instruction, vm->registers);
+#endif // PHOTON_DEBUG_CALLBACK_ENABLED
+
+        if(vm->isSuspended)
+            return false;
+        if(--budget <= 0 && !vm->isHalted && vm->currentPosition != nextPosition)
+            return false;
+    }
+
+    return true;
+}
+
+/** Execute the instruction at the specified position using the checked instruction handlers.
+ * This is the slow path of the decoded execution for faults and instructions that need runtime validation. */
+static void executeCheckedInstruction(VirtualMachine* vm, uint32_t position)
+{
+    MappedInstruction instruction;
+    vm->currentPosition = position + unpackInstruction(&vm->byteCode.instructions[position], vm->byteCode.instructionCount - position, &instruction);
+    executeInstruction(vm, &instruction);
+}
+
+#if PHOTON_DEBUG_CALLBACK_ENABLED
+/** Call the debug callback of the VM with the raw instruction at the specified position. */
+static void invokeDebugCallback(VirtualMachine* vm, uint32_t position)
+{
+    if(vm->debugCallback)
+    {
+        MappedInstruction instruction;
+        if(position < vm->byteCode.instructionCount)
+            unpackInstruction(&vm->byteCode.instructions[position], vm->byteCode.instructionCount - position, &instruction);
+        else
+            unpackInstruction(0, &instruction);
+        vm->debugCallback(&instruction, vm->registers);
+    }
+}
+#endif // PHOTON_DEBUG_CALLBACK_ENABLED
+
+/* Helper macros that define the instruction loop of the decoded execution. Operations are written once and get expanded
+ * to either a computed goto dispatch (threaded) or a single switch statement, depending on PHOTON_DISPATCH. */
+#if PHOTON_DISPATCH_IS_THREADED
+    #define PHOTON_OPERATION(name) operation##name:
+    #define PHOTON_FETCH() \
+        instruction = &instructions[position]; \
+        ++position; \
+        goto *dispatchTable[instruction->op]
+    #define PHOTON_DISPATCH_BEGIN() PHOTON_FETCH();
+    #define PHOTON_DISPATCH_END()
+    #define PHOTON_DISPATCH_RESUME() PHOTON_FETCH();
+#else
+    #define PHOTON_OPERATION(name) case DecodedOp##name:
+    #define PHOTON_FETCH() continue
+    #define PHOTON_DISPATCH_BEGIN() \
+        for(;;) \
+        { \
+            instruction = &instructions[position]; \
+            ++position; \
+            switch(instruction->op) \
+            {
+    #define PHOTON_DISPATCH_END() \
+            default: \
+                break; \
+            }
+    #define PHOTON_DISPATCH_RESUME() \
+        }
+#endif // PHOTON_DISPATCH_IS_THREADED
+
+#if PHOTON_TRACE_ENABLED
+    #define PHOTON_RECORD_INSTRUCTION(traced) \
+        if(traceBuffer) traceInstruction(traceBuffer, static_cast<uint32_t>((traced) - instructions), (traced), registers[(traced)->destReg])
+    #define PHOTON_RECORD_FUSED(originalOp) \
+        if(traceBuffer) \
+        { \
+            DecodedInstruction original = *instruction; \
+            original.op = (originalOp); \
+            traceInstruction(traceBuffer, static_cast<uint32_t>(instruction - instructions), &original, registers[original.destReg]); \
+        }
+#else
+    #define PHOTON_RECORD_INSTRUCTION(traced)
+    #define PHOTON_RECORD_FUSED(originalOp)
+#endif // PHOTON_TRACE_ENABLED
+#if PHOTON_PROFILE_ENABLED
+    #define PHOTON_PROFILE_INSTRUCTION(profiled) \
+        if(profile) profileInstruction(profile, static_cast<uint32_t>((profiled) - instructions))
+#else
+    #define PHOTON_PROFILE_INSTRUCTION(profiled)
+#endif // PHOTON_PROFILE_ENABLED
+/* Record an executed instruction in the trace buffer and the profile. Fused operations report every instruction they execute. */
+#define PHOTON_TRACE_INSTRUCTION(traced) \
+    PHOTON_RECORD_INSTRUCTION(traced); \
+    PHOTON_PROFILE_INSTRUCTION(traced)
+#define PHOTON_TRACE_FUSED(originalOp) \
+    PHOTON_RECORD_FUSED(originalOp); \
+    PHOTON_PROFILE_INSTRUCTION(instruction)
+#define PHOTON_TRACE() PHOTON_TRACE_INSTRUCTION(instruction)
+
+/* Take a jump to the specified target. Position must point behind the jump, so the instructions from the start of the
+ * current basic block up to and including the jump are charged to the budget. */
+#define PHOTON_JUMP(target) \
+    { \
+        budget -= position - blockStart; \
+        position = blockStart = (target); \
+        if(budget <= 0) \
+            goto exhausted; \
+    }
+
+/* Second and third instruction of the fused compare, multiply and jump operations. */
+#define PHOTON_FUSED_MUL_JUMP() \
+    { \
+        const DecodedInstruction* multiply = instruction + 1; \
+        const DecodedInstruction* jump = instruction + 2; \
+        registers[multiply->destReg] = registers[multiply->argRegA] * registers[multiply->argRegB]; \
+        PHOTON_TRACE_INSTRUCTION(multiply); \
+        PHOTON_TRACE_INSTRUCTION(jump); \
+        position += 2; \
+        int32_t jumpOffset = registers[jump->destReg]; \
+        if(jumpOffset != 0) \
+        { \
+            if(jump->op == DecodedOpJumpResolved) \
+            { \
+                PHOTON_JUMP(static_cast<uint32_t>(jump->value)); \
+            } \
+            else \
+            { \
+                uint32_t newPosition = position + jumpOffset - 1; \
+                if(newPosition >= instructionCount) \
+                    goto checked; \
+                PHOTON_JUMP(newPosition); \
+            } \
+        } \
+        PHOTON_FETCH(); \
+    }
+
+/* Jump with a resolved target as the last instruction of a fused operation. */
+#define PHOTON_FUSED_RESOLVED_JUMP(jump) \
+    { \
+        PHOTON_TRACE_INSTRUCTION(jump); \
+        position = static_cast<uint32_t>((jump) - instructions) + 1; \
+        if((jump)->op == DecodedOpJumpDirect || registers[(jump)->destReg] != 0) \
+            PHOTON_JUMP(static_cast<uint32_t>((jump)->value)); \
+        PHOTON_FETCH(); \
+    }
+
+#if PHOTON_DEBUG_CALLBACK_ENABLED
+    #define PHOTON_REPORT() \
+        PHOTON_TRACE(); \
+        invokeDebugCallback(vm, static_cast<uint32_t>(instruction - instructions))
+#else
+    #define PHOTON_REPORT() \
+        PHOTON_TRACE()
+#endif // PHOTON_DEBUG_CALLBACK_ENABLED
+#define PHOTON_NEXT() \
+    PHOTON_REPORT(); \
+    PHOTON_FETCH()
+/* Skip the immediate words of a wide instruction. The budget only charges the wide instruction once. */
+#define PHOTON_NEXT_WIDE() \
+    position += WideInstructionSize - 1; \
+    blockStart += WideInstructionSize - 1; \
+    PHOTON_NEXT()
+
+/** Execute the pre-decoded instruction stream of the VM. Operands of decoded instructions are known to be valid, so
+ * only jumps, divisions and host calls need to be checked at runtime. Any fault is handed to the checked handlers.
+ * \param	budget	Number of instructions that may be executed before the VM is stopped. The budget is only checked when a jump is taken.
+ * \return	Returns <b>false</b> if the budget got used up or a Host-Call suspended the VM before it halted. */
+static bool executeDecodedByteCode(VirtualMachine* vm, int64_t budget = INT64_MAX)
+{
+#if PHOTON_DISPATCH_IS_THREADED
+    // Must be in the same order as the DecodedOp enumeration.
+    static const void* const dispatchTable[DecodedOpCount] =
+    {
+        &&operationHalt,
+        &&operationSet,
+        &&operationCopy,
+        &&operationAdd,
+        &&operationSub,
+        &&operationMul,
+        &&operationDiv,
+        &&operationInv,
+        &&operationEql,
+        &&operationNeq,
+        &&operationGrt,
+        &&operationLet,
+        &&operationJumpRelative,
+        &&operationJumpAbsolute,
+        &&operationCallHost,
+        &&operationJumpResolved,
+        &&operationJumpDirect,
+        &&operationSetWide,
+        &&operationAddImmediate,
+        &&operationSubImmediate,
+        &&operationMulImmediate,
+        &&operationDivImmediate,
+        &&operationEqlImmediate,
+        &&operationNeqImmediate,
+        &&operationGrtImmediate,
+        &&operationLetImmediate,
+        &&operationEqlMulJump,
+        &&operationNeqMulJump,
+        &&operationGrtMulJump,
+        &&operationLetMulJump,
+        &&operationSetJump,
+        &&operationSetInvJump,
+        &&operationSetAdd,
+        &&operationSetSub,
+        &&checked,
+    };
+#endif // PHOTON_DISPATCH_IS_THREADED
+
+    const DecodedInstruction* instructions = vm->decodedByteCode.instructions;
+    const DecodedInstruction* instruction = instructions;
+    const uint32_t instructionCount = vm->decodedByteCode.instructionCount;
+    RegisterType* registers = vm->registers;
+#if PHOTON_TRACE_ENABLED
+    TraceBuffer* traceBuffer = vm->traceBuffer;
+#endif // PHOTON_TRACE_ENABLED
+#if PHOTON_PROFILE_ENABLED
+    Profile* profile = vm->profile;
+    if(profile) profile->timestamp = readCycleCounter();
+#endif // PHOTON_PROFILE_ENABLED
+
+    // Positions past the end execute the trailing halt instruction.
+    uint32_t position = (vm->currentPosition < instructionCount) ? vm->currentPosition : instructionCount;
+    // First instruction of the current basic block.
+    uint32_t blockStart = position;
+
+    PHOTON_DISPATCH_BEGIN()
+        PHOTON_OPERATION(Set)
+        {
+            registers[instruction->destReg] = instruction->value;
+            PHOTON_NEXT();
+        }
+        PHOTON_OPERATION(Copy)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA];
+            PHOTON_NEXT();
+        }
+        PHOTON_OPERATION(Add)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] + registers[instruction->argRegB];
+            PHOTON_NEXT();
+        }
+        PHOTON_OPERATION(Sub)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] - registers[instruction->argRegB];
+            PHOTON_NEXT();
+        }
+        PHOTON_OPERATION(Mul)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] * registers[instruction->argRegB];
+            PHOTON_NEXT();
+        }
+        PHOTON_OPERATION(Div)
+        {
+            RegisterType regB = registers[instruction->argRegB];
+            if(regB == 0)
+                goto checked;
+            registers[instruction->destReg] = divideRegister(registers[instruction->argRegA], regB);
+            PHOTON_NEXT();
+        }
+        PHOTON_OPERATION(Inv)
+        {
+            registers[instruction->destReg] = -registers[instruction->destReg];
+            PHOTON_NEXT();
+        }
+        PHOTON_OPERATION(Eql)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] == registers[instruction->argRegB];
+            PHOTON_NEXT();
+        }
+        PHOTON_OPERATION(Neq)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] != registers[instruction->argRegB];
+            PHOTON_NEXT();
+        }
+        PHOTON_OPERATION(Grt)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] > registers[instruction->argRegB];
+            PHOTON_NEXT();
+        }
+        PHOTON_OPERATION(Let)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] < registers[instruction->argRegB];
+            PHOTON_NEXT();
+        }
+        PHOTON_OPERATION(JumpRelative)
+        {
+            int32_t jumpOffset = registers[instruction->destReg];
+            if(jumpOffset != 0)
+            {
+                // Relative to the jump instruction, see jumpTo.
+                uint32_t newPosition = position + jumpOffset - 1;
+                if(newPosition >= instructionCount)
+                    goto checked;
+                PHOTON_REPORT();
+                PHOTON_JUMP(newPosition);
+                PHOTON_FETCH();
+            }
+            PHOTON_NEXT();
+        }
+        PHOTON_OPERATION(JumpAbsolute)
+        {
+            uint32_t newPosition = registers[instruction->destReg];
+            if(newPosition >= instructionCount)
+                goto checked;
+            PHOTON_REPORT();
+            PHOTON_JUMP(newPosition);
+            PHOTON_FETCH();
+        }
+        PHOTON_OPERATION(JumpResolved)
+        {
+            PHOTON_REPORT();
+            if(registers[instruction->destReg] != 0)
+                PHOTON_JUMP(static_cast<uint32_t>(instruction->value));
+            PHOTON_FETCH();
+        }
+        PHOTON_OPERATION(JumpDirect)
+        {
+            PHOTON_REPORT();
+            PHOTON_JUMP(static_cast<uint32_t>(instruction->value));
+            PHOTON_FETCH();
+        }
+        PHOTON_OPERATION(SetWide)
+        {
+            registers[instruction->destReg] = instruction->value;
+            PHOTON_NEXT_WIDE();
+        }
+        PHOTON_OPERATION(AddImmediate)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] + instruction->value;
+            PHOTON_NEXT_WIDE();
+        }
+        PHOTON_OPERATION(SubImmediate)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] - instruction->value;
+            PHOTON_NEXT_WIDE();
+        }
+        PHOTON_OPERATION(MulImmediate)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] * instruction->value;
+            PHOTON_NEXT_WIDE();
+        }
+        PHOTON_OPERATION(DivImmediate)
+        {
+            registers[instruction->destReg] = divideRegister(registers[instruction->argRegA], instruction->value);
+            PHOTON_NEXT_WIDE();
+        }
+        PHOTON_OPERATION(EqlImmediate)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] == instruction->value;
+            PHOTON_NEXT_WIDE();
+        }
+        PHOTON_OPERATION(NeqImmediate)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] != instruction->value;
+            PHOTON_NEXT_WIDE();
+        }
+        PHOTON_OPERATION(GrtImmediate)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] > instruction->value;
+            PHOTON_NEXT_WIDE();
+        }
+        PHOTON_OPERATION(LetImmediate)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] < instruction->value;
+            PHOTON_NEXT_WIDE();
+        }
+        PHOTON_OPERATION(EqlMulJump)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] == registers[instruction->argRegB];
+            PHOTON_TRACE_FUSED(DecodedOpEql);
+            PHOTON_FUSED_MUL_JUMP();
+        }
+        PHOTON_OPERATION(NeqMulJump)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] != registers[instruction->argRegB];
+            PHOTON_TRACE_FUSED(DecodedOpNeq);
+            PHOTON_FUSED_MUL_JUMP();
+        }
+        PHOTON_OPERATION(GrtMulJump)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] > registers[instruction->argRegB];
+            PHOTON_TRACE_FUSED(DecodedOpGrt);
+            PHOTON_FUSED_MUL_JUMP();
+        }
+        PHOTON_OPERATION(LetMulJump)
+        {
+            registers[instruction->destReg] = registers[instruction->argRegA] < registers[instruction->argRegB];
+            PHOTON_TRACE_FUSED(DecodedOpLet);
+            PHOTON_FUSED_MUL_JUMP();
+        }
+        PHOTON_OPERATION(SetJump)
+        {
+            registers[instruction->destReg] = instruction->value;
+            PHOTON_TRACE_FUSED(DecodedOpSet);
+            PHOTON_FUSED_RESOLVED_JUMP(instruction + 1);
+        }
+        PHOTON_OPERATION(SetInvJump)
+        {
+            const DecodedInstruction* invert = instruction + 1;
+            registers[instruction->destReg] = instruction->value;
+            PHOTON_TRACE_FUSED(DecodedOpSet);
+            registers[invert->destReg] = -registers[invert->destReg];
+            PHOTON_TRACE_INSTRUCTION(invert);
+            PHOTON_FUSED_RESOLVED_JUMP(instruction + 2);
+        }
+        PHOTON_OPERATION(SetAdd)
+        {
+            const DecodedInstruction* add = instruction + 1;
+            registers[instruction->destReg] = instruction->value;
+            PHOTON_TRACE_FUSED(DecodedOpSet);
+            registers[add->destReg] = registers[add->argRegA] + registers[add->argRegB];
+            PHOTON_TRACE_INSTRUCTION(add);
+            position += 1;
+            PHOTON_FETCH();
+        }
+        PHOTON_OPERATION(SetSub)
+        {
+            const DecodedInstruction* subtract = instruction + 1;
+            registers[instruction->destReg] = instruction->value;
+            PHOTON_TRACE_FUSED(DecodedOpSet);
+            registers[subtract->destReg] = registers[subtract->argRegA] - registers[subtract->argRegB];
+            PHOTON_TRACE_INSTRUCTION(subtract);
+            position += 1;
+            PHOTON_FETCH();
+        }
+        PHOTON_OPERATION(CallHost)
+        {
+            const uint32_t id = static_cast<uint32_t>(instruction->value);
+            const HostCallStatus status = invokeHostCall(vm, getHostCallEntry(vm->hostCallTable, id), id);
+            if(status != HostCallContinue)
+            {
+                if(status == HostCallNotFound)
+                    goto checked;
+                vm->currentPosition = position;
+                stopHostCall(vm, status, id);
+                PHOTON_TRACE();
+#if PHOTON_DEBUG_CALLBACK_ENABLED
+                invokeDebugCallback(vm, static_cast<uint32_t>(instruction - instructions));
+#endif // PHOTON_DEBUG_CALLBACK_ENABLED
+                return !vm->isSuspended;
+            }
+            PHOTON_NEXT();
+        }
+        PHOTON_OPERATION(Halt)
+        {
+            vm->currentPosition = (position <= instructionCount) ? position : instructionCount;
+            instructionHalt(vm, static_cast<VMExitCode>(instruction->value));
+            PHOTON_TRACE();
+#if PHOTON_DEBUG_CALLBACK_ENABLED
+            invokeDebugCallback(vm, static_cast<uint32_t>(instruction - instructions));
+#endif // PHOTON_DEBUG_CALLBACK_ENABLED
+            return true;
+        }
+    PHOTON_DISPATCH_END()
+
+checked:
+    // Slow path for faults and instructions that need to be validated at runtime.
+    executeCheckedInstruction(vm, position - 1);
+#if PHOTON_TRACE_ENABLED
+    if(traceBuffer) traceCheckedInstruction(vm, position - 1);
+#endif // PHOTON_TRACE_ENABLED
+#if PHOTON_PROFILE_ENABLED
+    if(profile) profileInstruction(profile, position - 1);
+#endif // PHOTON_PROFILE_ENABLED
+#if PHOTON_DEBUG_CALLBACK_ENABLED
+    invokeDebugCallback(vm, position - 1);
+#endif // PHOTON_DEBUG_CALLBACK_ENABLED
+    if(vm->isHalted)
+        return true;
+    if(vm->isSuspended)
+        return false;
+    // The checked instruction may have jumped, so it always ends the basic block.
+    PHOTON_JUMP(vm->currentPosition);
+    PHOTON_DISPATCH_RESUME()
+
+exhausted:
+    vm->currentPosition = position;
+    return false;
+}
+
+#undef PHOTON_OPERATION
+#undef PHOTON_FETCH
+#undef PHOTON_NEXT
+#undef PHOTON_NEXT_WIDE
+#undef PHOTON_REPORT
+#undef PHOTON_TRACE
+#undef PHOTON_TRACE_INSTRUCTION
+#undef PHOTON_TRACE_FUSED
+#undef PHOTON_RECORD_INSTRUCTION
+#undef PHOTON_RECORD_FUSED
+#undef PHOTON_PROFILE_INSTRUCTION
+#undef PHOTON_FUSED_MUL_JUMP
+#undef PHOTON_FUSED_RESOLVED_JUMP
+#undef PHOTON_JUMP
+#undef PHOTON_DISPATCH_BEGIN
+#undef PHOTON_DISPATCH_END
+#undef PHOTON_DISPATCH_RESUME
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * 
+ *--------------------------------------------------------------------------------------------------------------*/  
+
+PHO_DECL VirtualMachine createVirtualMachine(ByteCode byteCode, VerbosityLevel verbosity)
+{
+    VirtualMachine vm = {};
+    vm.isHalted = true;
+    vm.byteCode = byteCode;
+    vm.verbosityLevel = verbosity;
+    decodeByteCode(&byteCode, &vm.decodedByteCode);
+
+    return vm;
+}
+
+PHO_DECL void releaseVirtualMachine(VirtualMachine* vm)
+{
+    if(vm)
+    {
+        setHostCallTable(vm, nullptr);
+        if(vm->isForked)
+            return; // The decoded byte-code and the native code belong to the VM that was forked.
+
+        releaseDecodedByteCode(&vm->decodedByteCode);
+#if PHOTON_JIT_IS_SUPPORTED
+        releaseJitCode(&vm->jitCode);
+#endif // PHOTON_JIT_IS_SUPPORTED
+    }
+}
+
+PHO_DECL VMExitCode run(VirtualMachine* vm)
+{
+    if(!vm) return ExitCodeHaltRequested;
+
+    vm->isHalted = false;
+    vm->isSuspended = false;
+    vm->exitCode = ExitCodeSuccess;
+    memset(&vm->registers, 0, sizeof(vm->registers));
+
+    if(vm->decodedByteCode.instructions)
+        executeDecodedByteCode(vm);
+    else
+        executeByteCode(vm);
+
+    return (vm->exitCode);
+}
+
+PHO_DECL VMExitCode runFor(VirtualMachine* vm, uint32_t maxInstructions)
+{
+    if(!vm) return ExitCodeHaltRequested;
+
+    vm->isHalted = false;
+    vm->isSuspended = false;
+    vm->exitCode = ExitCodeSuccess;
+    vm->currentPosition = 0;
+    memset(&vm->registers, 0, sizeof(vm->registers));
+
+    return resume(vm, maxInstructions);
+}
+
+PHO_DECL VMExitCode resume(VirtualMachine* vm, uint32_t maxInstructions)
+{
+    if(!vm) return ExitCodeHaltRequested;
+    if(vm->isHalted || vm->isSuspended) return vm->exitCode;
+
+    // A VM that got stopped or suspended is not halted and its exit code is still ExitCodeSuccess, see isHalted.
+    if(vm->decodedByteCode.instructions)
+        executeDecodedByteCode(vm, maxInstructions);
+    else
+        executeByteCode(vm, maxInstructions);
+
+    return (vm->exitCode);
+}
+
+PHO_DECL bool completeHostCall(VirtualMachine* vm)
+{
+    if(!vm || !vm->isSuspended)
+        return false;
+
+    vm->isSuspended = false;
+    return true;
+}
+
+PHO_DECL void setDebugCallback(VirtualMachine* vm, fDebugCallback* callback)
+{
+#if PHOTON_DEBUG_CALLBACK_ENABLED
+    vm->debugCallback = callback;
+#endif // PHOTON_DEBUG_CALLBACK_ENABLED
+}
+
+PHO_DECL void setTraceBuffer(VirtualMachine* vm, TraceBuffer* buffer)
+{
+#if PHOTON_TRACE_ENABLED
+    vm->traceBuffer = buffer;
+#else
+    (void)vm;
+    (void)buffer;
+#endif // PHOTON_TRACE_ENABLED
+}
+
+PHO_DECL void setProfile(VirtualMachine* vm, Profile* profile)
+{
+#if PHOTON_PROFILE_ENABLED
+    vm->profile = profile;
+#else
+    (void)vm;
+    (void)profile;
+#endif // PHOTON_PROFILE_ENABLED
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Snapshots
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Get the checksum of the byte-code of a VM. The checksum of the decoded byte-code is used if available. */
+static uint32_t getByteCodeChecksum(const VirtualMachine* vm)
+{
+    if(vm->decodedByteCode.memory)
+        return vm->decodedByteCode.checksum;
+    if(!isByteCodeValid(&vm->byteCode))
+        return HashSeed;
+    return hashBytes(vm->byteCode.instructions, sizeof(RawInstruction) * vm->byteCode.instructionCount, HashSeed);
+}
+
+PHO_DECL uint32_t saveSnapshot(const VirtualMachine* vm, void* buffer, uint32_t bufferSize)
+{
+    if(!vm || !buffer || bufferSize < sizeof(Snapshot))
+        return 0;
+
+    Snapshot snapshot = {};
+    snapshot.magic            = SnapshotMagic;
+    snapshot.version          = PHOTON_VM_VERSION;
+    snapshot.byteCodeChecksum = getByteCodeChecksum(vm);
+    snapshot.currentPosition  = vm->currentPosition;
+    snapshot.flags            = (vm->isHalted ? SnapshotFlagHalted : 0) | (vm->isSuspended ? SnapshotFlagSuspended : 0);
+    snapshot.exitCode         = vm->exitCode;
+    memcpy(snapshot.registers, vm->registers, sizeof(snapshot.registers));
+
+    // The buffer does not need to be aligned.
+    memcpy(buffer, &snapshot, sizeof(snapshot));
+    return sizeof(snapshot);
+}
+
+PHO_DECL SnapshotResult restoreSnapshot(VirtualMachine* vm, const void* buffer, uint32_t bufferSize)
+{
+    if(!vm || !buffer || bufferSize < sizeof(Snapshot))
+        return SnapshotInvalid;
+
+    Snapshot snapshot;
+    memcpy(&snapshot, buffer, sizeof(snapshot));
+    if(snapshot.magic != SnapshotMagic || (snapshot.flags & ~(SnapshotFlagHalted | SnapshotFlagSuspended)))
+        return SnapshotInvalid;
+    if(snapshot.version != PHOTON_VM_VERSION)
+        return SnapshotVersionMismatch;
+    if(snapshot.byteCodeChecksum != getByteCodeChecksum(vm) || snapshot.currentPosition > vm->byteCode.instructionCount)
+        return SnapshotByteCodeMismatch;
+
+    vm->currentPosition = snapshot.currentPosition;
+    vm->isHalted        = (snapshot.flags & SnapshotFlagHalted) != 0;
+    vm->isSuspended     = (snapshot.flags & SnapshotFlagSuspended) != 0;
+    vm->exitCode        = snapshot.exitCode;
+    memcpy(vm->registers, snapshot.registers, sizeof(vm->registers));
+    return SnapshotSuccess;
+}
+
+PHO_DECL VirtualMachine forkVirtualMachine(const VirtualMachine* vm)
+{
+    VirtualMachine fork = *vm;
+    fork.isForked = true;
+    // A private Host-Call table stays owned by the original VM, registerHostCall on the fork creates its own copy.
+    fork.isHostCallTableOwned = false;
+#if PHOTON_TRACE_ENABLED
+    fork.traceBuffer = nullptr;
+#endif // PHOTON_TRACE_ENABLED
+#if PHOTON_PROFILE_ENABLED
+    fork.profile = nullptr;
+#endif // PHOTON_PROFILE_ENABLED
+    return fork;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Native Code Generation
+ *--------------------------------------------------------------------------------------------------------------*/
+
+#if PHOTON_JIT_IS_SUPPORTED
+/* The generated code keeps the VM registers in memory and addresses them with rbx, so host calls and the checked
+ * handlers always see the current register values. The code is entered with:
+ *     rdi = registers, rsi = groups of the Host-Call table, rdx = jump table, rcx = address of the first instruction to execute.
+ * It returns the position in the upper 32 bits and the exit code or JitResultChecked in the lower 32 bits. */
+
+/** Signature of the generated code. */
+typedef uint64_t (fJitEntry)(RegisterType* registers, const HostCallEntry* const* hostCallGroups, const void* const* jumpTable, const void* start);
+
+/** Flag of a native result that requests the instruction at the returned position to be executed by the checked handlers. */
+const uint64_t JitResultChecked = 0x100;
+/** Maximum number of bytes that are generated for a single instruction, including its fault handler and a jump to the next instruction. */
+const size_t JitMaxInstructionSize = 64;
+/** Number of bytes that are reserved for the entry and exit code. */
+const size_t JitEntrySize = 64;
+
+/** Buffer that receives the generated machine code. */
+struct JitAssembler
+{
+    uint8_t* code;
+    uint32_t size;
+};
+
+inline void emit8(JitAssembler* assembler, uint8_t value)
+{
+    assembler->code[assembler->size++] = value;
+}
+
+inline void emit32(JitAssembler* assembler, uint32_t value)
+{
+    memcpy(&assembler->code[assembler->size], &value, sizeof(value));
+    assembler->size += sizeof(value);
+}
+
+inline void emit64(JitAssembler* assembler, uint64_t value)
+{
+    memcpy(&assembler->code[assembler->size], &value, sizeof(value));
+    assembler->size += sizeof(value);
+}
+
+/** Emit an instruction that accesses a VM register: "op reg, [rbx + registerIndex * 4]". */
+inline void emitRegisterAccess(JitAssembler* assembler, uint8_t opCode, uint8_t reg, uint8_t registerIndex)
+{
+    emit8(assembler, opCode);
+    emit8(assembler, static_cast<uint8_t>(0x43 | (reg << 3)));
+    emit8(assembler, static_cast<uint8_t>(registerIndex * sizeof(RegisterType)));
+}
+
+/** Emit a jump with a 32-bit displacement and return the offset of the displacement so it can be patched later.
+ * \param	condition	Condition code of the jump or 0 for an unconditional jump. */
+inline uint32_t emitJump(JitAssembler* assembler, uint8_t condition)
+{
+    if(condition)
+    {
+        emit8(assembler, 0x0F);
+        emit8(assembler, condition);
+    }
+    else
+    {
+        emit8(assembler, 0xE9);
+    }
+
+    uint32_t location = assembler->size;
+    emit32(assembler, 0);
+    return location;
+}
+
+/** Patch the displacement of a jump that was emitted by emitJump. */
+inline void patchJump(JitAssembler* assembler, uint32_t location, uint32_t target)
+{
+    uint32_t displacement = target - (location + 4);
+    memcpy(&assembler->code[location], &displacement, sizeof(displacement));
+}
+
+/** Emit code that leaves the native code with the specified result. */
+inline void emitExit(JitAssembler* assembler, uint32_t exitOffset, uint64_t result)
+{
+    emit8(assembler, 0x48); emit8(assembler, 0xB8); emit64(assembler, result); // mov rax, result
+    patchJump(assembler, emitJump(assembler, 0), exitOffset);
+}
+
+/** Generate the native code of a single decoded instruction.
+ * \param	labelFixup	Receives the location of a jump to another instruction or 0.
+ * \param	faultFixup	Receives the location of a jump to the fault handler of the instruction or 0. */
+static void generateInstruction(JitAssembler* assembler, const DecodedInstruction* instruction, uint32_t position, uint32_t instructionCount,
+                                uint32_t exitOffset, uint32_t* labelFixup, uint32_t* faultFixup)
+{
+    const uint8_t registerEax = 0, registerEcx = 1;
+    const uint8_t movLoad = 0x8B, movStore = 0x89;
+    const uint8_t destReg = instruction->destReg, argRegA = instruction->argRegA, argRegB = instruction->argRegB;
+    const uint8_t op = getUnfusedOperation(instruction->op);
+
+    *labelFixup = 0;
+    *faultFixup = 0;
+
+    switch(op)
+    {
+    case DecodedOpSet:
+    case DecodedOpSetWide:
+    {
+        emit8(assembler, 0xC7); emit8(assembler, 0x43); emit8(assembler, static_cast<uint8_t>(destReg * sizeof(RegisterType))); // mov dword [rbx + dest], value
+        emit32(assembler, static_cast<uint32_t>(instruction->value));
+    } break;
+    case DecodedOpAddImmediate:
+    case DecodedOpSubImmediate:
+    case DecodedOpMulImmediate:
+    {
+        emitRegisterAccess(assembler, movLoad, registerEax, argRegA);
+        if(op == DecodedOpMulImmediate)
+        {
+            emit8(assembler, 0x69); emit8(assembler, 0xC0); // imul eax, eax, value
+        }
+        else
+        {
+            emit8(assembler, (op == DecodedOpAddImmediate) ? 0x05 : 0x2D); // add/sub eax, value
+        }
+        emit32(assembler, static_cast<uint32_t>(instruction->value));
+        emitRegisterAccess(assembler, movStore, registerEax, destReg);
+    } break;
+    case DecodedOpDivImmediate:
+    {
+        // The divisor is never zero and a divisor of -1 is a negation, see divideRegister.
+        emitRegisterAccess(assembler, movLoad, registerEax, argRegA);
+        if(instruction->value == -1)
+        {
+            emit8(assembler, 0xF7); emit8(assembler, 0xD8); // neg eax
+        }
+        else
+        {
+            emit8(assembler, 0x99);                         // cdq
+            emit8(assembler, 0xB9); emit32(assembler, static_cast<uint32_t>(instruction->value)); // mov ecx, value
+            emit8(assembler, 0xF7); emit8(assembler, 0xF9); // idiv ecx
+        }
+        emitRegisterAccess(assembler, movStore, registerEax, destReg);
+    } break;
+    case DecodedOpEqlImmediate:
+    case DecodedOpNeqImmediate:
+    case DecodedOpGrtImmediate:
+    case DecodedOpLetImmediate:
+    {
+        static const uint8_t conditions[] = { 0x94, 0x95, 0x9F, 0x9C }; // sete, setne, setg, setl
+        emit8(assembler, 0x31); emit8(assembler, 0xC9); // xor ecx, ecx
+        emitRegisterAccess(assembler, movLoad, registerEax, argRegA);
+        emit8(assembler, 0x3D); emit32(assembler, static_cast<uint32_t>(instruction->value)); // cmp eax, value
+        emit8(assembler, 0x0F); emit8(assembler, conditions[op - DecodedOpEqlImmediate]); emit8(assembler, 0xC1); // setcc cl
+        emitRegisterAccess(assembler, movStore, registerEcx, destReg);
+    } break;
+    case DecodedOpCopy:
+    {
+        emitRegisterAccess(assembler, movLoad, registerEax, argRegA);
+        emitRegisterAccess(assembler, movStore, registerEax, destReg);
+    } break;
+    case DecodedOpAdd:
+    case DecodedOpSub:
+    case DecodedOpMul:
+    {
+        emitRegisterAccess(assembler, movLoad, registerEax, argRegA);
+        if(op == DecodedOpMul)
+        {
+            emit8(assembler, 0x0F); // imul eax, [rbx + b]
+            emitRegisterAccess(assembler, 0xAF, registerEax, argRegB);
+        }
+        else
+        {
+            emitRegisterAccess(assembler, (op == DecodedOpAdd) ? 0x03 : 0x2B, registerEax, argRegB); // add/sub eax, [rbx + b]
+        }
+        emitRegisterAccess(assembler, movStore, registerEax, destReg);
+    } break;
+    case DecodedOpDiv:
+    {
+        emitRegisterAccess(assembler, movLoad, registerEcx, argRegB);
+        emit8(assembler, 0x85); emit8(assembler, 0xC9); // test ecx, ecx
+        *faultFixup = emitJump(assembler, 0x84);        // jz fault
+        emitRegisterAccess(assembler, movLoad, registerEax, argRegA);
+        // Dividing by -1 is a negation like in divideRegister, this prevents the hardware exception of INT32_MIN / -1.
+        emit8(assembler, 0x83); emit8(assembler, 0xF9); emit8(assembler, 0xFF); // cmp ecx, -1
+        emit8(assembler, 0x75); emit8(assembler, 0x04); // jne divide
+        emit8(assembler, 0xF7); emit8(assembler, 0xD8); // neg eax
+        emit8(assembler, 0xEB); emit8(assembler, 0x03); // jmp store
+        emit8(assembler, 0x99);                         // divide: cdq
+        emit8(assembler, 0xF7); emit8(assembler, 0xF9); // idiv ecx
+        emitRegisterAccess(assembler, movStore, registerEax, destReg); // store:
+    } break;
+    case DecodedOpInv:
+    {
+        emit8(assembler, 0xF7); emit8(assembler, 0x5B); emit8(assembler, static_cast<uint8_t>(destReg * sizeof(RegisterType))); // neg dword [rbx + dest]
+    } break;
+    case DecodedOpEql:
+    case DecodedOpNeq:
+    case DecodedOpGrt:
+    case DecodedOpLet:
+    {
+        static const uint8_t conditions[] = { 0x94, 0x95, 0x9F, 0x9C }; // sete, setne, setg, setl
+        emit8(assembler, 0x31); emit8(assembler, 0xC9); // xor ecx, ecx
+        emitRegisterAccess(assembler, movLoad, registerEax, argRegA);
+        emitRegisterAccess(assembler, 0x3B, registerEax, argRegB); // cmp eax, [rbx + b]
+        emit8(assembler, 0x0F); emit8(assembler, conditions[op - DecodedOpEql]); emit8(assembler, 0xC1); // setcc cl
+        emitRegisterAccess(assembler, movStore, registerEcx, destReg);
+    } break;
+    case DecodedOpJumpRelative:
+    {
+        // Relative to the jump instruction, see jumpTo. An offset of zero does not jump.
+        emitRegisterAccess(assembler, movLoad, registerEax, destReg);
+        emit8(assembler, 0x85); emit8(assembler, 0xC0);        // test eax, eax
+        *labelFixup = emitJump(assembler, 0x84);               // jz next
+        emit8(assembler, 0x05); emit32(assembler, position);   // add eax, position
+        emit8(assembler, 0x3D); emit32(assembler, instructionCount); // cmp eax, instructionCount
+        *faultFixup = emitJump(assembler, 0x83);               // jae fault
+        emit8(assembler, 0x41); emit8(assembler, 0xFF); emit8(assembler, 0x64); emit8(assembler, 0xC5); emit8(assembler, 0x00); // jmp [r13 + rax * 8]
+    } break;
+    case DecodedOpJumpAbsolute:
+    {
+        emitRegisterAccess(assembler, movLoad, registerEax, destReg);
+        emit8(assembler, 0x3D); emit32(assembler, instructionCount); // cmp eax, instructionCount
+        *faultFixup = emitJump(assembler, 0x83);               // jae fault
+        emit8(assembler, 0x41); emit8(assembler, 0xFF); emit8(assembler, 0x64); emit8(assembler, 0xC5); emit8(assembler, 0x00); // jmp [r13 + rax * 8]
+    } break;
+    case DecodedOpJumpResolved:
+    {
+        emit8(assembler, 0x83); emit8(assembler, 0x7B); emit8(assembler, static_cast<uint8_t>(destReg * sizeof(RegisterType))); emit8(assembler, 0x00); // cmp dword [rbx + dest], 0
+        *labelFixup = emitJump(assembler, 0x85); // jne target
+    } break;
+    case DecodedOpJumpDirect:
+    {
+        *labelFixup = emitJump(assembler, 0); // jmp target
+    } break;
+    case DecodedOpCallHost:
+    {
+        const uint32_t groupId = static_cast<uint32_t>(instruction->value) >> 8, functionId = instruction->value & 0xFF;
+        emit8(assembler, 0x49); emit8(assembler, 0x8B); emit8(assembler, 0x84); emit8(assembler, 0x24); // mov rax, [r12 + groupId * 8]
+        emit32(assembler, static_cast<uint32_t>(groupId * sizeof(const HostCallEntry*)));
+        emit8(assembler, 0x48); emit8(assembler, 0x8B); emit8(assembler, 0x80);                         // mov rax, [rax + functionId * sizeof(HostCallEntry)]
+        emit32(assembler, static_cast<uint32_t>(functionId * sizeof(HostCallEntry)));                   // The callback is the first member of the entry.
+        emit8(assembler, 0x48); emit8(assembler, 0x85); emit8(assembler, 0xC0); // test rax, rax
+        *faultFixup = emitJump(assembler, 0x84);                                // jz fault, callbacks with context are executed by the checked handler
+        emit8(assembler, 0x48); emit8(assembler, 0x89); emit8(assembler, 0xDF); // mov rdi, rbx
+        emit8(assembler, 0xFF); emit8(assembler, 0xD0);                         // call rax
+    } break;
+    case DecodedOpHalt:
+    {
+        emitExit(assembler, exitOffset, (static_cast<uint64_t>(position + 1) << 32) | static_cast<uint8_t>(instruction->value));
+    } break;
+    default:
+    {
+        // Instructions that need runtime validation are always executed by the checked handlers.
+        emitExit(assembler, exitOffset, (static_cast<uint64_t>(position) << 32) | JitResultChecked);
+    } break;
+    }
+}
+
+/** Generate the native code of the decoded byte-code of a VM.
+ * \return	Returns <b>true</b> on success or <b>false</b> if the memory could not be allocated. */
+static bool generateJitCode(const DecodedByteCode* decoded, JitCode* jitCode)
+{
+    const uint32_t instructionCount = decoded->instructionCount;
+    const size_t size = JitEntrySize + (static_cast<size_t>(instructionCount) + 1) * JitMaxInstructionSize;
+
+    void* code = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(code == MAP_FAILED)
+        return false;
+
+    const void** jumpTable = static_cast<const void**>(pho_malloc((instructionCount + 1) * sizeof(void*)));
+    uint32_t* offsets = static_cast<uint32_t*>(pho_malloc((instructionCount + 1) * 4 * sizeof(uint32_t)));
+    if(!jumpTable || !offsets)
+    {
+        munmap(code, size);
+        pho_free(jumpTable);
+        pho_free(offsets);
+        return false;
+    }
+
+    uint32_t* labelOffsets = offsets;
+    uint32_t* labelFixups = offsets + (instructionCount + 1);
+    uint32_t* faultFixups = offsets + (instructionCount + 1) * 2;
+    uint32_t* nextFixups = offsets + (instructionCount + 1) * 3;
+    memset(labelOffsets, 0xFF, (instructionCount + 1) * sizeof(uint32_t));
+
+    JitAssembler assembler = {};
+    assembler.code = static_cast<uint8_t*>(code);
+
+    // Entry: Save the callee-saved registers, this also aligns the stack for host calls.
+    emit8(&assembler, 0x53);                                            // push rbx
+    emit8(&assembler, 0x41); emit8(&assembler, 0x54);                   // push r12
+    emit8(&assembler, 0x41); emit8(&assembler, 0x55);                   // push r13
+    emit8(&assembler, 0x48); emit8(&assembler, 0x89); emit8(&assembler, 0xFB); // mov rbx, rdi
+    emit8(&assembler, 0x49); emit8(&assembler, 0x89); emit8(&assembler, 0xF4); // mov r12, rsi
+    emit8(&assembler, 0x49); emit8(&assembler, 0x89); emit8(&assembler, 0xD5); // mov r13, rdx
+    emit8(&assembler, 0xFF); emit8(&assembler, 0xE1);                   // jmp rcx
+
+    // Exit: The result is already stored in rax.
+    const uint32_t exitOffset = assembler.size;
+    emit8(&assembler, 0x41); emit8(&assembler, 0x5D);                   // pop r13
+    emit8(&assembler, 0x41); emit8(&assembler, 0x5C);                   // pop r12
+    emit8(&assembler, 0x5B);                                            // pop rbx
+    emit8(&assembler, 0xC3);                                            // ret
+
+    // Instructions are generated in the order in which they are read from the start, so each one falls through into the next.
+    for(uint32_t i = 0; i < instructionCount; i += getDecodedInstructionSize(decoded->instructions[i].op))
+    {
+        labelOffsets[i] = assembler.size;
+        generateInstruction(&assembler, &decoded->instructions[i], i, instructionCount, exitOffset, &labelFixups[i], &faultFixups[i]);
+        nextFixups[i] = 0;
+    }
+
+    // Running past the end executes the trailing halt instruction which keeps the position at the end.
+    labelOffsets[instructionCount] = assembler.size;
+    emitExit(&assembler, exitOffset, static_cast<uint64_t>(instructionCount) << 32);
+
+    // The immediate words of wide instructions can only be entered by a jump. They are generated behind everything else
+    // and need an explicit jump to the instruction that follows them.
+    for(uint32_t i = 0; i < instructionCount; ++i)
+    {
+        if(labelOffsets[i] != InvalidPosition)
+            continue;
+        labelOffsets[i] = assembler.size;
+        generateInstruction(&assembler, &decoded->instructions[i], i, instructionCount, exitOffset, &labelFixups[i], &faultFixups[i]);
+        nextFixups[i] = emitJump(&assembler, 0);
+    }
+
+    for(uint32_t i = 0; i < instructionCount; ++i)
+    {
+        if(nextFixups[i])
+            patchJump(&assembler, nextFixups[i], labelOffsets[i + getDecodedInstructionSize(decoded->instructions[i].op)]);
+        if(labelFixups[i])
+        {
+            // Resolved jumps go to the target in value, relative jumps with an offset of zero to the next instruction.
+            const DecodedInstruction* instruction = &decoded->instructions[i];
+            bool isResolved = (instruction->op == DecodedOpJumpResolved || instruction->op == DecodedOpJumpDirect);
+            patchJump(&assembler, labelFixups[i], labelOffsets[isResolved ? static_cast<uint32_t>(instruction->value) : i + 1]);
+        }
+        if(faultFixups[i])
+        {
+            patchJump(&assembler, faultFixups[i], assembler.size);
+            emitExit(&assembler, exitOffset, (static_cast<uint64_t>(i) << 32) | JitResultChecked);
+        }
+    }
+
+    for(uint32_t i = 0; i <= instructionCount; ++i)
+        jumpTable[i] = assembler.code + labelOffsets[i];
+    pho_free(offsets);
+
+    if(mprotect(code, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(code, size);
+        pho_free(jumpTable);
+        return false;
+    }
+
+    jitCode->code = code;
+    jitCode->size = size;
+    jitCode->jumpTable = jumpTable;
+    return true;
+}
+
+/** Release the native code of a VM. */
+static void releaseJitCode(JitCode* jitCode)
+{
+    if(jitCode->code)
+    {
+        munmap(jitCode->code, jitCode->size);
+        pho_free(jitCode->jumpTable);
+        *jitCode = {};
+    }
+}
+
+/** Execute the native code of the VM. Faults and instructions that need runtime validation leave the native code and are
+ * executed by the checked handlers, after which the native code is entered again at the new position. */
+static void executeJitCode(VirtualMachine* vm)
+{
+    const JitCode* jitCode = &vm->jitCode;
+    const uint32_t instructionCount = vm->decodedByteCode.instructionCount;
+    fJitEntry* entry = reinterpret_cast<fJitEntry*>(jitCode->code);
+    const HostCallEntry* const* hostCallGroups = (vm->hostCallTable ? vm->hostCallTable : &EmptyHostCallTable)->groups;
+
+    uint32_t position = (vm->currentPosition < instructionCount) ? vm->currentPosition : instructionCount;
+    for(;;)
+    {
+        uint64_t result = entry(vm->registers, hostCallGroups, jitCode->jumpTable, jitCode->jumpTable[position]);
+        uint32_t resultPosition = static_cast<uint32_t>(result >> 32);
+
+        if(result & JitResultChecked)
+        {
+            executeCheckedInstruction(vm, resultPosition);
+            if(vm->isHalted || vm->isSuspended)
+                return;
+            position = (vm->currentPosition < instructionCount) ? vm->currentPosition : instructionCount;
+        }
+        else
+        {
+            vm->currentPosition = resultPosition;
+            instructionHalt(vm, static_cast<VMExitCode>(result & 0xFF));
+            return;
+        }
+    }
+}
+#endif // PHOTON_JIT_IS_SUPPORTED
+
+PHO_DECL VirtualMachine createJitVirtualMachine(ByteCode byteCode, VerbosityLevel verbosity)
+{
+    VirtualMachine vm = createVirtualMachine(byteCode, verbosity);
+#if PHOTON_JIT_IS_SUPPORTED
+    if(vm.decodedByteCode.instructions && !generateJitCode(&vm.decodedByteCode, &vm.jitCode))
+    {
+        printMessage(&vm, VerbosityLevelWarning, "Failed to generate native code, the VM will use the interpreter instead.\n");
+    }
+#endif // PHOTON_JIT_IS_SUPPORTED
+
+    return vm;
+}
+
+PHO_DECL VMExitCode runJit(VirtualMachine* vm)
+{
+#if PHOTON_JIT_IS_SUPPORTED
+    if(!vm) return ExitCodeHaltRequested;
+
+    bool isNativeCodeUsable = (vm->jitCode.code != nullptr);
+#if PHOTON_DEBUG_CALLBACK_ENABLED
+    isNativeCodeUsable = isNativeCodeUsable && !vm->debugCallback;
+#endif // PHOTON_DEBUG_CALLBACK_ENABLED
+#if PHOTON_TRACE_ENABLED
+    isNativeCodeUsable = isNativeCodeUsable && !vm->traceBuffer;
+#endif // PHOTON_TRACE_ENABLED
+#if PHOTON_PROFILE_ENABLED
+    isNativeCodeUsable = isNativeCodeUsable && !vm->profile;
+#endif // PHOTON_PROFILE_ENABLED
+
+    if(isNativeCodeUsable)
+    {
+        vm->isHalted = false;
+        vm->isSuspended = false;
+        vm->exitCode = ExitCodeSuccess;
+        memset(&vm->registers, 0, sizeof(vm->registers));
+
+        executeJitCode(vm);
+        return (vm->exitCode);
+    }
+#endif // PHOTON_JIT_IS_SUPPORTED
+
+    return run(vm);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Programs and Instances
+ *--------------------------------------------------------------------------------------------------------------*/
+
+PHO_DECL bool createProgram(ByteCode byteCode, Program* program, VerbosityLevel verbosity)
+{
+    *program = {};
+    program->byteCode = byteCode;
+    program->verbosityLevel = verbosity;
+    return decodeByteCode(&byteCode, &program->decodedByteCode);
+}
+
+PHO_DECL bool createJitProgram(ByteCode byteCode, Program* program, VerbosityLevel verbosity)
+{
+    if(!createProgram(byteCode, program, verbosity))
+        return false;
+
+#if PHOTON_JIT_IS_SUPPORTED
+    if(!generateJitCode(&program->decodedByteCode, &program->jitCode) && (verbosity & VerbosityLevelWarning))
+    {
+        printf("Failed to generate native code, the program will use the interpreter instead.\n");
+    }
+#endif // PHOTON_JIT_IS_SUPPORTED
+    return true;
+}
+
+PHO_DECL void releaseProgram(Program* program)
+{
+    if(program)
+    {
+        releaseDecodedByteCode(&program->decodedByteCode);
+#if PHOTON_JIT_IS_SUPPORTED
+        releaseJitCode(&program->jitCode);
+#endif // PHOTON_JIT_IS_SUPPORTED
+    }
+}
+
+PHO_DECL void setProgramHostCallTable(Program* program, const HostCallTable* table)
+{
+    program->hostCallTable = table;
+}
+
+PHO_DECL Instance* createInstances(uint32_t instanceCount)
+{
+    // The address of the allocation is stored in front of the aligned array.
+    const size_t alignment = alignof(Instance);
+    void* memory = pho_malloc(sizeof(void*) + alignment - 1 + static_cast<size_t>(instanceCount) * sizeof(Instance));
+    if(!memory)
+        return nullptr;
+
+    uintptr_t address = (reinterpret_cast<uintptr_t>(memory) + sizeof(void*) + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+    Instance* instances = reinterpret_cast<Instance*>(address);
+    reinterpret_cast<void**>(instances)[-1] = memory;
+    for(uint32_t i = 0; i < instanceCount; ++i)
+        resetInstance(&instances[i]);
+
+    return instances;
+}
+
+PHO_DECL void releaseInstances(Instance* instances)
+{
+    if(instances)
+        pho_free(reinterpret_cast<void**>(instances)[-1]);
+}
+
+PHO_DECL void resetInstance(Instance* instance)
+{
+    *instance = {};
+}
+
+/** Bind a program to a VM that executes its instances. The VM does not own anything and must not be released. */
+static void bindProgram(const Program* program, VirtualMachine* vm)
+{
+    *vm = {};
+    vm->byteCode = program->byteCode;
+    vm->decodedByteCode = program->decodedByteCode;
+    vm->hostCallTable = program->hostCallTable;
+    vm->verbosityLevel = program->verbosityLevel;
+    vm->isForked = true;
+#if PHOTON_JIT_ENABLED
+    vm->jitCode = program->jitCode;
+#endif // PHOTON_JIT_ENABLED
+}
+
+/** Execute a single instance on a VM that got bound to the program of the instance, see bindProgram. */
+static VMExitCode executeInstance(VirtualMachine* vm, Instance* instance, uint32_t maxInstructions)
+{
+    if(instance->isHalted || instance->isSuspended)
+        return instance->exitCode;
+
+    memcpy(vm->registers, instance->registers, sizeof(vm->registers));
+    vm->currentPosition = instance->currentPosition;
+    vm->isHalted = false;
+    vm->isSuspended = false;
+    vm->exitCode = ExitCodeSuccess;
+    vm->hostCallContext = instance;
+
+#if PHOTON_JIT_IS_SUPPORTED
+    if(vm->jitCode.code && maxInstructions == UINT32_MAX)
+        executeJitCode(vm);
+    else
+#endif // PHOTON_JIT_IS_SUPPORTED
+    if(vm->decodedByteCode.instructions)
+        executeDecodedByteCode(vm, maxInstructions);
+    else
+        executeByteCode(vm, maxInstructions);
+
+    memcpy(instance->registers, vm->registers, sizeof(instance->registers));
+    instance->currentPosition = vm->currentPosition;
+    instance->isHalted = vm->isHalted;
+    instance->isSuspended = vm->isSuspended;
+    instance->exitCode = vm->exitCode;
+
+    return (vm->exitCode);
+}
+
+PHO_DECL VMExitCode runInstance(const Program* program, Instance* instance, uint32_t maxInstructions)
+{
+    if(!program || !instance) return ExitCodeHaltRequested;
+
+    VirtualMachine vm;
+    bindProgram(program, &vm);
+    return executeInstance(&vm, instance, maxInstructions);
+}
+
+PHO_DECL void runInstances(const Program* program, Instance* instances, uint32_t instanceCount, uint32_t maxInstructions)
+{
+    if(!program || !instances)
+        return;
+
+    VirtualMachine vm;
+    bindProgram(program, &vm);
+    for(uint32_t i = 0; i < instanceCount; ++i)
+        executeInstance(&vm, &instances[i], maxInstructions);
+}
+
+PHO_DECL bool completeHostCall(Instance* instance)
+{
+    if(!instance || !instance->isSuspended)
+        return false;
+
+    instance->isSuspended = false;
+    return true;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Batch Execution
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/* Vector operations on the registers of all lanes. A lane mask has one bit per lane, bit n is set if lane n is selected.
+ * Compare operations return 1 or 0 for every lane, just like the compare instructions. */
+#if defined(__AVX512F__)
+typedef __m512i LaneVector;
+
+inline LaneVector laneLoad(const RegisterType* values) { return _mm512_load_si512(values); }
+inline void laneStore(RegisterType* values, LaneVector vector) { _mm512_store_si512(values, vector); }
+inline LaneVector laneSplat(RegisterType value) { return _mm512_set1_epi32(value); }
+inline LaneVector laneAdd(LaneVector a, LaneVector b) { return _mm512_add_epi32(a, b); }
+inline LaneVector laneSub(LaneVector a, LaneVector b) { return _mm512_sub_epi32(a, b); }
+inline LaneVector laneMul(LaneVector a, LaneVector b) { return _mm512_mullo_epi32(a, b); }
+inline LaneVector laneEqual(LaneVector a, LaneVector b) { return _mm512_maskz_mov_epi32(_mm512_cmpeq_epi32_mask(a, b), _mm512_set1_epi32(1)); }
+inline LaneVector laneGreater(LaneVector a, LaneVector b) { return _mm512_maskz_mov_epi32(_mm512_cmpgt_epi32_mask(a, b), _mm512_set1_epi32(1)); }
+inline LaneVector laneSelect(uint32_t mask, LaneVector value, LaneVector other) { return _mm512_mask_mov_epi32(other, static_cast<__mmask16>(mask), value); }
+inline uint32_t laneNonZeroMask(LaneVector vector) { return _mm512_test_epi32_mask(vector, vector); }
+#elif defined(__AVX2__)
+typedef __m256i LaneVector;
+
+inline LaneVector laneLoad(const RegisterType* values) { return _mm256_load_si256(reinterpret_cast<const __m256i*>(values)); }
+inline void laneStore(RegisterType* values, LaneVector vector) { _mm256_store_si256(reinterpret_cast<__m256i*>(values), vector); }
+inline LaneVector laneSplat(RegisterType value) { return _mm256_set1_epi32(value); }
+inline LaneVector laneAdd(LaneVector a, LaneVector b) { return _mm256_add_epi32(a, b); }
+inline LaneVector laneSub(LaneVector a, LaneVector b) { return _mm256_sub_epi32(a, b); }
+inline LaneVector laneMul(LaneVector a, LaneVector b) { return _mm256_mullo_epi32(a, b); }
+inline LaneVector laneEqual(LaneVector a, LaneVector b) { return _mm256_srli_epi32(_mm256_cmpeq_epi32(a, b), 31); }
+inline LaneVector laneGreater(LaneVector a, LaneVector b) { return _mm256_srli_epi32(_mm256_cmpgt_epi32(a, b), 31); }
+inline LaneVector laneSelect(uint32_t mask, LaneVector value, LaneVector other)
+{
+    const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i selected = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(static_cast<int32_t>(mask)), bits), bits);
+    return _mm256_blendv_epi8(other, value, selected);
+}
+inline uint32_t laneNonZeroMask(LaneVector vector)
+{
+    __m256i isZero = _mm256_cmpeq_epi32(vector, _mm256_setzero_si256());
+    return ~static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(isZero))) & 0xFFU;
+}
+#elif defined(__GNUC__) || defined(__clang__)
+/** Portable lane vector using the generic vector extension of GCC and Clang. */
+typedef RegisterType LaneVector __attribute__((vector_size(PHOTON_BATCH_LANES * sizeof(RegisterType))));
+
+inline LaneVector laneLoad(const RegisterType* values) { LaneVector result; memcpy(&result, values, sizeof(result)); return result; }
+inline void laneStore(RegisterType* values, LaneVector vector) { memcpy(values, &vector, sizeof(vector)); }
+inline LaneVector laneSplat(RegisterType value) { return LaneVector{} + value; }
+inline LaneVector laneAdd(LaneVector a, LaneVector b) { return a + b; }
+inline LaneVector laneSub(LaneVector a, LaneVector b) { return a - b; }
+inline LaneVector laneMul(LaneVector a, LaneVector b) { return a * b; }
+inline LaneVector laneEqual(LaneVector a, LaneVector b) { return (a == b) & 1; }
+inline LaneVector laneGreater(LaneVector a, LaneVector b) { return (a > b) & 1; }
+inline LaneVector laneSelect(uint32_t mask, LaneVector value, LaneVector other)
+{
+    LaneVector bits;
+    for(uint32_t i = 0; i < PHOTON_BATCH_LANES; ++i)
+        bits[i] = 1 << i;
+    LaneVector selected = ((LaneVector{} + static_cast<RegisterType>(mask)) & bits) != 0;
+    return (value & selected) | (other & ~selected);
+}
+inline uint32_t laneNonZeroMask(LaneVector vector)
+{
+    uint32_t mask = 0;
+    for(uint32_t i = 0; i < PHOTON_BATCH_LANES; ++i)
+        mask |= static_cast<uint32_t>(vector[i] != 0) << i;
+    return mask;
+}
+#else
+/** Portable lane vector. The loops have a fixed length, so they can still be vectorized by the compiler. */
+struct LaneVector
+{
+    RegisterType lanes[PHOTON_BATCH_LANES];
+};
+
+inline LaneVector laneLoad(const RegisterType* values) { LaneVector result; memcpy(result.lanes, values, sizeof(result.lanes)); return result; }
+inline void laneStore(RegisterType* values, LaneVector vector) { memcpy(values, vector.lanes, sizeof(vector.lanes)); }
+inline LaneVector laneSplat(RegisterType value) { LaneVector result; for(uint32_t i = 0; i < PHOTON_BATCH_LANES; ++i) result.lanes[i] = value; return result; }
+inline LaneVector laneAdd(LaneVector a, LaneVector b) { for(uint32_t i = 0; i < PHOTON_BATCH_LANES; ++i) a.lanes[i] = static_cast<RegisterType>(static_cast<uint32_t>(a.lanes[i]) + static_cast<uint32_t>(b.lanes[i])); return a; }
+inline LaneVector laneSub(LaneVector a, LaneVector b) { for(uint32_t i = 0; i < PHOTON_BATCH_LANES; ++i) a.lanes[i] = static_cast<RegisterType>(static_cast<uint32_t>(a.lanes[i]) - static_cast<uint32_t>(b.lanes[i])); return a; }
+inline LaneVector laneMul(LaneVector a, LaneVector b) { for(uint32_t i = 0; i < PHOTON_BATCH_LANES; ++i) a.lanes[i] = static_cast<RegisterType>(static_cast<uint32_t>(a.lanes[i]) * static_cast<uint32_t>(b.lanes[i])); return a; }
+inline LaneVector laneEqual(LaneVector a, LaneVector b) { for(uint32_t i = 0; i < PHOTON_BATCH_LANES; ++i) a.lanes[i] = (a.lanes[i] == b.lanes[i]); return a; }
+inline LaneVector laneGreater(LaneVector a, LaneVector b) { for(uint32_t i = 0; i < PHOTON_BATCH_LANES; ++i) a.lanes[i] = (a.lanes[i] > b.lanes[i]); return a; }
+inline LaneVector laneSelect(uint32_t mask, LaneVector value, LaneVector other)
+{
+    for(uint32_t i = 0; i < PHOTON_BATCH_LANES; ++i)
+    {
+        RegisterType selected = -static_cast<RegisterType>((mask >> i) & 1);
+        other.lanes[i] = (value.lanes[i] & selected) | (other.lanes[i] & ~selected);
+    }
+    return other;
+}
+inline uint32_t laneNonZeroMask(LaneVector vector) { uint32_t mask = 0; for(uint32_t i = 0; i < PHOTON_BATCH_LANES; ++i) mask |= (vector.lanes[i] != 0) << i; return mask; }
+#endif
+
+/** Registers and positions of the lanes that are executed together. */
+struct LaneGroup
+{
+    /** Registers of all lanes in structure of arrays form. */
+    alignas(64) RegisterType registers[RegisterCount][PHOTON_BATCH_LANES];
+    /** Position of every lane that is not executing the current instruction. */
+    uint32_t positions[PHOTON_BATCH_LANES];
+    /** Mask of all lanes that have not halted yet. */
+    uint32_t activeMask;
+    /** Exit code of every lane. */
+    VMExitCode* exitCodes;
+    /** Flag of every lane that ended at a pending Host-Call or <b>nullptr</b>. */
+    bool* suspended;
+    /** VM that is used to execute single lanes with the checked handlers. */
+    VirtualMachine laneVm;
+};
+
+/** Store the result of a vector operation into the selected lanes of a register. */
+inline void storeLanes(RegisterType* values, LaneVector result, uint32_t mask)
+{
+    laneStore(values, laneSelect(mask, result, laneLoad(values)));
+}
+
+/** Halt a single lane of the group. */
+static void haltLane(LaneGroup* group, uint32_t lane, VMExitCode exitCode)
+{
+    group->laneVm.isHalted = false;
+    instructionHalt(&group->laneVm, exitCode);
+    group->activeMask &= ~(1U << lane);
+    group->exitCodes[lane] = exitCode;
+}
+
+/** Execute the instruction at the specified position for a single lane using the checked instruction handlers. */
+static void executeCheckedLane(LaneGroup* group, uint32_t lane, uint32_t position)
+{
+    VirtualMachine* vm = &group->laneVm;
+    for(uint32_t i = 0; i < RegisterCount; ++i)
+        vm->registers[i] = group->registers[i][lane];
+
+    vm->isHalted = false;
+    vm->isSuspended = false;
+    vm->exitCode = ExitCodeSuccess;
+    executeCheckedInstruction(vm, position);
+
+    for(uint32_t i = 0; i < RegisterCount; ++i)
+        group->registers[i][lane] = vm->registers[i];
+
+    group->positions[lane] = vm->currentPosition;
+    if(vm->isHalted || vm->isSuspended)
+    {
+        // Lanes can not be continued, so a pending Host-Call ends the lane.
+        group->activeMask &= ~(1U << lane);
+        group->exitCodes[lane] = vm->exitCode;
+        if(group->suspended) group->suspended[lane] = vm->isSuspended;
+    }
+}
+
+/** Select the lanes with the lowest position, these are executed next so that lanes which took different jumps can join again.
+ * \param	position		Receives the position of the selected lanes.
+ * \param	waitingPosition	Receives the lowest position of all other lanes or InvalidPosition if there are none.
+ * \return	Returns the mask of the selected lanes. */
+static uint32_t scheduleLanes(const LaneGroup* group, uint32_t* position, uint32_t* waitingPosition)
+{
+    uint32_t minimum = InvalidPosition;
+    uint32_t secondMinimum = InvalidPosition;
+    uint32_t mask = 0;
+    for(uint32_t lane = 0; lane < PHOTON_BATCH_LANES; ++lane)
+    {
+        if(!(group->activeMask & (1U << lane)))
+            continue;
+
+        const uint32_t lanePosition = group->positions[lane];
+        if(lanePosition < minimum)
+        {
+            secondMinimum = minimum;
+            minimum = lanePosition;
+            mask = (1U << lane);
+        }
+        else if(lanePosition == minimum)
+        {
+            mask |= (1U << lane);
+        }
+        else if(lanePosition < secondMinimum)
+        {
+            secondMinimum = lanePosition;
+        }
+    }
+
+    *position = minimum;
+    *waitingPosition = secondMinimum;
+    return mask;
+}
+
+/** Execute the decoded byte-code for all active lanes of the group. All lanes at the same position execute an instruction
+ * together. Instructions without a vector form, faults and Host-Calls are executed for every selected lane on its own. */
+static void executeLaneGroup(LaneGroup* group, const DecodedByteCode* decoded)
+{
+    const DecodedInstruction* instructions = decoded->instructions;
+    const uint32_t instructionCount = decoded->instructionCount;
+    RegisterType (*registers)[PHOTON_BATCH_LANES] = group->registers;
+    const HostCallTable* hostCallTable = group->laneVm.hostCallTable;
+
+    uint32_t position, waitingPosition;
+    uint32_t mask = scheduleLanes(group, &position, &waitingPosition);
+    while(group->activeMask)
+    {
+        const DecodedInstruction* instruction = &instructions[position];
+        const uint8_t destReg = instruction->destReg, argRegA = instruction->argRegA, argRegB = instruction->argRegB;
+
+        // Lanes that stay together continue at the next position, all others store their own position.
+        uint32_t nextPosition = position + getDecodedInstructionSize(instruction->op);
+        bool isUniform = true;
+
+        switch(getUnfusedOperation(instruction->op))
+        {
+        case DecodedOpSet:
+            storeLanes(registers[destReg], laneSplat(instruction->value), mask);
+            break;
+        case DecodedOpCopy:
+            storeLanes(registers[destReg], laneLoad(registers[argRegA]), mask);
+            break;
+        case DecodedOpAdd:
+            storeLanes(registers[destReg], laneAdd(laneLoad(registers[argRegA]), laneLoad(registers[argRegB])), mask);
+            break;
+        case DecodedOpSub:
+            storeLanes(registers[destReg], laneSub(laneLoad(registers[argRegA]), laneLoad(registers[argRegB])), mask);
+            break;
+        case DecodedOpMul:
+            storeLanes(registers[destReg], laneMul(laneLoad(registers[argRegA]), laneLoad(registers[argRegB])), mask);
+            break;
+        case DecodedOpInv:
+            storeLanes(registers[destReg], laneSub(laneSplat(0), laneLoad(registers[destReg])), mask);
+            break;
+        case DecodedOpEql:
+            storeLanes(registers[destReg], laneEqual(laneLoad(registers[argRegA]), laneLoad(registers[argRegB])), mask);
+            break;
+        case DecodedOpNeq:
+            storeLanes(registers[destReg], laneSub(laneSplat(1), laneEqual(laneLoad(registers[argRegA]), laneLoad(registers[argRegB]))), mask);
+            break;
+        case DecodedOpGrt:
+            storeLanes(registers[destReg], laneGreater(laneLoad(registers[argRegA]), laneLoad(registers[argRegB])), mask);
+            break;
+        case DecodedOpLet:
+            storeLanes(registers[destReg], laneGreater(laneLoad(registers[argRegB]), laneLoad(registers[argRegA])), mask);
+            break;
+        case DecodedOpSetWide:
+            storeLanes(registers[destReg], laneSplat(instruction->value), mask);
+            break;
+        case DecodedOpAddImmediate:
+            storeLanes(registers[destReg], laneAdd(laneLoad(registers[argRegA]), laneSplat(instruction->value)), mask);
+            break;
+        case DecodedOpSubImmediate:
+            storeLanes(registers[destReg], laneSub(laneLoad(registers[argRegA]), laneSplat(instruction->value)), mask);
+            break;
+        case DecodedOpMulImmediate:
+            storeLanes(registers[destReg], laneMul(laneLoad(registers[argRegA]), laneSplat(instruction->value)), mask);
+            break;
+        case DecodedOpEqlImmediate:
+            storeLanes(registers[destReg], laneEqual(laneLoad(registers[argRegA]), laneSplat(instruction->value)), mask);
+            break;
+        case DecodedOpNeqImmediate:
+            storeLanes(registers[destReg], laneSub(laneSplat(1), laneEqual(laneLoad(registers[argRegA]), laneSplat(instruction->value))), mask);
+            break;
+        case DecodedOpGrtImmediate:
+            storeLanes(registers[destReg], laneGreater(laneLoad(registers[argRegA]), laneSplat(instruction->value)), mask);
+            break;
+        case DecodedOpLetImmediate:
+            storeLanes(registers[destReg], laneGreater(laneSplat(instruction->value), laneLoad(registers[argRegA])), mask);
+            break;
+        case DecodedOpJumpDirect:
+            nextPosition = static_cast<uint32_t>(instruction->value);
+            break;
+        case DecodedOpJumpResolved:
+        {
+            uint32_t takenMask = laneNonZeroMask(laneLoad(registers[destReg])) & mask;
+            if(takenMask == mask)
+            {
+                nextPosition = static_cast<uint32_t>(instruction->value);
+            }
+            else if(takenMask != 0)
+            {
+                isUniform = false;
+                for(uint32_t lane = 0; lane < PHOTON_BATCH_LANES; ++lane)
+                {
+                    if(mask & (1U << lane))
+                        group->positions[lane] = (takenMask & (1U << lane)) ? static_cast<uint32_t>(instruction->value) : position + 1;
+                }
+            }
+        } break;
+        case DecodedOpHalt:
+        {
+            isUniform = false;
+            for(uint32_t lane = 0; lane < PHOTON_BATCH_LANES; ++lane)
+            {
+                if(mask & (1U << lane))
+                    haltLane(group, lane, static_cast<VMExitCode>(instruction->value));
+            }
+        } break;
+        default:
+        {
+            // Divisions, unresolved jumps and Host-Calls are executed for every lane on its own.
+            isUniform = false;
+            for(uint32_t lane = 0; lane < PHOTON_BATCH_LANES; ++lane)
+            {
+                if(!(mask & (1U << lane)))
+                    continue;
+
+                group->positions[lane] = nextPosition;
+                switch(instruction->op)
+                {
+                case DecodedOpDiv:
+                {
+                    RegisterType regB = registers[argRegB][lane];
+                    if(regB != 0)
+                        registers[destReg][lane] = divideRegister(registers[argRegA][lane], regB);
+                    else
+                        executeCheckedLane(group, lane, position);
+                } break;
+                case DecodedOpDivImmediate:
+                {
+                    registers[destReg][lane] = divideRegister(registers[argRegA][lane], instruction->value);
+                } break;
+                case DecodedOpJumpRelative:
+                {
+                    // Relative to the jump instruction, see jumpTo.
+                    int32_t jumpOffset = registers[destReg][lane];
+                    uint32_t newPosition = position + jumpOffset;
+                    if(jumpOffset == 0)
+                        break;
+                    if(newPosition < instructionCount)
+                        group->positions[lane] = newPosition;
+                    else
+                        executeCheckedLane(group, lane, position);
+                } break;
+                case DecodedOpJumpAbsolute:
+                {
+                    uint32_t newPosition = registers[destReg][lane];
+                    if(newPosition < instructionCount)
+                        group->positions[lane] = newPosition;
+                    else
+                        executeCheckedLane(group, lane, position);
+                } break;
+                case DecodedOpCallHost:
+                {
+                    // Callbacks with context can halt the lane, so they are executed by the checked handler.
+                    fHostCallback* callback = getHostCallEntry(hostCallTable, static_cast<uint32_t>(instruction->value))->callback;
+                    if(callback)
+                    {
+                        RegisterType laneRegisters[RegisterCount];
+                        for(uint32_t i = 0; i < RegisterCount; ++i)
+                            laneRegisters[i] = registers[i][lane];
+                        callback(laneRegisters);
+                        for(uint32_t i = 0; i < RegisterCount; ++i)
+                            registers[i][lane] = laneRegisters[i];
+                    }
+                    else
+                    {
+                        executeCheckedLane(group, lane, position);
+                    }
+                } break;
+                default:
+                {
+                    executeCheckedLane(group, lane, position);
+                } break;
+                }
+            }
+        } break;
+        }
+
+        if(isUniform)
+        {
+            // The selected lanes continue on their own until they reach the position of a waiting lane.
+            position = nextPosition;
+            if(position < waitingPosition)
+                continue;
+
+            for(uint32_t lane = 0; lane < PHOTON_BATCH_LANES; ++lane)
+            {
+                if(mask & (1U << lane))
+                    group->positions[lane] = position;
+            }
+        }
+
+        if(group->activeMask)
+            mask = scheduleLanes(group, &position, &waitingPosition);
+    }
+}
+
+PHO_DECL void runBatch(const VirtualMachine* vm, RegisterType* registers, uint32_t laneCount, VMExitCode* exitCodes, bool* suspended)
+{
+    if(!vm || !registers || !exitCodes)
+        return;
+    if(suspended)
+        memset(suspended, 0, sizeof(bool) * laneCount);
+
+    // The registers of the group need to be aligned for the vector loads and stores.
+    void* memory = pho_malloc(sizeof(LaneGroup) + alignof(LaneGroup));
+    if(!memory)
+        return;
+    LaneGroup* group = reinterpret_cast<LaneGroup*>((reinterpret_cast<uintptr_t>(memory) + alignof(LaneGroup) - 1) & ~(static_cast<uintptr_t>(alignof(LaneGroup)) - 1));
+
+    for(uint32_t first = 0; first < laneCount; first += PHOTON_BATCH_LANES)
+    {
+        const uint32_t groupLaneCount = (laneCount - first < PHOTON_BATCH_LANES) ? (laneCount - first) : PHOTON_BATCH_LANES;
+        const uint32_t startPosition = (vm->currentPosition < vm->decodedByteCode.instructionCount) ? vm->currentPosition : vm->decodedByteCode.instructionCount;
+
+        memset(group->registers, 0, sizeof(group->registers));
+        for(uint32_t i = 0; i < RegisterCount; ++i)
+            memcpy(group->registers[i], &registers[static_cast<size_t>(i) * laneCount + first], groupLaneCount * sizeof(RegisterType));
+        for(uint32_t lane = 0; lane < PHOTON_BATCH_LANES; ++lane)
+            group->positions[lane] = startPosition;
+        group->activeMask = (groupLaneCount < 32) ? ((1U << groupLaneCount) - 1) : 0xFFFFFFFFU;
+        group->exitCodes = &exitCodes[first];
+        group->suspended = suspended ? &suspended[first] : nullptr;
+        group->laneVm = *vm;
+#if PHOTON_DEBUG_CALLBACK_ENABLED
+        group->laneVm.debugCallback = nullptr;
+#endif // PHOTON_DEBUG_CALLBACK_ENABLED
+#if PHOTON_TRACE_ENABLED
+        group->laneVm.traceBuffer = nullptr;
+#endif // PHOTON_TRACE_ENABLED
+#if PHOTON_PROFILE_ENABLED
+        group->laneVm.profile = nullptr;
+#endif // PHOTON_PROFILE_ENABLED
+
+        if(vm->decodedByteCode.instructions)
+        {
+            executeLaneGroup(group, &vm->decodedByteCode);
+        }
+        else
+        {
+            // Without decoded instructions every lane is executed on its own by the raw byte-code loop.
+            for(uint32_t lane = 0; lane < groupLaneCount; ++lane)
+            {
+                VirtualMachine* laneVm = &group->laneVm;
+                for(uint32_t i = 0; i < RegisterCount; ++i)
+                    laneVm->registers[i] = group->registers[i][lane];
+                laneVm->isHalted = false;
+                laneVm->isSuspended = false;
+                laneVm->exitCode = ExitCodeSuccess;
+                laneVm->currentPosition = vm->currentPosition;
+                executeByteCode(laneVm);
+                for(uint32_t i = 0; i < RegisterCount; ++i)
+                    group->registers[i][lane] = laneVm->registers[i];
+                group->exitCodes[lane] = laneVm->exitCode;
+                if(group->suspended) group->suspended[lane] = laneVm->isSuspended;
+            }
+        }
+
+        for(uint32_t i = 0; i < RegisterCount; ++i)
+            memcpy(&registers[static_cast<size_t>(i) * laneCount + first], group->registers[i], groupLaneCount * sizeof(RegisterType));
+    }
+
+    pho_free(memory);
+}
+
+#if PHOTON_POOL_ENABLED
+/*----------------------------------------------------------------------------------------------------------------
+ * Thread Pool
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Worker of a VMPool. Workers are aligned to cache lines so that the job ranges of different workers do not share one. */
+struct alignas(PHOTON_CACHE_LINE_SIZE) VMPoolWorker
+{
+    /** Range of jobs that are owned by the worker. The first job is stored in the lower and the end in the upper 32 bits, so
+     * both can be changed with a single compare and swap. */
+    std::atomic<uint64_t> jobRange;
+    /** Thread of the worker. Not used by the first worker which is the thread that calls runJobs. */
+    std::thread thread;
+    /** VM that executes the jobs. This is a copy of the program of the last job. */
+    VirtualMachine vm;
+    /** Program that got copied into vm. */
+    const VirtualMachine* program;
+};
+
+inline uint64_t packJobRange(uint32_t begin, uint32_t end)
+{
+    return (static_cast<uint64_t>(end) << 32) | begin;
+}
+
+/** Take the first job from the range of the worker.
+ * \return	Returns <b>true</b> if a job was taken or <b>false</b> if the range is empty. */
+static bool popJob(VMPoolWorker* worker, uint32_t* job)
+{
+    uint64_t range = worker->jobRange.load(std::memory_order_acquire);
+    for(;;)
+    {
+        const uint32_t begin = static_cast<uint32_t>(range);
+        const uint32_t end = static_cast<uint32_t>(range >> 32);
+        if(begin >= end)
+            return false;
+
+        if(worker->jobRange.compare_exchange_weak(range, packJobRange(begin + 1, end), std::memory_order_acq_rel))
+        {
+            *job = begin;
+            return true;
+        }
+    }
+}
+
+/** Steal the second half of the jobs of another worker. Every job index is only ever part of a single range, so a range can
+ * never get the same value again and the compare and swap is not affected by the ABA problem.
+ * \return	Returns <b>true</b> if jobs were stolen or <b>false</b> if all other workers are out of jobs. */
+static bool stealJobs(VMPool* pool, uint32_t thiefIndex)
+{
+    for(uint32_t i = 1; i < pool->workerCount; ++i)
+    {
+        VMPoolWorker* victim = &pool->workers[(thiefIndex + i) % pool->workerCount];
+        uint64_t range = victim->jobRange.load(std::memory_order_acquire);
+        for(;;)
+        {
+            const uint32_t begin = static_cast<uint32_t>(range);
+            const uint32_t end = static_cast<uint32_t>(range >> 32);
+            if(begin >= end)
+                break;
+
+            const uint32_t middle = end - (end - begin + 1) / 2;
+            if(victim->jobRange.compare_exchange_weak(range, packJobRange(begin, middle), std::memory_order_acq_rel))
+            {
+                pool->workers[thiefIndex].jobRange.store(packJobRange(middle, end), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/** Execute a single job on the VM of the worker. */
+static void executeJob(VMPoolWorker* worker, VMJob* job)
+{
+    VirtualMachine* vm = &worker->vm;
+    if(worker->program != job->program)
+    {
+        *vm = *job->program;
+#if PHOTON_DEBUG_CALLBACK_ENABLED
+        vm->debugCallback = nullptr;
+#endif // PHOTON_DEBUG_CALLBACK_ENABLED
+#if PHOTON_TRACE_ENABLED
+        vm->traceBuffer = nullptr;
+#endif // PHOTON_TRACE_ENABLED
+#if PHOTON_PROFILE_ENABLED
+        vm->profile = nullptr;
+#endif // PHOTON_PROFILE_ENABLED
+        worker->program = job->program;
+    }
+
+    memcpy(vm->registers, job->registers, sizeof(vm->registers));
+    vm->isHalted = false;
+    vm->isSuspended = false;
+    vm->exitCode = ExitCodeSuccess;
+    vm->currentPosition = job->program->currentPosition;
+
+#if PHOTON_JIT_IS_SUPPORTED
+    if(vm->jitCode.code)
+        executeJitCode(vm);
+    else
+#endif // PHOTON_JIT_IS_SUPPORTED
+    if(vm->decodedByteCode.instructions)
+        executeDecodedByteCode(vm);
+    else
+        executeByteCode(vm);
+
+    memcpy(job->registers, vm->registers, sizeof(job->registers));
+    job->exitCode = vm->exitCode;
+    job->isSuspended = vm->isSuspended;
+}
+
+/** Execute jobs until the worker and all other workers are out of jobs. */
+static void executePoolJobs(VMPool* pool, uint32_t workerIndex)
+{
+    VMPoolWorker* worker = &pool->workers[workerIndex];
+    worker->program = nullptr; // Programs may have changed since the last call.
+
+    uint32_t job;
+    do
+    {
+        while(popJob(worker, &job))
+            executeJob(worker, &pool->jobs[job]);
+    }
+    while(stealJobs(pool, workerIndex));
+}
+
+/** Main function of a worker thread. */
+static void runPoolWorker(VMPool* pool, uint32_t workerIndex)
+{
+    uint32_t epoch = 0;
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->wakeCondition.wait(lock, [&]() { return pool->isShuttingDown || pool->epoch != epoch; });
+            if(pool->isShuttingDown)
+                return;
+            epoch = pool->epoch;
+        }
+
+        executePoolJobs(pool, workerIndex);
+
+        if(pool->runningWorkerCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            pool->doneCondition.notify_one();
+        }
+    }
+}
+
+PHO_DECL VMPool* createVMPool(uint32_t workerCount)
+{
+    if(workerCount == 0)
+        workerCount = std::thread::hardware_concurrency();
+    if(workerCount == 0)
+        workerCount = 1;
+
+    // The pool and the cache aligned workers share a single memory block.
+    const size_t poolSize = (sizeof(VMPool) + alignof(VMPoolWorker) - 1) & ~(alignof(VMPoolWorker) - 1);
+    void* memory = pho_malloc(alignof(VMPoolWorker) + poolSize + workerCount * sizeof(VMPoolWorker));
+    if(!memory)
+        return nullptr;
+
+    uintptr_t address = (reinterpret_cast<uintptr_t>(memory) + alignof(VMPoolWorker) - 1) & ~(static_cast<uintptr_t>(alignof(VMPoolWorker)) - 1);
+    VMPool* pool = new(reinterpret_cast<void*>(address)) VMPool();
+    pool->workers = reinterpret_cast<VMPoolWorker*>(address + poolSize);
+    pool->workerCount = workerCount;
+    pool->runningWorkerCount.store(0);
+    pool->memory = memory;
+
+    for(uint32_t i = 0; i < workerCount; ++i)
+    {
+        VMPoolWorker* worker = new(&pool->workers[i]) VMPoolWorker();
+        worker->jobRange.store(0);
+        if(i > 0)
+            worker->thread = std::thread(runPoolWorker, pool, i);
+    }
+
+    return pool;
+}
+
+PHO_DECL void releaseVMPool(VMPool* pool)
+{
+    if(!pool)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->isShuttingDown = true;
+    }
+    pool->wakeCondition.notify_all();
+
+    for(uint32_t i = 0; i < pool->workerCount; ++i)
+    {
+        if(pool->workers[i].thread.joinable())
+            pool->workers[i].thread.join();
+        pool->workers[i].~VMPoolWorker();
+    }
+
+    void* memory = pool->memory;
+    pool->~VMPool();
+    pho_free(memory);
+}
+
+PHO_DECL void runJobs(VMPool* pool, VMJob* jobs, uint32_t jobCount)
+{
+    if(!pool || !jobs || jobCount == 0)
+        return;
+
+    // Every worker starts with an equal share of the jobs.
+    for(uint32_t i = 0; i < pool->workerCount; ++i)
+    {
+        uint32_t begin = static_cast<uint32_t>((static_cast<uint64_t>(jobCount) * i) / pool->workerCount);
+        uint32_t end = static_cast<uint32_t>((static_cast<uint64_t>(jobCount) * (i + 1)) / pool->workerCount);
+        pool->workers[i].jobRange.store(packJobRange(begin, end), std::memory_order_relaxed);
+    }
+
+    pool->jobs = jobs;
+    pool->runningWorkerCount.store(pool->workerCount - 1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        ++pool->epoch;
+    }
+    pool->wakeCondition.notify_all();
+
+    executePoolJobs(pool, 0);
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->doneCondition.wait(lock, [&]() { return pool->runningWorkerCount.load(std::memory_order_acquire) == 0; });
+}
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Scheduler
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Append a task to the run queue and wake up a thread. The lock of the scheduler must be held. */
+static void queueTask(VMScheduler* scheduler, VMTask* task)
+{
+    task->state = VMTaskStateQueued;
+    task->next = nullptr;
+    if(scheduler->queueTail)
+        scheduler->queueTail->next = task;
+    else
+        scheduler->queueHead = task;
+    scheduler->queueTail = task;
+    scheduler->wakeCondition.notify_one();
+}
+
+/** Take the first task from the run queue. The lock of the scheduler must be held.
+ * \return	Returns the task or <b>nullptr</b> if the queue is empty. */
+static VMTask* popTask(VMScheduler* scheduler)
+{
+    VMTask* task = scheduler->queueHead;
+    if(!task)
+        return nullptr;
+
+    scheduler->queueHead = task->next;
+    if(!scheduler->queueHead)
+        scheduler->queueTail = nullptr;
+    task->state = VMTaskStateRunning;
+    return task;
+}
+
+/** Execute a single slice of a task and put it back into the run queue, park it or finish it. */
+static void executeTaskSlice(VMScheduler* scheduler, VMTask* task)
+{
+    VirtualMachine* vm = task->vm;
+    resume(vm, scheduler->sliceInstructions);
+
+    std::unique_lock<std::mutex> lock(scheduler->mutex);
+    if(vm->isHalted)
+    {
+        task->state = VMTaskStateIdle;
+        --scheduler->activeTaskCount;
+        lock.unlock();
+
+        if(scheduler->finishedCallback)
+            scheduler->finishedCallback(task);
+        return;
+    }
+
+    // The Host-Call may already be completed by another thread while this slice was still running.
+    if(vm->isSuspended && !task->isCompleted)
+    {
+        task->state = VMTaskStateParked;
+        ++scheduler->parkedTaskCount;
+        return;
+    }
+
+    vm->isSuspended = false;
+    task->isCompleted = false;
+    queueTask(scheduler, task);
+}
+
+/** Main function of a scheduler thread. */
+static void runSchedulerThread(VMScheduler* scheduler)
+{
+    for(;;)
+    {
+        VMTask* task;
+        {
+            std::unique_lock<std::mutex> lock(scheduler->mutex);
+            scheduler->wakeCondition.wait(lock, [&]() { return scheduler->isShuttingDown || scheduler->queueHead; });
+            if(scheduler->isShuttingDown)
+                return;
+            task = popTask(scheduler);
+        }
+
+        executeTaskSlice(scheduler, task);
+    }
+}
+
+PHO_DECL VMScheduler* createVMScheduler(uint32_t threadCount, uint32_t sliceInstructions, fVMTaskCallback* finishedCallback)
+{
+    // The scheduler and its threads share a single memory block.
+    const size_t schedulerSize = (sizeof(VMScheduler) + alignof(std::thread) - 1) & ~(alignof(std::thread) - 1);
+    void* memory = pho_malloc(schedulerSize + threadCount * sizeof(std::thread));
+    if(!memory)
+        return nullptr;
+
+    VMScheduler* scheduler = new(memory) VMScheduler();
+    scheduler->threads = reinterpret_cast<std::thread*>(static_cast<uint8_t*>(memory) + schedulerSize);
+    scheduler->threadCount = threadCount;
+    scheduler->sliceInstructions = (sliceInstructions > 0) ? sliceInstructions : 1;
+    scheduler->finishedCallback = finishedCallback;
+    scheduler->memory = memory;
+
+    for(uint32_t i = 0; i < threadCount; ++i)
+        new(&scheduler->threads[i]) std::thread(runSchedulerThread, scheduler);
+
+    return scheduler;
+}
+
+PHO_DECL void releaseVMScheduler(VMScheduler* scheduler)
+{
+    if(!scheduler)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(scheduler->mutex);
+        scheduler->isShuttingDown = true;
+    }
+    scheduler->wakeCondition.notify_all();
+
+    for(uint32_t i = 0; i < scheduler->threadCount; ++i)
+    {
+        scheduler->threads[i].join();
+        scheduler->threads[i].~thread();
+    }
+
+    void* memory = scheduler->memory;
+    scheduler->~VMScheduler();
+    pho_free(memory);
+}
+
+PHO_DECL bool startTask(VMScheduler* scheduler, VMTask* task)
+{
+    std::lock_guard<std::mutex> lock(scheduler->mutex);
+    if(task->state != VMTaskStateIdle)
+        return false;
+
+    task->vm->isHalted = false;
+    task->vm->isSuspended = false;
+    task->vm->exitCode = ExitCodeSuccess;
+    task->isCompleted = false;
+    ++scheduler->activeTaskCount;
+    queueTask(scheduler, task);
+    return true;
+}
+
+PHO_DECL bool resumeTask(VMScheduler* scheduler, VMTask* task)
+{
+    std::lock_guard<std::mutex> lock(scheduler->mutex);
+    if(task->state == VMTaskStateRunning)
+    {
+        task->isCompleted = true;
+        return true;
+    }
+    if(task->state != VMTaskStateParked)
+        return false;
+
+    task->vm->isSuspended = false;
+    --scheduler->parkedTaskCount;
+    queueTask(scheduler, task);
+    return true;
+}
+
+PHO_DECL uint32_t pollVMScheduler(VMScheduler* scheduler, uint32_t maxSlices)
+{
+    for(uint32_t i = 0; i < maxSlices; ++i)
+    {
+        VMTask* task;
+        {
+            std::lock_guard<std::mutex> lock(scheduler->mutex);
+            task = popTask(scheduler);
+            if(!task)
+                return scheduler->activeTaskCount;
+        }
+
+        executeTaskSlice(scheduler, task);
+    }
+
+    std::lock_guard<std::mutex> lock(scheduler->mutex);
+    return scheduler->activeTaskCount;
+}
+#endif // PHOTON_POOL_ENABLED
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Tracing
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Get the mnemonic of the specified op code as it is used in Photon source code. */
+inline const char* getOpCodeMnemonic(uint32_t opCode)
+{
+    static const char* const mnemonics[] = { "halt", "set", "cpy", "add", "sub", "mul", "div", "inv", "eql", "neq", "gre", "les", "jmp", "hcl", "jmp" };
+    return (opCode < (sizeof(mnemonics) / sizeof(mnemonics[0]))) ? mnemonics[opCode] : "???";
+}
+
+/** Write the source code representation of an instruction into the specified text buffer, e.g. "add reg1 reg2 reg3".
+ * Branches are written with their offset instead of a label, e.g. "jmp reg4 @-3".
+ * \param	hasImmediate	Flag to indicate if the immediate of a wide instruction is known, otherwise it is written as '?'.
+ * \return	Returns the number of characters that were written or would have been written, see snprintf. */
+static int32_t formatInstruction(const MappedInstruction* instruction, char* text, size_t size, bool hasImmediate = true)
+{
+    const char* mnemonic = getOpCodeMnemonic(instruction->opCode);
+    switch(instruction->opCode)
+    {
+    case OpCodeHalt:
+        return snprintf(text, size, "%s %d", mnemonic, instruction->params.value);
+    case OpCodeSet:
+    case OpCodeJump:
+        return snprintf(text, size, "%s reg%u %d", mnemonic, instruction->params.destReg, instruction->params.value);
+    case OpCodeCopy:
+        return snprintf(text, size, "%s reg%u reg%d", mnemonic, instruction->params.destReg, instruction->params.argRegA);
+    case OpCodeInv:
+        return snprintf(text, size, "%s reg%u", mnemonic, instruction->params.destReg);
+    case OpCodeCallHost:
+        return snprintf(text, size, "%s %u %d", mnemonic, instruction->params.destReg, instruction->params.value);
+    case OpCodeBranch:
+        if(instruction->params.destReg == BranchAlways)
+            return snprintf(text, size, "%s @%+d", mnemonic, static_cast<int8_t>(instruction->params.value));
+        return snprintf(text, size, "%s reg%u @%+d", mnemonic, instruction->params.destReg, static_cast<int8_t>(instruction->params.value));
+    case OpCodeAdd:
+    case OpCodeSub:
+    case OpCodeMul:
+    case OpCodeDiv:
+    case OpCodeEql:
+    case OpCodeNeq:
+    case OpCodeGrt:
+    case OpCodeLet:
+        return snprintf(text, size, "%s reg%u reg%d reg%d", mnemonic, instruction->params.destReg, instruction->params.argRegA, instruction->params.argRegB);
+    case OpCodeWide:
+    {
+        // Wide instructions are written like in the source code, with the immediate in place of the last register.
+        if(!isWideOperation(instruction->wideOpCode))
+            break;
+
+        char immediate[16];
+        if(hasImmediate)
+            snprintf(immediate, sizeof(immediate), "%d", instruction->params.value);
+        else
+            snprintf(immediate, sizeof(immediate), "?");
+
+        const char* operation = getOpCodeMnemonic(instruction->wideOpCode);
+        if(instruction->wideOpCode == OpCodeSet)
+            return snprintf(text, size, "%s reg%u %s", operation, instruction->params.destReg, immediate);
+        return snprintf(text, size, "%s reg%u reg%d %s", operation, instruction->params.destReg, instruction->params.argRegA, immediate);
+    }
+    default:
+        break;
+    }
+
+    return snprintf(text, size, "%s", mnemonic);
+}
+
+PHO_DECL int32_t formatTraceRecord(const TraceRecord* record, char* text, size_t size)
+{
+    const DecodedInstruction* decoded = &record->instruction;
+
+    // Convert the decoded instruction back into the instruction that it was generated from.
+    MappedInstruction instruction = {};
+    instruction.opCode         = static_cast<OpCode>(decoded->op);
+    instruction.params.destReg = decoded->destReg;
+    instruction.params.argRegA = decoded->argRegA;
+    instruction.params.argRegB = decoded->argRegB;
+    instruction.params.value   = decoded->value;
+
+    switch(decoded->op)
+    {
+    case DecodedOpJumpRelative:
+    case DecodedOpJumpResolved:
+    case DecodedOpJumpAbsolute:
+    case DecodedOpJumpDirect:
+    {
+        instruction.opCode = OpCodeJump;
+        instruction.params.value = (decoded->op == DecodedOpJumpAbsolute || decoded->op == DecodedOpJumpDirect);
+
+        // Branches keep their op code in argRegA when they get resolved, see resolveBranch.
+        if(decoded->argRegA == OpCodeBranch && (decoded->op == DecodedOpJumpResolved || decoded->op == DecodedOpJumpDirect))
+        {
+            instruction.opCode = OpCodeBranch;
+            instruction.params.destReg = (decoded->op == DecodedOpJumpDirect) ? BranchAlways : decoded->destReg;
+            instruction.params.value = static_cast<int32_t>((static_cast<uint32_t>(decoded->value) - record->position) & 0xFF);
+        }
+    } break;
+    case DecodedOpCallHost:
+    {
+        instruction.opCode = OpCodeCallHost;
+        instruction.params.destReg = (decoded->value >> 8) & 0x0F;
+        instruction.params.value = decoded->value & 0xFF;
+    } break;
+    case DecodedOpChecked:
+    {
+        // Only the first word is recorded, so the immediate of a wide instruction is not known.
+        unpackInstruction(static_cast<RawInstruction>(decoded->value & 0xFFFF), &instruction);
+    } break;
+    case DecodedOpSetWide:
+    case DecodedOpAddImmediate:
+    case DecodedOpSubImmediate:
+    case DecodedOpMulImmediate:
+    case DecodedOpDivImmediate:
+    case DecodedOpEqlImmediate:
+    case DecodedOpNeqImmediate:
+    case DecodedOpGrtImmediate:
+    case DecodedOpLetImmediate:
+    {
+        instruction.opCode = OpCodeWide;
+        instruction.wideOpCode = getWideOperation(decoded->op);
+        instruction.params.argRegB = 0;
+    } break;
+    default:
+        break;
+    }
+
+    char instructionText[32];
+    formatInstruction(&instruction, instructionText, sizeof(instructionText), decoded->op != DecodedOpChecked);
+
+    const bool hasResult = (instruction.opCode >= OpCodeSet && instruction.opCode <= OpCodeLet) ||
+                           (instruction.opCode == OpCodeWide && isWideOperation(instruction.wideOpCode));
+    if(decoded->op == DecodedOpChecked && (decoded->value & (1 << 24)))
+        return snprintf(text, size, "%u: %s => halted with exit code %d", record->position, instructionText, (decoded->value >> 16) & 0xFF);
+    if(instruction.opCode == OpCodeJump || (instruction.opCode == OpCodeBranch && isRegisterIndexValid(instruction.params.destReg)))
+        return snprintf(text, size, "%u: %s (reg%u=%d)", record->position, instructionText, instruction.params.destReg, record->result);
+    if(!hasResult)
+        return snprintf(text, size, "%u: %s", record->position, instructionText);
+
+    return snprintf(text, size, "%u: %s => reg%u=%d", record->position, instructionText,
+                    isRegisterIndexValid(instruction.params.destReg) ? instruction.params.destReg : static_cast<uint32_t>(Local), record->result);
+}
+
+PHO_DECL void dumpTraceBuffer(const TraceBuffer* buffer, FILE* file)
+{
+    char text[128];
+    const uint32_t count = getTraceRecordCount(buffer);
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        formatTraceRecord(getTraceRecord(buffer, i), text, sizeof(text));
+        fprintf(file, "%s\n", text);
+    }
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Profiling
+ *--------------------------------------------------------------------------------------------------------------*/
+
+PHO_DECL bool createProfile(const ByteCode* byteCode, Profile* profile)
+{
+    if(!profile)
+        return false;
+
+    *profile = {};
+    if(!isByteCodeValid(byteCode))
+        return false;
+
+    // One additional entry for the trailing halt instruction.
+    const uint32_t positionCount = byteCode->instructionCount + 1;
+    profile->positions = static_cast<ProfileEntry*>(pho_malloc(sizeof(ProfileEntry) * positionCount));
+    profile->opCodes = static_cast<uint8_t*>(pho_malloc(sizeof(uint8_t) * positionCount));
+    if(!profile->positions || !profile->opCodes)
+    {
+        releaseProfile(profile);
+        return false;
+    }
+
+    for(uint32_t i = 0; i < byteCode->instructionCount; ++i)
+    {
+        // Wide instructions are counted as the operation in the low four bits of their prefix.
+        const RawInstruction* words = &byteCode->instructions[i];
+        const bool isWide = getInstructionSize(words, byteCode->instructionCount - i) == WideInstructionSize;
+        profile->opCodes[i] = static_cast<uint8_t>(isWide ? (words[0] & 0x0F) : ((words[0] >> 12) & 0x0F));
+    }
+    profile->opCodes[byteCode->instructionCount] = OpCodeHalt;
+
+    profile->positionCount = positionCount;
+    resetProfile(profile);
+    return true;
+}
+
+PHO_DECL void releaseProfile(Profile* profile)
+{
+    if(profile)
+    {
+        if(profile->positions) pho_free(profile->positions);
+        if(profile->opCodes) pho_free(profile->opCodes);
+        *profile = {};
+    }
+}
+
+PHO_DECL void resetProfile(Profile* profile)
+{
+    if(profile->positions)
+        memset(profile->positions, 0, sizeof(ProfileEntry) * profile->positionCount);
+    memset(profile->hostCalls, 0, sizeof(profile->hostCalls));
+}
+
+PHO_DECL ProfileEntry getOpCodeProfile(const Profile* profile, uint32_t opCode)
+{
+    ProfileEntry result = {};
+    for(uint32_t i = 0; i < profile->positionCount; ++i)
+    {
+        if(profile->opCodes[i] == opCode)
+        {
+            result.count  += profile->positions[i].count;
+            result.cycles += profile->positions[i].cycles;
+        }
+    }
+    return result;
+}
+
+/** Select the executed entries with the most cycles, sorted from the most to the least expensive one.
+ * \param	indices		Receives the indices of the selected entries, maxCount values.
+ * \return	Returns the number of selected entries. */
+static uint32_t selectHottestEntries(const ProfileEntry* entries, uint32_t entryCount, uint32_t* indices, uint32_t maxCount)
+{
+    uint32_t selectedCount = 0;
+    for(uint32_t i = 0; i < entryCount; ++i)
+    {
+        if(entries[i].count == 0)
+            continue;
+
+        // Insertion into the sorted selection, entries with the same cycles keep their order.
+        uint32_t slot = selectedCount;
+        while(slot > 0 && entries[indices[slot - 1]].cycles < entries[i].cycles)
+            --slot;
+        if(slot >= maxCount)
+            continue;
+
+        const uint32_t last = (selectedCount < maxCount) ? selectedCount : (maxCount - 1);
+        memmove(&indices[slot + 1], &indices[slot], sizeof(uint32_t) * (last - slot));
+        indices[slot] = i;
+        if(selectedCount < maxCount)
+            ++selectedCount;
+    }
+    return selectedCount;
+}
+
+/** Write a line of the profile report for the specified entry. */
+static void printProfileEntry(FILE* file, const char* name, const ProfileEntry* entry, uint64_t totalCycles)
+{
+    fprintf(file, "%-16s %14llu %16llu %12.1f %7.2f%%\n", name,
+            static_cast<unsigned long long>(entry->count), static_cast<unsigned long long>(entry->cycles),
+            static_cast<double>(entry->cycles) / static_cast<double>(entry->count),
+            (totalCycles > 0) ? (100.0 * static_cast<double>(entry->cycles) / static_cast<double>(totalCycles)) : 0.0);
+}
+
+PHO_DECL void dumpProfile(const Profile* profile, FILE* file, uint32_t maxPositions)
+{
+    // Branches have their own op code but share the mnemonic of jumps.
+    static const char* const names[] = { "halt", "set", "cpy", "add", "sub", "mul", "div", "inv", "eql", "neq", "gre", "les", "jmp", "hcl", "branch", "wide" };
+    const char* unit = PHOTON_PROFILE_USES_TSC ? "cycles" : "ns";
+
+    ProfileEntry opCodes[16] = {};
+    ProfileEntry total = {};
+    for(uint32_t i = 0; i < profile->positionCount; ++i)
+    {
+        opCodes[profile->opCodes[i]].count  += profile->positions[i].count;
+        opCodes[profile->opCodes[i]].cycles += profile->positions[i].cycles;
+        total.count  += profile->positions[i].count;
+        total.cycles += profile->positions[i].cycles;
+    }
+
+    fprintf(file, "Executed instructions: %llu, %s: %llu\n\n", static_cast<unsigned long long>(total.count), unit, static_cast<unsigned long long>(total.cycles));
+
+    char name[32];
+    uint32_t indices[PHOTON_MAX_HOST_CALLS > 16 ? PHOTON_MAX_HOST_CALLS : 16];
+    uint32_t count = selectHottestEntries(opCodes, 16, indices, 16);
+    fprintf(file, "%-16s %14s %16s %12s %8s\n", "Op code", "Count", unit, "Per op", "Share");
+    for(uint32_t i = 0; i < count; ++i)
+        printProfileEntry(file, names[indices[i]], &opCodes[indices[i]], total.cycles);
+
+    uint32_t* positions = (maxPositions > 0) ? static_cast<uint32_t*>(pho_malloc(sizeof(uint32_t) * maxPositions)) : nullptr;
+    if(positions)
+    {
+        count = selectHottestEntries(profile->positions, profile->positionCount, positions, maxPositions);
+        fprintf(file, "\n%-16s %14s %16s %12s %8s\n", "Instruction", "Count", unit, "Per op", "Share");
+        for(uint32_t i = 0; i < count; ++i)
+        {
+            snprintf(name, sizeof(name), "%u: %s", positions[i], names[profile->opCodes[positions[i]]]);
+            printProfileEntry(file, name, &profile->positions[positions[i]], total.cycles);
+        }
+        pho_free(positions);
+    }
+
+    count = selectHottestEntries(profile->hostCalls, PHOTON_MAX_HOST_CALLS, indices, PHOTON_MAX_HOST_CALLS);
+    if(count > 0)
+    {
+        fprintf(file, "\n%-16s %14s %16s %12s %8s\n", "Host-Call", "Count", unit, "Per call", "Share");
+        for(uint32_t i = 0; i < count; ++i)
+        {
+            snprintf(name, sizeof(name), "gid=%u fid=%u", indices[i] >> 8, indices[i] & 0xFF);
+            printProfileEntry(file, name, &profile->hostCalls[indices[i]], total.cycles);
+        }
+    }
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Ahead-of-Time Translation
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Get the register that the checked handlers access for the specified register index, see getRegister. */
+inline uint32_t getCheckedRegister(uint32_t registerIndex)
+{
+    return isRegisterIndexValid(registerIndex) ? registerIndex : static_cast<uint32_t>(Local);
+}
+
+/** Write the source code of an arithmetic or compare operation. Comparing a register with itself is written as a
+ * constant, so the generated code does not trigger any self-comparison warnings. */
+static void translateBinaryOperation(const char* operation, uint32_t destReg, uint32_t argRegA, uint32_t argRegB, FILE* file)
+{
+    if(argRegA == argRegB && (operation[0] == '=' || operation[0] == '!' || operation[0] == '<' || operation[0] == '>'))
+        fprintf(file, "    registers[%u] = %d;\n", destReg, (operation[0] == '=') ? 1 : 0);
+    else
+        fprintf(file, "    registers[%u] = registers[%u] %s registers[%u];\n", destReg, argRegA, operation, argRegB);
+}
+
+/** Write the source code of a division by a register that is not zero, the code is not indented. A divisor of -1 is
+ * a negation like in divideRegister, so INT32_MIN / -1 wraps around instead of trapping. */
+static void translateDivision(uint32_t destReg, uint32_t argRegA, uint32_t argRegB, FILE* file)
+{
+    fprintf(file, "registers[%u] = (registers[%u] == -1) ? static_cast<Photon::RegisterType>(0U - static_cast<uint32_t>(registers[%u])) : registers[%u] / registers[%u];\n",
+            destReg, argRegB, argRegA, argRegA, argRegB);
+}
+
+/** Write the source code of an arithmetic or compare operation with an immediate as second argument. A division by -1
+ * is written as a negation like in divideRegister, so INT32_MIN / -1 wraps around instead of trapping. */
+static void translateImmediateOperation(uint32_t opCode, uint32_t destReg, uint32_t argRegA, int32_t value, FILE* file)
+{
+    static const char* const operators[] = { "+", "-", "*", "/", "", "==", "!=", ">", "<" };
+    if(opCode == OpCodeDiv && value == -1)
+        fprintf(file, "    registers[%u] = static_cast<Photon::RegisterType>(0U - static_cast<uint32_t>(registers[%u]));\n", destReg, argRegA);
+    else
+        fprintf(file, "    registers[%u] = registers[%u] %s %d;\n", destReg, argRegA, operators[opCode - OpCodeAdd], value);
+}
+
+/** Write the source code of an instruction that can not be executed without runtime checks. The checked handlers still
+ * execute such an instruction on the Local register before the VM halts, so the translation does the same.
+ * \param	words		Words of the instruction.
+ * \param	wordCount	Number of words that can be read. */
+static void translateCheckedInstruction(const RawInstruction* words, uint32_t wordCount, FILE* file)
+{
+    MappedInstruction instruction;
+    unpackInstruction(words, wordCount, &instruction);
+
+    const uint32_t destReg = getCheckedRegister(instruction.params.destReg);
+    const uint32_t argRegA = getCheckedRegister(instruction.params.argRegA);
+    const uint32_t argRegB = getCheckedRegister(instruction.params.argRegB);
+    static const char* const operators[] = { "+", "-", "*", "/", "", "==", "!=", ">", "<" };
+
+    switch(instruction.opCode)
+    {
+    case OpCodeSet:
+        fprintf(file, "    registers[%u] = %d;\n", destReg, instruction.params.value);
+        break;
+    case OpCodeCopy:
+        fprintf(file, "    registers[%u] = registers[%u];\n", destReg, argRegA);
+        break;
+    case OpCodeInv:
+        fprintf(file, "    registers[%u] = -registers[%u];\n", destReg, destReg);
+        break;
+    case OpCodeDiv:
+        fprintf(file, "    if(registers[%u] != 0) ", argRegB);
+        translateDivision(destReg, argRegA, argRegB, file);
+        break;
+    case OpCodeAdd:
+    case OpCodeSub:
+    case OpCodeMul:
+    case OpCodeEql:
+    case OpCodeNeq:
+    case OpCodeGrt:
+    case OpCodeLet:
+        translateBinaryOperation(operators[instruction.opCode - OpCodeAdd], destReg, argRegA, argRegB, file);
+        break;
+    case OpCodeJump:
+        break;
+    case OpCodeBranch:
+    {
+        if(instruction.params.destReg != BranchAlways && !isRegisterIndexValid(instruction.params.destReg))
+            break;
+
+        // Branches with a target in bounds are always resolved, so the branch either does not jump or jumps out of bounds.
+        if(instruction.params.value == 0)
+            return;
+        if(instruction.params.destReg == BranchAlways)
+            fprintf(file, "    return Photon::ExitCodeJumpOutOfBounds;\n");
+        else
+            fprintf(file, "    if(registers[%u] != 0) return Photon::ExitCodeJumpOutOfBounds;\n", instruction.params.destReg);
+    } return;
+    case OpCodeCallHost:
+    {
+        // The Host-Call id is out of range.
+        fprintf(file, "#if PHOTON_IS_HOST_CALL_STRICT\n    return Photon::ExitCodeInvalidHostCall;\n#endif\n");
+    } return;
+    case OpCodeWide:
+    {
+        const uint32_t wideOpCode = instruction.wideOpCode;
+        if(!isWideOperation(wideOpCode))
+        {
+            // Unknown operations and wide instructions without their immediate halt the VM.
+            fprintf(file, "    return Photon::ExitCodeHaltRequested;\n");
+            return;
+        }
+        if(validateInstruction(&instruction) == ExitCodeSuccess)
+        {
+            // All registers are valid, so this is a division by zero.
+            fprintf(file, "    return Photon::ExitCodeDivideByZero;\n");
+            return;
+        }
+
+        if(wideOpCode == OpCodeSet)
+            fprintf(file, "    registers[%u] = %d;\n", destReg, instruction.params.value);
+        else if(wideOpCode != OpCodeDiv || instruction.params.value != 0)
+            translateImmediateOperation(wideOpCode, destReg, argRegA, instruction.params.value, file);
+    } break;
+    default:
+    {
+        // Unknown instructions halt the VM with their value as the exit code.
+        fprintf(file, "    return %d;\n", instruction.params.value);
+    } return;
+    }
+
+    fprintf(file, "    return Photon::ExitCodeRegisterFault;\n");
+}
+
+/** Write the source code of a single decoded instruction.
+ * \param	words		Words of the raw instruction that the instruction was decoded from.
+ * \param	wordCount	Number of words that can be read. */
+static void translateInstruction(const DecodedInstruction* instruction, const RawInstruction* words, uint32_t wordCount, uint32_t position, FILE* file)
+{
+    const uint32_t destReg = instruction->destReg, argRegA = instruction->argRegA, argRegB = instruction->argRegB;
+    const uint8_t op = getUnfusedOperation(instruction->op);
+    static const char* const operators[] = { "+", "-", "*", "/", "", "==", "!=", ">", "<" };
+
+    switch(op)
+    {
+    case DecodedOpHalt:
+        fprintf(file, "    return %d;\n", instruction->value);
+        break;
+    case DecodedOpSet:
+    case DecodedOpSetWide:
+        fprintf(file, "    registers[%u] = %d;\n", destReg, instruction->value);
+        break;
+    case DecodedOpCopy:
+        fprintf(file, "    registers[%u] = registers[%u];\n", destReg, argRegA);
+        break;
+    case DecodedOpInv:
+        fprintf(file, "    registers[%u] = -registers[%u];\n", destReg, destReg);
+        break;
+    case DecodedOpAddImmediate:
+    case DecodedOpSubImmediate:
+    case DecodedOpMulImmediate:
+    case DecodedOpDivImmediate:
+    case DecodedOpEqlImmediate:
+    case DecodedOpNeqImmediate:
+    case DecodedOpGrtImmediate:
+    case DecodedOpLetImmediate:
+        translateImmediateOperation(getWideOperation(op), destReg, argRegA, instruction->value, file);
+        break;
+    case DecodedOpDiv:
+        fprintf(file, "    if(registers[%u] == 0) return Photon::ExitCodeDivideByZero;\n    ", argRegB);
+        translateDivision(destReg, argRegA, argRegB, file);
+        break;
+    case DecodedOpAdd:
+    case DecodedOpSub:
+    case DecodedOpMul:
+    case DecodedOpEql:
+    case DecodedOpNeq:
+    case DecodedOpGrt:
+    case DecodedOpLet:
+        translateBinaryOperation(operators[op - DecodedOpAdd], destReg, argRegA, argRegB, file);
+        break;
+    case DecodedOpJumpRelative:
+    {
+        // Relative to the jump instruction, see jumpTo.
+        fprintf(file, "    if(registers[%u] != 0) { position = %uU + static_cast<uint32_t>(registers[%u]); goto dispatch; }\n", destReg, position, destReg);
+    } break;
+    case DecodedOpJumpAbsolute:
+        fprintf(file, "    position = static_cast<uint32_t>(registers[%u]); goto dispatch;\n", destReg);
+        break;
+    case DecodedOpJumpResolved:
+        fprintf(file, "    if(registers[%u] != 0) goto instruction%d;\n", destReg, instruction->value);
+        break;
+    case DecodedOpJumpDirect:
+        fprintf(file, "    goto instruction%d;\n", instruction->value);
+        break;
+    case DecodedOpCallHost:
+    {
+        fprintf(file, "    if(Photon::HostCallStatus status = Photon::callHostCall(Photon::getHostCallEntry(hostCalls, %d), registers, hostCallContext))\n    {\n", instruction->value);
+        fprintf(file, "        if(status & Photon::HostCallPending) { if(isSuspended) *isSuspended = true; return Photon::ExitCodeSuccess; }\n");
+        fprintf(file, "        if(status != Photon::HostCallNotFound) return static_cast<Photon::VMExitCode>(status);\n");
+        fprintf(file, "#if PHOTON_IS_HOST_CALL_STRICT\n        return Photon::ExitCodeInvalidHostCall;\n#endif\n    }\n");
+    } break;
+    default:
+        translateCheckedInstruction(words, wordCount, file);
+        break;
+    }
+}
+
+/** Write the label or comment and the source code of the decoded instruction at the specified position. */
+static void translatePosition(const ByteCode* byteCode, const DecodedByteCode* decoded, uint32_t position, bool hasLabel, FILE* file)
+{
+    MappedInstruction instruction;
+    char text[64];
+    const RawInstruction* words = &byteCode->instructions[position];
+    const uint32_t wordCount = byteCode->instructionCount - position;
+    unpackInstruction(words, wordCount, &instruction);
+    formatInstruction(&instruction, text, sizeof(text));
+
+    if(hasLabel)
+        fprintf(file, "instruction%u: // %s\n", position, text);
+    else
+        fprintf(file, "    // %u: %s\n", position, text);
+    translateInstruction(&decoded->instructions[position], words, wordCount, position, file);
+}
+
+PHO_DECL bool translateByteCode(const ByteCode* byteCode, const char* functionName, FILE* file)
+{
+    if(!functionName || !file)
+        return false;
+
+    DecodedByteCode decoded = {};
+    if(!decodeByteCode(byteCode, &decoded))
+        return false;
+
+    const uint32_t instructionCount = decoded.instructionCount;
+    bool* isJumpTarget = static_cast<bool*>(pho_malloc((instructionCount + 1) * sizeof(bool)));
+    if(!isJumpTarget)
+    {
+        releaseDecodedByteCode(&decoded);
+        return false;
+    }
+
+    // Only instructions that can be jumped to get a label. If any jump could not be resolved then every instruction can be a target.
+    // The immediate words of wide instructions only jump if they are translated, so their targets are added below.
+    bool hasDispatch = false;
+    memset(isJumpTarget, 0, (instructionCount + 1) * sizeof(bool));
+    for(uint32_t i = 0; i < instructionCount; i += getDecodedInstructionSize(decoded.instructions[i].op))
+    {
+        const DecodedInstruction* instruction = &decoded.instructions[i];
+        if(instruction->op == DecodedOpJumpResolved || instruction->op == DecodedOpJumpDirect)
+            isJumpTarget[instruction->value] = true;
+        else if(instruction->op == DecodedOpJumpRelative || instruction->op == DecodedOpJumpAbsolute)
+            hasDispatch = true;
+    }
+
+    // Instructions are translated in the order in which they are read from the start, so each one falls through into the next.
+    // The immediate words of wide instructions are only translated if a jump can enter them. They follow at the end and
+    // continue with a goto to the instruction behind them.
+    bool hasImmediateTarget = false;
+    for(uint32_t i = 0, next = 0; i < instructionCount; ++i)
+    {
+        if(i == next)
+            next += getDecodedInstructionSize(decoded.instructions[i].op);
+        else
+            hasImmediateTarget |= hasDispatch || isJumpTarget[i];
+    }
+    for(uint32_t i = 0, next = 0; hasImmediateTarget && i < instructionCount; ++i)
+    {
+        if(i == next)
+        {
+            next += getDecodedInstructionSize(decoded.instructions[i].op);
+            continue;
+        }
+
+        const DecodedInstruction* instruction = &decoded.instructions[i];
+        isJumpTarget[i + getDecodedInstructionSize(instruction->op)] = true;
+        if(instruction->op == DecodedOpJumpResolved || instruction->op == DecodedOpJumpDirect)
+            isJumpTarget[instruction->value] = true;
+        else if(instruction->op == DecodedOpJumpRelative || instruction->op == DecodedOpJumpAbsolute)
+            hasDispatch = true;
+    }
+
+    fprintf(file, "/* Translated from %u instructions of Photon byte-code. */\n", instructionCount);
+    fprintf(file, "Photon::VMExitCode %s(Photon::RegisterType* registers, const Photon::HostCallTable* hostCalls, void* hostCallContext = nullptr,\n", functionName);
+    fprintf(file, "    bool* isSuspended = nullptr)\n{\n");
+    fprintf(file, "    static_assert(PHOTON_MAX_HOST_CALLS == %d, \"The byte-code was translated with a different PHOTON_MAX_HOST_CALLS.\");\n", PHOTON_MAX_HOST_CALLS);
+    fprintf(file, "    (void)registers;\n    (void)hostCalls;\n    (void)hostCallContext;\n");
+    fprintf(file, "    if(isSuspended) *isSuspended = false;\n");
+    if(hasDispatch)
+        fprintf(file, "    uint32_t position;\n");
+    fprintf(file, "\n");
+
+    for(uint32_t i = 0; i < instructionCount; i += getDecodedInstructionSize(decoded.instructions[i].op))
+        translatePosition(byteCode, &decoded, i, hasDispatch || isJumpTarget[i], file);
+
+    // Running past the end executes the trailing halt instruction.
+    if(isJumpTarget[instructionCount])
+        fprintf(file, "instruction%u:\n", instructionCount);
+    fprintf(file, "    return Photon::ExitCodeSuccess;\n");
+
+    for(uint32_t i = 0, next = 0; hasImmediateTarget && i < instructionCount; ++i)
+    {
+        if(i == next)
+        {
+            next += getDecodedInstructionSize(decoded.instructions[i].op);
+            continue;
+        }
+        fprintf(file, "\n");
+        translatePosition(byteCode, &decoded, i, hasDispatch || isJumpTarget[i], file);
+        fprintf(file, "    goto instruction%u;\n", i + getDecodedInstructionSize(decoded.instructions[i].op));
+    }
+
+    if(hasDispatch)
+    {
+        fprintf(file, "\ndispatch:\n    switch(position)\n    {\n");
+        for(uint32_t i = 0; i < instructionCount; ++i)
+            fprintf(file, "    case %u: goto instruction%u;\n", i, i);
+        fprintf(file, "    default: return Photon::ExitCodeJumpOutOfBounds;\n    }\n");
+    }
+    fprintf(file, "}\n");
+
+    pho_free(isJumpTarget);
+    releaseDecodedByteCode(&decoded);
+    return true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Compiler Implementation
+ *--------------------------------------------------------------------------------------------------------------*/  
+
+#ifndef PHOTON_NO_COMPILER
+
+/** Checks if the specified character is an end of line. 
+ * This will handle both \n and \r end-lines. */
+inline bool isEndOfLine(uint8_t c)
+{
+    return ((c == '\n') ||
+            (c == '\r'));
+}
+
+/** Checks if the specified character is whitespace (space, tab or end of line). */
+inline bool isWhitespace(uint8_t c)
+{
+    return ((c == ' ') ||
+            (c == '\t') ||
+            (isEndOfLine(c)));
+}
+
+/** Check if the specified character is an alphabetic value.*/
+inline bool isAlpha(uint8_t c)
+{
+    return (((c >= 'a') && (c <= 'z')) ||
+            ((c >= 'A') && (c <= 'Z')));
+}
+
+/** Check if the specified character is a numeric value. */
+inline bool isNumber(uint8_t c)
+{
+    return ((c >= '0') && (c <= '9'));
+}
+
+/** Convert a string to a signed 32-bit integer value.
+ * This supports decimal numbers as well as negative and positive numbers. 
+ * If the number could not be parsed then this function will return the numeric value up to the 
+ * point of the parser error (e.g. "24c6" => 24). */
+inline int32_t stringToSint(const char* str)
+{
+    int32_t sign = 1;
+    int32_t value = 0;
+    uint8_t c;
+
+    if(*str == '-')
+    {
+        sign = -1;
+        ++str;
+    }
+    
+    for(;;)
+    {
+        c = *str;
+        ++str;
+        if((c < '0') || (c > '9'))
+            return (sign * value);
+        value = value * 10 + c - '0';
+    }
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Data Structures
+ *--------------------------------------------------------------------------------------------------------------*/  
+
+/** Token types that can be generated by the lexer. */
+enum Token
+{
+    /** Unknown or invalid token. */
+    TokenUnknown,
+    /** The token indicates that the end of the file to parse has been reached. */
+    TokenEOF,
+    
+    /** The token is an identifier. This can be an instruction or a function name. */ 
+    TokenIdentifier,
+    /** The token is a numeric value. */
+    TokenNumber,
+    /** The token is a register of the VM. */
+    TokenRegister,
+    /** The token is the definition of a label: an identifier that is followed by a colon. */
+    TokenLabel,
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * 
+ *--------------------------------------------------------------------------------------------------------------*/  
+
+/** Internal string structure that indexes into a larger source string. */
+struct StringRef
+{
+    /** Pointer to the start of the string. */
+    char* text;
+    /** Size of the string in characters. */
+    size_t length;
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * 
+ *--------------------------------------------------------------------------------------------------------------*/  
+
+/** Label that got defined in the source, e.g. "loop:". */
+struct CompilerLabel
+{
+    /** Name of the label without the colon. */
+    StringRef name;
+    /** Position of the instruction that follows the label. */
+    uint32_t position;
+    /** Line of the definition. For error reporting only. */
+    uint32_t lineNumber;
+};
+
+/** Jump to a label, e.g. "jmp loop" or "jmp reg4 loop". A placeholder branch is emitted for every reference and replaced
+ * with the cheapest encoding of the jump after all labels are known. */
+struct CompilerLabelReference
+{
+    /** Name of the label to jump to. */
+    StringRef name;
+    /** Position of the placeholder instruction. */
+    uint32_t position;
+    /** Position of the first instruction of the jump after all jumps got their encoding. */
+    uint32_t newPosition;
+    /** Index of the label or InvalidPosition if the label is not defined. */
+    uint32_t labelIndex;
+    /** Line of the jump. For error reporting only. */
+    uint32_t lineNumber;
+    /** The jump is only made if this register is not zero. BranchAlways if the jump is always made. */
+    uint8_t conditionReg;
+    /** Number of instructions of the encoding of the jump. */
+    uint8_t size;
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * 
+ *--------------------------------------------------------------------------------------------------------------*/  
+
+/** Internal structure that contains data that is used to generate tokens from a source string. */
+struct Lexer
+{
+    /** Current position of the lexer in the string to parse. */
+    char* at;
+    /** The last string that was found with the last Identifier token. */
+    StringRef identifierString;
+    /** The current token. Use getNextToken to get the next token in the input stream. */
+    Token token;
+    /** Value of the last Number token or index of the last Register token. */
+    int64_t tokenValue;
+
+    /** Buffer that receives the packed instructions. This is the memory of a CompilerArena. */
+    RawInstruction* instructions;
+    /** Number of instructions that have been parsed. */
+    uint32_t instructionCount;
+    /** Number of instructions that fit into the buffer. */
+    uint32_t instructionCapacity;
+    /** Arena that owns the instruction buffer and stores the labels. */
+    CompilerArena* arena;
+    /** Number of labels and label references that have been parsed. */
+    uint32_t labelCount;
+    uint32_t labelReferenceCount;
+
+    /** Current line that the parser is currently at. For error reporting only. */
+    uint32_t lineNumber;
+    /** Path to the file that is getting parsed. For error reporting only. */
+    const char* fileName;
+    /** Number of errors that have been reported. */
+    uint32_t errorCount;
+};
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * 
+ *--------------------------------------------------------------------------------------------------------------*/  
+
+/** Reports a compiler error to the user. */
+static void reportErrorInternal(Lexer* lexer, const char* format, ...)
+{
+    va_list list;
+
+    // @Extendable: Notify lexer or do some sort of error tracking. 
+    //    - C-574 (18.08.2017)
+    ++lexer->errorCount;
+
+    va_start(list, format);
+    vprintf(format, list);
+    va_end(list);
+}
+
+#define reportError(lexer, format, ...) \
+{ reportErrorInternal(lexer, "%s(%d): [ERROR] " format "\n", (lexer->fileName ? lexer->fileName : "<unknown>"), lexer->lineNumber, ##__VA_ARGS__); }
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * 
+ *--------------------------------------------------------------------------------------------------------------*/  
+
+/** Convert a token type to a human readable string. */
+inline const char* tokenToString(Token token)
+{
+    switch(token)
+    {
+    case TokenEOF:
+        return "end of file";
+    case TokenIdentifier:
+        return "identifier";
+    case TokenNumber:
+        return "number";
+    case TokenRegister:
+        return "register";
+    case TokenLabel:
+        return "label";
+    case TokenUnknown:
+    default: {} break;
+    }
+    return "unknown";
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Lexical Functions 
+ *--------------------------------------------------------------------------------------------------------------*/  
+
+/** Check if the current identifier equals a required token string.
+ * \param   lexer       Lexer which contains the current identifier string to compare to. 
+ * \param   tokenString Token string that is required. 
+ * \return Returns <b>true</b> if the required token is found or otherwise <b>false</b>. */
+inline bool isTokenStringEqual(Lexer* lexer, const char* tokenString)
+{
+    return (strncmp(tokenString, lexer->identifierString.text, lexer->identifierString.length) == 0);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * 
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Largest value that is returned by parseDigits. This is out of range of every operand. */
+const int64_t MaxParsedValue = static_cast<int64_t>(UINT32_MAX) + 1;
+
+/** Parse the digits of a number. Values that do not fit into 32 bits are clamped to MaxParsedValue.
+ * \param   text    First digit of the number.
+ * \param   length  Number of digits. */
+inline int64_t parseDigits(const char* text, size_t length)
+{
+    int64_t value = 0;
+    for(size_t i = 0; i < length; ++i)
+    {
+        value = value * 10 + (text[i] - '0');
+        if(value > MaxParsedValue)
+            return MaxParsedValue;
+    }
+
+    return value;
+}
+
+/** Check if the specified identifier string is a register name (rX and regX) and parse the index of the register.
+ * This will automatically remove the register prefix from the identifier leaving only the index.
+ * Note that this will <b>not</b> check whether the register index is out of bounds.
+ * \param	identifier	Identifier to check.
+ * \param	index		Receives the index of the register.
+ * \return	Returns <b>true</b> if the identifier is a register name, <b>false</b> otherwise. */
+static bool isIdentifierRegister(StringRef* identifier, int64_t* index)
+{
+    size_t prefixLength;
+    if(identifier->length >= 4 &&
+        identifier->text[0] == 'r' &&
+        identifier->text[1] == 'e' &&
+        identifier->text[2] == 'g') // regX
+        prefixLength = 3;
+    else if(identifier->length >= 2 &&
+        identifier->length <= 3 &&
+        identifier->text[0] == 'r') // rX
+        prefixLength = 1;
+    else
+        return false;
+
+    for(size_t i = prefixLength; i < identifier->length; ++i)
+    {
+        if(!isNumber(identifier->text[i]))
+            return false;
+    }
+
+    identifier->text += prefixLength;
+    identifier->length -= prefixLength;
+    *index = parseDigits(identifier->text, identifier->length);
+    return true;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ *
+ *--------------------------------------------------------------------------------------------------------------*/
+
+#if PHOTON_LEXER_BLOCK_SIZE > 1
+/* Blocks are always loaded from aligned addresses, so a block never crosses a page boundary and can be read even if it
+ * extends past the end of the source. Address sanitizers would still report this, so they are disabled for these reads. */
+#define PHOTON_LEXER_SCAN __attribute__((no_sanitize_address))
+
+/** Characters of an aligned block of source code. Bit i of every mask belongs to the i-th character of the block. */
+struct LexerBlock
+{
+    /** Spaces, tabs and end of lines. */
+    uint32_t whitespace;
+    /** Line feed characters. */
+    uint32_t lineFeeds;
+    /** Carriage return characters. */
+    uint32_t carriageReturns;
+    /** Characters that end a comment: end of lines and the null-terminator. */
+    uint32_t commentEnds;
+};
+
+/** Mask of all characters of a block. */
+static const uint32_t LexerBlockMask = static_cast<uint32_t>((1ull << PHOTON_LEXER_BLOCK_SIZE) - 1);
+
+/** Load the aligned block at the specified address and classify its characters. */
+PHOTON_LEXER_SCAN inline LexerBlock classifyLexerBlock(const char* block)
+{
+    LexerBlock result;
+#if PHOTON_LEXER_BLOCK_SIZE == 32
+    __m256i text            = _mm256_load_si256(reinterpret_cast<const __m256i*>(block));
+    __m256i lineFeeds       = _mm256_cmpeq_epi8(text, _mm256_set1_epi8('\n'));
+    __m256i carriageReturns = _mm256_cmpeq_epi8(text, _mm256_set1_epi8('\r'));
+    __m256i endOfLines      = _mm256_or_si256(lineFeeds, carriageReturns);
+    __m256i blanks          = _mm256_or_si256(_mm256_cmpeq_epi8(text, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(text, _mm256_set1_epi8('\t')));
+    __m256i terminators     = _mm256_cmpeq_epi8(text, _mm256_setzero_si256());
+
+    result.whitespace      = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(endOfLines, blanks)));
+    result.lineFeeds       = static_cast<uint32_t>(_mm256_movemask_epi8(lineFeeds));
+    result.carriageReturns = static_cast<uint32_t>(_mm256_movemask_epi8(carriageReturns));
+    result.commentEnds     = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(endOfLines, terminators)));
+#else
+    __m128i text            = _mm_load_si128(reinterpret_cast<const __m128i*>(block));
+    __m128i lineFeeds       = _mm_cmpeq_epi8(text, _mm_set1_epi8('\n'));
+    __m128i carriageReturns = _mm_cmpeq_epi8(text, _mm_set1_epi8('\r'));
+    __m128i endOfLines      = _mm_or_si128(lineFeeds, carriageReturns);
+    __m128i blanks          = _mm_or_si128(_mm_cmpeq_epi8(text, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(text, _mm_set1_epi8('\t')));
+    __m128i terminators     = _mm_cmpeq_epi8(text, _mm_setzero_si128());
+
+    result.whitespace      = static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(endOfLines, blanks)));
+    result.lineFeeds       = static_cast<uint32_t>(_mm_movemask_epi8(lineFeeds));
+    result.carriageReturns = static_cast<uint32_t>(_mm_movemask_epi8(carriageReturns));
+    result.commentEnds     = static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(endOfLines, terminators)));
+#endif // PHOTON_LEXER_BLOCK_SIZE
+    return result;
+}
+
+/** Skip all spaces, tabs and end of lines. A line ends with "\n", "\r\n" or a single "\r".
+ * \param   at          First character to check.
+ * \param   lineNumber  Gets incremented for every skipped end of line.
+ * \return	Returns the first character that is not whitespace. */
+PHOTON_LEXER_SCAN static const char* skipWhitespace(const char* at, uint32_t* lineNumber)
+{
+    // Whitespace between tokens is usually only a few characters long, so the start is checked without loading any blocks.
+    for(uint32_t i = 0; i < 8; ++i)
+    {
+        if(!isWhitespace(at[0]))
+            return at;
+        if(at[0] == '\n' || (at[0] == '\r' && at[1] != '\n'))
+            ++(*lineNumber);
+        ++at;
+    }
+
+    const uintptr_t offset = reinterpret_cast<uintptr_t>(at) & (PHOTON_LEXER_BLOCK_SIZE - 1);
+    const char* block = at - offset;
+    uint32_t validMask = (LexerBlockMask << offset) & LexerBlockMask;
+    uint32_t previousCarriageReturn = 0;
+
+    for(;;)
+    {
+        LexerBlock characters = classifyLexerBlock(block);
+        uint32_t others = ~characters.whitespace & validMask;
+        uint32_t skipped = others ? ((others & (0u - others)) - 1) & validMask : validMask;
+
+        // A carriage return that is followed by a line feed does not end another line.
+        uint32_t lineFeeds = characters.lineFeeds & skipped;
+        uint32_t carriageReturns = characters.carriageReturns & skipped;
+        uint32_t pairs = ((carriageReturns << 1) | previousCarriageReturn) & lineFeeds;
+        *lineNumber += __builtin_popcount(lineFeeds) + __builtin_popcount(carriageReturns) - __builtin_popcount(pairs);
+
+        if(others)
+            return block + __builtin_ctz(others);
+
+        previousCarriageReturn = carriageReturns >> (PHOTON_LEXER_BLOCK_SIZE - 1);
+        block += PHOTON_LEXER_BLOCK_SIZE;
+        validMask = LexerBlockMask;
+    }
+}
+
+/** Skip a comment up to the end of its line.
+ * \return	Returns the end of line or the null-terminator that ends the comment. */
+PHOTON_LEXER_SCAN static const char* skipComment(const char* at)
+{
+    const uintptr_t offset = reinterpret_cast<uintptr_t>(at) & (PHOTON_LEXER_BLOCK_SIZE - 1);
+    const char* block = at - offset;
+    uint32_t validMask = (LexerBlockMask << offset) & LexerBlockMask;
+
+    for(;;)
+    {
+        uint32_t ends = classifyLexerBlock(block).commentEnds & validMask;
+        if(ends)
+            return block + __builtin_ctz(ends);
+
+        block += PHOTON_LEXER_BLOCK_SIZE;
+        validMask = LexerBlockMask;
+    }
+}
+
+#undef PHOTON_LEXER_SCAN
+#else
+/** Skip all spaces, tabs and end of lines. A line ends with "\n", "\r\n" or a single "\r".
+ * \param   at          First character to check.
+ * \param   lineNumber  Gets incremented for every skipped end of line.
+ * \return	Returns the first character that is not whitespace. */
+static const char* skipWhitespace(const char* at, uint32_t* lineNumber)
+{
+    while(isWhitespace(at[0]))
+    {
+        if(at[0] == '\n' || (at[0] == '\r' && at[1] != '\n'))
+            ++(*lineNumber);
+        ++at;
+    }
+
+    return at;
+}
+
+/** Skip a comment up to the end of its line.
+ * \return	Returns the end of line or the null-terminator that ends the comment. */
+static const char* skipComment(const char* at)
+{
+    while(at[0] != '\0' && !isEndOfLine(at[0]))
+        ++at;
+
+    return at;
+}
+#endif // PHOTON_LEXER_BLOCK_SIZE
+
+/** Moves the position of the lexer's cursor forward until all whitespace is skipped.
+ * This will automatically ignore spaces, tabs, end-of-lines and comments.
+ * \param   lexer   Lexer to parse the input. */
+static void eatAllWhitespace(Lexer* lexer)
+{
+    const char* at = skipWhitespace(lexer->at, &lexer->lineNumber);
+    while(at[0] == '#')
+    {
+        at = skipComment(at);
+        at = skipWhitespace(at, &lexer->lineNumber);
+    }
+
+    lexer->at = const_cast<char*>(at);
+    if(at[0] == '\0')
+    {
+        lexer->token = TokenEOF;
+    }
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * 
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Get the next token from the input data and stores it in the lexer's token field. 
+ * \param   lexer   Lexer that is used to convert the input data into tokens.  */
+static void getNextToken(Lexer* lexer)
+{
+    Token token = TokenUnknown;
+    eatAllWhitespace(lexer);
+
+    if(lexer->token == TokenEOF)
+        return;
+
+    // Identifier: [a-zA-Z][a-zA-Z0-9]*
+    if(isAlpha(lexer->at[0]))
+    {
+        // Scan with a local cursor, the compiler would otherwise have to assume that the characters alias the lexer.
+        char* at = lexer->at;
+        while(isAlpha(at[0]) || isNumber(at[0]))
+        {
+            ++at;
+        } 
+
+        token = TokenIdentifier;
+        lexer->identifierString.text = lexer->at;
+        lexer->identifierString.length = at - lexer->at; 
+        lexer->at = at;
+
+        // Label: [a-zA-Z][a-zA-Z0-9]*:
+        if(at[0] == ':')
+        {
+            token = TokenLabel;
+            ++lexer->at;
+            if(isIdentifierRegister(&lexer->identifierString, &lexer->tokenValue))
+                reportError(lexer, "Register names can not be used as labels! Got: 'reg%.*s:'", (int)lexer->identifierString.length, lexer->identifierString.text);
+        }
+        else if(isIdentifierRegister(&lexer->identifierString, &lexer->tokenValue))
+        {
+            token = TokenRegister;
+        }
+#if 0
+        // Handle specific token strings.
+        if(isTokenStringEqual(lexer, "function"))  token = TokenFunctionBegin;
+        else if(isTokenStringEqual(lexer, "end"))  token = TokenFunctionEnd;
+        else if(isTokenStringEqual(lexer, "call")) token = TokenFunctionCall;
+#endif
+    }
+    // Number: -?[0-9]+
+    else if(isNumber(lexer->at[0]) || (lexer->at[0] == '-' && isNumber(lexer->at[1])))
+    {
+        StringRef valueString = {};
+        valueString.text = lexer->at;
+        const bool isNegative = (lexer->at[0] == '-');
+        char* at = lexer->at + (isNegative ? 1 : 0);
+        char* digits = at;
+        while(isNumber(at[0]))
+        {
+            ++at;
+        } 
+
+        lexer->at = at;
+        valueString.length = at - valueString.text;
+        lexer->identifierString = valueString;
+        lexer->tokenValue = parseDigits(digits, at - digits);
+        if(isNegative)
+            lexer->tokenValue = -lexer->tokenValue;
+
+        token = TokenNumber;
+    }
+    else
+    {
+        reportError(lexer, "Unknown character '%c'! Only alphabetic or numeric characters are allowed.", lexer->at[0]);
+        ++lexer->at;
+    }
+
+    lexer->token = token;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * 
+ *--------------------------------------------------------------------------------------------------------------*/  
+
+/** Get the value of the current token, which must be a number between 0 and 255. */
+static int32_t parseNumber(Lexer* lexer)
+{
+    int32_t result = 0;
+
+    if(lexer->token == TokenNumber)
+    {
+        if(lexer->tokenValue > UINT8_MAX || lexer->tokenValue < 0)
+        {
+            reportError(lexer, "Numeric value is out of range! Got: '%.*s', minimum is 0 and maximum is 255", (int)lexer->identifierString.length, lexer->identifierString.text);
+        }
+        else
+        {
+            result = static_cast<int32_t>(lexer->tokenValue);
+        }
+    }
+    else
+    {
+        reportError(lexer, "Expected numeric value! Got: '%.*s' (%s)", (int)lexer->identifierString.length, lexer->identifierString.text, tokenToString(lexer->token));
+    }
+
+    return result;
+}
+
+/** Get the index of the current token, which must be a register. */
+static Register parseRegister(Lexer* lexer)
+{
+    Register result = Reg0;
+
+    if(lexer->token == TokenRegister)
+    {
+        if(lexer->tokenValue >= RegisterCount)
+        {
+            reportError(lexer, "Register index out of bounds! Got: '%.*s', maximum is %d", (int)lexer->identifierString.length, lexer->identifierString.text, (RegisterCount - 1));
+            result = static_cast<Register>(RegisterCount - 1);
+        }
+        else
+        {
+            result = static_cast<Register>(lexer->tokenValue);
+        }
+    }
+    else
+    {
+        reportError(lexer, "Expected a register name! Got: '%.*s' (%s)", (int)lexer->identifierString.length, lexer->identifierString.text, tokenToString(lexer->token));
+    }
+
+    return result;
+}
+
+/** Get the value of the current token, which must be a number that fits into a signed 32-bit immediate. */
+static int32_t parseImmediate(Lexer* lexer)
+{
+    int32_t result = 0;
+
+    if(lexer->token == TokenNumber)
+    {
+        if(lexer->tokenValue > INT32_MAX || lexer->tokenValue < INT32_MIN)
+        {
+            reportError(lexer, "Numeric value is out of range! Got: '%.*s', minimum is %d and maximum is %d", (int)lexer->identifierString.length, lexer->identifierString.text, INT32_MIN, INT32_MAX);
+        }
+        else
+        {
+            result = static_cast<int32_t>(lexer->tokenValue);
+        }
+    }
+    else
+    {
+        reportError(lexer, "Expected numeric value! Got: '%.*s' (%s)", (int)lexer->identifierString.length, lexer->identifierString.text, tokenToString(lexer->token));
+    }
+
+    return result;
+}
+
+static int32_t getNumber(Lexer* lexer)
+{
+    getNextToken(lexer);
+    return parseNumber(lexer);
+}
+
+static int32_t getImmediate(Lexer* lexer)
+{
+    getNextToken(lexer);
+    return parseImmediate(lexer);
+}
+
+static Register getRegister(Lexer* lexer)
+{
+    getNextToken(lexer);
+    return parseRegister(lexer);
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Labels
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Maximum number of words of a jump to a label, see encodeLabelJump. */
+const uint8_t MaxLabelJumpSize = 6;
+
+/** Add a label with the name of the current token at the position of the next instruction. */
+static void addLabel(Lexer* lexer)
+{
+    CompilerArena* arena = lexer->arena;
+    if(lexer->labelCount == arena->labelCapacity)
+    {
+        uint32_t capacity = arena->labelCapacity ? arena->labelCapacity * 2 : 16;
+        arena->labels = static_cast<CompilerLabel*>(growArray(arena->labels, lexer->labelCount, capacity, sizeof(CompilerLabel)));
+        arena->labelCapacity = arena->labels ? capacity : 0;
+        if(!arena->labels)
+        {
+            fprintf(stderr, "INTERNAL COMPILER ERROR: Failed to allocate label buffer!\n");
+            lexer->labelCount = 0;
+            return;
+        }
+    }
+
+    CompilerLabel* label = &arena->labels[lexer->labelCount++];
+    label->name       = lexer->identifierString;
+    label->position   = lexer->instructionCount;
+    label->lineNumber = lexer->lineNumber;
+}
+
+/** Add a jump to the label with the name of the current token. The jump is emitted at the position of the next instruction.
+ * \param	conditionReg	Register that must not be zero for the jump to be made or BranchAlways. */
+static void addLabelReference(Lexer* lexer, uint8_t conditionReg)
+{
+    CompilerArena* arena = lexer->arena;
+    if(lexer->labelReferenceCount == arena->labelReferenceCapacity)
+    {
+        uint32_t capacity = arena->labelReferenceCapacity ? arena->labelReferenceCapacity * 2 : 16;
+        arena->labelReferences = static_cast<CompilerLabelReference*>(growArray(arena->labelReferences, lexer->labelReferenceCount, capacity, sizeof(CompilerLabelReference)));
+        arena->labelReferenceCapacity = arena->labelReferences ? capacity : 0;
+        if(!arena->labelReferences)
+        {
+            fprintf(stderr, "INTERNAL COMPILER ERROR: Failed to allocate label buffer!\n");
+            lexer->labelReferenceCount = 0;
+            return;
+        }
+    }
+
+    CompilerLabelReference* reference = &arena->labelReferences[lexer->labelReferenceCount++];
+    reference->name         = lexer->identifierString;
+    reference->position     = lexer->instructionCount;
+    reference->newPosition  = lexer->instructionCount;
+    reference->labelIndex   = InvalidPosition;
+    reference->lineNumber   = lexer->lineNumber;
+    reference->conditionReg = conditionReg;
+    reference->size         = 1;
+}
+
+/** FNV-1a hash of the name of a label. */
+inline uint32_t hashLabelName(const StringRef* name)
+{
+    uint32_t hash = 2166136261U;
+    for(size_t i = 0; i < name->length; ++i)
+        hash = (hash ^ static_cast<uint8_t>(name->text[i])) * 16777619U;
+    return hash;
+}
+
+/** Find the entry of the label table that holds the label with the specified name or the empty entry where it belongs. */
+static uint32_t* findLabelEntry(Lexer* lexer, const StringRef* name, uint32_t tableMask)
+{
+    const CompilerArena* arena = lexer->arena;
+    for(uint32_t entry = hashLabelName(name) & tableMask;; entry = (entry + 1) & tableMask)
+    {
+        const uint32_t index = arena->labelTable[entry];
+        if(index == InvalidPosition)
+            return &arena->labelTable[entry];
+
+        const StringRef* labelName = &arena->labels[index].name;
+        if(labelName->length == name->length && memcmp(labelName->text, name->text, name->length) == 0)
+            return &arena->labelTable[entry];
+    }
+}
+
+/** Build the table that maps the names of all labels to their indices. Labels that are defined twice are reported.
+ * \return	Returns the mask of the table or InvalidPosition if the table could not be allocated. */
+static uint32_t buildLabelTable(Lexer* lexer)
+{
+    CompilerArena* arena = lexer->arena;
+    uint32_t capacity = 16;
+    while(capacity < lexer->labelCount * 2)
+        capacity *= 2;
+
+    if(arena->labelTableCapacity < capacity)
+    {
+        pho_free(arena->labelTable);
+        arena->labelTable = static_cast<uint32_t*>(pho_malloc(sizeof(uint32_t) * capacity));
+        arena->labelTableCapacity = arena->labelTable ? capacity : 0;
+        if(!arena->labelTable)
+            return InvalidPosition;
+    }
+
+    memset(arena->labelTable, 0xFF, sizeof(uint32_t) * capacity);
+    for(uint32_t i = 0; i < lexer->labelCount; ++i)
+    {
+        const CompilerLabel* label = &arena->labels[i];
+        uint32_t* entry = findLabelEntry(lexer, &label->name, capacity - 1);
+        if(*entry != InvalidPosition)
+        {
+            lexer->lineNumber = label->lineNumber;
+            reportError(lexer, "Label '%.*s' is already defined on line %d!", (int)label->name.length, label->name.text, arena->labels[*entry].lineNumber);
+            continue;
+        }
+        *entry = i;
+    }
+
+    return capacity - 1;
+}
+
+/** Pack an instruction that only uses destReg and value. */
+inline RawInstruction makeInstruction(OpCode opCode, uint32_t destReg, int32_t value)
+{
+    MappedInstruction instruction = {};
+    instruction.opCode         = opCode;
+    instruction.params.destReg = destReg;
+    instruction.params.value   = value & 0xFF;
+    return packInstruction(&instruction);
+}
+
+/** Encode a jump that is always made with at most the specified number of words. The cheapest encoding is a branch,
+ * a jump to itself takes two branches and jumps that are further away write their offset or target into the local register. Every target can be reached with
+ * a wide set of the target and an absolute jump. Shorter encodings are padded with branches without an offset which are never reached.
+ * \param	instructions	Receives the instructions or <b>nullptr</b> to only check if the jump can be encoded.
+ * \param	position		Position of the first instruction of the jump.
+ * \return	Returns <b>false</b> if the target can not be reached with the number of words. */
+static bool encodeJump(RawInstruction* instructions, uint32_t position, uint32_t target, uint32_t size)
+{
+    RawInstruction encoding[WideInstructionSize + 1];
+    uint32_t encodingSize;
+
+    // Relative jumps are relative to the jump instruction, which is the last instruction of every encoding.
+    const int64_t offset = static_cast<int64_t>(target) - position;
+    if(offset != 0 && offset >= INT8_MIN && offset <= INT8_MAX)
+    {
+        encoding[0] = makeInstruction(OpCodeBranch, BranchAlways, static_cast<int32_t>(offset));
+        encodingSize = 1;
+    }
+    else if(size >= 2 && offset == 0)
+    {
+        // A branch without an offset does not jump, so a jump to itself goes back and forth between two branches.
+        encoding[0] = makeInstruction(OpCodeBranch, BranchAlways, 1);
+        encoding[1] = makeInstruction(OpCodeBranch, BranchAlways, -1);
+        encodingSize = 2;
+    }
+    else if(size >= 2 && offset - 1 >= 1 && offset - 1 <= UINT8_MAX)
+    {
+        encoding[0] = makeInstruction(OpCodeSet, Local, static_cast<int32_t>(offset - 1));
+        encoding[1] = makeInstruction(OpCodeJump, Local, 0);
+        encodingSize = 2;
+    }
+    else if(size >= 2 && target <= UINT8_MAX)
+    {
+        encoding[0] = makeInstruction(OpCodeSet, Local, static_cast<int32_t>(target));
+        encoding[1] = makeInstruction(OpCodeJump, Local, 1);
+        encodingSize = 2;
+    }
+    else if(size >= 3 && offset - 2 <= -1 && offset - 2 >= -static_cast<int64_t>(UINT8_MAX))
+    {
+        encoding[0] = makeInstruction(OpCodeSet, Local, static_cast<int32_t>(2 - offset));
+        encoding[1] = makeInstruction(OpCodeInv, Local, 0);
+        encoding[2] = makeInstruction(OpCodeJump, Local, 0);
+        encodingSize = 3;
+    }
+    else if(size >= WideInstructionSize + 1)
+    {
+        MappedInstruction set = {};
+        set.opCode         = OpCodeWide;
+        set.wideOpCode     = OpCodeSet;
+        set.params.destReg = Local;
+        set.params.value   = static_cast<int32_t>(target);
+        packInstruction(&set, encoding);
+        encoding[WideInstructionSize] = makeInstruction(OpCodeJump, Local, 1);
+        encodingSize = WideInstructionSize + 1;
+    }
+    else
+    {
+        return false;
+    }
+
+    if(instructions)
+    {
+        for(uint32_t i = 0; i < size; ++i)
+            instructions[i] = (i < encodingSize) ? encoding[i] : makeInstruction(OpCodeBranch, BranchAlways, 0);
+    }
+    return true;
+}
+
+/** Encode a jump to a label with the specified number of words. A jump with a condition register that is too far
+ * away for a single branch skips over an unconditional jump if the register is zero:
+ *     "jmp reg +2", "jmp @+size", unconditional jump to the target
+ * \param	instructions	Receives the instructions or <b>nullptr</b> to only check if the jump can be encoded.
+ * \return	Returns <b>false</b> if the target can not be reached with the number of words. */
+static bool encodeLabelJump(RawInstruction* instructions, const CompilerLabelReference* reference, uint32_t target, uint32_t size)
+{
+    const uint32_t position = reference->newPosition;
+    if(reference->conditionReg == BranchAlways)
+        return encodeJump(instructions, position, target, size);
+
+    const int64_t offset = static_cast<int64_t>(target) - position;
+    if(offset != 0 && offset >= INT8_MIN && offset <= INT8_MAX)
+    {
+        // Branches without an offset do nothing, so they can pad the encoding.
+        if(instructions)
+        {
+            instructions[0] = makeInstruction(OpCodeBranch, reference->conditionReg, static_cast<int32_t>(offset));
+            for(uint32_t i = 1; i < size; ++i)
+                instructions[i] = makeInstruction(OpCodeBranch, BranchAlways, 0);
+        }
+        return true;
+    }
+
+    if(size < 3 || !encodeJump(instructions ? (instructions + 2) : nullptr, position + 2, target, size - 2))
+        return false;
+
+    if(instructions)
+    {
+        instructions[0] = makeInstruction(OpCodeBranch, reference->conditionReg, 2);
+        instructions[1] = makeInstruction(OpCodeBranch, BranchAlways, static_cast<int32_t>(size - 1));
+    }
+    return true;
+}
+
+/** Calculate the position of every jump to a label after the jumps in front of it got their encoding.
+ * \return	Returns the number of instructions that are added to the byte-code. */
+static uint32_t updateLabelReferencePositions(Lexer* lexer)
+{
+    uint32_t addedCount = 0;
+    for(uint32_t i = 0; i < lexer->labelReferenceCount; ++i)
+    {
+        CompilerLabelReference* reference = &lexer->arena->labelReferences[i];
+        reference->newPosition = reference->position + addedCount;
+        addedCount += reference->size - 1;
+    }
+    return addedCount;
+}
+
+/** Get the position of an instruction after the jumps in front of it got their encoding. */
+static uint32_t getNewLabelPosition(const Lexer* lexer, uint32_t position, uint32_t addedCount)
+{
+    // The jumps are sorted by position, find the first one at or behind the instruction.
+    const CompilerLabelReference* references = lexer->arena->labelReferences;
+    uint32_t begin = 0;
+    uint32_t end = lexer->labelReferenceCount;
+    while(begin < end)
+    {
+        const uint32_t middle = begin + (end - begin) / 2;
+        if(references[middle].position < position)
+            begin = middle + 1;
+        else
+            end = middle;
+    }
+
+    if(begin == lexer->labelReferenceCount)
+        return position + addedCount;
+    return position + (references[begin].newPosition - references[begin].position);
+}
+
+/** Replace the placeholders of all jumps to labels with the cheapest encoding. Every jump starts as a single branch and only
+ * grows while its target is out of reach, so the encodings settle after a few passes. Labels that are not defined are reported.
+ * \return	Returns <b>false</b> if the memory for the instructions could not be allocated. */
+static bool resolveLabels(Lexer* lexer)
+{
+    CompilerArena* arena = lexer->arena;
+    const uint32_t tableMask = buildLabelTable(lexer);
+    if(tableMask == InvalidPosition)
+        return false;
+
+    // Jumps can only land on instructions, so a label at the end of the source gets a halt instruction. The same goes for
+    // a conditional jump at the end, which jumps behind itself if the register is zero and the target is far away.
+    bool hasEndLabel = false;
+    if(lexer->labelReferenceCount > 0)
+    {
+        const CompilerLabelReference* reference = &arena->labelReferences[lexer->labelReferenceCount - 1];
+        hasEndLabel = (reference->position + 1 == lexer->instructionCount && reference->conditionReg != BranchAlways);
+    }
+
+    for(uint32_t i = 0; i < lexer->labelReferenceCount; ++i)
+    {
+        CompilerLabelReference* reference = &arena->labelReferences[i];
+        reference->labelIndex = *findLabelEntry(lexer, &reference->name, tableMask);
+        if(reference->labelIndex == InvalidPosition)
+        {
+            lexer->lineNumber = reference->lineNumber;
+            reportError(lexer, "Undefined label '%.*s'!", (int)reference->name.length, reference->name.text);
+        }
+        else if(arena->labels[reference->labelIndex].position == lexer->instructionCount)
+        {
+            hasEndLabel = true;
+        }
+    }
+
+    bool isChanged = true;
+    uint32_t addedCount = 0;
+    while(isChanged)
+    {
+        isChanged = false;
+        addedCount = updateLabelReferencePositions(lexer);
+        for(uint32_t i = 0; i < lexer->labelReferenceCount; ++i)
+        {
+            CompilerLabelReference* reference = &arena->labelReferences[i];
+            if(reference->labelIndex == InvalidPosition)
+                continue;
+
+            const uint32_t target = getNewLabelPosition(lexer, arena->labels[reference->labelIndex].position, addedCount);
+            uint32_t size = reference->size;
+            while(size <= MaxLabelJumpSize && !encodeLabelJump(nullptr, reference, target, size))
+                ++size;
+
+            if(size <= MaxLabelJumpSize && size != reference->size)
+            {
+                reference->size = static_cast<uint8_t>(size);
+                isChanged = true;
+            }
+        }
+    }
+
+    const uint32_t instructionCount = lexer->instructionCount + (hasEndLabel ? 1 : 0);
+    const uint32_t newInstructionCount = instructionCount + addedCount;
+    if(newInstructionCount > lexer->instructionCapacity)
+    {
+        arena->instructions = static_cast<RawInstruction*>(growArray(arena->instructions, lexer->instructionCount, newInstructionCount, sizeof(RawInstruction)));
+        arena->capacity = arena->instructions ? newInstructionCount : 0;
+        lexer->instructions = arena->instructions;
+        lexer->instructionCapacity = arena->capacity;
+        if(!arena->instructions)
+        {
+            lexer->instructionCount = 0;
+            return false;
+        }
+    }
+
+    if(hasEndLabel)
+        lexer->instructions[lexer->instructionCount] = makeInstruction(OpCodeHalt, 0, ExitCodeSuccess);
+
+    // Move the instructions back to front, so every instruction is moved before it gets overwritten.
+    uint32_t end = instructionCount;
+    for(uint32_t i = lexer->labelReferenceCount; i-- > 0;)
+    {
+        const CompilerLabelReference* reference = &arena->labelReferences[i];
+        memmove(&lexer->instructions[reference->newPosition + reference->size], &lexer->instructions[reference->position + 1],
+                sizeof(RawInstruction) * (end - reference->position - 1));
+        end = reference->position;
+
+        // Jumps to undefined labels got reported and do nothing. Every other label can be reached with MaxLabelJumpSize words.
+        RawInstruction* instructions = &lexer->instructions[reference->newPosition];
+        for(uint32_t j = 0; j < reference->size; ++j)
+            instructions[j] = makeInstruction(OpCodeBranch, BranchAlways, 0);
+        if(reference->labelIndex == InvalidPosition)
+            continue;
+
+        const CompilerLabel* label = &arena->labels[reference->labelIndex];
+        encodeLabelJump(instructions, reference, getNewLabelPosition(lexer, label->position, addedCount), reference->size);
+    }
+
+    lexer->instructionCount = newInstructionCount;
+    return true;
+}
+
+
+/*----------------------------------------------------------------------------------------------------------------
+ * 
+ *--------------------------------------------------------------------------------------------------------------*/  
+
+/** Entry of the mnemonic table. */
+struct Mnemonic
+{
+    /** Name of the instruction. Empty for unused entries. */
+    const char* text;
+    /** Length of the name in characters. */
+    size_t length;
+    /** Operation code of the instruction. */
+    OpCode opCode;
+};
+
+/** Perfect hash of the instruction names. The first three characters are unique for every instruction. */
+constexpr uint32_t hashMnemonic(const char* text)
+{
+    return (static_cast<uint32_t>(text[0]) * 3 + static_cast<uint32_t>(text[1]) * 9 + static_cast<uint32_t>(text[2])) & 31;
+}
+
+/** All instructions stored at the index of their hash. */
+static constexpr Mnemonic Mnemonics[32] =
+{
+    { "",     0, OpCodeHalt     }, { "",     0, OpCodeHalt     }, { "",     0, OpCodeHalt     }, { "jmp",  3, OpCodeJump     },
+    { "les",  3, OpCodeLet      }, { "",     0, OpCodeHalt     }, { "",     0, OpCodeHalt     }, { "",     0, OpCodeHalt     },
+    { "neq",  3, OpCodeNeq      }, { "",     0, OpCodeHalt     }, { "",     0, OpCodeHalt     }, { "add",  3, OpCodeAdd      },
+    { "",     0, OpCodeHalt     }, { "halt", 4, OpCodeHalt     }, { "",     0, OpCodeHalt     }, { "inv",  3, OpCodeInv      },
+    { "mul",  3, OpCodeMul      }, { "",     0, OpCodeHalt     }, { "cpy",  3, OpCodeCopy     }, { "div",  3, OpCodeDiv      },
+    { "eql",  3, OpCodeEql      }, { "",     0, OpCodeHalt     }, { "",     0, OpCodeHalt     }, { "",     0, OpCodeHalt     },
+    { "sub",  3, OpCodeSub      }, { "",     0, OpCodeHalt     }, { "set",  3, OpCodeSet      }, { "",     0, OpCodeHalt     },
+    { "gre",  3, OpCodeGrt      }, { "",     0, OpCodeHalt     }, { "",     0, OpCodeHalt     }, { "hcl",  3, OpCodeCallHost },
+};
+
+/** Check that every instruction is stored at the index of its hash. */
+constexpr bool isMnemonicTableValid(uint32_t index)
+{
+    return (index == 32) || ((Mnemonics[index].length == 0 || hashMnemonic(Mnemonics[index].text) == index) && isMnemonicTableValid(index + 1));
+}
+static_assert(isMnemonicTableValid(0), "Every mnemonic must be stored at the index of its hash!");
+
+static OpCode getOpCode(Lexer* lexer)
+{
+    const StringRef* identifier = &lexer->identifierString;
+    if(identifier->length == 3 || identifier->length == 4)
+    {
+        const Mnemonic* mnemonic = &Mnemonics[hashMnemonic(identifier->text)];
+        if(mnemonic->length == identifier->length && memcmp(mnemonic->text, identifier->text, identifier->length) == 0)
+            return mnemonic->opCode;
+    }
+
+    reportError(lexer, "Unknown instruction '%.*s'!", (int)identifier->length, identifier->text);
+    return OpCodeHalt;
+}
+
+static void handleInstruction(Lexer* lexer, MappedInstruction* inst)
+{
+    // @Bug: Every unknown instruction will be interpreted as "halt". This will eat the next token as it will be seen as the
+    // halt argument. We should add an OpCodeInvald(0) and handle it here and in getOpCode accordingly (e.g. generate "halt 251").
+    //    - C-574 (28.09.2017)  
+    OpCode opCode = getOpCode(lexer);
+    switch(opCode)
+    {
+    case OpCodeHalt:
+    {
+        inst->params.value = getNumber(lexer);
+    } break;
+    case OpCodeSet:
+    {
+        // Values that do not fit into the instruction become a wide set.
+        inst->params.destReg = getRegister(lexer);
+        inst->params.value   = getImmediate(lexer);
+        if(inst->params.value < 0 || inst->params.value > UINT8_MAX)
+        {
+            inst->wideOpCode = OpCodeSet;
+            opCode = OpCodeWide;
+        }
+    } break;
+    case OpCodeCopy: 
+    {
+        inst->params.destReg = getRegister(lexer);
+        inst->params.argRegA = getRegister(lexer);
+    } break;
+    case OpCodeAdd:
+    case OpCodeSub:
+    case OpCodeMul:
+    case OpCodeDiv:
+    case OpCodeEql:
+    case OpCodeNeq:
+    case OpCodeGrt:
+    case OpCodeLet:
+    {
+        // "op dst src imm" combines a register with an immediate in a wide instruction.
+        inst->params.destReg = getRegister(lexer);
+        inst->params.argRegA = getRegister(lexer);
+        getNextToken(lexer);
+        if(lexer->token == TokenNumber)
+        {
+            inst->params.value = parseImmediate(lexer);
+            inst->wideOpCode = opCode;
+            opCode = OpCodeWide;
+        }
+        else
+        {
+            inst->params.argRegB = parseRegister(lexer);
+        }
+    } break;
+    case OpCodeInv:	
+    {
+        inst->params.destReg = getRegister(lexer);
+    } break;
+    
+    case OpCodeJump:
+    {
+        // Jumps to labels become branches: "jmp label" always jumps, "jmp reg label" jumps if the register is not zero.
+        getNextToken(lexer);
+        if(lexer->token == TokenIdentifier)
+        {
+            opCode = OpCodeBranch;
+            inst->params.destReg = BranchAlways;
+            addLabelReference(lexer, BranchAlways);
+            break;
+        }
+
+        inst->params.destReg = parseRegister(lexer);
+        getNextToken(lexer);
+        if(lexer->token == TokenIdentifier)
+        {
+            opCode = OpCodeBranch;
+            addLabelReference(lexer, static_cast<uint8_t>(inst->params.destReg));
+        }
+        else
+        {
+            inst->params.value = parseNumber(lexer);
+        }
+    } break;
+    case OpCodeCallHost:
+    {
+        int32_t groupId = getNumber(lexer);
+        if(groupId > 0xF)
+        {
+            reportError(lexer, "Host call group id is out of bounds! Got: '%d', maximum is 15", groupId);
+            groupId = 0xF;
+        }
+        inst->params.destReg = groupId;
+        inst->params.value   = getNumber(lexer);
+    } break;
+    default:
+    {
+    } break;
     }
 
-    return (vm->exitCode);
+    inst->opCode = opCode;
 }
 
-PHO_DECL void setDebugCallback(VirtualMachine* vm, fDebugCallback* callback)
+static void handleIdentifier(Lexer* lexer)
 {
-#if PHOTON_DEBUG_CALLBACK_ENABLED
-    vm->debugCallback = callback;
-#endif // PHOTON_DEBUG_CALLBACK_ENABLED
+    MappedInstruction inst = {};
+    handleInstruction(lexer, &inst);
+
+    const uint32_t size = (inst.opCode == OpCodeWide) ? WideInstructionSize : 1;
+    if(lexer->instructionCapacity - lexer->instructionCount >= size)
+    {
+        lexer->instructionCount += packInstruction(&inst, &lexer->instructions[lexer->instructionCount]);
+    }
+    else
+    {
+        fprintf(stderr, "INTERNAL COMPILER ERROR: Instruction buffer is too small!\n");
+    }
 }
 
 
 /*----------------------------------------------------------------------------------------------------------------
- * Compiler Implementation
- *--------------------------------------------------------------------------------------------------------------*/  
+ * Optimizer
+ *--------------------------------------------------------------------------------------------------------------*/
 
-#ifndef PHOTON_NO_COMPILER
+/** Flags of an instruction that gets optimized. */
+enum OptimizerFlag
+{
+    /** The instruction can be reached from the first instruction. */
+    OptimizerFlagReachable = 0x1,
+    /** The instruction writes the value that is already stored in the register, e.g. a copy of a register into itself. */
+    OptimizerFlagNoEffect = 0x2,
+    /** The instruction writes a register that is always overwritten before it is read. */
+    OptimizerFlagDeadStore = 0x4,
+    /** The instruction must stay at its position because the offset of a jump can not be fixed up. */
+    OptimizerFlagKeep = 0x8
+};
 
-/** Checks if the specified character is an end of line. 
- * This will handle both \n and \r end-lines. */
-inline bool isEndOfLine(uint8_t c)
+/** Jump or branch that can be reached from the first instruction. */
+struct OptimizerJump
 {
-    return ((c == '\n') ||
-            (c == '\r'));
-}
+    /** Position of the jump instruction. */
+    uint32_t position;
+    /** Register that holds the offset of the jump or the condition of the branch. BranchAlways if the branch reads no register. */
+    uint32_t offsetReg;
+    /** All values that the offset register holds when the jump is executed. For branches these are the offsets that can be
+     * taken: the offset of the branch and 0 if the branch can fall through. */
+    AbstractValue offset;
+    bool isRelative;
+    /** Flag to indicate that the offset is stored in the branch instruction itself. */
+    bool isBranch;
+};
 
-/** Checks if the specified character is whitespace (space, tab or end of line). */
-inline bool isWhitespace(uint8_t c)
+/** Internal data that is used while the instructions get optimized. */
+struct Optimizer
 {
-    return ((c == ' ') ||
-            (c == '\t') ||
-            (isEndOfLine(c)));
+    /** Instructions that get optimized in place. */
+    RawInstruction* instructions;
+    uint32_t instructionCount;
+    /** Register values of all reachable blocks and the size of every instruction. */
+    ByteCodeAnalysis analysis;
+    /** Combination of OptimizerFlag values for every instruction. The immediate words of wide instructions have no flags. */
+    uint8_t* flags;
+    /** Registers that are read before they are written on any path that starts at an instruction. The entry after the last
+     * instruction contains all registers, because all of them can be read by the host application after the VM halted. */
+    uint16_t* liveRegisters;
+    /** Position of every instruction after all removed instructions are gone. The entry after the last instruction holds the new
+     * instruction count. */
+    uint32_t* newPositions;
+    /** All reachable jumps, sorted by position. */
+    OptimizerJump* jumps;
+    uint32_t jumpCount;
+    /** Flag to indicate that a jump can leave the byte-code. No instruction may be removed in this case. */
+    bool hasJumpOutOfBounds;
+};
+
+/** Check if an instruction with the specified flags is removed from the byte-code. */
+inline bool isInstructionRemoved(uint8_t flags)
+{
+    if(flags & OptimizerFlagKeep)
+        return false;
+    return !(flags & OptimizerFlagReachable) || (flags & (OptimizerFlagNoEffect | OptimizerFlagDeadStore));
 }
 
-/** Check if the specified character is an alphabetic value.*/
-inline bool isAlpha(uint8_t c)
+/** Unpack the instruction that starts at the specified position, including the immediate of a wide instruction. */
+inline void unpackOptimizerInstruction(const Optimizer* optimizer, uint32_t position, MappedInstruction* instruction)
 {
-    return (((c >= 'a') && (c <= 'z')) ||
-            ((c >= 'A') && (c <= 'Z')));
+    unpackInstruction(&optimizer->instructions[position], optimizer->instructionCount - position, instruction);
 }
 
-/** Check if the specified character is a numeric value. */
-inline bool isNumber(uint8_t c)
+/** Get the position that a jump continues at for the specified offset. */
+inline uint32_t getOptimizerJumpTarget(const OptimizerJump* jump, int32_t offset)
 {
-    return ((c >= '0') && (c <= '9'));
+    if(!jump->isRelative)
+        return static_cast<uint32_t>(offset);
+    return (offset == 0) ? (jump->position + 1) : (jump->position + offset);
 }
 
-/** Convert a string to a signed 32-bit integer value.
- * This supports decimal numbers as well as negative and positive numbers. 
- * If the number could not be parsed then this function will return the numeric value up to the 
- * point of the parser error (e.g. "24c6" => 24). */
-inline int32_t stringToSint(const char* str)
+/** Get the registers that the specified jump reads. */
+inline uint16_t getJumpReads(const OptimizerJump* jump)
 {
-    int32_t sign = 1;
-    int32_t value = 0;
-    uint8_t c;
+    return (jump->offsetReg == BranchAlways) ? 0 : static_cast<uint16_t>(1U << jump->offsetReg);
+}
 
-    if(*str == '-')
-    {
-        sign = -1;
-        ++str;
-    }
-    
-    for(;;)
+/** Check if the specified jump can continue at another instruction than the next one. runFor, resume and the scheduler
+ * check the instruction budget when a jump is taken, so the VM can be stopped there and the host can read all registers. */
+inline bool canTakeJump(const OptimizerJump* jump)
+{
+    if(!jump->isRelative)
+        return true;
+    for(uint8_t i = 0; i < jump->offset.count; ++i)
     {
-        c = *str;
-        ++str;
-        if((c < '0') || (c > '9'))
-            return (sign * value);
-        value = value * 10 + c - '0';
+        if(jump->offset.values[i] != 0)
+            return true;
     }
+    return false;
 }
 
-
-/*----------------------------------------------------------------------------------------------------------------
- * Data Structures
- *--------------------------------------------------------------------------------------------------------------*/  
-
-/** Token types that can be generated by the lexer. */
-enum Token
+/** Get the registers that are live after the specified jump. */
+static uint16_t getLiveRegistersAfterJump(const Optimizer* optimizer, const OptimizerJump* jump)
 {
-    /** Unknown or invalid token. */
-    TokenUnknown,
-    /** The token indicates that the end of the file to parse has been reached. */
-    TokenEOF,
-    
-    /** The token is an identifier. This can be an instruction or a function name. */ 
-    TokenIdentifier,
-    /** The token is a numeric value. */
-    TokenNumber,
-    /** The token is a register of the VM. */
-    TokenRegister,
-};
-
-
-/*----------------------------------------------------------------------------------------------------------------
- * 
- *--------------------------------------------------------------------------------------------------------------*/  
+    uint16_t live = 0;
+    for(uint8_t i = 0; i < jump->offset.count; ++i)
+        live |= optimizer->liveRegisters[getOptimizerJumpTarget(jump, jump->offset.values[i])];
+    return live;
+}
 
-/** Internal string structure that indexes into a larger source string. */
-struct StringRef
+/** Replace an instruction that always writes the same value with a set instruction. Wide instructions become a wide set,
+ * all other instructions only if the value fits into 8 bits, so the size of every instruction stays the same.
+ * Instructions that write the value that the register already holds are marked as having no effect. */
+static void foldInstruction(Optimizer* optimizer, uint32_t position, MappedInstruction* instruction, const AbstractState* state)
 {
-    /** Pointer to the start of the string. */
-    char* text;
-    /** Size of the string in characters. */
-    size_t length;
-};
+    if(validateInstruction(instruction) != ExitCodeSuccess)
+        return;
 
+    // Every operand must hold a single value, so the instruction writes the same value on every path.
+    const bool isWide = (instruction->opCode == OpCodeWide);
+    const uint32_t opCode = isWide ? instruction->wideOpCode : instruction->opCode;
+    const AbstractValue* argA = &state->registers[instruction->params.argRegA];
+    const AbstractValue* argB = &state->registers[instruction->params.argRegB];
+    const AbstractValue* dest = &state->registers[instruction->params.destReg];
+    int32_t value;
+    switch(opCode)
+    {
+    case OpCodeSet:
+    {
+        value = instruction->params.value;
+    } break;
+    case OpCodeCopy:
+    {
+        if(instruction->params.destReg == static_cast<uint32_t>(instruction->params.argRegA))
+        {
+            optimizer->flags[position] |= OptimizerFlagNoEffect;
+            return;
+        }
+        if(argA->count != 1)
+            return;
+        value = argA->values[0];
+    } break;
+    case OpCodeInv:
+    {
+        if(dest->count != 1)
+            return;
+        value = static_cast<int32_t>(0U - static_cast<uint32_t>(dest->values[0]));
+    } break;
+    case OpCodeAdd:
+    case OpCodeSub:
+    case OpCodeMul:
+    case OpCodeDiv:
+    case OpCodeEql:
+    case OpCodeNeq:
+    case OpCodeGrt:
+    case OpCodeLet:
+    {
+        if(argA->count != 1 || (!isWide && argB->count != 1))
+            return;
+        const int32_t b = isWide ? instruction->params.value : argB->values[0];
+        if(!evaluateOperation(opCode, argA->values[0], b, &value))
+            return;
+    } break;
+    default:
+        return;
+    }
 
-/*----------------------------------------------------------------------------------------------------------------
- * 
- *--------------------------------------------------------------------------------------------------------------*/  
+    if(dest->count == 1 && dest->values[0] == value)
+    {
+        optimizer->flags[position] |= OptimizerFlagNoEffect;
+    }
+    else if(opCode != OpCodeSet && (isWide || (value >= 0 && value <= 0xFF)))
+    {
+        if(isWide)
+            instruction->wideOpCode = OpCodeSet;
+        else
+            instruction->opCode = OpCodeSet;
+        instruction->params.value = value;
+        instruction->params.argRegA = 0;
+        instruction->params.argRegB = 0;
+        packInstruction(instruction, &optimizer->instructions[position]);
+    }
+}
 
-/** Structure that contains data for a single instruction. */
-struct InstructionNode
+/** Fold all instructions of the block that starts at the specified position and collect its jumps. Works like analyseBlock. */
+static void foldBlock(Optimizer* optimizer, uint32_t position)
 {
-    /** Next instruction node in the list. Null if no successor. */
-    InstructionNode* next;
-    /** MappedInstruction data mapped into memory. */
-    MappedInstruction inst;
-};
-
-
-/*----------------------------------------------------------------------------------------------------------------
- * 
- *--------------------------------------------------------------------------------------------------------------*/  
+    const ByteCodeAnalysis* analysis = &optimizer->analysis;
+    AbstractState state = analysis->blocks[analysis->blockIndices[position]].state;
 
-/** Internal structure that contains data that is used to generate tokens from a source string. */
-struct Lexer
-{
-    /** Current position of the lexer in the string to parse. */
-    char* at;
-    /** The last string that was found with the last Identifier token. */
-    StringRef identifierString;
-    /** The current token. Use getNextToken to get the next token in the input stream. */
-    Token token;
+    for(uint32_t i = position; i < optimizer->instructionCount; i += analysis->instructionSizes[i])
+    {
+        if(i != position && analysis->blockIndices[i] != InvalidPosition)
+            return;
+        optimizer->flags[i] |= OptimizerFlagReachable;
+
+        MappedInstruction instruction;
+        unpackOptimizerInstruction(optimizer, i, &instruction);
+        const bool isBranch = (instruction.opCode == OpCodeBranch && instruction.params.value != 0);
+        if((instruction.opCode != OpCodeJump && !isBranch) || validateInstruction(&instruction) != ExitCodeSuccess)
+        {
+            foldInstruction(optimizer, i, &instruction, &state);
+            if(!transferInstruction(&instruction, &state))
+                return;
+            continue;
+        }
 
-    /** Head of the instruction node list. */
-    InstructionNode* nodeHead;
-    /** Tail of the instruction node list. */
-    InstructionNode* nodeTail;
+        // The analysis succeeded, so the offset of every reachable jump is known.
+        OptimizerJump* jump = &optimizer->jumps[optimizer->jumpCount++];
+        jump->position = i;
+        jump->offsetReg = instruction.params.destReg;
+        jump->isRelative = (instruction.params.value == 0) || isBranch;
+        jump->isBranch = isBranch;
+        if(isBranch)
+        {
+            // A branch behaves like a relative jump that reads either its offset or 0 from the condition.
+            const int32_t offset = static_cast<int8_t>(instruction.params.value);
+            const AbstractValue* condition = (instruction.params.destReg == BranchAlways) ? nullptr : &state.registers[instruction.params.destReg];
+            jump->offset = {};
+            if(!condition || condition->count == AbstractValueUnknown)
+            {
+                addAbstractValue(&jump->offset, offset);
+                if(condition)
+                    addAbstractValue(&jump->offset, 0);
+            }
+            else
+            {
+                for(uint8_t v = 0; v < condition->count; ++v)
+                    addAbstractValue(&jump->offset, (condition->values[v] != 0) ? offset : 0);
+            }
 
-    /** Current line that the parser is currently at. For error reporting only. */
-    uint32_t lineNumber;
-    /** Path to the file that is getting parsed. For error reporting only. */
-    const char* fileName;
-};
+            // A branch that is never taken can be removed like any other instruction without an effect.
+            if(jump->offset.count == 1 && jump->offset.values[0] == 0)
+                optimizer->flags[i] |= OptimizerFlagNoEffect;
+        }
+        else
+        {
+            jump->offset = state.registers[instruction.params.destReg];
+        }
 
+        bool isFallthrough = false;
+        for(uint8_t v = 0; v < jump->offset.count; ++v)
+        {
+            if(jump->isRelative && jump->offset.values[v] == 0)
+                isFallthrough = true;
+            else if(getOptimizerJumpTarget(jump, jump->offset.values[v]) >= optimizer->instructionCount)
+                optimizer->hasJumpOutOfBounds = true;
+        }
 
-/*----------------------------------------------------------------------------------------------------------------
- * 
- *--------------------------------------------------------------------------------------------------------------*/  
+        if(!isFallthrough)
+            return;
+    }
+}
 
-/** Reports a compiler error to the user. */
-static void reportErrorInternal(Lexer* lexer, const char* format, ...)
+/** Find the registers that are live at every instruction and mark all stores to registers that are not live. A register is
+ * live if its value can be read before it gets overwritten. The reads of instructions that get removed do not count.
+ * All registers are live at a jump that can be taken, because the VM may be stopped there by an instruction budget. */
+static void findDeadStores(Optimizer* optimizer)
 {
-    va_list list;
+    const uint32_t instructionCount = optimizer->instructionCount;
+    memset(optimizer->liveRegisters, 0, sizeof(uint16_t) * instructionCount);
+    optimizer->liveRegisters[instructionCount] = AllRegisters;
 
-    // @Extendable: Notify lexer or do some sort of error tracking. 
-    //    - C-574 (18.08.2017)
-
-    va_start(list, format);
-    vprintf(format, list);
-    va_end(list);
-}
+    // The registers only get added to the live sets, so repeat until nothing changes anymore.
+    bool isChanged = true;
+    while(isChanged)
+    {
+        isChanged = false;
+        uint32_t jumpIndex = optimizer->jumpCount;
+        for(uint32_t i = instructionCount; i-- > 0;)
+        {
+            if(!(optimizer->flags[i] & OptimizerFlagReachable))
+                continue;
 
-#define reportError(lexer, format, ...) \
-{ reportErrorInternal(lexer, "%s(%d): [ERROR] " format "\n", (lexer->fileName ? lexer->fileName : "<unknown>"), lexer->lineNumber, ##__VA_ARGS__); }
+            uint16_t live;
+            if(jumpIndex > 0 && optimizer->jumps[jumpIndex - 1].position == i)
+            {
+                const OptimizerJump* jump = &optimizer->jumps[--jumpIndex];
+                live = canTakeJump(jump) ? AllRegisters : (getLiveRegistersAfterJump(optimizer, jump) | getJumpReads(jump));
+            }
+            else
+            {
+                MappedInstruction instruction;
+                unpackOptimizerInstruction(optimizer, i, &instruction);
+                uint16_t reads, writes;
+                getRegisterAccess(&instruction, &reads, &writes);
+
+                live = optimizer->liveRegisters[i + optimizer->analysis.instructionSizes[i]];
+                const bool isDeadStore = (reads != AllRegisters) && writes && !(live & writes);
+                if(optimizer->flags[i] & OptimizerFlagNoEffect)
+                {
+                    // The register keeps its value, but the instruction may have to stay for a jump and then reads its operands.
+                    live |= reads & ~writes;
+                }
+                else if(!isDeadStore)
+                {
+                    live = (live & ~writes) | reads;
+                }
+            }
 
+            if(live != optimizer->liveRegisters[i])
+            {
+                optimizer->liveRegisters[i] = live;
+                isChanged = true;
+            }
+        }
+    }
 
-/*----------------------------------------------------------------------------------------------------------------
- * 
- *--------------------------------------------------------------------------------------------------------------*/  
+    for(uint32_t i = 0; i < instructionCount; i += optimizer->analysis.instructionSizes[i])
+    {
+        MappedInstruction instruction;
+        unpackOptimizerInstruction(optimizer, i, &instruction);
+        if(!(optimizer->flags[i] & OptimizerFlagReachable) || instruction.opCode == OpCodeJump || instruction.opCode == OpCodeBranch)
+            continue;
+
+        uint16_t reads, writes;
+        getRegisterAccess(&instruction, &reads, &writes);
+        if((reads != AllRegisters) && writes && !(optimizer->liveRegisters[i + optimizer->analysis.instructionSizes[i]] & writes))
+            optimizer->flags[i] |= OptimizerFlagDeadStore;
+    }
+}
 
-/** Convert a token type to a human readable string. */
-inline const char* tokenToString(Token token)
+/** Calculate the position of every instruction after all removed instructions are gone. Immediate words have a size of 0,
+ * so they move with the wide instruction in front of them. */
+static void updateNewPositions(Optimizer* optimizer)
 {
-    switch(token)
+    uint32_t position = 0;
+    for(uint32_t i = 0; i < optimizer->instructionCount; ++i)
     {
-    case TokenEOF:
-        return "end of file";
-    case TokenIdentifier:
-        return "identifier";
-    case TokenNumber:
-        return "number";
-    case TokenRegister:
-        return "register";
-    case TokenUnknown:
-    default: {} break;
+        optimizer->newPositions[i] = position;
+        if(!isInstructionRemoved(optimizer->flags[i]))
+            position += optimizer->analysis.instructionSizes[i];
     }
-    return "unknown";
+    optimizer->newPositions[optimizer->instructionCount] = position;
 }
 
+/** Get the offset that makes a jump continue at the same instruction after all removed instructions are gone. */
+static int32_t getNewJumpOffset(const Optimizer* optimizer, const OptimizerJump* jump, int32_t offset)
+{
+    if(jump->isRelative && offset == 0)
+        return 0;
 
-/*----------------------------------------------------------------------------------------------------------------
- * Lexical Functions 
- *--------------------------------------------------------------------------------------------------------------*/  
+    const uint32_t target = optimizer->newPositions[getOptimizerJumpTarget(jump, offset)];
+    if(!jump->isRelative)
+        return static_cast<int32_t>(target);
+    return static_cast<int32_t>(target - optimizer->newPositions[jump->position]);
+}
 
-/** Check if the current identifier equals a required token string.
- * \param   lexer       Lexer which contains the current identifier string to compare to. 
- * \param   tokenString Token string that is required. 
- * \return Returns <b>true</b> if the required token is found or otherwise <b>false</b>. */
-inline bool isTokenStringEqual(Lexer* lexer, const char* tokenString)
+/** Find the set instruction that writes the offset of a jump. The value of the set instruction can only be changed if no
+ * other instruction can read it and if the jump can not be entered from anywhere else. An inv instruction may follow the set,
+ * which is either a set or a wide set.
+ * \return	Returns the position of the set instruction or InvalidPosition if there is none. */
+static uint32_t findJumpOffsetSource(const Optimizer* optimizer, const OptimizerJump* jump, bool* isInverted)
 {
-    return (strncmp(tokenString, lexer->identifierString.text, lexer->identifierString.length) == 0);
-}
+    const uint16_t offsetMask = static_cast<uint16_t>(1U << jump->offsetReg);
+    if(jump->offset.count != 1 || (getLiveRegistersAfterJump(optimizer, jump) & offsetMask))
+        return InvalidPosition;
 
+    *isInverted = false;
+    uint32_t position = jump->position;
+    while(position > 0 && optimizer->analysis.blockIndices[position] == InvalidPosition)
+    {
+        --position;
+        if(optimizer->analysis.instructionSizes[position] == 0 || isInstructionRemoved(optimizer->flags[position]))
+            continue;
+
+        MappedInstruction instruction;
+        unpackOptimizerInstruction(optimizer, position, &instruction);
+        uint16_t reads, writes;
+        getRegisterAccess(&instruction, &reads, &writes);
+        const bool isSet = (instruction.opCode == OpCodeSet) || (instruction.opCode == OpCodeWide && instruction.wideOpCode == OpCodeSet);
+        if(isSet && writes == offsetMask)
+            return position;
+
+        if(instruction.opCode == OpCodeInv && writes == offsetMask && !*isInverted)
+            *isInverted = true;
+        else if(instruction.opCode == OpCodeJump || instruction.opCode == OpCodeBranch || ((reads | writes) & offsetMask))
+            break;
+    }
 
-/*----------------------------------------------------------------------------------------------------------------
- * 
- *--------------------------------------------------------------------------------------------------------------*/
+    return InvalidPosition;
+}
 
-/** Check if the specified identifier string is a register name. 
- * This will automatically remove the register prefix (rX and regX) from the identifier leaving only the index.
- * Note that this will <b>not</b> check whether the register index is out of bounds. 
- * \param	identifier	Identifier to check.
- * \return	Returns <b>true</b> if the identifier is a register name, <b>false</b> otherwise. */
-static bool isIdentifierRegister(StringRef* identifier)
+/** Keep all instructions between a jump and its target, including the target, so the offset stays the same.
+ * \return	Returns <b>true</b> if any instruction that would have been removed is kept now. */
+static bool keepJumpRange(Optimizer* optimizer, const OptimizerJump* jump, int32_t offset)
 {
-    // regX
-    if(identifier->length >= 4 && 
-        identifier->text[0] == 'r' &&
-        identifier->text[1] == 'e' &&
-        identifier->text[2] == 'g' &&
-        isNumber(identifier->text[3]))
+    if(jump->isRelative && offset == 0)
+        return false;
+
+    const uint32_t target = getOptimizerJumpTarget(jump, offset);
+    uint32_t begin = 0;
+    uint32_t end = target;
+    if(jump->isRelative)
     {
-        identifier->text += 3;
-        identifier->length -= 3;
-        return true;
+        begin = (target < jump->position) ? target : jump->position;
+        end   = (target < jump->position) ? jump->position : target;
     }
-    // rX
-    if(identifier->length >= 1 && 
-        identifier->length <= 3 && 
-        identifier->text[0] == 'r' && 
-        isNumber(identifier->text[1]))
+
+    bool isChanged = false;
+    for(uint32_t i = begin; i <= end; ++i)
     {
-        identifier->text += 1;
-        identifier->length--;
-        return true;
+        if(isInstructionRemoved(optimizer->flags[i]))
+        {
+            optimizer->flags[i] |= OptimizerFlagKeep;
+            isChanged = true;
+        }
     }
-
-    return false;
+    return isChanged;
 }
 
-
-/*----------------------------------------------------------------------------------------------------------------
- * 
- *--------------------------------------------------------------------------------------------------------------*/
-
-/** Moves the position of the lexer's cursor forward until all whitespace is skipped.
- * This will automatically ignore spaces, tabs, end-of-lines and comments. 
- * \param   lexer   Lexer to parse the input. */
-static void eatAllWhitespace(Lexer* lexer)
+/** Check if a jump continues at the same instructions after all removed instructions are gone, either with its current offset
+ * or with a new value of the set instruction that writes the offset. The offset of a branch is changed in the branch itself.
+ * \param	sourcePosition	Receives the position of the set instruction or branch that must be changed or InvalidPosition.
+ * \param	sourceValue		Receives the new value of the set instruction or branch. */
+static bool canFixJump(const Optimizer* optimizer, const OptimizerJump* jump, uint32_t* sourcePosition, int32_t* sourceValue)
 {
-    while(isWhitespace(lexer->at[0]))
+    *sourcePosition = InvalidPosition;
+    bool isMoved = false;
+    for(uint8_t i = 0; i < jump->offset.count; ++i)
     {
-        if(isEndOfLine(lexer->at[0]))
+        const int32_t offset = jump->offset.values[i];
+        const int32_t newOffset = getNewJumpOffset(optimizer, jump, offset);
+
+        // All instructions between the jump and a target in front of it got removed, a relative jump can not address itself.
+        if(jump->isRelative && offset != 0 && newOffset == 0)
+            return false;
+        // The target and all instructions after it got removed, but jumping to the end is not the same as reaching it.
+        if(offset != 0 || !jump->isRelative)
         {
-            if(isEndOfLine(lexer->at[1])) // Make sure to handle \r\n as one new line.
-                ++lexer->at;
-            ++lexer->lineNumber;
+            const uint32_t target = getOptimizerJumpTarget(jump, offset);
+            if(optimizer->newPositions[target] == optimizer->newPositions[optimizer->instructionCount])
+                return false;
         }
-        ++lexer->at;
+        isMoved |= (newOffset != offset);
     }
 
-    if(lexer->at[0] == '#')
-    {
-        do ++lexer->at;
-        while(lexer->at[0] != '\0' && !isEndOfLine(lexer->at[0]));
+    if(!isMoved)
+        return true;
 
-        eatAllWhitespace(lexer);
-    }
-    else if(lexer->at[0] == '\0')
+    if(jump->isBranch)
     {
-        lexer->token = TokenEOF;
+        // Removing instructions only moves the target closer, so the new offset always fits.
+        *sourcePosition = jump->position;
+        for(uint8_t i = 0; i < jump->offset.count; ++i)
+        {
+            if(jump->offset.values[i] != 0)
+                *sourceValue = getNewJumpOffset(optimizer, jump, jump->offset.values[i]);
+        }
+        return (*sourceValue >= INT8_MIN && *sourceValue <= INT8_MAX);
     }
-}
 
+    bool isInverted;
+    *sourcePosition = findJumpOffsetSource(optimizer, jump, &isInverted);
+    if(*sourcePosition == InvalidPosition)
+        return false;
 
-/*----------------------------------------------------------------------------------------------------------------
- * 
- *--------------------------------------------------------------------------------------------------------------*/
+    // A wide set can hold any offset.
+    const int32_t newOffset = getNewJumpOffset(optimizer, jump, jump->offset.values[0]);
+    *sourceValue = isInverted ? -newOffset : newOffset;
+    if(optimizer->analysis.instructionSizes[*sourcePosition] == WideInstructionSize)
+        return true;
+    return (*sourceValue >= 0 && *sourceValue <= 0xFF);
+}
 
-/** Get the next token from the input data and stores it in the lexer's token field. 
- * \param   lexer   Lexer that is used to convert the input data into tokens.  */
-static void getNextToken(Lexer* lexer)
+/** Make sure that every jump continues at the same instruction after all removed instructions are gone. Jumps that can not
+ * be fixed up keep all instructions between them and their targets. */
+static void fixJumps(Optimizer* optimizer)
 {
-    Token token = TokenUnknown;
-    eatAllWhitespace(lexer);
-
-    if(lexer->token == TokenEOF)
-        return;
-
-    // Identifier: [a-zA-Z][a-zA-Z0-9]*
-    if(isAlpha(lexer->at[0]))
+    bool isChanged = true;
+    while(isChanged)
     {
-        lexer->identifierString.text = lexer->at;
-        while(isAlpha(lexer->at[0]) || isNumber(lexer->at[0]))
-        {
-            ++lexer->at;
-        } 
+        isChanged = false;
+        updateNewPositions(optimizer);
 
-        token = TokenIdentifier;
-        lexer->identifierString.length = lexer->at - lexer->identifierString.text; 
-
-        if(isIdentifierRegister(&lexer->identifierString))
+        for(uint32_t i = 0; i < optimizer->jumpCount; ++i)
         {
-            token = TokenRegister;
+            const OptimizerJump* jump = &optimizer->jumps[i];
+            uint32_t sourcePosition;
+            int32_t sourceValue;
+            if(canFixJump(optimizer, jump, &sourcePosition, &sourceValue))
+                continue;
+
+            for(uint8_t v = 0; v < jump->offset.count; ++v)
+                isChanged |= keepJumpRange(optimizer, jump, jump->offset.values[v]);
         }
-#if 0
-        // Handle specific token strings.
-        if(isTokenStringEqual(lexer, "function"))  token = TokenFunctionBegin;
-        else if(isTokenStringEqual(lexer, "end"))  token = TokenFunctionEnd;
-        else if(isTokenStringEqual(lexer, "call")) token = TokenFunctionCall;
-#endif
     }
-    // Number: [0-9.]+
-    else if(isNumber(lexer->at[0]))
+
+    // No more instructions are kept, so the new positions are final.
+    for(uint32_t i = 0; i < optimizer->jumpCount; ++i)
     {
-        StringRef valueString = {};
-        valueString.text = lexer->at;
-        while(isNumber(lexer->at[0]))
+        uint32_t sourcePosition;
+        int32_t sourceValue;
+        if(canFixJump(optimizer, &optimizer->jumps[i], &sourcePosition, &sourceValue) && sourcePosition != InvalidPosition)
         {
-            ++lexer->at;
-        } 
-
-        valueString.length = lexer->at - valueString.text;
-        lexer->identifierString = valueString;
+            MappedInstruction instruction;
+            unpackOptimizerInstruction(optimizer, sourcePosition, &instruction);
+            instruction.params.value = (instruction.opCode == OpCodeWide) ? sourceValue : (sourceValue & 0xFF);
+            instruction.params.argRegA = 0;
+            instruction.params.argRegB = 0;
+            packInstruction(&instruction, &optimizer->instructions[sourcePosition]);
+        }
+    }
+}
 
-        token = TokenNumber;
+/** Make sure that the optimizer buffers of the arena can hold the specified number of instructions and jumps.
+ * \return	Returns <b>false</b> if the memory could not be allocated. */
+static bool reserveOptimizerMemory(CompilerArena* arena, uint32_t instructionCount, uint32_t jumpCount)
+{
+    // The live registers and the new positions have an extra entry behind the last instruction.
+    if(arena->optimizerCapacity < instructionCount + 1)
+    {
+        pho_free(arena->optimizerFlags);
+        pho_free(arena->liveRegisters);
+        pho_free(arena->newPositions);
+        arena->optimizerFlags = static_cast<uint8_t*>(pho_malloc(sizeof(uint8_t) * (instructionCount + 1)));
+        arena->liveRegisters = static_cast<uint16_t*>(pho_malloc(sizeof(uint16_t) * (instructionCount + 1)));
+        arena->newPositions = static_cast<uint32_t*>(pho_malloc(sizeof(uint32_t) * (instructionCount + 1)));
+        const bool isAllocated = arena->optimizerFlags && arena->liveRegisters && arena->newPositions;
+        arena->optimizerCapacity = isAllocated ? instructionCount + 1 : 0;
+        if(!isAllocated)
+            return false;
     }
-    else
+
+    if(arena->optimizerJumpCapacity < jumpCount || !arena->optimizerJumps)
     {
-        reportError(lexer, "Unknown character '%c'! Only alphabetic or numeric characters are allowed.", lexer->at[0]);
-        ++lexer->at;
+        const uint32_t capacity = jumpCount ? jumpCount : 1;
+        pho_free(arena->optimizerJumps);
+        arena->optimizerJumps = static_cast<OptimizerJump*>(pho_malloc(sizeof(OptimizerJump) * capacity));
+        arena->optimizerJumpCapacity = arena->optimizerJumps ? capacity : 0;
+        if(!arena->optimizerJumps)
+            return false;
     }
 
-    lexer->token = token;
+    return true;
 }
 
+/** Move the memory of the analysis between the arena and the analysis. The analysis owns it while the optimizer runs, so
+ * rerunAnalysis can reuse it, and the arena keeps it for the next compile. */
+static void swapAnalysisMemory(CompilerArena* arena, ByteCodeAnalysis* analysis)
+{
+    uint32_t* blockIndices = analysis->blockIndices;
+    uint32_t* blockOwners = analysis->blockOwners;
+    uint8_t* instructionSizes = analysis->instructionSizes;
+    uint32_t instructionCapacity = analysis->instructionCapacity;
+    AbstractBlock* blocks = analysis->blocks;
+    uint32_t* queue = analysis->queue;
+    uint32_t blockCapacity = analysis->blockCapacity;
+
+    analysis->blockIndices = arena->blockIndices;
+    analysis->blockOwners = arena->blockOwners;
+    analysis->instructionSizes = arena->instructionSizes;
+    analysis->instructionCapacity = arena->analysisCapacity;
+    analysis->blocks = arena->blocks;
+    analysis->queue = arena->blockQueue;
+    analysis->blockCapacity = arena->blockCapacity;
+
+    arena->blockIndices = blockIndices;
+    arena->blockOwners = blockOwners;
+    arena->instructionSizes = instructionSizes;
+    arena->analysisCapacity = instructionCapacity;
+    arena->blocks = blocks;
+    arena->blockQueue = queue;
+    arena->blockCapacity = blockCapacity;
+}
 
-/*----------------------------------------------------------------------------------------------------------------
- * 
- *--------------------------------------------------------------------------------------------------------------*/  
-
-static int32_t getNumber(Lexer* lexer)
+/** Optimize the instructions in place. Nothing gets optimized if the jumps of the instructions can not be resolved.
+ * All scratch memory is taken from the arena and stays there for the next compile.
+ * \return	Returns the number of instructions that are left. */
+static uint32_t optimizeInstructions(CompilerArena* arena, RawInstruction* instructions, uint32_t instructionCount, OptimizationLevel level)
 {
-    int32_t result = 0;
+    if(level == OptimizationLevelNone || instructionCount == 0)
+        return instructionCount;
 
-    getNextToken(lexer);
-    if(lexer->token == TokenNumber)
-    {
-        result = stringToSint(lexer->identifierString.text);
-        if(result > UINT8_MAX || result < 0)
-        {
-            reportError(lexer, "Numeric value is out of range! Got: '%d', minimum is 0 and maximum is 255", result);
-            result = 0;
-        }
-    }
-    else
+    Optimizer optimizer = {};
+    optimizer.instructions = instructions;
+    optimizer.instructionCount = instructionCount;
+
+    ByteCode byteCode = {};
+    byteCode.instructions = instructions;
+    byteCode.instructionCount = instructionCount;
+
+    uint32_t jumpCapacity = 0;
+    for(uint32_t i = 0; i < instructionCount; ++i)
     {
-        reportError(lexer, "Expected numeric value! Got: '%.*s' (%s)", (int)lexer->identifierString.length, lexer->identifierString.text, tokenToString(lexer->token));
+        MappedInstruction instruction;
+        unpackInstruction(instructions[i], &instruction);
+        if(instruction.opCode == OpCodeJump || instruction.opCode == OpCodeBranch)
+            ++jumpCapacity;
     }
 
-    return result;
-}
+    if(!reserveOptimizerMemory(arena, instructionCount, jumpCapacity))
+        return instructionCount;
 
-static Register getRegister(Lexer* lexer)
-{
-    Register result = Reg0;
+    optimizer.flags = arena->optimizerFlags;
+    optimizer.liveRegisters = arena->liveRegisters;
+    optimizer.newPositions = arena->newPositions;
+    optimizer.jumps = arena->optimizerJumps;
+    swapAnalysisMemory(arena, &optimizer.analysis);
 
-    getNextToken(lexer);
-    if(lexer->token == TokenRegister)
+    uint32_t resultCount = instructionCount;
+    if(rerunAnalysis(&optimizer.analysis, &byteCode))
     {
-        result = static_cast<Register>(stringToSint(lexer->identifierString.text));
-        if(result >= RegisterCount)
+        memset(optimizer.flags, 0, sizeof(uint8_t) * instructionCount);
+
+        // Visit the blocks in the order of their positions, so the jumps are sorted.
+        for(uint32_t i = 0; i < instructionCount; i += optimizer.analysis.instructionSizes[i])
         {
-            reportError(lexer, "Register index out of bounds! Got: '%d', maximum is %d", result, (RegisterCount - 1));
-            result = static_cast<Register>(RegisterCount - 1);
+            if(optimizer.analysis.blockIndices[i] != InvalidPosition)
+                foldBlock(&optimizer, i);
+        }
+
+        if(level >= OptimizationLevelFull && !optimizer.hasJumpOutOfBounds)
+        {
+            findDeadStores(&optimizer);
+            fixJumps(&optimizer);
+
+            resultCount = 0;
+            for(uint32_t i = 0; i < instructionCount; i += optimizer.analysis.instructionSizes[i])
+            {
+                if(isInstructionRemoved(optimizer.flags[i]))
+                    continue;
+                for(uint32_t j = 0; j < optimizer.analysis.instructionSizes[i]; ++j)
+                    instructions[resultCount++] = instructions[i + j];
+            }
         }
-    }
-    else
-    {
-        reportError(lexer, "Expected a register name! Got: '%.*s' (%s)", (int)lexer->identifierString.length, lexer->identifierString.text, tokenToString(lexer->token));
     }
 
-    return result;
+    swapAnalysisMemory(arena, &optimizer.analysis);
+    return resultCount;
 }
 
 
@@ -1169,142 +8796,59 @@ static Register getRegister(Lexer* lexer)
  * 
  *--------------------------------------------------------------------------------------------------------------*/  
 
-static OpCode getOpCode(Lexer* lexer)
+/** Make sure that the arena can hold all instructions of the specified source. Every instruction starts with an identifier
+ * which is followed by at least one other character, so a source can never contain more than (length + 1) / 2 instructions.
+ * A wide instruction takes three words but needs at least a mnemonic, a register and a number, so the bound holds for words.
+ * Jumps to labels that need more than one instruction grow the buffer later, see resolveLabels.
+ * \return	Returns <b>false</b> if the memory could not be allocated. */
+static bool reserveCompilerArena(CompilerArena* arena, const char* source)
 {
-    OpCode opCode = OpCodeHalt;
-
-    if(isTokenStringEqual(lexer, "set"))
-        opCode = OpCodeSet;
-    else if(isTokenStringEqual(lexer, "cpy"))
-        opCode = OpCodeCopy;
-    else if(isTokenStringEqual(lexer, "add"))
-        opCode = OpCodeAdd;
-    else if(isTokenStringEqual(lexer, "sub"))
-        opCode = OpCodeSub;
-    else if(isTokenStringEqual(lexer, "mul"))
-        opCode = OpCodeMul;
-    else if(isTokenStringEqual(lexer, "div"))
-        opCode = OpCodeDiv;
-    else if(isTokenStringEqual(lexer, "inv"))
-        opCode = OpCodeInv;
-    else if(isTokenStringEqual(lexer, "eql"))
-        opCode = OpCodeEql;
-    else if(isTokenStringEqual(lexer, "neq"))
-        opCode = OpCodeNeq;
-    else if(isTokenStringEqual(lexer, "gre"))
-        opCode = OpCodeGrt;
-    else if(isTokenStringEqual(lexer, "les"))
-        opCode = OpCodeLet;
-    else if(isTokenStringEqual(lexer, "jmp"))
-        opCode = OpCodeJump;
-    else if(isTokenStringEqual(lexer, "hcl"))
-        opCode = OpCodeCallHost;
-    else if(isTokenStringEqual(lexer, "halt"))
-        opCode = OpCodeHalt;
-    else
-        reportError(lexer, "Unknown instruction '%.*s'!", (int)lexer->identifierString.length, lexer->identifierString.text);
-
-    return opCode;
-}
+    size_t requiredCapacity = (strlen(source) + 1) / 2;
+    if(requiredCapacity > UINT32_MAX)
+        return false;
 
-static void handleInstruction(Lexer* lexer, MappedInstruction* inst)
-{
-    // @Bug: Every unknown instruction will be interpreted as "halt". This will eat the next token as it will be seen as the
-    // halt argument. We should add an OpCodeInvald(0) and handle it here and in getOpCode accordingly (e.g. generate "halt 251").
-    //    - C-574 (28.09.2017)  
-    OpCode opCode = getOpCode(lexer);
-    switch(opCode)
-    {
-    case OpCodeHalt:
-    {
-        inst->params.value = getNumber(lexer);
-    } break;
-    case OpCodeSet:
-    {
-        inst->params.destReg = getRegister(lexer);
-        inst->params.value   = getNumber(lexer);
-    } break;
-    case OpCodeCopy: 
-    {
-        inst->params.destReg = getRegister(lexer);
-        inst->params.argRegA = getRegister(lexer);
-    } break;
-    case OpCodeAdd:
-    case OpCodeSub:
-    case OpCodeMul:
-    case OpCodeDiv:
-    case OpCodeEql:
-    case OpCodeNeq:
-    case OpCodeGrt:
-    case OpCodeLet:
+    if(arena->capacity < requiredCapacity)
     {
-        inst->params.destReg = getRegister(lexer);
-        inst->params.argRegA = getRegister(lexer);
-        inst->params.argRegB = getRegister(lexer);
+        RawInstruction* instructions = static_cast<RawInstruction*>(pho_malloc(sizeof(RawInstruction) * requiredCapacity));
+        if(!instructions)
+            return false;
 
-    } break;
-    case OpCodeInv:	
-    {
-        inst->params.destReg = getRegister(lexer);
-    } break;
-    
-    case OpCodeJump:
-    {
-        inst->params.destReg = getRegister(lexer);
-        inst->params.value   = getNumber(lexer);
-    } break;
-    case OpCodeCallHost:
-    {
-        int32_t groupId = getNumber(lexer);
-        if(groupId > 0xF)
-        {
-            reportError(lexer, "Host call group id is out of bounds! Got: '%d', maximum is 15", groupId);
-            groupId = 0xF;
-        }
-        inst->params.destReg = groupId;
-        inst->params.value   = getNumber(lexer);
-    } break;
-    default:
-    {
-    } break;
+        pho_free(arena->instructions);
+        arena->instructions = instructions;
+        arena->capacity = static_cast<uint32_t>(requiredCapacity);
     }
 
-    inst->opCode = opCode;
+    return true;
 }
 
-static void handleIdentifier(Lexer* lexer)
+PHO_DECL ByteCode compile(char* source, const char* fileName, OptimizationLevel level)
 {
-    InstructionNode* node = static_cast<InstructionNode*>(pho_malloc(sizeof(InstructionNode)));
-    if(node)
-    {
-        node->inst = {};
-        node->next = nullptr;
-        handleInstruction(lexer, &node->inst);
-
-        if(lexer->nodeTail == nullptr)
-            lexer->nodeTail = lexer->nodeHead = node;
+    CompilerArena arena = {};
+    ByteCode byteCode = compileWithArena(&arena, source, fileName, level);
+    releaseCompilerArena(&arena);
 
-        lexer->nodeHead->next = node;
-        lexer->nodeHead = node;
-    }
-    else
-    {
-        fprintf(stderr, "INTERNAL COMPILER ERROR: Failed to allocate instruction node!\n");
-    }
+    return byteCode;
 }
 
-
-/*----------------------------------------------------------------------------------------------------------------
- * 
- *--------------------------------------------------------------------------------------------------------------*/  
-
-PHO_DECL ByteCode compile(char* source, const char* fileName)
+/** Compile the source like compileWithArena.
+ * \param	errorCount	Receives the number of errors that got reported. */
+static ByteCode compileSource(CompilerArena* arena, char* source, const char* fileName, OptimizationLevel level, uint32_t* errorCount)
 {
     ByteCode byteCode = {};
+    *errorCount = 1;
+    if(!reserveCompilerArena(arena, source))
+    {
+        fprintf(stderr, "INTERNAL COMPILER ERROR: Failed to allocate instruction buffer!\n");
+        return byteCode;
+    }
+
     Lexer lexer = {};
     lexer.at = source;
     lexer.lineNumber = 1;
     lexer.fileName = fileName;
+    lexer.instructions = arena->instructions;
+    lexer.instructionCapacity = arena->capacity;
+    lexer.arena = arena;
 
     getNextToken(&lexer);
     bool isParsing = true;
@@ -1324,6 +8868,10 @@ PHO_DECL ByteCode compile(char* source, const char* fileName)
             {
                 handleIdentifier(&lexer);
             } 
+            else if(lexer.token == TokenLabel)
+            {
+                addLabel(&lexer);
+            }
             else
             {
                 // If we get here we have propably a syntax error. Unexpected number at new line, etc.
@@ -1335,33 +8883,188 @@ PHO_DECL ByteCode compile(char* source, const char* fileName)
         }
     }
 
-    uint32_t instructionCount = 0;
-    InstructionNode* currentNode = lexer.nodeTail;
-    while(currentNode)
+    if((lexer.labelCount > 0 || lexer.labelReferenceCount > 0) && !resolveLabels(&lexer))
+        fprintf(stderr, "INTERNAL COMPILER ERROR: Failed to allocate label buffer!\n");
+
+    lexer.instructionCount = optimizeInstructions(arena, lexer.instructions, lexer.instructionCount, level);
+
+    // Empty byte-code is invalid and would never be released, so no memory is allocated for it.
+    RawInstruction* instructions = nullptr;
+    if(lexer.instructionCount > 0)
     {
-        // @Incomplete: Optimize node list, e.g. removal of chained halt instructions.
-        //    - C-574 (18.08.2017)
-        ++instructionCount;
-        currentNode = currentNode->next;
+        instructions = static_cast<RawInstruction*>(pho_malloc(sizeof(RawInstruction) * lexer.instructionCount));
+        if(instructions)
+            memcpy(instructions, lexer.instructions, sizeof(RawInstruction) * lexer.instructionCount);
     }
 
-    RawInstruction* instructions = static_cast<RawInstruction*>(pho_malloc(sizeof(RawInstruction) * instructionCount));
+    byteCode.instructionCount = instructions ? lexer.instructionCount : 0;
+    byteCode.instructions     = instructions;
+    *errorCount = lexer.errorCount;
+    return byteCode;
+}
 
-    uint32_t instructionIndex = 0;
-    currentNode = lexer.nodeTail;
-    while(currentNode)
-    {	
-        instructions[instructionIndex] = packInstruction(&currentNode->inst);
-        ++instructionIndex;
+PHO_DECL ByteCode compileWithArena(CompilerArena* arena, char* source, const char* fileName, OptimizationLevel level)
+{
+    uint32_t errorCount;
+    return compileSource(arena, source, fileName, level, &errorCount);
+}
 
-        InstructionNode* nodeToDelete = currentNode;
-        currentNode = currentNode->next;
-        pho_free(nodeToDelete);
+PHO_DECL void releaseCompilerArena(CompilerArena* arena)
+{
+    if(arena)
+    {
+        pho_free(arena->instructions);
+        pho_free(arena->labels);
+        pho_free(arena->labelReferences);
+        pho_free(arena->labelTable);
+        pho_free(arena->optimizerFlags);
+        pho_free(arena->liveRegisters);
+        pho_free(arena->newPositions);
+        pho_free(arena->optimizerJumps);
+        pho_free(arena->blockIndices);
+        pho_free(arena->blockOwners);
+        pho_free(arena->instructionSizes);
+        pho_free(arena->blocks);
+        pho_free(arena->blockQueue);
+        *arena = {};
     }
-    lexer.nodeHead = lexer.nodeTail = nullptr;
+}
 
-    byteCode.instructionCount = instructionCount;
-    byteCode.instructions     = instructions;
+
+/*----------------------------------------------------------------------------------------------------------------
+ * Compile Cache
+ *--------------------------------------------------------------------------------------------------------------*/
+
+/** Seed of the 64-bit FNV-1a hash. */
+const uint64_t HashSeed64 = 14695981039346656037ULL;
+
+/** Continue the 64-bit FNV-1a hash of the specified bytes. Start with HashSeed64. */
+static uint64_t hashBytes64(const void* data, size_t size, uint64_t hash)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for(size_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    return hash;
+}
+
+/** Seed of the second hash of a cache entry, the first digits of pi. */
+const uint64_t CompileCacheHashSeed = 0x243F6A8885A308D3ULL;
+
+/** Data that is stored in the padding of the byte-code file of a cache entry. A key that matches could still be a collision of
+ * the hash, so the entry also identifies its source with the length and a second hash that is independent of the key. */
+struct CompileCacheEntryHeader
+{
+    /** Length of the source in bytes. */
+    uint64_t sourceLength;
+    /** Hash of the configuration and the source with hashBytesMix64. */
+    uint64_t sourceHash;
+};
+static_assert(sizeof(ByteCodeFileHeader) + sizeof(CompileCacheEntryHeader) <= ByteCodeFileAlignment,
+              "The header of a cache entry must fit into the padding of a byte-code file.");
+
+/** Continue a 64-bit hash of the specified bytes that is independent of hashBytes64. Every byte is mixed
+ * with a multiplication by the golden ratio and a shift instead of FNV-1a. Start with CompileCacheHashSeed. */
+static uint64_t hashBytesMix64(const void* data, size_t size, uint64_t hash)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash = (hash + bytes[i] + 1) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+/** Get the key and the header of the cache entry of a source. Everything that changes the output of the compiler is part of
+ * both hashes. */
+static uint64_t getCompileCacheKey(const char* source, size_t sourceLength, OptimizationLevel level, CompileCacheEntryHeader* entryHeader)
+{
+    const int32_t configuration[] = { PHOTON_VM_VERSION, PHOTON_COMPILER_ERROR_STRICT, static_cast<int32_t>(level) };
+    entryHeader->sourceLength = sourceLength;
+    entryHeader->sourceHash   = hashBytesMix64(source, sourceLength, hashBytesMix64(configuration, sizeof(configuration), CompileCacheHashSeed));
+
+    uint64_t key = hashBytes64(configuration, sizeof(configuration), HashSeed64);
+    return hashBytes64(source, sourceLength, key);
+}
+
+/** Copy the byte-code of a cache entry into memory that is released with releaseByteCode.
+ * \return	Returns <b>false</b> if the entry does not exist, is not valid or was written for a different source. */
+static bool loadCompileCacheEntry(const char* path, const CompileCacheEntryHeader* entryHeader, ByteCode* byteCode)
+{
+    ByteCodeFile file;
+    if(loadByteCodeFile(path, &file) != ByteCodeFileSuccess)
+        return false;
+
+    // The header of the byte-code file was checked by the loader, entries of other writers may not have room for the data.
+    ByteCodeFileHeader fileHeader;
+    CompileCacheEntryHeader storedHeader = {};
+    memcpy(&fileHeader, file.data, sizeof(fileHeader));
+    if(fileHeader.instructionOffset >= sizeof(ByteCodeFileHeader) + sizeof(CompileCacheEntryHeader))
+        memcpy(&storedHeader, static_cast<const uint8_t*>(file.data) + sizeof(ByteCodeFileHeader), sizeof(storedHeader));
+    if(storedHeader.sourceLength != entryHeader->sourceLength || storedHeader.sourceHash != entryHeader->sourceHash)
+    {
+        releaseByteCodeFile(&file);
+        return false;
+    }
+
+    const size_t size = sizeof(RawInstruction) * file.byteCode.instructionCount;
+    byteCode->instructions = static_cast<RawInstruction*>(pho_malloc(size));
+    if(byteCode->instructions)
+    {
+        memcpy(byteCode->instructions, file.byteCode.instructions, size);
+        byteCode->instructionCount = file.byteCode.instructionCount;
+    }
+    releaseByteCodeFile(&file);
+    return (byteCode->instructions != nullptr);
+}
+
+/** Write a cache entry into a temporary file and rename it, so other processes never see a partial entry. The name of the
+ * temporary file contains the process id and an address on the stack of the calling thread, so it is unique. */
+static void storeCompileCacheEntry(const char* path, const CompileCacheEntryHeader* entryHeader, const ByteCode* byteCode)
+{
+#if PHOTON_MMAP_IS_SUPPORTED
+    const unsigned long processId = static_cast<unsigned long>(getpid());
+#else
+    const unsigned long processId = 0;
+#endif // PHOTON_MMAP_IS_SUPPORTED
+
+    const size_t length = strlen(path) + 64;
+    char* temporaryPath = static_cast<char*>(pho_malloc(length));
+    if(!temporaryPath)
+        return;
+
+    snprintf(temporaryPath, length, "%s.%lu.%llx.tmp", path, processId, static_cast<unsigned long long>(reinterpret_cast<uintptr_t>(&length)));
+    if(!writeByteCodeFileData(byteCode, temporaryPath, entryHeader, sizeof(*entryHeader)) || rename(temporaryPath, path) != 0)
+        remove(temporaryPath);
+    pho_free(temporaryPath);
+}
+
+PHO_DECL ByteCode compileCached(const char* cacheDirectory, CompilerArena* arena, char* source, const char* fileName, OptimizationLevel level)
+{
+    ByteCode byteCode = {};
+    CompileCacheEntryHeader entryHeader;
+    const uint64_t key = getCompileCacheKey(source, strlen(source), level, &entryHeader);
+
+    const size_t length = strlen(cacheDirectory) + 32;
+    char* path = static_cast<char*>(pho_malloc(length));
+    if(path)
+    {
+        snprintf(path, length, "%s/%016llx.pbc", cacheDirectory, static_cast<unsigned long long>(key));
+        if(loadCompileCacheEntry(path, &entryHeader, &byteCode))
+        {
+            pho_free(path);
+            return byteCode;
+        }
+    }
+
+    CompilerArena temporaryArena = {};
+    uint32_t errorCount;
+    byteCode = compileSource(arena ? arena : &temporaryArena, source, fileName, level, &errorCount);
+    releaseCompilerArena(&temporaryArena);
+
+    if(path && errorCount == 0 && isByteCodeValid(&byteCode))
+        storeCompileCacheEntry(path, &entryHeader, &byteCode);
+    pho_free(path);
     return byteCode;
 }
 
@@ -0,0 +1,403 @@
+#define PHOTON_IMPLEMENTATION
+#include "PhotonVM.h"
+#include <algorithm>
+#include <chrono>
+
+/* Measures the performance of the Photon interpreter with a fixed set of workloads. Every workload is generated from constants,
+ * so the same build always executes the same instructions. The number of executed instructions of every workload is known
+ * up front, which gives instructions per second and nanoseconds per dispatched instruction. Fused instructions are counted
+ * as the instructions that they replace. Every workload checks its registers after the last run.
+ *
+ * Each workload is executed warmup times without being measured and then the given number of repetitions. The best, median
+ * and mean time of the repetitions are reported. With PHOTON_JIT_ENABLED every workload is also measured with runJit.
+ *
+ * Usage: pvm-bench [--repetitions count] [--warmup count] [--scale factor] [--filter name] [--json] */
+
+/** Maximum length of the source code of a workload in characters. */
+const uint32_t MaxSourceLength = 64 * 1024;
+
+/** Workload that is executed by the benchmark. */
+struct Workload
+{
+    const char* name;
+    /** Source code of the workload. */
+    char source[MaxSourceLength];
+    uint32_t sourceLength;
+    /** Number of instructions that one run executes. */
+    uint64_t instructionCount;
+    /** Register that is checked after the last run and its expected value. */
+    Photon::Register checkRegister;
+    Photon::RegisterType checkValue;
+};
+
+/** Times of all repetitions of a measurement in nanoseconds. */
+struct Measurement
+{
+    double best;
+    double median;
+    double mean;
+};
+
+/** Append a formatted line to the source of a workload. */
+static void appendLine(Workload* workload, const char* format, ...)
+{
+    va_list list;
+    va_start(list, format);
+    int length = vsnprintf(workload->source + workload->sourceLength, MaxSourceLength - workload->sourceLength - 1, format, list);
+    va_end(list);
+
+    if(length > 0)
+        workload->sourceLength = std::min<uint32_t>(workload->sourceLength + length, MaxSourceLength - 2);
+    workload->source[workload->sourceLength++] = '\n';
+    workload->source[workload->sourceLength] = '\0';
+}
+
+/** The Fibonacci loop of the sample program, repeated so the numbers never overflow. */
+static void generateFibonacci(Workload* workload, uint32_t scale)
+{
+    const uint32_t repetitions = 40000 * scale;
+    workload->name = "fibonacci";
+    appendLine(workload, "set reg5 %u", repetitions);
+    appendLine(workload, "outer:");
+    appendLine(workload, "    set reg0 40");
+    appendLine(workload, "    set reg2 0");
+    appendLine(workload, "    set reg3 1");
+    appendLine(workload, "    set reg4 2");
+    appendLine(workload, "inner:");
+    appendLine(workload, "    gre reg12 reg4 reg0");
+    appendLine(workload, "    jmp reg12 done");
+    appendLine(workload, "    add reg1 reg2 reg3");
+    appendLine(workload, "    cpy reg2 reg3");
+    appendLine(workload, "    cpy reg3 reg1");
+    appendLine(workload, "    add reg4 reg4 1");
+    appendLine(workload, "    jmp inner");
+    appendLine(workload, "done:");
+    appendLine(workload, "    sub reg5 reg5 1");
+    appendLine(workload, "    jmp reg5 outer");
+    appendLine(workload, "halt 0");
+
+    // 39 iterations of the inner loop and the compare and jump that leave it.
+    workload->instructionCount = 1 + repetitions * (4 + 39 * 7 + 2 + 2) + 1;
+    workload->checkRegister = Photon::Reg1;
+    workload->checkValue = 102334155;
+}
+
+/** Straight-line arithmetic with registers and immediates. Every block starts from constants, so nothing overflows. */
+static void generateArithmetic(Workload* workload, uint32_t scale)
+{
+    const uint32_t iterations = 200000 * scale;
+    const uint32_t blockCount = 8;
+    workload->name = "arithmetic";
+    appendLine(workload, "set reg1 7");
+    appendLine(workload, "set reg2 11");
+    appendLine(workload, "set reg3 13");
+    appendLine(workload, "set reg10 %u", iterations);
+    appendLine(workload, "loop:");
+    for(uint32_t i = 0; i < blockCount; ++i)
+    {
+        appendLine(workload, "    add reg4 reg1 reg2");
+        appendLine(workload, "    mul reg5 reg4 reg3");
+        appendLine(workload, "    sub reg6 reg5 reg1");
+        appendLine(workload, "    add reg7 reg6 100");
+        appendLine(workload, "    mul reg8 reg7 3");
+        appendLine(workload, "    sub reg9 reg8 reg4");
+        appendLine(workload, "    eql reg11 reg9 reg5");
+        appendLine(workload, "    add reg4 reg4 reg11");
+    }
+    appendLine(workload, "    sub reg10 reg10 1");
+    appendLine(workload, "    jmp reg10 loop");
+    appendLine(workload, "halt 0");
+
+    workload->instructionCount = 4 + iterations * (blockCount * 8 + 2) + 1;
+    workload->checkRegister = Photon::Reg9;
+    workload->checkValue = (((7 + 11) * 13 - 7) + 100) * 3 - (7 + 11);
+}
+
+/** Loop with a data dependent branch that is taken every third iteration. Both paths execute the same number of instructions. */
+static void generateBranches(Workload* workload, uint32_t scale)
+{
+    const uint32_t iterations = 1500000 * scale;
+    workload->name = "branches";
+    appendLine(workload, "set reg0 %u", iterations);
+    appendLine(workload, "set reg1 0");
+    appendLine(workload, "set reg2 0");
+    appendLine(workload, "loop:");
+    appendLine(workload, "    div reg3 reg0 3");
+    appendLine(workload, "    mul reg3 reg3 3");
+    appendLine(workload, "    sub reg3 reg0 reg3");
+    appendLine(workload, "    jmp reg3 other");
+    appendLine(workload, "    add reg1 reg1 1");
+    appendLine(workload, "    jmp next");
+    appendLine(workload, "other:");
+    appendLine(workload, "    add reg2 reg2 1");
+    appendLine(workload, "    eql reg4 reg3 1");
+    appendLine(workload, "next:");
+    appendLine(workload, "    sub reg0 reg0 1");
+    appendLine(workload, "    jmp reg0 loop");
+    appendLine(workload, "halt 0");
+
+    workload->instructionCount = 3 + iterations * 8 + 1;
+    workload->checkRegister = Photon::Reg1;
+    workload->checkValue = iterations / 3;
+}
+
+HostCallback(countCall)
+{
+    ++registers[Photon::Reg1];
+}
+
+/** Loop that calls the host in every iteration. */
+static void generateHostCalls(Workload* workload, uint32_t scale)
+{
+    const uint32_t iterations = 3000000 * scale;
+    workload->name = "host-calls";
+    appendLine(workload, "set reg0 %u", iterations);
+    appendLine(workload, "loop:");
+    appendLine(workload, "    hcl 0 0");
+    appendLine(workload, "    sub reg0 reg0 1");
+    appendLine(workload, "    jmp reg0 loop");
+    appendLine(workload, "halt 0");
+
+    workload->instructionCount = 1 + iterations * 3 + 1;
+    workload->checkRegister = Photon::Reg1;
+    workload->checkValue = static_cast<Photon::RegisterType>(iterations);
+}
+
+/** Divisions by registers and by immediates. */
+static void generateDivisions(Workload* workload, uint32_t scale)
+{
+    const uint32_t iterations = 500000 * scale;
+    const uint32_t pairCount = 8;
+    workload->name = "divisions";
+    appendLine(workload, "set reg0 %u", iterations);
+    appendLine(workload, "set reg1 2000000000");
+    appendLine(workload, "loop:");
+    for(uint32_t i = 0; i < pairCount; ++i)
+    {
+        appendLine(workload, "    div reg2 reg1 reg0");
+        appendLine(workload, "    div reg4 reg2 %u", 3 + i);
+    }
+    appendLine(workload, "    sub reg0 reg0 1");
+    appendLine(workload, "    jmp reg0 loop");
+    // INT32_MIN / -1 wraps around to INT32_MIN for registers and immediates, so the difference added to reg4 is zero.
+    appendLine(workload, "set reg3 -2147483648");
+    appendLine(workload, "set reg6 -1");
+    appendLine(workload, "div reg5 reg3 reg6");
+    appendLine(workload, "div reg5 reg5 -1");
+    appendLine(workload, "sub reg5 reg5 reg3");
+    appendLine(workload, "add reg4 reg4 reg5");
+    appendLine(workload, "halt 0");
+
+    workload->instructionCount = 2 + iterations * (pairCount * 2 + 2) + 6 + 1;
+    workload->checkRegister = Photon::Reg4;
+    workload->checkValue = 2000000000 / 1 / (3 + pairCount - 1);
+}
+
+/** Generate a script with the specified number of lines that looks like machine generated code, see pvm-compile-bench. */
+static char* generateCompileSource(uint32_t lineCount)
+{
+    const size_t maxLineLength = 80;
+    char* source = static_cast<char*>(pho_malloc(maxLineLength * lineCount + 1));
+    if(!source)
+        return nullptr;
+
+    static const char* const binaryOperations[] = { "add", "sub", "mul", "div", "eql", "neq", "gre", "les" };
+    uint32_t seed = 12345;
+    char* at = source;
+    for(uint32_t line = 0; line < lineCount; ++line)
+    {
+        seed = seed * 1664525 + 1013904223;
+        uint32_t random = seed >> 8;
+        uint32_t a = random % 13, b = (random >> 4) % 13, c = (random >> 8) % 13;
+
+        switch((random >> 16) % 6)
+        {
+        case 0:  at += sprintf(at, "    set reg%u %u\n", a, (random >> 20) % 256); break;
+        case 1:  at += sprintf(at, "    cpy r%u r%u\n", a, b); break;
+        case 2:  at += sprintf(at, "    add reg%u reg%u %u  # Immediate\n", a, b, random >> 12); break;
+        case 3:  at += sprintf(at, "\n    # Comment that explains the next block.\n"); ++line; break;
+        default: at += sprintf(at, "    %s reg%u reg%u reg%u\n", binaryOperations[random % 8], a, b, c); break;
+        }
+    }
+
+    *at = '\0';
+    return source;
+}
+
+/** Get the best, median and mean of the specified times. The times get sorted. */
+static Measurement summarize(double* times, uint32_t count)
+{
+    std::sort(times, times + count);
+    Measurement result = {};
+    result.best = times[0];
+    result.median = (count % 2) ? times[count / 2] : (times[count / 2 - 1] + times[count / 2]) * 0.5;
+    for(uint32_t i = 0; i < count; ++i)
+        result.mean += times[i] / count;
+    return result;
+}
+
+/** Run the virtual machine the specified number of times and measure every run. */
+static Measurement measureRuns(Photon::VirtualMachine* vm, bool isJit, uint32_t warmup, uint32_t repetitions, double* times)
+{
+    for(uint32_t i = 0; i < warmup + repetitions; ++i)
+    {
+        // A halted VM keeps its position, so every run starts over at the first instruction.
+        vm->currentPosition = 0;
+        auto start = std::chrono::steady_clock::now();
+        if(isJit)
+            Photon::runJit(vm);
+        else
+            Photon::run(vm);
+        auto end = std::chrono::steady_clock::now();
+
+        if(i >= warmup)
+            times[i - warmup] = std::chrono::duration<double, std::nano>(end - start).count();
+    }
+    return summarize(times, repetitions);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t repetitions = 10;
+    uint32_t warmup = 2;
+    uint32_t scale = 1;
+    const char* filter = nullptr;
+    bool isJson = false;
+    for(int i = 1; i < argc; ++i)
+    {
+        const bool hasValue = (i + 1 < argc);
+        if(strcmp(argv[i], "--repetitions") == 0 && hasValue)
+            repetitions = static_cast<uint32_t>(atoi(argv[++i]));
+        else if(strcmp(argv[i], "--warmup") == 0 && hasValue)
+            warmup = static_cast<uint32_t>(atoi(argv[++i]));
+        else if(strcmp(argv[i], "--scale") == 0 && hasValue)
+            scale = static_cast<uint32_t>(atoi(argv[++i]));
+        else if(strcmp(argv[i], "--filter") == 0 && hasValue)
+            filter = argv[++i];
+        else if(strcmp(argv[i], "--json") == 0)
+            isJson = true;
+        else
+            repetitions = 0;
+    }
+
+    if(repetitions == 0 || scale == 0)
+    {
+        fprintf(stderr, "Usage: %s [--repetitions count] [--warmup count] [--scale factor] [--filter name] [--json]\n", argv[0]);
+        return 1;
+    }
+
+    static void (*const generators[])(Workload*, uint32_t) =
+    {
+        generateFibonacci, generateArithmetic, generateBranches, generateHostCalls, generateDivisions
+    };
+    const uint32_t workloadCount = sizeof(generators) / sizeof(generators[0]);
+    const bool isJitSupported = (PHOTON_JIT_IS_SUPPORTED != 0);
+
+    double* times = static_cast<double*>(pho_malloc(sizeof(double) * repetitions));
+    Workload* workload = static_cast<Workload*>(pho_malloc(sizeof(Workload)));
+    if(!times || !workload)
+        return 1;
+
+    if(isJson)
+    {
+        printf("{\n  \"version\": %d,\n", PHOTON_VM_VERSION);
+        printf("  \"config\": { \"dispatch\": \"%s\", \"fusion\": %d, \"jit\": %d, \"batch_lanes\": %d, \"repetitions\": %u, \"warmup\": %u, \"scale\": %u },\n",
+               PHOTON_DISPATCH_IS_THREADED ? "threaded" : "switch", PHOTON_FUSION_ENABLED, isJitSupported ? 1 : 0, PHOTON_BATCH_LANES, repetitions, warmup, scale);
+        printf("  \"results\": [");
+    }
+    else
+    {
+        printf("Photon %d, %s dispatch, fusion %s, %u repetitions after %u warmup runs, scale %u\n\n", PHOTON_VM_VERSION,
+               PHOTON_DISPATCH_IS_THREADED ? "threaded" : "switch", PHOTON_FUSION_ENABLED ? "on" : "off", repetitions, warmup, scale);
+        printf("%-12s %-11s %14s %12s %12s %12s %10s %10s\n", "workload", "executor", "instructions", "best ms", "median ms", "mean ms", "M instr/s", "ns/disp");
+    }
+
+    int result = 0;
+    bool isFirstResult = true;
+    for(uint32_t w = 0; w < workloadCount; ++w)
+    {
+        *workload = {};
+        generators[w](workload, scale);
+        if(filter && !strstr(workload->name, filter))
+            continue;
+
+        Photon::ByteCode byteCode = Photon::compile(workload->source, workload->name);
+        for(uint32_t executor = 0; executor < (isJitSupported ? 2U : 1U); ++executor)
+        {
+            const bool isJit = (executor == 1);
+            Photon::VirtualMachine vm = isJit ? Photon::createJitVirtualMachine(byteCode) : Photon::createVirtualMachine(byteCode);
+            Photon::registerHostCall(&vm, countCall, 0, 0);
+
+            const Measurement time = measureRuns(&vm, isJit, warmup, repetitions, times);
+            if(vm.exitCode != Photon::ExitCodeSuccess || vm.registers[workload->checkRegister] != workload->checkValue)
+            {
+                fprintf(stderr, "Workload '%s' produced the wrong result: exit code %d, reg%d = %d, expected %d\n", workload->name,
+                        vm.exitCode, workload->checkRegister, vm.registers[workload->checkRegister], workload->checkValue);
+                result = 1;
+            }
+            Photon::releaseVirtualMachine(&vm);
+
+            const char* executorName = isJit ? "jit" : "interpreter";
+            const double instructionsPerSecond = workload->instructionCount / (time.median * 1e-9);
+            const double nsPerDispatch = time.median / workload->instructionCount;
+            if(isJson)
+            {
+                printf("%s\n    { \"name\": \"%s\", \"executor\": \"%s\", \"instructions\": %llu, \"best_ns\": %.0f, \"median_ns\": %.0f, \"mean_ns\": %.0f, "
+                       "\"instructions_per_second\": %.0f, \"ns_per_dispatch\": %.4f }", isFirstResult ? "" : ",", workload->name, executorName,
+                       static_cast<unsigned long long>(workload->instructionCount), time.best, time.median, time.mean, instructionsPerSecond, nsPerDispatch);
+            }
+            else
+            {
+                printf("%-12s %-11s %14llu %12.3f %12.3f %12.3f %10.1f %10.3f\n", workload->name, executorName,
+                       static_cast<unsigned long long>(workload->instructionCount), time.best * 1e-6, time.median * 1e-6, time.mean * 1e-6,
+                       instructionsPerSecond * 1e-6, nsPerDispatch);
+            }
+            isFirstResult = false;
+        }
+        Photon::releaseByteCode(&byteCode);
+    }
+
+    // The compile benchmark measures the compiler with a reused arena, like pvm-compile-bench.
+    const uint32_t lineCount = 500000 * scale;
+    char* source = (!filter || strstr("compile", filter)) ? generateCompileSource(lineCount) : nullptr;
+    if(source)
+    {
+        const size_t sourceSize = strlen(source);
+        Photon::CompilerArena arena = {};
+        for(uint32_t i = 0; i < warmup + repetitions; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            Photon::ByteCode byteCode = Photon::compileWithArena(&arena, source, "compile");
+            auto end = std::chrono::steady_clock::now();
+
+            if(i >= warmup)
+                times[i - warmup] = std::chrono::duration<double, std::nano>(end - start).count();
+            Photon::releaseByteCode(&byteCode);
+        }
+        Photon::releaseCompilerArena(&arena);
+        pho_free(source);
+
+        const Measurement time = summarize(times, repetitions);
+        const double linesPerSecond = lineCount / (time.median * 1e-9);
+        const double megabytesPerSecond = sourceSize / (time.median * 1e-9) / (1024.0 * 1024.0);
+        if(isJson)
+        {
+            printf("%s\n    { \"name\": \"compile\", \"executor\": \"compiler\", \"lines\": %u, \"bytes\": %zu, \"best_ns\": %.0f, \"median_ns\": %.0f, "
+                   "\"mean_ns\": %.0f, \"lines_per_second\": %.0f, \"megabytes_per_second\": %.2f }", isFirstResult ? "" : ",", lineCount, sourceSize,
+                   time.best, time.median, time.mean, linesPerSecond, megabytesPerSecond);
+        }
+        else
+        {
+            printf("\n%-12s %-11s %14s %12s %12s %12s %10s %10s\n", "workload", "executor", "lines", "best ms", "median ms", "mean ms", "M lines/s", "MB/s");
+            printf("%-12s %-11s %14u %12.3f %12.3f %12.3f %10.2f %10.1f\n", "compile", "compiler", lineCount, time.best * 1e-6, time.median * 1e-6,
+                   time.mean * 1e-6, linesPerSecond * 1e-6, megabytesPerSecond);
+        }
+    }
+
+    if(isJson)
+        printf("\n  ]\n}\n");
+
+    pho_free(workload);
+    pho_free(times);
+    return result;
+}
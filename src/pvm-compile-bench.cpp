@@ -0,0 +1,148 @@
+#define PHOTON_IMPLEMENTATION
+#include "PhotonVM.h"
+#include <chrono>
+
+/* Measures the throughput of the Photon compiler in lines per second. Without a source file a script that looks like
+ * machine generated code is compiled: indented instructions of all kinds, blank lines and comments.
+ *
+ * Usage: pvm-compile-bench [line count | source file] [repetitions] */
+
+/** Read the whole file into a null-terminated string. Returns nullptr if the file can not be read. */
+static char* readSourceFile(const char* path, uint32_t* lineCount)
+{
+    FILE* file = fopen(path, "rb");
+    if(!file)
+        return nullptr;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* source = nullptr;
+    if(size >= 0)
+    {
+        source = static_cast<char*>(pho_malloc(size + 1));
+        if(source && fread(source, 1, size, file) == static_cast<size_t>(size))
+        {
+            source[size] = '\0';
+        }
+        else
+        {
+            pho_free(source);
+            source = nullptr;
+        }
+    }
+
+    fclose(file);
+
+    *lineCount = 1;
+    for(const char* at = source; at && *at; ++at)
+    {
+        if(*at == '\n')
+            ++(*lineCount);
+    }
+
+    return source;
+}
+
+/** Generate a script with the specified number of lines. */
+static char* generateSource(uint32_t lineCount)
+{
+    // Longest line: "        add reg12 reg12 reg12  # Comment that explains the instruction.\n"
+    const size_t maxLineLength = 80;
+    char* source = static_cast<char*>(pho_malloc(maxLineLength * lineCount + 1));
+    if(!source)
+        return nullptr;
+
+    static const char* const binaryOperations[] = { "add", "sub", "mul", "div", "eql", "neq", "gre", "les" };
+    uint32_t seed = 12345;
+    char* at = source;
+    for(uint32_t line = 0; line < lineCount; ++line)
+    {
+        seed = seed * 1664525 + 1013904223;
+        uint32_t random = seed >> 8;
+        uint32_t a = random % 13, b = (random >> 4) % 13, c = (random >> 8) % 13;
+        const char* indent = (random & 0x1000) ? "        " : "    ";
+
+        switch((random >> 16) % 8)
+        {
+        case 0:
+            at += sprintf(at, "%sset reg%u %u\n", indent, a, (random >> 20) % 256);
+            break;
+        case 1:
+            at += sprintf(at, "%scpy r%u r%u\n", indent, a, b);
+            break;
+        case 2:
+            at += sprintf(at, "%sjmp reg%u 0\n", indent, a);
+            break;
+        case 3:
+            at += sprintf(at, "%shcl 0 %u\n", indent, b);
+            break;
+        case 4:
+            at += sprintf(at, "\n%s# Comment that explains the next block.\n", indent);
+            ++line;
+            break;
+        case 5:
+            at += sprintf(at, "%sinv reg%u\n", indent, a);
+            break;
+        default:
+            at += sprintf(at, "%s%s reg%u reg%u reg%u  # Comment that explains the instruction.\n", indent, binaryOperations[random % 8], a, b, c);
+            break;
+        }
+    }
+
+    *at = '\0';
+    return source;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t lineCount = 1000000;
+    uint32_t repetitions = (argc > 2) ? static_cast<uint32_t>(atoi(argv[2])) : 10;
+    char* source;
+    if(argc > 1 && atoi(argv[1]) == 0)
+    {
+        source = readSourceFile(argv[1], &lineCount);
+    }
+    else
+    {
+        if(argc > 1)
+            lineCount = static_cast<uint32_t>(atoi(argv[1]));
+        source = generateSource(lineCount);
+    }
+
+    if(!source || repetitions == 0)
+    {
+        fprintf(stderr, "Usage: %s [line count | source file] [repetitions]\n", argv[0]);
+        return 1;
+    }
+
+    size_t sourceSize = strlen(source);
+    Photon::CompilerArena arena = {};
+    double bestSeconds = 0.0;
+    uint32_t instructionCount = 0;
+
+    // The first compile warms up the caches and the arena and is not measured.
+    for(uint32_t i = 0; i <= repetitions; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        Photon::ByteCode byteCode = Photon::compileWithArena(&arena, source, "benchmark");
+        auto end = std::chrono::steady_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        if(i == 1 || (i > 1 && seconds < bestSeconds))
+            bestSeconds = seconds;
+
+        instructionCount = byteCode.instructionCount;
+        Photon::releaseByteCode(&byteCode);
+    }
+
+    printf("Lexer block size:  %d characters\n", PHOTON_LEXER_BLOCK_SIZE);
+    printf("Source:            %u lines, %.1f MB, %u instructions\n", lineCount, sourceSize / (1024.0 * 1024.0), instructionCount);
+    printf("Best of %u:        %.2f ms\n", repetitions, bestSeconds * 1000.0);
+    printf("Throughput:        %.2f million lines/s, %.1f MB/s\n", lineCount / bestSeconds / 1000000.0, sourceSize / bestSeconds / (1024.0 * 1024.0));
+
+    Photon::releaseCompilerArena(&arena);
+    pho_free(source);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#define PHOTON_IMPLEMENTATION
+#include "PhotonVM.h"
+
+/* Translates a Photon source file into a C++ source file that contains a single function which executes the script
+ * without the VM, see Photon::translateByteCode. The generated file includes PhotonVM.h for the types it uses.
+ *
+ * Usage: pvm-translate <source file> <output file> [function name]
+ *
+ * The generated function is called with the registers and the Host-Calls of a VM:
+ *     Photon::RegisterType registers[Photon::RegisterCount] = {};
+ *     Photon::VMExitCode result = myScript(registers, vm.hostCallTable); */
+
+/** Read the whole file into a null-terminated string. Returns nullptr if the file can not be read. */
+static char* readSourceFile(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if(!file)
+        return nullptr;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* source = nullptr;
+    if(size >= 0)
+    {
+        source = static_cast<char*>(pho_malloc(size + 1));
+        if(source && fread(source, 1, size, file) == static_cast<size_t>(size))
+        {
+            source[size] = '\0';
+        }
+        else
+        {
+            pho_free(source);
+            source = nullptr;
+        }
+    }
+
+    fclose(file);
+    return source;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <source file> <output file> [function name]\n", argv[0]);
+        return 1;
+    }
+
+    const char* sourcePath = argv[1];
+    const char* outputPath = argv[2];
+    const char* functionName = (argc > 3) ? argv[3] : "runScript";
+
+    char* source = readSourceFile(sourcePath);
+    if(!source)
+    {
+        fprintf(stderr, "Failed to read source file '%s'.\n", sourcePath);
+        return 1;
+    }
+
+    Photon::ByteCode byteCode = Photon::compile(source, sourcePath);
+    pho_free(source);
+    if(!Photon::isByteCodeValid(&byteCode))
+    {
+        fprintf(stderr, "Failed to compile source file '%s'.\n", sourcePath);
+        return 1;
+    }
+
+    FILE* output = fopen(outputPath, "w");
+    if(!output)
+    {
+        fprintf(stderr, "Failed to open output file '%s'.\n", outputPath);
+        Photon::releaseByteCode(&byteCode);
+        return 1;
+    }
+
+    fprintf(output, "/* Generated by pvm-translate from '%s'. Do not edit. */\n", sourcePath);
+    fprintf(output, "#include \"PhotonVM.h\"\n\n");
+    bool isTranslated = Photon::translateByteCode(&byteCode, functionName, output);
+    fclose(output);
+    Photon::releaseByteCode(&byteCode);
+
+    if(!isTranslated)
+    {
+        fprintf(stderr, "Failed to translate the byte-code of '%s'.\n", sourcePath);
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,4 +1,5 @@
 #define PHOTON_IMPLEMENTATION
+#define PHOTON_TRACE_ENABLED 1
 #include "PhotonVM.h"
 
 namespace HostCalls
@@ -82,7 +83,7 @@ static void printEncodedByteCode(Photon::ByteCode* byteCode)
         {
             printf("0x%.4hX\n", *(byteCode->instructions + i));
         }
-        printf("Stats: %u total instructions, %zu bytes\n", byteCode->instructionCount, byteCode->instructionCount * sizeof(Photon::RawInstruction));
+        printf("Stats: %u total words, %zu bytes\n", byteCode->instructionCount, byteCode->instructionCount * sizeof(Photon::RawInstruction));
         printf("---------------------------------------\n");
     }
 }
@@ -111,7 +112,6 @@ int main(int argc, char** argv)
         # FibN-1    | reg2 tmp0
         # FibN-2    | reg3 tmp1
         # i         | reg4 tmp2 
-        # blockSize | reg5 tmp3
         # local <= reg12
         # ------------------
         
@@ -124,28 +124,22 @@ int main(int argc, char** argv)
         set reg3 1
         
         
-        # reg5 = instruction count of loop-block.
-        set reg5 9
         # reg4 = start index of loop (i).
         set reg4 2
         
         # while(i < N) ...
+    loop:
         gre reg12 reg4 reg0
-        mul reg12 reg12 reg5
-        jmp reg12 0
-        # BEGIN - While
+        jmp reg12 done
             add reg1 reg2 reg3
             cpy reg2 reg3
             cpy reg3 reg1
             
             # Increment the loop counter 'i'.
-            set reg12 1
-            add reg4 reg4 reg12
+            add reg4 reg4 1
             # jump back to the loop-head.
-            set reg12 10
-            inv reg12
-            jmp reg12 0
-        # END - While
+            jmp loop
+    done:
         hcl 0 4
         halt 0
     )Foo";
@@ -157,6 +151,10 @@ int main(int argc, char** argv)
     HostCalls::registerHostCalls(&vm);
     Photon::setDebugCallback(&vm, myCallback);
 
+    // Record the last executed instructions so they can be inspected after the VM halted.
+    Photon::TraceBuffer traceBuffer = {};
+    Photon::setTraceBuffer(&vm, &traceBuffer);
+
     // Note that when executing byte code, the VM will never assume that the byte code is correct.
     Photon::VMExitCode result = Photon::run(&vm);
     if(result != 0)
@@ -164,6 +162,10 @@ int main(int argc, char** argv)
         printf("VM Exited with code: %d\n", result);
     }
 
+    printf("Last executed instructions:\n");
+    Photon::dumpTraceBuffer(&traceBuffer);
+
+    Photon::releaseVirtualMachine(&vm);
     Photon::releaseByteCode(&byteCode);
 
     return 0;